@@ -0,0 +1,18 @@
+from qipype.commands import NewImage
+from qipype.fitting import MultiechoSim
+
+me_sequence = {'MultiEcho': {'TR': 10, 'TE1': 0.01, 'ESP': 0.01, 'ETL': 5}}
+
+
+def multiecho_phantom(out_file, img_size, maps, noise=0.001, verbose=True, **kwargs):
+    """
+    Simulate me_sequence from a PD map that varies along the first axis and a T2 map that varies
+    along the last, written to {maps}PD.nii.gz and {maps}T2.nii.gz. Other arguments, e.g. environ,
+    are passed to MultiechoSim.
+    """
+    NewImage(img_size=img_size, grad_dim=0, grad_vals=(0.8, 1.0), out_file=f'{maps}PD.nii.gz',
+             verbose=verbose).run()
+    NewImage(img_size=img_size, grad_dim=2, grad_vals=(0.04, 0.1), out_file=f'{maps}T2.nii.gz',
+             verbose=verbose).run()
+    MultiechoSim(sequence=me_sequence, out_file=out_file, PD_map=f'{maps}PD.nii.gz',
+                 T2_map=f'{maps}T2.nii.gz', noise=noise, verbose=verbose, **kwargs).run()
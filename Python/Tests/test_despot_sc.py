@@ -1,6 +1,9 @@
 from pathlib import Path
 from os import chdir
+from time import perf_counter
 import unittest
+import numpy as np
+import nibabel as nib
 from nipype.interfaces.base import CommandLine
 from qipype.commands import NewImage, Diff
 from qipype.fitting import DESPOT1, DESPOT1Sim, DESPOT2, DESPOT2Sim, HIFI, HIFISim, FM, FMSim
@@ -9,6 +12,24 @@ vb = True
 CommandLine.terminal_output = 'allatonce'
 
 
+def covar_from_signal(signal, data, p, fixed):
+    """
+    The CoV and correlation outputs of --covar, computed from a central-difference Jacobian of the
+    signal equation. Each row of data, p and fixed is one voxel.
+    """
+    J = np.empty((*data.shape, p.shape[1]))
+    for i in range(p.shape[1]):
+        h = np.zeros_like(p)
+        h[:, i] = 1e-6 * p[:, i]
+        J[..., i] = (signal(p + h, fixed) - signal(p - h, fixed)) / (2 * h[:, i:i + 1])
+    var = np.sum((data - signal(p, fixed))**2, axis=1) / (data.shape[1] - p.shape[1])
+    cov = np.linalg.inv(np.einsum('vni,vnj->vij', J, J)) * var[:, np.newaxis, np.newaxis]
+    sd = np.sqrt(np.diagonal(cov, axis1=1, axis2=2))
+    corr = [cov[:, i, j] / (sd[:, i] * sd[:, j])
+            for i in range(p.shape[1]) for j in range(i + 1, p.shape[1])]
+    return sd / p, np.stack(corr, axis=1)
+
+
 class DESPOT_SC(unittest.TestCase):
     def setUp(self):
         Path('testdata').mkdir(exist_ok=True)
@@ -41,6 +62,110 @@ class DESPOT_SC(unittest.TestCase):
         self.assertLessEqual(diff_T1.outputs.out_diff, 35)
         self.assertLessEqual(diff_PD.outputs.out_diff, 35)
 
+    def test_despot1_batch(self):
+        """
+        Covariances are not available from fit_batch(), so requesting them makes the LLS fit go
+        one voxel at a time. Both paths must give the same answer.
+        """
+        seq = {'SPGR': {'TR': 10e-3, 'FA': [3, 8, 13, 18]}}
+        spgr_file = 'sim_spgr_batch.nii.gz'
+        img_sz = [20, 20, 20]  # Not a multiple of the batch size, so partial tiles get used
+
+        NewImage(img_size=img_sz, grad_dim=0, grad_vals=(
+            0.8, 1.0), out_file='PD_batch.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=1, grad_vals=(
+            0.8, 1.3), out_file='T1_batch.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=2, grad_vals=(
+            0.8, 1.2), out_file='B1_batch.nii.gz', verbose=vb).run()
+
+        DESPOT1Sim(sequence=seq, out_file=spgr_file, noise=0.001, verbose=vb,
+                   PD_map='PD_batch.nii.gz', T1_map='T1_batch.nii.gz',
+                   B1_map='B1_batch.nii.gz').run()
+        DESPOT1(sequence=seq, in_file=spgr_file, B1_map='B1_batch.nii.gz',
+                prefix='batch_', verbose=vb, residuals=True).run()
+        DESPOT1(sequence=seq, in_file=spgr_file, B1_map='B1_batch.nii.gz',
+                prefix='voxel_', verbose=vb, residuals=True, covar=True).run()
+
+        for p in ['T1', 'PD', 'rmse']:
+            diff = Diff(in_file=f'batch_D1_{p}.nii.gz', baseline=f'voxel_D1_{p}.nii.gz',
+                        noise=1e-6, verbose=vb).run()
+            self.assertLess(diff.outputs.out_diff, 1)
+
+    def test_despot1_lm(self):
+        """
+        The built-in Levenberg-Marquardt must find the same minimum as Ceres, to within the
+        parameter tolerance of the fit, and be at least as accurate against the true values.
+        """
+        seq = {'SPGR': {'TR': 10e-3, 'FA': [3, 8, 13, 18]}}
+        spgr_file = 'sim_spgr_lm.nii.gz'
+        img_sz = [32, 32, 32]
+        noise = 0.001
+
+        NewImage(img_size=img_sz, grad_dim=0, grad_vals=(
+            0.8, 1.0), out_file='PD_lm.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=1, grad_vals=(
+            0.8, 1.3), out_file='T1_lm.nii.gz', verbose=vb).run()
+        DESPOT1Sim(sequence=seq, out_file=spgr_file, noise=noise, verbose=vb,
+                   PD_map='PD_lm.nii.gz', T1_map='T1_lm.nii.gz').run()
+
+        times = {}
+        for solver, lm in [('ceres', False), ('lm', True)]:
+            start = perf_counter()
+            DESPOT1(sequence=seq, in_file=spgr_file, algo='n', lm=lm,
+                    prefix=f'{solver}_', verbose=vb).run()
+            times[solver] = perf_counter() - start
+        print(f'NLLS: Ceres {times["ceres"]:.2f} s, LM {times["lm"]:.2f} s')
+
+        for p in ['T1', 'PD']:
+            diff = Diff(in_file=f'lm_D1_{p}.nii.gz', baseline=f'ceres_D1_{p}.nii.gz',
+                        noise=1e-3, verbose=vb).run()
+            self.assertLess(diff.outputs.out_diff, 1)
+            errors = {solver: Diff(in_file=f'{solver}_D1_{p}.nii.gz', baseline=f'{p}_lm.nii.gz',
+                                   noise=noise, verbose=vb).run().outputs.out_diff
+                      for solver in ['ceres', 'lm']}
+            self.assertLessEqual(errors['lm'], errors['ceres'] * 1.05)
+
+    def check_covar(self, prefix, names, data_file, signal, fixed_files=[]):
+        """
+        The --covar outputs use the analytic Jacobian at the fitted parameters, so must agree with
+        the same quantities worked out from finite differences of the signal equation
+        """
+        def load(f):
+            img = nib.load(f)
+            return img.get_fdata().reshape(-1, *img.shape[3:])
+        p = np.stack([load(f'{prefix}{n}.nii.gz') for n in names], axis=1)
+        CoV = np.stack([load(f'{prefix}CoV_{n}.nii.gz') for n in names], axis=1)
+        corr = np.stack([load(f'{prefix}Corr_{n1}_{n2}.nii.gz')
+                         for i, n1 in enumerate(names) for n2 in names[i + 1:]], axis=1)
+        fitted = np.all(p > 0, axis=1)
+        data = load(data_file)[fitted]
+        fixed = [load(f)[fitted, np.newaxis] for f in fixed_files]
+        expected_CoV, expected_corr = covar_from_signal(signal, data, p[fitted], fixed)
+        np.testing.assert_allclose(CoV[fitted], expected_CoV, rtol=1e-3)
+        np.testing.assert_allclose(corr[fitted], expected_corr, rtol=1e-3, atol=1e-4)
+
+    def test_despot1_jacobian(self):
+        seq = {'SPGR': {'TR': 10e-3, 'FA': [3, 8, 13, 18]}}
+        spgr_file = 'sim_spgr_jac.nii.gz'
+        img_sz = [8, 8, 8]
+
+        NewImage(img_size=img_sz, grad_dim=0, grad_vals=(
+            0.8, 1.0), out_file='PD_jac.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=1, grad_vals=(
+            0.8, 1.3), out_file='T1_jac.nii.gz', verbose=vb).run()
+        DESPOT1Sim(sequence=seq, out_file=spgr_file, noise=0.001, verbose=vb,
+                   PD_map='PD_jac.nii.gz', T1_map='T1_jac.nii.gz').run()
+        DESPOT1(sequence=seq, in_file=spgr_file, algo='n', covar=True,
+                prefix='jac_', verbose=vb).run()
+
+        TR = seq['SPGR']['TR']
+        alpha = np.radians(seq['SPGR']['FA'])
+
+        def signal(p, fixed):
+            E1 = np.exp(-TR / p[:, 1:2])
+            return p[:, 0:1] * (1 - E1) * np.sin(alpha) / (1 - E1 * np.cos(alpha))
+        self.check_covar('jac_D1_', ['PD', 'T1'], spgr_file, signal)
+
     def test_hifi(self):
         seqs = {'SPGR': {'TR': 5e-3, 'FA': [3, 18]},
                 'MPRAGE': {'FA': 5, 'TR': 5e-3, 'TI': 0.45, 'TD': 0, 'eta': 1, 'ETL': 64, 'k0': 0},
@@ -104,6 +229,38 @@ class DESPOT_SC(unittest.TestCase):
     def test_despot2gs(self):
         self.test_despot2(True, 30)
 
+    def test_despot2_jacobian(self, gs=False):
+        seq = {'SSFP': {'TR': 10e-3,
+                        'FA': [15, 30, 45, 60],
+                        'PhaseInc': [180, 180, 180, 180]}}
+        ssfp_file = 'sim_ssfp_jac.nii.gz'
+        img_sz = [8, 8, 8]
+
+        NewImage(img_size=img_sz, grad_dim=0, grad_vals=(0.8, 1.0),
+                 out_file='PD_jac.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=1, grad_vals=(0.8, 1.2),
+                 out_file='T1_jac.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=2, grad_vals=(0.04, 0.1),
+                 out_file='T2_jac.nii.gz', verbose=vb).run()
+        DESPOT2Sim(sequence=seq, out_file=ssfp_file, ellipse=gs, noise=0.001, verbose=vb,
+                   PD_map='PD_jac.nii.gz', T2_map='T2_jac.nii.gz', T1_map='T1_jac.nii.gz').run()
+        DESPOT2(sequence=seq, in_file=ssfp_file, T1_map='T1_jac.nii.gz', ellipse=gs,
+                args='--algo=n', covar=True, prefix='jac_', verbose=vb).run()
+
+        TR = seq['SSFP']['TR']
+        alpha = np.radians(seq['SSFP']['FA'])
+
+        def signal(p, fixed):
+            E1 = np.exp(-TR / fixed[0])
+            E2 = np.exp(-TR / p[:, 1:2])
+            E2d = E2**2 if gs else E2
+            return p[:, 0:1] * np.sqrt(E2) * (1 - E1) * np.sin(alpha) / \
+                (1 - E1 * E2d - (E1 - E2d) * np.cos(alpha))
+        self.check_covar('jac_D2_', ['PD', 'T2'], ssfp_file, signal, ['T1_jac.nii.gz'])
+
+    def test_despot2gs_jacobian(self):
+        self.test_despot2_jacobian(True)
+
     def test_fm(self):
         seq = {'SSFP': {'TR': 5e-3,
                         'FA': [15, 15, 60, 60],
@@ -0,0 +1,218 @@
+from pathlib import Path
+from os import chdir
+from time import perf_counter
+import gzip
+import json
+import re
+import struct
+import unittest
+import zlib
+import numpy as np
+import nibabel as nib
+from nipype.interfaces.base import CommandLine
+from qipype.commands import NewImage, Diff
+from qipype.fitting import Multiecho
+from phantoms import me_sequence as me, multiecho_phantom
+
+vb = True
+CommandLine.terminal_output = 'allatonce'
+
+block_env = {'QUIT_EXT': 'NIFTI_GZ'}
+itk_env = {'QUIT_EXT': 'NIFTI_GZ', 'QUIT_BLOCK_GZIP': '0'}
+
+
+def timed(interface):
+    start = perf_counter()
+    result = interface.run()
+    return result, perf_counter() - start
+
+
+def block_lengths(path):
+    """
+    Lengths of the gzip members of a block gzip file, read from their 'QI' extra fields
+    """
+    data = Path(path).read_bytes()
+    lengths = []
+    pos = 0
+    while pos < len(data):
+        if data[pos:pos + 4] != b'\x1f\x8b\x08\x04' or data[pos + 12:pos + 14] != b'QI':
+            return None
+        lengths.append(struct.unpack('<I', data[pos + 16:pos + 20])[0])
+        pos += lengths[-1]
+    return lengths if pos == len(data) else None
+
+
+def write_block_gzip(path, data, block):
+    """
+    Write data as gzip members of block bytes, like a foreign block gzip writer would. The header
+    shares the first member, so values straddle the members unless block is a multiple of their size
+    """
+    with open(path, 'wb') as f:
+        for start in range(0, len(data), block):
+            chunk = data[start:start + block]
+            z = zlib.compressobj(wbits=-15)
+            deflated = z.compress(chunk) + z.flush()
+            length = 20 + len(deflated) + 8
+            f.write(b'\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x08\x00QI\x04\x00' +
+                    struct.pack('<I', length) + deflated +
+                    struct.pack('<II', zlib.crc32(chunk), len(chunk)))
+
+
+def nifti_geometry(header):
+    """
+    The fields of a NIfTI-1 header that describe the data and where it is. Unused dimensions are
+    left out, as writers differ in what they put there.
+    """
+    dim = struct.unpack('<8h', header[40:56])
+    return {'dim': dim[:1 + dim[0]],
+            'datatype': struct.unpack('<2h', header[70:74]),
+            'pixdim': struct.unpack('<8f', header[76:108])[:1 + dim[0]],
+            'vox_offset': struct.unpack('<f', header[108:112]),
+            'scl': struct.unpack('<2f', header[112:120]),
+            'xform_codes': struct.unpack('<2h', header[252:256]),
+            'quatern': struct.unpack('<6f', header[256:280]),
+            'srow': struct.unpack('<12f', header[280:328]),
+            'magic': header[344:348]}
+
+
+class IO(unittest.TestCase):
+    def setUp(self):
+        Path('testdata').mkdir(exist_ok=True)
+        chdir('testdata')
+
+    def tearDown(self):
+        chdir('../')
+
+    def test_block_gzip(self):
+        """
+        Compare the parallel block gzip reader and writer with ITK's default NIfTI IO. The writer
+        builds its own header, so that must describe the data as ITK's does, and the data must be
+        identical. The file must be several gzip members that a standard reader sees as one file.
+        """
+        size = [192, 192, 192]
+        args = {'img_size': size, 'grad_dim': 0,
+                'grad_vals': (0, 1), 'grad_steps': 32, 'verbose': vb}
+        _, t_itk = timed(NewImage(out_file='io_itk.nii.gz', environ=itk_env, **args))
+        _, t_block = timed(NewImage(out_file='io_block.nii.gz', environ=block_env, **args))
+        print(f'Write: ITK {t_itk:.2f} s, block gzip {t_block:.2f} s')
+
+        self.assertIsNone(block_lengths('io_itk.nii.gz'))
+        lengths = block_lengths('io_block.nii.gz')
+        self.assertIsNotNone(lengths)
+        self.assertGreater(len(lengths), 2)  # The header, then blocks of 1 MB of 27 MB of data
+
+        with gzip.open('io_itk.nii.gz', 'rb') as f:
+            itk_bytes = f.read()
+        with gzip.open('io_block.nii.gz', 'rb') as f:
+            block_bytes = f.read()
+        self.assertEqual(len(itk_bytes), len(block_bytes))
+        self.assertEqual(nifti_geometry(itk_bytes), nifti_geometry(block_bytes))
+        self.assertEqual(itk_bytes[352:], block_bytes[352:])
+
+        diff, t_itk = timed(Diff(baseline='io_itk.nii.gz', in_file='io_block.nii.gz',
+                                 noise=1, abs_diff=True, environ=itk_env, verbose=vb))
+        self.assertEqual(diff.outputs.out_diff, 0)
+        diff, t_block = timed(Diff(baseline='io_itk.nii.gz', in_file='io_block.nii.gz',
+                                   noise=1, abs_diff=True, environ=block_env, verbose=vb))
+        self.assertEqual(diff.outputs.out_diff, 0)
+        print(f'Read: ITK {t_itk:.2f} s, block gzip {t_block:.2f} s')
+
+        # Blocks that split the header and the values must still be read back exactly
+        write_block_gzip('io_odd.nii.gz', itk_bytes, 100003)
+        self.assertEqual(len(block_lengths('io_odd.nii.gz')), len(itk_bytes) // 100003 + 1)
+        diff = Diff(baseline='io_itk.nii.gz', in_file='io_odd.nii.gz',
+                    noise=1, abs_diff=True, environ=block_env, verbose=vb).run()
+        self.assertEqual(diff.outputs.out_diff, 0)
+
+    def test_write_error(self):
+        """
+        An output that cannot be written must be reported, not lost or crash the program, when
+        the outputs are written on background threads.
+        """
+        multiecho_phantom('io_me.nii.gz', [8, 8, 8], 'io_', verbose=vb)
+        with self.assertRaises(RuntimeError) as error:
+            Multiecho(sequence=me, in_file='io_me.nii.gz', prefix='no_such_dir/',
+                      environ=block_env, verbose=vb).run()
+        self.assertIn('Error writing outputs: Could not write file', str(error.exception))
+
+    def test_pack(self):
+        """
+        With --pack every output is a volume of one file, found through the JSON index, and must
+        be the same as the file it replaces
+        """
+        multiecho_phantom('io_me.nii.gz', [8, 8, 8], 'io_', verbose=vb)
+        args = {'sequence': me, 'in_file': 'io_me.nii.gz', 'algo': 'n', 'covar': True,
+                'residuals': True, 'environ': block_env, 'verbose': vb}
+        Multiecho(prefix='files_', **args).run()
+        Multiecho(prefix='packed_', pack=True, **args).run()
+
+        with open('packed_ME_outputs.json') as f:
+            index = json.load(f)
+        self.assertEqual(index['file'], 'packed_ME_outputs.nii.gz')
+        self.assertEqual([o['name'] for o in index['outputs']],
+                         ['PD', 'T2', 'rmse', 'iterations', 'CoV_PD', 'CoV_T2', 'Corr_PD_T2',
+                          'residuals_0'])
+        packed = nib.load(index['file']).get_fdata()
+        self.assertEqual(packed.shape, (8, 8, 8, 12))
+        for o in index['outputs']:
+            single = nib.load(f'files_ME_{o["name"]}.nii.gz').get_fdata()
+            volumes = packed[..., o['volume']:o['volume'] + o['volumes']]
+            np.testing.assert_array_equal(volumes, single.reshape(volumes.shape))
+
+    def test_stream(self):
+        """
+        Fitting in slabs, with and without overlapping the writes, must give exactly the same
+        outputs as fitting the whole image at once
+        """
+        # About 160 kB of input and residuals per slice, so several slabs
+        multiecho_phantom('io_me_stream.nii.gz', [64, 64, 32], 'io_', verbose=vb)
+        args = {'sequence': me, 'in_file': 'io_me_stream.nii.gz', 'residuals': True,
+                'environ': block_env, 'verbose': vb}
+        Multiecho(prefix='whole_', **args).run()
+        Multiecho(prefix='stream_', stream=1, **args).run()
+        Multiecho(prefix='overlap_', stream=1, overlap=True, **args).run()
+        for prefix in ['stream_', 'overlap_']:
+            # Residuals are 4D, so not qi diff, and streamed residuals are written uncompressed
+            for p, ext in [('PD', '.nii.gz'), ('T2', '.nii.gz'), ('rmse', '.nii.gz'),
+                           ('residuals_0', '.nii')]:
+                np.testing.assert_array_equal(nib.load(f'{prefix}ME_{p}{ext}').get_fdata(),
+                                              nib.load(f'whole_ME_{p}.nii.gz').get_fdata())
+
+    def test_stream_gzip(self):
+        """
+        Block gzip inputs are streamed by reading only the blocks of each slab, other gzip inputs
+        are decompressed from the start for every slab with a warning, and both must match
+        """
+        multiecho_phantom('io_me_block.nii.gz', [32, 32, 32], 'io_', environ=block_env,
+                          verbose=vb)
+        multiecho_phantom('io_me_itk.nii.gz', [32, 32, 32], 'io_', environ=itk_env, verbose=vb)
+        args = {'sequence': me, 'stream': 1, 'environ': block_env, 'verbose': vb}
+        block = Multiecho(prefix='block_', in_file='io_me_block.nii.gz', **args).run()
+        itk = Multiecho(prefix='itk_', in_file='io_me_itk.nii.gz', **args).run()
+        self.assertNotIn('is not block gzip', block.runtime.stderr)
+        self.assertIn('is not block gzip', itk.runtime.stderr)
+        for p in ['PD', 'T2']:
+            np.testing.assert_array_equal(nib.load(f'block_ME_{p}.nii.gz').get_fdata(),
+                                          nib.load(f'itk_ME_{p}.nii.gz').get_fdata())
+
+    def test_workspace_buffer_moves(self):
+        """
+        The workspace buffers are sized before the voxel loop, so no fit may resize and so move
+        them, whether the voxels are fitted in chunks or by region, with or without warm starts.
+        This does not count allocations made inside the fits themselves.
+        """
+        multiecho_phantom('io_me.nii.gz', [8, 8, 8], 'io_', verbose=vb)
+        for algo in ['l', 'a', 'n']:
+            for extra in ['', '--chunk=0', '--warm']:
+                result = Multiecho(sequence=me, in_file='io_me.nii.gz', algo=algo, covar=True,
+                                   residuals=True, prefix='ws_', args=extra,
+                                   verbose=True).run()
+                log = re.search(r'Workspace buffers allocated: (\d+) over (\d+) work units, '
+                                r'moved in voxel loop: (\d+)', result.runtime.stderr)
+                self.assertIsNotNone(log)
+                self.assertGreater(int(log.group(1)), 0)
+                self.assertEqual(int(log.group(3)), 0, f'algo {algo} {extra}')
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -1,7 +1,9 @@
 from pathlib import Path
 from os import chdir
+import json
 import unittest
 import numpy as np
+from scipy.integrate import quad
 from nipype.interfaces.base import CommandLine
 from qipype.fitting import LtzWaterMT, LtzWaterMTSim, qMT, qMTSim
 from qipype.commands import NewImage, Diff, ZSpec, Lineshape
@@ -128,6 +130,30 @@ class MT(unittest.TestCase):
         self.assertLessEqual(diff_F.outputs.out_diff, 30)
         self.assertLessEqual(diff_k.outputs.out_diff, 35)
 
+    def test_superlorentzian(self):
+        """
+        The super-Lorentzian is interpolated from a table of one integral, scaled by T2b. Check it
+        against integrating directly, split at the magic angle where the integrand peaks.
+        """
+        def direct(f, T2b):
+            def integrand(u):
+                w = T2b / abs(3 * u**2 - 1)
+                return np.sqrt(2 / np.pi) * w * np.exp(-2 * (2 * np.pi * f * w)**2)
+            u_magic = 1 / np.sqrt(3)
+            return (quad(integrand, 0, u_magic, epsabs=0, epsrel=1e-12, limit=200)[0] +
+                    quad(integrand, u_magic, 1, epsabs=0, epsrel=1e-12, limit=200)[0])
+
+        for T2b in [5e-6, 12e-6, 30e-6, 80e-6]:
+            lineshape_file = f'_sl_{T2b * 1e6:.0f}us.json'
+            Lineshape(out_file=lineshape_file, lineshape='SuperLorentzian', t2b=T2b,
+                      frq_start=200, frq_space=500, frq_count=200).run()
+            with open(lineshape_file) as f:
+                ls = json.load(f)['lineshape']
+            freqs = ls['freq_min'] + ls['freq_step'] * np.arange(ls['freq_count'])
+            expected = [direct(f, ls['T2_nominal']) for f in freqs]
+            np.testing.assert_allclose(ls['values'], expected, rtol=1e-8,
+                                       atol=1e-10 * max(expected))
+
     def test_ZSpec(self):
         NewImage(out_file='zspec_linear.nii.gz', verbose=vb, img_size=[8, 8, 8, 4],
                  grad_dim=3, grad_vals=(-3, 3)).run()
@@ -0,0 +1,149 @@
+from pathlib import Path
+from os import chdir
+from time import perf_counter
+import unittest
+import numpy as np
+import nibabel as nib
+from scipy.linalg import expm
+from nipype.interfaces.base import CommandLine
+from qipype.commands import NewImage, Diff
+from qipype.fitting import Transient, TransientSim
+
+vb = True
+CommandLine.terminal_output = 'allatonce'
+
+MUPA = {'MUPA': {'TR': 2.34e-3, 'Tramp': 10e-3, 'spokes_per_seg': 256,
+                 'groups_per_seg': [1, 1, 1, 1, 2, 2],
+                 'Trf': [24, 24, 24, 24, 24, 24],
+                 'FA': [2, 2, 2, 2, 6, 6],
+                 'prep': ['none', 'inversion', 'T2-20', 'T2-60', 'none', 'inversion'],
+                 'prep_pulses': {
+                     'none': {'FAeff': 0, 'int_b1_sq': 0, 'T_long': 0, 'T_trans': 0},
+                     'inversion': {'FAeff': 180, 'int_b1_sq': 0, 'T_long': 10e-3, 'T_trans': 0},
+                     'T2-20': {'FAeff': 0, 'int_b1_sq': 0, 'T_long': 0, 'T_trans': 20e-3},
+                     'T2-60': {'FAeff': 0, 'int_b1_sq': 0, 'T_long': 0, 'T_trans': 60e-3}}}}
+
+
+def mupa_b1_signal(seq, M0, T1, T2, B1):
+    """
+    The MUPA-B1 signal built step by step from general matrix exponentials and powers, in
+    (Mx, My, Mz, 1), spoke by spoke for the average over each group
+    """
+    R1, R2 = 1 / T1, 1 / T2
+
+    def prop(B1x, t):
+        G = np.array([[-R2, 0, 0, 0],
+                      [0, -R2, B1x, 0],
+                      [0, -B1x, -R1, R1],
+                      [0, 0, 0, 0]])
+        return expm(G * t)
+    FA = np.radians(seq['FA'])
+    Trf = np.array(seq['Trf']) * 1e-6
+    groups = seq['groups_per_seg']
+    spokes = [seq['spokes_per_seg'] // g for g in groups]
+    ramp = prop(0, seq['Tramp'])
+    TR_mats, seg_mats, prep_mats = [], [], []
+    for FA_s, Trf_s, spokes_s, prep in zip(FA, Trf, spokes, seq['prep']):
+        pulse = prop(B1 * FA_s / Trf_s, Trf_s)
+        TR_mats.append(np.diag([0, 0, 1, 1]) @ prop(0, seq['TR']) @ pulse)
+        seg_mats.append(np.linalg.matrix_power(TR_mats[-1], spokes_s))
+        p = seq['prep_pulses'][prep]
+        C = np.zeros((4, 4))
+        E1 = np.exp(-R1 * p['T_long'])
+        C[2, 2] = E1 * np.exp(-R2 * p['T_trans']) * np.cos(np.radians(p['FAeff']))
+        C[2, 3] = 1 - E1
+        C[3, 3] = 1
+        prep_mats.append(C)
+
+    X = np.eye(4)
+    for seg, prep, g in zip(seg_mats, prep_mats, groups):
+        X = np.linalg.matrix_power(ramp @ seg @ ramp @ prep, g) @ X
+    m = np.append(np.linalg.solve((X - np.eye(4))[:3, :3], -X[:3, 3]), 1)
+    signal = []
+    for FA_s, TR_mat, seg, prep, g, n in zip(FA, TR_mats, seg_mats, prep_mats, groups, spokes):
+        total = 0
+        for _ in range(g):
+            m = ramp @ prep @ m
+            spoke = m
+            for _ in range(n):
+                total += spoke[2] * np.sin(B1 * FA_s) / n
+                spoke = TR_mat @ spoke
+            m = ramp @ seg @ m
+        signal.append(M0 * total / g)
+    return np.array(signal)
+
+
+class PARMESAN(unittest.TestCase):
+    def setUp(self):
+        Path('testdata').mkdir(exist_ok=True)
+        chdir('testdata')
+
+    def tearDown(self):
+        chdir('../')
+
+    def test_transient_autodiff(self):
+        """
+        Fitting with the autodiff Jacobian must find the same minimum as central numeric
+        differences, and be at least as accurate against the true values
+        """
+        seq = MUPA
+        mupa_file = 'sim_mupa.nii.gz'
+        img_sz = [8, 8, 8]
+        noise = 0.01
+
+        NewImage(img_size=img_sz, fill=30., out_file='M0.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=0, grad_vals=(0.8, 1.5),
+                 out_file='T1.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=1, grad_vals=(0.05, 0.1),
+                 out_file='T2.nii.gz', verbose=vb).run()
+        NewImage(img_size=img_sz, grad_dim=2, grad_vals=(0.9, 1.1),
+                 out_file='B1.nii.gz', verbose=vb).run()
+        TransientSim(sequence=seq, out_file=mupa_file, noise=noise, verbose=vb,
+                     M0_map='M0.nii.gz', T1_map='T1.nii.gz', T2_map='T2.nii.gz',
+                     B1_map='B1.nii.gz').run()
+
+        times = {}
+        iterations = {}
+        for method, numeric in [('auto', False), ('numeric', True)]:
+            start = perf_counter()
+            Transient(sequence=seq, in_file=mupa_file, numeric=numeric,
+                      prefix=f'{method}_', verbose=vb).run()
+            times[method] = perf_counter() - start
+            iterations[method] = nib.load(
+                f'{method}_MUPAB1_iterations.nii.gz').get_fdata().mean()
+        print(f'Autodiff {times["auto"]:.2f} s, {iterations["auto"]:.1f} iterations. '
+              f'Numeric {times["numeric"]:.2f} s, {iterations["numeric"]:.1f} iterations')
+
+        for p in ['M0', 'T1', 'T2', 'B1']:
+            diff = Diff(in_file=f'auto_MUPAB1_{p}.nii.gz', baseline=f'numeric_MUPAB1_{p}.nii.gz',
+                        noise=noise, verbose=vb).run()
+            self.assertLess(diff.outputs.out_diff, 1)
+            errors = {method: Diff(in_file=f'{method}_MUPAB1_{p}.nii.gz', baseline=f'{p}.nii.gz',
+                                   noise=noise, verbose=vb).run().outputs.out_diff
+                      for method in ['auto', 'numeric']}
+            self.assertLessEqual(errors['auto'], errors['numeric'] * 1.05)
+
+    def test_transient_propagators(self):
+        """
+        The transient models build their propagators in closed form. Check the simulated signal
+        against the same sequence built from general matrix exponentials.
+        """
+        img_sz = [2, 2, 2]
+        maps = {'M0_map': 'M0_prop.nii.gz'}
+        NewImage(img_size=img_sz, fill=30., out_file=maps['M0_map'], verbose=vb).run()
+        for p, dim, vals in [('T1', 0, (0.8, 1.5)), ('T2', 1, (0.05, 0.1)), ('B1', 2, (0.9, 1.1))]:
+            maps[f'{p}_map'] = f'{p}_prop.nii.gz'
+            NewImage(img_size=img_sz, grad_dim=dim, grad_vals=vals,
+                     out_file=maps[f'{p}_map'], verbose=vb).run()
+        TransientSim(sequence=MUPA, out_file='sim_mupa_prop.nii.gz', verbose=vb, **maps).run()
+
+        p = {k[:-4]: nib.load(f).get_fdata().ravel() for k, f in maps.items()}
+        signal = nib.load('sim_mupa_prop.nii.gz').get_fdata().reshape(-1, 6)
+        for i in range(signal.shape[0]):
+            expected = mupa_b1_signal(MUPA['MUPA'], p['M0'][i], p['T1'][i], p['T2'][i],
+                                      p['B1'][i])
+            np.testing.assert_allclose(signal[i], expected, rtol=1e-5, atol=1e-6)
+
+
+if __name__ == '__main__':
+    unittest.main()
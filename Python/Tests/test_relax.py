@@ -1,9 +1,13 @@
 from pathlib import Path
-from os import chdir
+from os import chdir, remove
 import unittest
+import numpy as np
+import nibabel as nib
+from scipy.linalg import expm
 from nipype.interfaces.base import CommandLine
-from qipype.commands import NewImage, Diff
-from qipype.fitting import Multiecho, MultiechoSim
+from qipype.commands import NewImage, Diff, MergeTiles
+from qipype.fitting import Multiecho, MultiechoSim, mcDESPOT, mcDESPOTSim
+from phantoms import me_sequence, multiecho_phantom
 
 vb = True
 CommandLine.terminal_output = 'allatonce'
@@ -41,6 +45,135 @@ class Relax(unittest.TestCase):
         self.assertLessEqual(diff_T2.outputs.out_diff, 3)
         self.assertLessEqual(diff_PD.outputs.out_diff, 2)
 
+    def test_multiecho_tiles(self):
+        """
+        Fit two halves of an image as separate tiles with --subregion, merge them, and check that
+        the result matches the whole image fitted in one go.
+        """
+        me = me_sequence
+        me_file = 'sim_me_tiles.nii.gz'
+        multiecho_phantom(me_file, [32, 32, 32], 'tiles_', verbose=vb)
+
+        Multiecho(sequence=me, in_file=me_file, prefix='whole_', verbose=vb).run()
+        Multiecho(sequence=me, in_file=me_file, prefix='tile0_',
+                  subregion='0,0,0,32,32,16', verbose=vb).run()
+        Multiecho(sequence=me, in_file=me_file, prefix='tile1_',
+                  subregion='0,0,16,32,32,16', verbose=vb).run()
+        for p in ['PD', 'T2']:
+            MergeTiles(reference=me_file, out_file=f'tiled_ME_{p}.nii.gz',
+                       tiles=[f'tile0_ME_{p}.nii.gz', f'tile1_ME_{p}.nii.gz'],
+                       verbose=vb).run()
+            diff = Diff(in_file=f'tiled_ME_{p}.nii.gz', baseline=f'whole_ME_{p}.nii.gz',
+                        noise=1, abs_diff=True, verbose=vb).run()
+            self.assertEqual(diff.outputs.out_diff, 0)
+
+    def test_mcdespot_tiles(self):
+        """
+        As above, but for a fit that seeds a random stream from each voxel's index. With a fixed
+        seed the tiles must still match the whole image, so the indices must be in the whole image.
+        """
+        seq = {'SPGR': {'TR': 5e-3, 'FA': [3, 4, 5, 6, 7, 9, 13, 18]},
+               'SSFP': {'TR': 5e-3, 'FA': [12, 16, 21, 27, 33, 40, 51, 68] * 2,
+                        'PhaseInc': [180] * 8 + [0] * 8}}
+        img_sz = [8, 8, 4]
+        values = {'PD': 1.0, 'T1_m': 0.465, 'T2_m': 0.012, 'T1_ie': 1.07, 'T2_ie': 0.117,
+                  'tau_m': 0.18}
+        maps = {}
+        for p, v in values.items():
+            maps[f'{p}_map'] = f'mcd_{p}.nii.gz'
+            NewImage(img_size=img_sz, fill=v, out_file=maps[f'{p}_map'], verbose=vb).run()
+        maps['f_m_map'] = 'mcd_f_m.nii.gz'
+        NewImage(img_size=img_sz, grad_dim=2, grad_vals=(0.1, 0.3),
+                 out_file=maps['f_m_map'], verbose=vb).run()
+        mcDESPOTSim(sequence=seq, spgr_file='sim_mcd_spgr.nii.gz',
+                    ssfp_file='sim_mcd_ssfp.nii.gz', scale=True, noise=0.001, seed=1,
+                    verbose=vb, **maps).run()
+
+        fit_args = {'sequence': seq, 'spgr_file': 'sim_mcd_spgr.nii.gz',
+                    'ssfp_file': 'sim_mcd_ssfp.nii.gz', 'scale': True, 'iterations': 2,
+                    'seed': 42, 'verbose': vb}
+        mcDESPOT(prefix='whole_', **fit_args).run()
+        mcDESPOT(prefix='tile0_', subregion='0,0,0,8,8,2', **fit_args).run()
+        mcDESPOT(prefix='tile1_', subregion='0,0,2,8,8,2', **fit_args).run()
+        for p in ['T1_m', 'f_m', 'rmse']:
+            MergeTiles(reference='sim_mcd_spgr.nii.gz', out_file=f'tiled_2C_{p}.nii.gz',
+                       tiles=[f'tile0_2C_{p}.nii.gz', f'tile1_2C_{p}.nii.gz'],
+                       verbose=vb).run()
+            diff = Diff(in_file=f'tiled_2C_{p}.nii.gz', baseline=f'whole_2C_{p}.nii.gz',
+                        noise=1, abs_diff=True, verbose=vb).run()
+            self.assertEqual(diff.outputs.out_diff, 0)
+
+    def test_mcdespot_spgr(self):
+        """
+        The two-pool SPGR signal uses a closed-form 2x2 matrix exponential. Check it against the
+        general one, including without exchange and with equal T1s, where the eigenvalues repeat.
+        """
+        seq = {'SPGR': {'TR': 5e-3, 'FA': [3, 4, 5, 6, 7, 9, 13, 18]},
+               'SSFP': {'TR': 5e-3, 'FA': [12, 16, 21, 27, 33, 40, 51, 68],
+                        'PhaseInc': [180] * 8}}
+        img_sz = [8, 8, 4]
+        maps = {}
+        for p, v in {'PD': 1.0, 'T2_m': 0.012, 'T2_ie': 0.117, 'tau_m': 0.18}.items():
+            maps[f'{p}_map'] = f'spgr_{p}.nii.gz'
+            NewImage(img_size=img_sz, fill=v, out_file=maps[f'{p}_map'], verbose=vb).run()
+        # T1_m and T1_ie are equal at one end, and f_m is zero in the first slice
+        for p, dim, vals in [('T1_m', 0, (0.465, 1.07)), ('T1_ie', 1, (0.465, 1.07)),
+                             ('f_m', 2, (0.0, 0.3))]:
+            maps[f'{p}_map'] = f'spgr_{p}.nii.gz'
+            NewImage(img_size=img_sz, grad_dim=dim, grad_vals=vals,
+                     out_file=maps[f'{p}_map'], verbose=vb).run()
+        mcDESPOTSim(sequence=seq, spgr_file='sim_spgr_expm.nii.gz',
+                    ssfp_file='sim_ssfp_expm.nii.gz', verbose=vb, **maps).run()
+
+        p = {k[:-4]: nib.load(f).get_fdata().ravel() for k, f in maps.items()}
+        spgr = nib.load('sim_spgr_expm.nii.gz').get_fdata().reshape(-1, 8)
+        TR = seq['SPGR']['TR']
+        alpha = np.radians(seq['SPGR']['FA'])
+        for i in range(spgr.shape[0]):
+            f_m = p['f_m'][i]
+            k_m = 1 / p['tau_m'][i] if f_m > 0 else 0
+            k_ie = k_m * f_m / (1 - f_m)
+            A = np.array([[1 / p['T1_m'][i] + k_m, -k_ie],
+                          [-k_m, 1 / p['T1_ie'][i] + k_ie]])
+            E = expm(-TR * A)
+            M0 = np.array([f_m, 1 - f_m])
+            expected = [p['PD'][i] * np.sum(np.linalg.solve(np.eye(2) - E * np.cos(a),
+                                                            (np.eye(2) - E) @ M0 * np.sin(a)))
+                        for a in alpha]
+            np.testing.assert_allclose(spgr[i], expected, rtol=1e-5)
+
+    def test_multiecho_checkpoint(self):
+        """
+        Resume from a checkpoint whose journal ends in a partial record, as after a crash. New
+        records must not be misaligned by it, and a different input of the same size must be
+        rejected.
+        """
+        me = me_sequence
+        me_file = 'sim_me_ckpt.nii.gz'
+        multiecho_phantom(me_file, [16, 16, 16], 'ckpt_', verbose=vb)
+
+        Multiecho(sequence=me, in_file=me_file, prefix='plain_', verbose=vb).run()
+        Multiecho(sequence=me, in_file=me_file, prefix='ckpt_',
+                  checkpoint='ckpt', verbose=vb).run()
+        # A partial record at the end, and no bitmap, so every voxel is fitted and appended again
+        with open('ckpt/voxels.qic', 'ab') as f:
+            f.write(b'\x01\x02\x03\x04\x05')
+        remove('ckpt/done.qic')
+        Multiecho(sequence=me, in_file=me_file, prefix='refit_',
+                  checkpoint='ckpt', resume=True, verbose=vb).run()
+        # Now every voxel must be restored from the records written after the partial one
+        Multiecho(sequence=me, in_file=me_file, prefix='resumed_',
+                  checkpoint='ckpt', resume=True, verbose=vb).run()
+        for p in ['PD', 'T2']:
+            diff = Diff(in_file=f'resumed_ME_{p}.nii.gz', baseline=f'plain_ME_{p}.nii.gz',
+                        noise=1, abs_diff=True, verbose=vb).run()
+            self.assertEqual(diff.outputs.out_diff, 0)
+
+        multiecho_phantom('sim_me_ckpt2.nii.gz', [16, 16, 16], 'ckpt_', noise=0.002, verbose=vb)
+        with self.assertRaises(Exception):
+            Multiecho(sequence=me, in_file='sim_me_ckpt2.nii.gz', prefix='other_',
+                      checkpoint='ckpt', resume=True, verbose=vb).run()
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -1,5 +1,6 @@
 import unittest
 import numpy as np
+import nibabel as nib
 from pathlib import Path
 from os import chdir
 from nipype.interfaces.base import CommandLine
@@ -133,6 +134,12 @@ class SSFP(unittest.TestCase):
         Ellipse(sequence=ellipse_fit, in_file=ellipse_file, verbose=vb).run()
         eMT(sequence=emt_seq, G_file=emt_G,
             a_file=emt_a, b_file=emt_b, verbose=vb).run()
+        # T2_f is calculated for the whole image and set directly, so must line up with each slab
+        eMT(sequence=emt_seq, G_file=emt_G, a_file=emt_a, b_file=emt_b,
+            stream=2, prefix='stream_', verbose=vb).run()
+        for p in ['PD', 'f_b', 'k_bf', 'T1_f', 'rmse']:
+            np.testing.assert_array_equal(nib.load(f'stream_EMT_{p}.nii.gz').get_fdata(),
+                                          nib.load(f'EMT_{p}.nii.gz').get_fdata())
 
         # Currently the simulation framework does not support blocked algorithms
         # Hence simulating a proper eMT dataset would involve individually simulating
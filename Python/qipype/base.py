@@ -37,6 +37,8 @@ class InputSpec(InputBaseSpec):
         desc='Add a prefix to output filenames', argstr='--out=%s')
     mask_file = File(
         desc='Only process voxels within the mask', argstr='--mask=%s')
+    seed = traits.Int(
+        desc='Seed for simulation noise and stochastic fits (default random)', argstr='--seed=%d')
 
 ################################### Commands ###################################
 
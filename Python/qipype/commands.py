@@ -97,6 +97,36 @@ class Diff(base.CommandLine):
         outputs.out_diff = float(runtime.stdout)
         return outputs
 
+############################ qi merge_tiles ############################
+
+
+class MergeTilesInputSpec(base.InputBaseSpec):
+    reference = File(desc='Image with the geometry of the whole output', argstr='%s',
+                     exists=True, mandatory=True, position=0)
+    out_file = traits.File(desc='Output file', exists=False,
+                           argstr='%s', mandatory=True, position=1)
+    tiles = traits.List(File(exists=True), desc='Tiles written with --subregion',
+                        argstr='%s', sep=' ', mandatory=True, position=2)
+
+
+class MergeTilesOutputSpec(TraitedSpec):
+    out_file = File(desc='Merged image')
+
+
+class MergeTiles(base.CommandLine):
+    """
+    Put tiles of an output, fitted by separate jobs with --subregion, back into one image
+    """
+
+    _cmd = 'qi merge_tiles'
+    input_spec = MergeTilesInputSpec
+    output_spec = MergeTilesOutputSpec
+
+    def _list_outputs(self):
+        outputs = self.output_spec().get()
+        outputs['out_file'] = path.abspath(self.inputs.out_file)
+        return outputs
+
 ############################ NOISE ESTIMATION ############################
 
 
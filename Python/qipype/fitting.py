@@ -38,6 +38,16 @@ def FitIS(name, fixed=None, in_files=None, extra=None):
                                   argstr='--covar'),
              'residuals': traits.Bool(desc='Write out residuals for each data-point',
                                       argstr='--resids'),
+             'checkpoint': traits.String(desc='Save finished voxels to a checkpoint in this directory',
+                                         argstr='--checkpoint=%s'),
+             'resume': traits.Bool(desc='Resume from the checkpoint, skipping finished voxels',
+                                   argstr='--resume'),
+             'pack': traits.Bool(desc='Write all outputs to one 4D file, with a JSON index',
+                                 argstr='--pack'),
+             'stream': traits.Int(desc='Read, fit and write in slabs that fit in this many MB',
+                                  argstr='--stream=%d'),
+             'overlap': traits.Bool(desc='When streaming, write each slab while the next is fitted',
+                                    argstr='--overlap'),
              '__module__': __name__}
 
     for f in fixed:
@@ -211,7 +221,8 @@ DESPOT1, DESPOT1Sim, DESPOT1FitIS, DESPOT1FitOS, DESPOT1SimIS, DESPOT1SimOS = Co
     varying=['PD', 'T1'],
     fixed=['B1'],
     extra={'algo': traits.String(desc="Choose algorithm (l/w/n)", argstr="--algo=%s"),
-           'iterations': traits.Int(desc='Max iterations for WLLS/NLLS (default 15)', argstr='--its=%d')})
+           'iterations': traits.Int(desc='Max iterations for WLLS/NLLS (default 15)', argstr='--its=%d'),
+           'lm': traits.Bool(desc='Use the built-in Levenberg-Marquardt for NLLS, not Ceres', argstr='--lm')})
 
 HIFI, HIFISim, HIFIFitIS, HIFIFitOS, HIFISimIS, HIFISimOS = Command(
     'HIFI', 'qi despot1hifi', 'HIFI',
@@ -242,8 +253,15 @@ JSR, JSRSim, JSRFitIS, JSRFitOS, JSRSimIS, JSRSimOS = Command(
     fixed=['B1'], files=['spgr', 'ssfp'],
     extra={'npsi': traits.Int(desc='Number of psi/off-resonance starts', argstr='--npsi=%d')})
 
+mcDESPOT, mcDESPOTSim, mcDESPOTFitIS, mcDESPOTFitOS, mcDESPOTSimIS, mcDESPOTSimOS = Command(
+    'mcDESPOT', 'qi mcdespot --model=2', '2C',
+    varying=['PD', 'T1_m', 'T2_m', 'T1_ie', 'T2_ie', 'tau_m', 'f_m'],
+    fixed=['f0', 'B1'], files=['spgr', 'ssfp'],
+    extra={'scale': traits.Bool(desc='Normalize signals to mean', argstr='--scale'),
+           'iterations': traits.Int(desc='Max iterations (default 4)', argstr='--its=%d')})
+
 Multiecho, MultiechoSim, MultiechoFitIS, MultiechoFitOS, MultiechoSimIS, MultiechoSimOS = Command(
-    'Multiecho', 'qi multiecho', 'ME', varying=['PD', 'T2'], extra={'algo': traits.String(desc="Choose algorithm (l/a/n)", argstr="--algo=%s"), 'iterations': traits.Int(desc='Max iterations for WLLS/NLLS (default 15)', argstr='--its=%d'), 'thresh_PD': traits.Float(desc='Only output maps when PD exceeds threshold value', argstr='-t=%f'), 'clamp_T2': traits.Float(desc='Clamp T2 between 0 and value', argstr='-p=%f')})
+    'Multiecho', 'qi multiecho', 'ME', varying=['PD', 'T2'], extra={'algo': traits.String(desc="Choose algorithm (l/a/n)", argstr="--algo=%s"), 'lm': traits.Bool(desc='Use the built-in Levenberg-Marquardt for NLLS, not Ceres', argstr='--lm'), 'iterations': traits.Int(desc='Max iterations for WLLS/NLLS (default 15)', argstr='--its=%d'), 'thresh_PD': traits.Float(desc='Only output maps when PD exceeds threshold value', argstr='-t=%f'), 'clamp_T2': traits.Float(desc='Clamp T2 between 0 and value', argstr='-p=%f')})
 
 MPMR2s, MPMR2sSim, MPMR2sFitIS, MPMR2sFitOS, MPMR2sSimIS, MPMR2sSimOS = Command(
     'MPMR2s', 'qi mpm_r2s', 'MPM', varying=['R2s', 'S0_PDw', 'S0_T1w', 'S0_MTw'], files=['PDw', 'T1w', 'MTw'])
@@ -341,6 +359,15 @@ an_pools = [{'name': 'Amide',
 LtzAmNOE, LtzAmNOESim, LtzAmNOEFitIS, LtzAmNOEFitOS, LtzAmNOESimIS, LtzAmNOESimOS = Lorentzian(
     'LtzAmNOE', an_pools)
 
+###
+# PARMESAN Commands
+###
+Transient, TransientSim, TransientFitIS, TransientFitOS, TransientSimIS, TransientSimOS = Command(
+    'Transient', 'qi transient', 'MUPAB1',
+    varying=['M0', 'T1', 'T2', 'B1'],
+    extra={'numeric': traits.Bool(desc='Use central numeric differences, not autodiff',
+                                  argstr='--numeric')})
+
 ###
 # Perfusion Commands
 ###
@@ -349,7 +376,8 @@ ASE, ASESim, ASEFitIS, ASEFitOS, ASESimIS, ASESimOS = Command(
     varying=['S0', 'dT', 'R2p'],
     derived=['Tc', 'OEF', 'dHb'],
     extra={'B0': traits.Float(desc='Field-strength (Tesla), default 3', argstr='--B0=%f'),
-           'fix_DBV': traits.Float(desc='Fix Deoxygenated Blood Volume to value (fraction)', argstr='--DBV=%f', mandatory=True)}
+           'fix_DBV': traits.Float(desc='Fix Deoxygenated Blood Volume to value (fraction)', argstr='--DBV=%f', mandatory=True),
+           'lm': traits.Bool(desc='Use the built-in Levenberg-Marquardt, not Ceres', argstr='--lm')}
 )
 
 ASEDBV, ASEDBVSim, ASEDBVFitIS, ASEDBVFitOS, ASEDBVSimIS, ASEDBVSimOS = Command(
@@ -357,7 +385,8 @@ ASEDBV, ASEDBVSim, ASEDBVFitIS, ASEDBVFitOS, ASEDBVSimIS, ASEDBVSimOS = Command(
     varying=['S0', 'dT', 'R2p', 'DBV'],
     derived=['Tc', 'OEF', 'dHb'],
     extra={'B0': traits.Float(
-        desc='Field-strength (Tesla), default 3', argstr='--B0=%f')}
+        desc='Field-strength (Tesla), default 3', argstr='--B0=%f'),
+        'lm': traits.Bool(desc='Use the built-in Levenberg-Marquardt, not Ceres', argstr='--lm')}
 )
 
 
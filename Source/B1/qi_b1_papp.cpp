@@ -21,7 +21,7 @@
 
 int b1_papp_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "INPUT", "Input file");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
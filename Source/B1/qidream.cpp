@@ -38,7 +38,7 @@ int dream_main(args::Subparser &parser) {
     args::Positional<std::string> input_file(
         parser, "DREAM_FILE", "Input file. Must have 2 volumes (FID and STE)");
 
-    args::ValueFlag<int>         threads(parser,
+    QI::ThreadsFlag              threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
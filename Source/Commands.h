@@ -66,6 +66,7 @@ int tvmask_main(args::Subparser &parser);
 int complex_main(args::Subparser &parser);
 int kfilter_main(args::Subparser &parser);
 int mask_main(args::Subparser &parser);
+int merge_tiles_main(args::Subparser &parser);
 int polyfit_main(args::Subparser &parser);
 int polyimg_main(args::Subparser &parser);
 int noise_est_main(args::Subparser &parser);
@@ -13,6 +13,7 @@
 
 #include "ImageTypes.h"
 #include "Log.h"
+#include "Scheduler.h"
 #include "args.hxx"
 
 namespace QI {
@@ -65,6 +66,20 @@ template <typename TArray, const int size> void ArrayArgF(const std::string &a,
     }
 }
 
+/*
+ *  Reader for --threads that applies the value to the process-wide scheduler as soon as it is parsed
+ */
+struct ThreadsReader {
+    bool operator()(const std::string &name, const std::string &value, int &threads) {
+        if (!args::ValueReader()(name, value, threads)) {
+            return false;
+        }
+        QI::SetThreads(threads);
+        return true;
+    }
+};
+using ThreadsFlag = args::ValueFlag<int, ThreadsReader>;
+
 } // End namespace QI
 
 extern args::Group    global_group;
@@ -76,13 +91,45 @@ extern args::Flag     verbose;
     args::Flag covar(                                                                          \
         parser, "COVAR", "Write out covariance matrix (CoV and Corr) images", {"covar"});      \
                                                                                                \
-    args::ValueFlag<int>   threads(parser,                                                     \
+    QI::ThreadsFlag        threads(parser,                                                     \
                                  "THREADS",                                                  \
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",  \
                                  {'T', "threads"},                                           \
                                  QI::GetDefaultThreads());                                   \
+    args::ValueFlag<int>   chunk(parser,                                                       \
+                               "CHUNK",                                                        \
+                               "Fit masked voxels in chunks of N (default 64, 0 to disable)",  \
+                               {"chunk"},                                                      \
+                               64);                                                            \
+    args::Flag warm(parser,                                                                    \
+                    "WARM",                                                                    \
+                    "Start each fit from the result of a neighbouring voxel",                  \
+                    {"warm"});                                                                 \
+    args::ValueFlag<std::string> checkpoint(                                                   \
+        parser, "DIR", "Save finished voxels to a checkpoint in DIR", {"checkpoint"});         \
+    args::Flag resume(                                                                         \
+        parser, "RESUME", "Resume from the checkpoint, skipping finished voxels", {"resume"}); \
+    args::ValueFlag<int> stream(                                                               \
+        parser, "MB", "Read, fit and write in slabs that fit in MB of memory", {"stream"}, 0); \
+    args::ValueFlag<int> writers(parser,                                                       \
+                                 "N",                                                          \
+                                 "Write outputs on N threads (default 4, 0 to disable)",       \
+                                 {"writers"},                                                  \
+                                 4);                                                           \
+    args::Flag overlap(parser,                                                                 \
+                       "OVERLAP",                                                              \
+                       "When streaming, write each slab while the next is fitted",             \
+                       {"overlap"});                                                           \
+    args::Flag pack(parser,                                                                    \
+                    "PACK",                                                                    \
+                    "Write all outputs to one 4D file, with a JSON index of the volumes",      \
+                    {"pack"});                                                                 \
     args::ValueFlag<float> simulate(                                                           \
         parser, "SIMULATE", "Simulate sequence (argument is noise level)", {"simulate"}, 0.0); \
+    args::ValueFlag<int64_t> seed(                                                             \
+        parser, "SEED", "Seed for simulation noise and stochastic fits (default random)",      \
+        {"seed"},                                                                              \
+        -1);                                                                                   \
     args::ValueFlag<std::string> mask(                                                         \
         parser, "MASK", "Only process voxels within the given mask", {'m', "mask"});           \
     args::ValueFlag<std::string> subregion(                                                    \
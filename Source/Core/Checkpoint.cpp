@@ -0,0 +1,207 @@
+/*
+ *  Checkpoint.cpp
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "itksys/SystemTools.hxx"
+
+#include "Checkpoint.h"
+#include "Log.h"
+
+namespace QI {
+
+namespace {
+char const JournalMagic[8] = {'Q', 'I', 'J', 'R', 'N', 'L', '2', '\0'};
+char const BitmapMagic[8]  = {'Q', 'I', 'D', 'O', 'N', 'E', '1', '\0'};
+
+template <typename T> void WriteValue(std::ostream &os, T const &v) {
+    os.write(reinterpret_cast<char const *>(&v), sizeof(T));
+}
+
+template <typename T> bool ReadValue(std::istream &is, T &v) {
+    return bool(is.read(reinterpret_cast<char *>(&v), sizeof(T)));
+}
+
+bool CheckMagic(std::istream &is, char const (&magic)[8]) {
+    char m[8];
+    return is.read(m, 8) && (std::memcmp(m, magic, 8) == 0);
+}
+
+size_t const JournalHeader = 8 + 3 * sizeof(uint64_t); // Magic, voxels, record size, key
+
+/*
+ *  Flush a file, or the entries of a directory, from the OS cache to the disk. A flushed stream
+ *  has only reached the OS, and a rename only becomes durable once its directory is synced.
+ */
+void SyncPath(std::string const &path) {
+    int const fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        QI::Fail("Could not open {} to sync it", path);
+    }
+    int const result = fsync(fd);
+    close(fd);
+    if (result != 0) {
+        QI::Fail("Could not sync {} to disk", path);
+    }
+}
+} // namespace
+
+uint64_t HashBytes(void const *data, size_t const size, uint64_t h) {
+    auto const * bytes = static_cast<unsigned char const *>(data);
+    size_t const words = size / sizeof(uint64_t);
+    for (size_t i = 0; i < words; i++) { // A word at a time, as inputs can be gigabytes
+        uint64_t w;
+        std::memcpy(&w, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+        h = (h ^ w) * 1099511628211ull;
+    }
+    for (size_t i = words * sizeof(uint64_t); i < size; i++) {
+        h = (h ^ bytes[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+Checkpoint::Checkpoint(std::string const &dir,
+                       size_t const       voxels,
+                       size_t const       record_size,
+                       uint64_t const     key,
+                       bool const         resume,
+                       Save const &       save,
+                       double const       interval) :
+    m_journal_path(dir + "/voxels.qic"),
+    m_bitmap_path(dir + "/done.qic"), m_voxels(voxels), m_record_size(record_size), m_save(save),
+    m_interval(interval), m_bits((voxels + 7) / 8, 0), m_last(std::chrono::steady_clock::now()) {
+    if (!itksys::SystemTools::MakeDirectory(dir)) {
+        QI::Fail("Could not create checkpoint directory {}", dir);
+    }
+    if (resume) {
+        std::ifstream journal(m_journal_path, std::ios::binary);
+        uint64_t      v = 0, r = 0, k = 0;
+        if (!CheckMagic(journal, JournalMagic) || !ReadValue(journal, v) ||
+            !ReadValue(journal, r) || !ReadValue(journal, k)) {
+            QI::Fail("Could not read checkpoint journal {}", m_journal_path);
+        }
+        if ((v != m_voxels) || (r != m_record_size) || (k != key)) {
+            QI::Fail("Checkpoint in {} is for a different image or fit", dir);
+        }
+        // Drop a record cut short by an interruption, otherwise every record appended after it
+        // would be misaligned. Its voxel cannot be in the bitmap, which is written afterwards.
+        journal.seekg(0, std::ios::end);
+        size_t const stride  = sizeof(int64_t) + m_record_size;
+        size_t const records = (static_cast<size_t>(journal.tellg()) - JournalHeader) / stride;
+        journal.close();
+        if (truncate(m_journal_path.c_str(), JournalHeader + records * stride) != 0) {
+            QI::Fail("Could not truncate checkpoint journal {}", m_journal_path);
+        }
+        // A missing bitmap means nothing was finished before the interruption
+        std::ifstream bitmap(m_bitmap_path, std::ios::binary);
+        if (bitmap) {
+            if (!CheckMagic(bitmap, BitmapMagic) || !ReadValue(bitmap, v) || (v != m_voxels) ||
+                !bitmap.read(m_bits.data(), m_bits.size())) {
+                QI::Fail("Could not read checkpoint bitmap {}", m_bitmap_path);
+            }
+        }
+        m_journal.open(m_journal_path, std::ios::binary | std::ios::app);
+    } else {
+        std::remove(m_bitmap_path.c_str());
+        m_journal.open(m_journal_path, std::ios::binary | std::ios::trunc);
+        m_journal.write(JournalMagic, 8);
+        WriteValue<uint64_t>(m_journal, m_voxels);
+        WriteValue<uint64_t>(m_journal, m_record_size);
+        WriteValue<uint64_t>(m_journal, key);
+        m_journal.flush();
+    }
+    if (!m_journal) {
+        QI::Fail("Could not open checkpoint journal {}", m_journal_path);
+    }
+}
+
+size_t Checkpoint::Replay(Restore const &restore) const {
+    std::ifstream journal(m_journal_path, std::ios::binary);
+    journal.seekg(JournalHeader);
+    std::vector<char> record(m_record_size);
+    int64_t           offset;
+    size_t            n = 0;
+    // The constructor dropped any record cut short by an interruption, so all records are whole
+    while (ReadValue(journal, offset) && journal.read(record.data(), m_record_size)) {
+        if ((offset >= 0) && (static_cast<size_t>(offset) < m_voxels) && Done(offset)) {
+            restore(offset, record.data());
+            n++;
+        }
+    }
+    return n;
+}
+
+void Checkpoint::Finished(itk::OffsetValueType const *offsets, size_t const n) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.insert(m_pending.end(), offsets, offsets + n);
+    if ((std::chrono::steady_clock::now() - m_last) >= m_interval) {
+        Write();
+    }
+}
+
+void Checkpoint::Flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Write();
+}
+
+void Checkpoint::Write() {
+    m_last = std::chrono::steady_clock::now();
+    if (m_pending.empty()) {
+        return;
+    }
+    size_t const stride = sizeof(int64_t) + m_record_size;
+    m_records.resize(m_pending.size() * stride);
+    char *dst = m_records.data();
+    for (auto const offset : m_pending) {
+        int64_t const o = offset;
+        std::memcpy(dst, &o, sizeof(int64_t));
+        m_save(offset, dst + sizeof(int64_t));
+        dst += stride;
+    }
+    m_journal.write(m_records.data(), m_records.size());
+    m_journal.flush();
+    if (!m_journal) {
+        QI::Fail("Failed to write checkpoint journal {}", m_journal_path);
+    }
+    // The records must be on disk before a bitmap that claims them, even if the power fails
+    SyncPath(m_journal_path);
+
+    for (auto const offset : m_pending) {
+        m_bits[offset / 8] |= char(1 << (offset % 8));
+    }
+    m_pending.clear();
+    std::string const tmp_path = m_bitmap_path + ".tmp";
+    {
+        std::ofstream bitmap(tmp_path, std::ios::binary | std::ios::trunc);
+        bitmap.write(BitmapMagic, 8);
+        WriteValue<uint64_t>(bitmap, m_voxels);
+        bitmap.write(m_bits.data(), m_bits.size());
+        if (!bitmap.flush()) {
+            QI::Fail("Failed to write checkpoint bitmap {}", tmp_path);
+        }
+    }
+    SyncPath(tmp_path);
+    // Replace the old bitmap in one step, so there is always a complete one on disk
+    if (std::rename(tmp_path.c_str(), m_bitmap_path.c_str()) != 0) {
+        std::remove(m_bitmap_path.c_str());
+        if (std::rename(tmp_path.c_str(), m_bitmap_path.c_str()) != 0) {
+            QI::Fail("Failed to replace checkpoint bitmap {}", m_bitmap_path);
+        }
+    }
+    SyncPath(itksys::SystemTools::GetFilenamePath(m_bitmap_path));
+}
+
+} // End namespace QI
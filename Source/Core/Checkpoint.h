@@ -0,0 +1,94 @@
+/*
+ *  Checkpoint.h
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "itkIntTypes.h"
+
+namespace QI {
+
+/*
+ *  Fold size bytes into the 64-bit hash h (FNV-1a over 64-bit words), e.g. to build a Checkpoint
+ *  key from the input geometry and data
+ */
+uint64_t HashBytes(void const *data, size_t const size, uint64_t h = 14695981039346656037ull);
+
+/*
+ *  Saves the results of finished voxels during a long fit, so that it can be resumed if it is
+ *  interrupted. Each voxel is saved as a fixed-size record, whose layout is up to the caller,
+ *  appended to a journal. A bitmap of the finished voxels is written alongside it. The bitmap is
+ *  only replaced after the journal has been synced to disk, so after a crash or a power failure it
+ *  never claims a voxel whose record was lost. Only the voxels finished since the last write are written each time,
+ *  so the cost is proportional to the work done rather than the image size.
+ */
+class Checkpoint {
+  public:
+    using Save    = std::function<void(itk::OffsetValueType const offset, char *record)>;
+    using Restore = std::function<void(itk::OffsetValueType const offset, char const *record)>;
+
+    /*
+     *  Start a new checkpoint in dir, or resume the one that is already there. Checks that the
+     *  existing checkpoint has the same voxel count, record size and key, which should identify
+     *  the input (see HashBytes()). A record cut short by an interruption is dropped before new
+     *  records are appended after it.
+     */
+    Checkpoint(std::string const &dir,
+               size_t const       voxels,
+               size_t const       record_size,
+               uint64_t const     key,
+               bool const         resume,
+               Save const &       save,
+               double const       interval = 60.0);
+
+    /*
+     *  Hand every voxel saved in the checkpoint to restore. Returns how many there were.
+     */
+    size_t Replay(Restore const &restore) const;
+
+    bool Done(itk::OffsetValueType const offset) const {
+        return (m_bits[offset / 8] >> (offset % 8)) & 1;
+    }
+
+    /*
+     *  Mark voxels as finished. They are written once the interval has passed since the last
+     *  write. Thread-safe, but the voxels' results must be final when this is called.
+     */
+    void Finished(itk::OffsetValueType const *offsets, size_t const n);
+
+    /*
+     *  Write any finished voxels now
+     */
+    void Flush();
+
+  private:
+    void Write(); // Requires m_mutex
+
+    std::string const                     m_journal_path, m_bitmap_path;
+    size_t const                          m_voxels, m_record_size;
+    Save const                            m_save;
+    std::chrono::duration<double> const   m_interval;
+    std::vector<char>                     m_bits; // One per voxel, set once it is in the journal
+    std::vector<itk::OffsetValueType>     m_pending;
+    std::vector<char>                     m_records;
+    std::ofstream                         m_journal;
+    std::chrono::steady_clock::time_point m_last;
+    std::mutex                            m_mutex;
+};
+
+} // End namespace QI
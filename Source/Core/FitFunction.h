@@ -11,12 +11,17 @@
 
 #pragma once
 
+#include "LevenbergMarquardt.h"
 #include "Macro.h"
 #include "Model.h"
 #include <Eigen/Core>
+#include <algorithm>
 #include <itkIndex.h>
+#include <limits>
 #include <string>
 #include <tuple>
+#include <type_traits>
+#include <vector>
 
 namespace QI {
 
@@ -29,6 +34,159 @@ struct FitReturnType {
     std::string message;
 };
 
+/*
+ *  Which solver the generic non-linear fits use. LM is QI::LevenbergMarquardt, which avoids the
+ *  per-voxel setup cost of Ceres and is much faster for models with a handful of parameters.
+ */
+enum class NLLSSolver { Ceres, LM };
+
+/*
+ *  Pick the start point for an iterative fit. In warm-start mode ModelFitFilter passes the result of
+ *  the last successful fit of a neighbouring voxel in the outputs argument of fit(), which is
+ *  otherwise zero. If there is one it is clamped to the bounds and kept, otherwise p is set to
+ *  start. Fits that scale their data must scale p to match first. Returns true for a warm start.
+ */
+template <typename Array>
+bool WarmStart(Array &p, Array const &start, Array const &lo, Array const &hi) {
+    if (p.allFinite() && (p != 0).any()) {
+        p = p.max(lo).min(hi);
+        return true;
+    }
+    p = start;
+    return false;
+}
+
+/*
+ *  Result of MultiStart()
+ */
+struct MultiStartSummary {
+    bool        usable     = false;
+    double      cost       = std::numeric_limits<double>::infinity();
+    int         iterations = 0; // Summed over every start that was solved
+    int         solved     = 0; // Number of starts that were solved
+    std::string message;        // Report from the last unusable solve, if any
+};
+
+/*
+ *  Fit a problem with several local minima, e.g. the off-resonance bands in bSSFP, from multiple
+ *  starts. p must be the parameter block registered with the problem. The cost at every start is
+ *  evaluated first, which only needs the residuals, and the starts are solved from the lowest
+ *  initial cost upwards. The search stops once a start converges to a cost below the initial cost
+ *  of every remaining start, so usually only one or two are solved. On return p holds the best
+ *  solution. Voxels are already spread across threads, so the starts run in sequence.
+ */
+template <typename Array>
+MultiStartSummary MultiStart(ceres::Solver::Options const &options,
+                             ceres::Problem &              problem,
+                             Array &                       p,
+                             std::vector<Array> const &    starts) {
+    std::vector<std::pair<double, size_t>> order;
+    order.reserve(starts.size());
+    for (size_t i = 0; i < starts.size(); i++) {
+        p           = starts[i];
+        double cost = 0;
+        bool const ok =
+            problem.Evaluate(ceres::Problem::EvaluateOptions(), &cost, nullptr, nullptr, nullptr);
+        if (!ok || !std::isfinite(cost)) {
+            cost = std::numeric_limits<double>::infinity();
+        }
+        order.emplace_back(cost, i);
+    }
+    std::sort(order.begin(), order.end());
+
+    MultiStartSummary      result;
+    ceres::Solver::Summary summary;
+    Array                  best      = starts.empty() ? p : starts[order.front().second];
+    bool                   converged = false;
+    for (size_t i = 0; i < order.size(); i++) {
+        p = starts[order[i].second];
+        ceres::Solve(options, &problem, &summary);
+        result.iterations += summary.iterations.size();
+        result.solved++;
+        if (!summary.IsSolutionUsable()) {
+            result.message = summary.FullReport();
+        } else if (summary.final_cost < result.cost) {
+            result.usable = true;
+            result.cost   = summary.final_cost;
+            converged     = (summary.termination_type == ceres::CONVERGENCE);
+            best          = p;
+        }
+        if (converged && (i + 1 < order.size()) && (result.cost < order[i + 1].first)) {
+            break;
+        }
+    }
+    p = best;
+    return result;
+}
+
+/*
+ *  A tile of voxels in structure-of-arrays layout, for fit functions that can fit many voxels at
+ *  once with fit_batch(). Row r of every array belongs to the same voxel, so each column of an
+ *  input holds one volume for the whole tile and can be processed with SIMD. For blocked fits each
+ *  row is one block of one voxel. Only the first size rows are valid, but fit_batch() may process
+ *  all MaxSize rows to keep the loops fixed-size.
+ */
+template <typename ModelType, typename FlagType> struct FitBatch {
+    static constexpr int MaxSize = 64;
+
+    using DataType      = typename ModelType::DataType;
+    using ParameterType = typename ModelType::ParameterType;
+    using DataTile      = Eigen::Array<DataType, MaxSize, Eigen::Dynamic>;
+    using Column        = Eigen::Array<ParameterType, MaxSize, 1>;
+
+    Eigen::Index                                         size = 0;
+    std::vector<DataTile>                                inputs;    // MaxSize x input_size(i)
+    std::vector<DataTile>                                residuals; // Empty unless requested
+    Eigen::Array<ParameterType, MaxSize, ModelType::NF> fixed;
+    Eigen::Array<ParameterType, MaxSize, ModelType::NV> outputs;
+    Eigen::Array<double, MaxSize, 1>                     rmse;
+    Eigen::Array<FlagType, MaxSize, 1>                   flags;
+    Eigen::Array<int, MaxSize, 1>                        blocks; // Block of each row, if blocked
+
+    template <typename FitType>
+    FitBatch(FitType const &fit, bool const allResiduals) :
+        inputs(ModelType::NI), residuals(allResiduals ? ModelType::NI : 0) {
+        for (int i = 0; i < ModelType::NI; i++) {
+            inputs[i] = DataTile::Zero(MaxSize, fit.input_size(i));
+            if (allResiduals) {
+                residuals[i] = DataTile::Zero(MaxSize, fit.input_size(i));
+            }
+        }
+        fixed.setZero();
+        blocks.setZero();
+        reset();
+    }
+
+    void reset() {
+        outputs.setZero();
+        rmse.setZero();
+        flags.setZero();
+        for (auto &r : residuals) {
+            r.setZero();
+        }
+    }
+
+    /*
+     *  Same semantics as QI::Clamp, including that NaN becomes lo
+     */
+    static Column Clamp(Column const &x, ParameterType const lo, ParameterType const hi) {
+        return (x > lo).select((x < hi).select(x, hi), lo);
+    }
+};
+
+/*
+ *  True if FitType has a fit_batch() member. The base fit functions deliberately do not declare
+ *  one, so only fits that really implement it are batched. It cannot be virtual, hence
+ *  ModelFitFilter must be instantiated with the derived fit type for batching to happen.
+ */
+template <typename FitType, typename = void> struct HasFitBatch : std::false_type {};
+template <typename FitType>
+struct HasFitBatch<
+    FitType,
+    std::void_t<decltype(std::declval<FitType const &>().fit_batch(
+        std::declval<FitBatch<typename FitType::ModelType, typename FitType::FlagType> &>()))>>
+    : std::true_type {};
+
 template <typename Model_, bool Blocked_ = false, bool Indexed_ = false> struct FitFunctionBase {
     using ModelType           = Model_;
     using RMSErrorType        = double;
@@ -49,6 +207,7 @@ struct FitFunction : FitFunctionBase<ModelType, false, false> {
     using InputType  = typename ModelType::DataType;
     using OutputType = typename ModelType::ParameterType;
     using FlagType   = FlagType_; // Iterations
+    using Batch      = FitBatch<ModelType, FlagType>;
 
     FitFunction(ModelType &m) : Super{m} {}
 
@@ -61,7 +220,7 @@ struct FitFunction : FitFunctionBase<ModelType, false, false> {
                               FlagType &                              flag) const = 0;
 };
 
-template <typename ModelType, typename FlagType_ = int>
+template <typename ModelType, typename FlagType_ = int, NLLSSolver Solver = NLLSSolver::Ceres>
 struct NLLSFitFunction : FitFunction<ModelType> {
     using Super = FitFunction<ModelType, FlagType_>;
     using Super::Super;
@@ -79,42 +238,77 @@ struct NLLSFitFunction : FitFunction<ModelType> {
                       RMSErrorType &                          rmse,
                       std::vector<QI_ARRAY(InputType)> &      residuals,
                       FlagType &                              iterations) const {
-        auto const &   data = inputs[0];
-        ceres::Problem problem;
-        using Cost      = ModelCost<ModelType>;
-        using AutoCost  = ceres::AutoDiffCostFunction<Cost, ceres::DYNAMIC, ModelType::NV>;
-        auto *cost      = new Cost{this->model, fixed, data};
-        auto *auto_cost = new AutoCost(cost, this->model.sequence.size());
-        problem.AddResidualBlock(auto_cost, NULL, p.data());
-        for (int i = 0; i < ModelType::NV; i++) {
-            problem.SetParameterLowerBound(p.data(), i, this->model.bounds_lo[i]);
-            problem.SetParameterUpperBound(p.data(), i, this->model.bounds_hi[i]);
-        }
-        ceres::Solver::Options options;
-        ceres::Solver::Summary summary;
-        options.max_num_iterations  = 15;
-        options.function_tolerance  = 1e-6;
-        options.gradient_tolerance  = 1e-7;
-        options.parameter_tolerance = 1e-5;
-        options.logging_type        = ceres::SILENT;
-        p << this->model.start;
-        ceres::Solve(options, &problem, &summary);
-        if (!summary.IsSolutionUsable()) {
-            return {false, summary.FullReport()};
-        }
-        iterations = summary.iterations.size();
+        auto const &data = inputs[0];
+        if constexpr (Solver == NLLSSolver::LM) {
+            LevenbergMarquardt<ModelType> lm(
+                this->model, fixed, data, this->model.bounds_lo, this->model.bounds_hi);
+            LMOptions options;
+            options.max_iterations      = 15;
+            options.function_tolerance  = 1e-6;
+            options.gradient_tolerance  = 1e-7;
+            options.parameter_tolerance = 1e-5;
+            bool const warm =
+                WarmStart(p, this->model.start, this->model.bounds_lo, this->model.bounds_hi);
+            auto summary = lm.solve(p, options);
+            if (warm && (!summary.usable || !p.allFinite())) {
+                p       = this->model.start;
+                summary = lm.solve(p, options);
+            }
+            if (!summary.usable) {
+                return {false, summary.message};
+            }
+            iterations = summary.iterations;
 
-        Eigen::ArrayXd const rs  = (data - this->model.signal(p, fixed));
-        double const         var = rs.square().sum();
-        rmse                     = sqrt(var / data.rows());
-        if (residuals.size() > 0) {
-            residuals[0] = rs;
-        }
-        if (cov) {
-            QI::GetModelCovariance<ModelType>(problem, p, var / (data.rows() - ModelType::NV), cov);
-        }
+            Eigen::ArrayXd const rs  = (data - this->model.signal(p, fixed));
+            double const         var = rs.square().sum();
+            rmse                     = sqrt(var / data.rows());
+            if (residuals.size() > 0) {
+                residuals[0] = rs;
+            }
+            if (cov) {
+                QI::GetModelCovariance<ModelType>(
+                    lm.JtJ(), p, var / (data.rows() - ModelType::NV), cov);
+            }
+            return {true, ""};
+        } else {
+            ceres::Problem problem;
+            problem.AddResidualBlock(MakeModelCost(this->model, fixed, data), NULL, p.data());
+            for (int i = 0; i < ModelType::NV; i++) {
+                problem.SetParameterLowerBound(p.data(), i, this->model.bounds_lo[i]);
+                problem.SetParameterUpperBound(p.data(), i, this->model.bounds_hi[i]);
+            }
+            ceres::Solver::Options options;
+            ceres::Solver::Summary summary;
+            options.max_num_iterations  = 15;
+            options.function_tolerance  = 1e-6;
+            options.gradient_tolerance  = 1e-7;
+            options.parameter_tolerance = 1e-5;
+            options.logging_type        = ceres::SILENT;
+            bool const warm =
+                WarmStart(p, this->model.start, this->model.bounds_lo, this->model.bounds_hi);
+            ceres::Solve(options, &problem, &summary);
+            if (warm && (!summary.IsSolutionUsable() || !p.allFinite())) {
+                p = this->model.start;
+                ceres::Solve(options, &problem, &summary);
+            }
+            if (!summary.IsSolutionUsable()) {
+                return {false, summary.FullReport()};
+            }
+            iterations = summary.iterations.size();
+
+            Eigen::ArrayXd const rs  = (data - this->model.signal(p, fixed));
+            double const         var = rs.square().sum();
+            rmse                     = sqrt(var / data.rows());
+            if (residuals.size() > 0) {
+                residuals[0] = rs;
+            }
+            if (cov) {
+                QI::GetModelCovariance<ModelType>(
+                    problem, p, var / (data.rows() - ModelType::NV), cov);
+            }
 
-        return {true, ""};
+            return {true, ""};
+        }
     }
 };
 
@@ -126,6 +320,7 @@ struct BlockFitFunction : FitFunctionBase<ModelType, true, false> {
     using InputType  = typename ModelType::DataType;
     using OutputType = typename ModelType::ParameterType;
     using FlagType   = FlagType_; // Iterations
+    using Batch      = FitBatch<ModelType, FlagType>;
 
     virtual FitReturnType fit(const std::vector<QI_ARRAY(InputType)> &inputs,
                               typename ModelType::FixedArray const &  fixed,
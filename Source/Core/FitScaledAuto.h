@@ -4,7 +4,13 @@
 
 namespace QI {
 
-template <typename ModelType, typename FlagType_ = int>
+/*
+ *  The first NScale parameters are signal amplitudes (e.g. M0) and are scaled with the data
+ */
+template <typename ModelType,
+          typename FlagType_ = int,
+          NLLSSolver Solver  = NLLSSolver::Ceres,
+          int        NScale  = 1>
 struct ScaledAutoDiffFit : FitFunction<ModelType, FlagType_> {
     using Super = FitFunction<ModelType, FlagType_>;
     using Super::Super;
@@ -29,40 +35,75 @@ struct ScaledAutoDiffFit : FitFunction<ModelType, FlagType_> {
             return {false, "Maximum data value was not positive"};
         }
         const Eigen::ArrayXd data = inputs[0] / scale;
-        ceres::Problem       problem;
-        using Cost      = ModelCost<ModelType>;
-        using AutoCost  = ceres::AutoDiffCostFunction<Cost, ceres::DYNAMIC, ModelType::NV>;
-        auto *cost      = new Cost{this->model, fixed, data};
-        auto *auto_cost = new AutoCost(cost, this->model.sequence.size());
-        problem.AddResidualBlock(auto_cost, NULL, p.data());
-        for (int i = 0; i < ModelType::NV; i++) {
-            problem.SetParameterLowerBound(p.data(), i, this->model.bounds_lo[i]);
-            problem.SetParameterUpperBound(p.data(), i, this->model.bounds_hi[i]);
+        // Any warm start is at the scale of a neighbouring voxel
+        p.template head<NScale>() /= scale;
+        bool const warm =
+            WarmStart(p, this->model.start, this->model.bounds_lo, this->model.bounds_hi);
+        if constexpr (Solver == NLLSSolver::LM) {
+            LevenbergMarquardt<ModelType> lm(
+                this->model, fixed, data, this->model.bounds_lo, this->model.bounds_hi);
+            LMOptions options;
+            options.max_iterations      = 30;
+            options.function_tolerance  = 1e-6;
+            options.gradient_tolerance  = 1e-7;
+            options.parameter_tolerance = 1e-5;
+            auto summary                = lm.solve(p, options);
+            if (warm && (!summary.usable || !p.allFinite())) {
+                p       = this->model.start;
+                summary = lm.solve(p, options);
+            }
+            if (!summary.usable) {
+                return {false, summary.message};
+            }
+            iterations               = summary.iterations;
+            Eigen::ArrayXd const rs  = (data - this->model.signal(p, fixed));
+            double const         var = rs.square().sum();
+            rmse                     = sqrt(var / data.rows()) * scale;
+            if (residuals.size() > 0) {
+                residuals[0] = rs * scale;
+            }
+            if (cov) {
+                QI::GetModelCovariance<ModelType>(
+                    lm.JtJ(), p, var / (data.rows() - ModelType::NV), cov);
+            }
+            p.template head<NScale>() *= scale;
+            return {true, ""};
+        } else {
+            ceres::Problem problem;
+            problem.AddResidualBlock(MakeModelCost(this->model, fixed, data), NULL, p.data());
+            for (int i = 0; i < ModelType::NV; i++) {
+                problem.SetParameterLowerBound(p.data(), i, this->model.bounds_lo[i]);
+                problem.SetParameterUpperBound(p.data(), i, this->model.bounds_hi[i]);
+            }
+            ceres::Solver::Options options;
+            ceres::Solver::Summary summary;
+            options.max_num_iterations  = 30;
+            options.function_tolerance  = 1e-6;
+            options.gradient_tolerance  = 1e-7;
+            options.parameter_tolerance = 1e-5;
+            options.logging_type        = ceres::SILENT;
+            ceres::Solve(options, &problem, &summary);
+            if (warm && (!summary.IsSolutionUsable() || !p.allFinite())) {
+                p = this->model.start;
+                ceres::Solve(options, &problem, &summary);
+            }
+            if (!summary.IsSolutionUsable()) {
+                return {false, summary.FullReport()};
+            }
+            iterations               = summary.iterations.size();
+            Eigen::ArrayXd const rs  = (data - this->model.signal(p, fixed));
+            double const         var = rs.square().sum();
+            rmse                     = sqrt(var / data.rows()) * scale;
+            if (residuals.size() > 0) {
+                residuals[0] = rs * scale;
+            }
+            if (cov) {
+                QI::GetModelCovariance<ModelType>(
+                    problem, p, var / (data.rows() - ModelType::NV), cov);
+            }
+            p.template head<NScale>() *= scale;
+            return {true, ""};
         }
-        ceres::Solver::Options options;
-        ceres::Solver::Summary summary;
-        options.max_num_iterations  = 30;
-        options.function_tolerance  = 1e-6;
-        options.gradient_tolerance  = 1e-7;
-        options.parameter_tolerance = 1e-5;
-        options.logging_type        = ceres::SILENT;
-        p << this->model.start;
-        ceres::Solve(options, &problem, &summary);
-        if (!summary.IsSolutionUsable()) {
-            return {false, summary.FullReport()};
-        }
-        iterations               = summary.iterations.size();
-        Eigen::ArrayXd const rs  = (data - this->model.signal(p, fixed));
-        double const         var = rs.square().sum();
-        rmse                     = sqrt(var / data.rows()) * scale;
-        if (residuals.size() > 0) {
-            residuals[0] = rs * scale;
-        }
-        if (cov) {
-            QI::GetModelCovariance<ModelType>(problem, p, var / (data.rows() - ModelType::NV), cov);
-        }
-        p[0] = p[0] * scale;
-        return {true, ""};
     }
 };
 
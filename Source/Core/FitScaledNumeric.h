@@ -51,8 +51,8 @@ struct ScaledNumericDiffFit : FitFunction<ModelType, int> {
 
         // Set up parameter bounds
         for (int i = 0; i < ModelType::NV; i++) {
-            problem.SetParameterLowerBound(varying.data(), i, this->model.lo[i]);
-            problem.SetParameterUpperBound(varying.data(), i, this->model.hi[i]);
+            problem.SetParameterLowerBound(varying.data(), i, this->model.bounds_lo[i]);
+            problem.SetParameterUpperBound(varying.data(), i, this->model.bounds_hi[i]);
         }
 
         ceres::Solver::Options options;
@@ -63,8 +63,15 @@ struct ScaledNumericDiffFit : FitFunction<ModelType, int> {
         options.parameter_tolerance = 1e-5;
         options.logging_type        = ceres::SILENT;
 
-        varying = this->model.start;
+        // Any warm start is at the scale of a neighbouring voxel
+        varying.template head<NScale>() /= scale;
+        bool const warm =
+            WarmStart(varying, this->model.start, this->model.bounds_lo, this->model.bounds_hi);
         ceres::Solve(options, &problem, &summary);
+        if (warm && (!summary.IsSolutionUsable() || !varying.allFinite())) {
+            varying = this->model.start;
+            ceres::Solve(options, &problem, &summary);
+        }
         if (!summary.IsSolutionUsable()) {
             return {false, summary.FullReport()};
         }
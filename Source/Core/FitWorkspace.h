@@ -0,0 +1,184 @@
+/*
+ *  FitWorkspace.h
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "FitFunction.h"
+#include "Macro.h"
+
+namespace QI {
+
+/*
+ *  Scratch memory for one work unit of a ModelFitFilter. Everything the voxel loop needs is sized
+ *  once in the constructor and then handed to fit() by reference, so that the loop does not resize
+ *  them. Fit functions may use the residual and covariance buffers as scratch space, but must not
+ *  resize them. check() counts any buffer that moved behind our back. It cannot see allocations
+ *  made inside fit() itself, e.g. the problem and cost functions of a non-linear fit.
+ *
+ *  If the fit provides fit_batch() the workspace also holds a tile of voxels waiting to be fitted.
+ *  In warm-start mode it remembers recent successful fits, per block, to seed the next voxel.
+ */
+template <typename FitType> struct FitWorkspace {
+    using ModelType     = typename FitType::ModelType;
+    using DataArray     = QI_ARRAY(typename ModelType::DataType);
+    using VaryingArray  = typename ModelType::VaryingArray;
+    using FixedArray    = typename ModelType::FixedArray;
+    using CovarArray    = typename ModelType::CovarArray;
+    using DerivedArray  = typename ModelType::DerivedArray;
+    using RMSErrorType  = typename FitType::RMSErrorType;
+    using FlagType      = typename FitType::FlagType;
+    using Batch         = FitBatch<ModelType, FlagType>;
+
+    std::vector<DataArray> inputs;
+    std::vector<DataArray> residuals; // Left empty if the user did not ask for them
+    VaryingArray           outputs;
+    FixedArray             fixed;
+    CovarArray             covar;
+    DerivedArray           derived;
+    RMSErrorType           rmse;
+    FlagType               flag;
+
+    std::unique_ptr<Batch>           batch;      // Null unless batched
+    std::array<long, Batch::MaxSize> batch_rows; // Output index of each row in the batch
+
+    size_t fits     = 0; // Voxels (or blocks) passed to fit() or fit_batch()
+    double flag_sum = 0; // Sum of their flags, usually iterations
+
+    size_t allocations   = 0; // Data buffers allocated while sizing the workspace
+    size_t moves         = 0; // Buffers that changed address inside the voxel loop
+
+    FitWorkspace(FitType const &fit, bool const allResiduals, bool const batched = false) :
+        inputs(ModelType::NI), residuals(allResiduals ? ModelType::NI : 0) {
+        if (batched) {
+            batch = std::make_unique<Batch>(fit, allResiduals);
+            allocations += batch->inputs.size() + batch->residuals.size();
+        }
+        for (int i = 0; i < ModelType::NI; i++) {
+            inputs[i] = DataArray::Zero(fit.input_size(i));
+            allocations++;
+            if (allResiduals) {
+                residuals[i] = DataArray::Zero(fit.input_size(i));
+                allocations++;
+            }
+        }
+        m_inputs_ptrs.reserve(inputs.size());
+        m_resids_ptrs.reserve(residuals.size());
+        for (auto const &in : inputs) {
+            m_inputs_ptrs.push_back(in.data());
+        }
+        for (auto const &r : residuals) {
+            m_resids_ptrs.push_back(r.data());
+        }
+    }
+
+    /*
+     *  Reset the per-voxel outputs. Does not allocate. Fixed parameters are filled in by the caller.
+     */
+    void reset() {
+        outputs = VaryingArray::Zero();
+        covar   = CovarArray::Zero();
+        rmse    = 0;
+        flag    = 0;
+        for (auto &r : residuals) {
+            r.setZero();
+        }
+    }
+
+    /*
+     *  Enable warm starts for a fit with this many blocks
+     */
+    void warm_start(int const blocks) {
+        m_seeds.resize(blocks);
+        allocations++;
+    }
+
+    /*
+     *  Voxels are visited in scanline order, so the previous voxel is the neighbour along the
+     *  first axis, except at the start of a row where the first voxel of the previous row is used.
+     *  If either is adjacent to index, copy it into outputs so that fit() can start from it.
+     */
+    void seed(int const b, itk::Index<3> const &index) {
+        if (b < static_cast<int>(m_seeds.size())) {
+            for (auto const *s : {&m_seeds[b].last, &m_seeds[b].row}) {
+                if (s->valid && Adjacent(s->index, index)) {
+                    outputs = s->p;
+                    return;
+                }
+            }
+        }
+    }
+
+    /*
+     *  Remember the result of fit() for the next voxel. Failed fits are not used as seeds.
+     */
+    void remember(int const b, itk::Index<3> const &index, bool const success) {
+        if (b < static_cast<int>(m_seeds.size())) {
+            auto &s = m_seeds[b];
+            if (!success || !outputs.allFinite()) {
+                s.last.valid = false;
+                return;
+            }
+            s.last = {outputs, index, true};
+            if (!s.row.valid || (s.row.index[1] != index[1]) || (s.row.index[2] != index[2])) {
+                s.row = s.last;
+            }
+        }
+    }
+
+    /*
+     *  Check that fit() did not resize any of the borrowed buffers. If it did, count it and adopt
+     *  the new buffer so that the same move is not counted twice.
+     */
+    void check() {
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (inputs[i].data() != m_inputs_ptrs[i]) {
+                moves++;
+                m_inputs_ptrs[i] = inputs[i].data();
+            }
+        }
+        for (size_t i = 0; i < residuals.size(); i++) {
+            if (residuals[i].data() != m_resids_ptrs[i]) {
+                moves++;
+                m_resids_ptrs[i] = residuals[i].data();
+            }
+        }
+    }
+
+  private:
+    std::vector<typename ModelType::DataType const *> m_inputs_ptrs, m_resids_ptrs;
+
+    struct Seed {
+        VaryingArray  p;
+        itk::Index<3> index;
+        bool          valid = false;
+    };
+    struct Seeds {
+        Seed last; // The last fit
+        Seed row;  // The first fit in the current row
+    };
+    std::vector<Seeds> m_seeds;
+
+    static bool Adjacent(itk::Index<3> const &a, itk::Index<3> const &b) {
+        for (int d = 0; d < 3; d++) {
+            if (std::abs(a[d] - b[d]) > 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+} // End namespace QI
@@ -0,0 +1,172 @@
+/*
+ *  LevenbergMarquardt.h
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <Eigen/Cholesky>
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+
+#include "ceres/jet.h"
+
+#include "Macro.h"
+#include "Model.h"
+
+namespace QI {
+
+/*
+ *  Same meaning and defaults as the matching ceres::Solver::Options
+ */
+struct LMOptions {
+    int    max_iterations      = 50;
+    double function_tolerance  = 1e-6;
+    double gradient_tolerance  = 1e-10;
+    double parameter_tolerance = 1e-8;
+};
+
+struct LMSummary {
+    bool        usable     = false;
+    int         iterations = 0; // Including the initial evaluation, as ceres::Solver::Summary
+    double      cost       = 0;
+    char const *message    = "";
+};
+
+/*
+ *  A small bounded Levenberg-Marquardt solver for models with only a handful of parameters. Every
+ *  matrix is fixed-size, and there is no problem or cost-function object to build, so the per-voxel
+ *  overhead is only the model evaluations. The Jacobian comes from Model::jacobian if there is one,
+ *  and otherwise from evaluating Model::signal with ceres::Jet, as ceres::AutoDiffCostFunction
+ *  would. Bounds are enforced by projecting each step onto the box, and the trust-region update
+ *  follows Ceres' LEVENBERG_MARQUARDT strategy so that results match NLLSFitFunction closely.
+ */
+template <typename ModelType> class LevenbergMarquardt {
+  public:
+    static constexpr int NV = ModelType::NV;
+    using VaryingArray      = typename ModelType::VaryingArray;
+    using FixedArray        = typename ModelType::FixedArray;
+    using DataArray         = QI_ARRAY(typename ModelType::DataType);
+    using Matrix            = Eigen::Matrix<double, NV, NV>;
+    using Vector            = Eigen::Matrix<double, NV, 1>;
+    using Jet               = ceres::Jet<double, NV>;
+
+    LevenbergMarquardt(ModelType const &   m,
+                       FixedArray const &  f,
+                       DataArray const &   d,
+                       VaryingArray const &lo,
+                       VaryingArray const &hi) :
+        m_model(m), m_fixed(f), m_data(d), m_lo(lo), m_hi(hi) {}
+
+    /*
+     *  Minimise 0.5 * |data - signal(p)|^2 starting from p, which is projected inside the bounds
+     */
+    LMSummary solve(VaryingArray &p, LMOptions const &options) {
+        LMSummary summary;
+        Vector    g;
+        p                  = Project(p);
+        double cost        = Evaluate(p, m_JtJ, g);
+        summary.iterations = 1;
+        if (!std::isfinite(cost)) {
+            summary.message = "Initial cost was not finite";
+            return summary;
+        }
+        double radius   = 1e4; // Ceres' initial_trust_region_radius
+        double decrease = 2.0;
+        while (summary.iterations <= options.max_iterations) {
+            if ((p - Project(p - g.array())).abs().maxCoeff() <= options.gradient_tolerance) {
+                break;
+            }
+            Matrix A = m_JtJ;
+            A.diagonal() += m_JtJ.diagonal().cwiseMax(1e-6).cwiseMin(1e32) / radius;
+            Vector const       step  = A.ldlt().solve(-g);
+            VaryingArray const trial = Project(p + step.array());
+            Vector const       dp    = (trial - p).matrix();
+            if (dp.norm() <= (p.matrix().norm() + options.parameter_tolerance) *
+                                 options.parameter_tolerance) {
+                break;
+            }
+            summary.iterations++;
+            double const new_cost  = Cost(trial);
+            double const predicted = -(g.dot(dp) + 0.5 * dp.dot(m_JtJ * dp));
+            double const rho       = (cost - new_cost) / predicted;
+            if (std::isfinite(new_cost) && (predicted > 0) && (rho > 1e-3)) {
+                bool const converged = (cost - new_cost) <= options.function_tolerance * cost;
+                p                    = trial;
+                cost                 = Evaluate(p, m_JtJ, g);
+                radius = std::min(1e16, radius / std::max(1. / 3., 1. - std::pow(2 * rho - 1, 3)));
+                decrease = 2.0;
+                if (converged) {
+                    break;
+                }
+            } else {
+                radius /= decrease;
+                decrease *= 2;
+                if (radius < 1e-32) {
+                    break;
+                }
+            }
+        }
+        summary.cost   = cost;
+        summary.usable = std::isfinite(cost);
+        if (!summary.usable) {
+            summary.message = "Final cost was not finite";
+        }
+        return summary;
+    }
+
+    /*
+     *  J'J at the last accepted point, i.e. the inverse covariance up to the residual variance
+     */
+    Matrix const &JtJ() const { return m_JtJ; }
+
+  private:
+    ModelType const &  m_model;
+    FixedArray const & m_fixed;
+    DataArray const &  m_data;
+    VaryingArray const m_lo, m_hi;
+    Matrix             m_JtJ;
+
+    VaryingArray Project(VaryingArray const &p) const { return p.max(m_lo).min(m_hi); }
+
+    double Cost(VaryingArray const &p) const {
+        return 0.5 * (m_data - m_model.signal(p, m_fixed)).square().sum();
+    }
+
+    /*
+     *  Cost, J'J and gradient J'r, where r = signal - data
+     */
+    double Evaluate(VaryingArray const &p, Matrix &jtj, Vector &g) const {
+        if constexpr (HasJacobian<ModelType>::value) {
+            Eigen::ArrayXd const r = m_model.signal(p, m_fixed) - m_data;
+            Eigen::Matrix<double, Eigen::Dynamic, NV> const J = m_model.jacobian(p, m_fixed);
+            jtj.noalias() = J.transpose() * J;
+            g.noalias()   = J.transpose() * r.matrix();
+            return 0.5 * r.square().sum();
+        }
+        Eigen::Array<Jet, NV, 1> pj;
+        for (int i = 0; i < NV; i++) {
+            pj[i] = Jet(p[i], i);
+        }
+        auto const s    = m_model.signal(pj, m_fixed);
+        double     cost = 0;
+        jtj.setZero();
+        g.setZero();
+        for (Eigen::Index k = 0; k < m_data.rows(); k++) {
+            double const r = s[k].a - m_data[k];
+            jtj.noalias() += s[k].v * s[k].v.transpose();
+            g.noalias() += s[k].v * r;
+            cost += r * r;
+        }
+        return 0.5 * cost;
+    }
+};
+
+} // End namespace QI
@@ -10,22 +10,153 @@
  */
 
 #include "Lineshape.h"
+#include "Log.h"
 #include "Macro.h"
+#include "NumericalIntegration.h"
+
+#include <algorithm>
+#include <cmath>
 
 using namespace std::string_literals;
 
 namespace QI {
 
+namespace {
+/*
+ *  Catmull-Rom coefficients matching ceres::CubicInterpolator, including its clamping of the
+ *  neighbouring points at either end of the grid
+ */
+Eigen::Array4Xd CatmullRomCoeffs(Eigen::ArrayXd const &v) {
+    auto const      n = v.rows();
+    Eigen::Array4Xd c(4, n - 1);
+    for (Eigen::Index i = 0; i < n - 1; i++) {
+        double const p0 = v[std::max<Eigen::Index>(i - 1, 0)];
+        double const p1 = v[i];
+        double const p2 = v[i + 1];
+        double const p3 = v[std::min<Eigen::Index>(i + 2, n - 1)];
+        c(0, i)         = p1;
+        c(1, i)         = 0.5 * (p2 - p0);
+        c(2, i)         = p0 - 2.5 * p1 + 2.0 * p2 - 0.5 * p3;
+        c(3, i)         = 0.5 * (-p0 + 3.0 * p1 - 3.0 * p2 + p3);
+    }
+    return c;
+}
+} // namespace
+
 InterpLineshape::InterpLineshape(const double          fmin,
                                  const double          fstep,
                                  const int             fcount,
                                  const Eigen::ArrayXd &vals,
                                  const double          T2) :
+    InterpLineshape(fmin, fstep, fcount, vals, CatmullRomCoeffs(vals), T2) {}
+
+InterpLineshape::InterpLineshape(const double           fmin,
+                                 const double           fstep,
+                                 const int              fcount,
+                                 const Eigen::ArrayXd & vals,
+                                 const Eigen::Array4Xd &cs,
+                                 const double           T2) :
     T2_nominal{T2},
-    freq_min{fmin}, freq_step{fstep}, freq_count{fcount}, values{vals} {
+    freq_min{fmin}, freq_step{fstep}, freq_count{fcount}, values{vals}, coeffs{cs} {
+    if (freq_count < 2 || values.rows() != freq_count) {
+        QI::Fail("Lineshape needs at least 2 values and freq_count ({}) to match the number of "
+                 "values ({})",
+                 freq_count,
+                 values.rows());
+    }
+    if (coeffs.cols() != freq_count - 1) {
+        QI::Fail("Lineshape had {} interpolation intervals, expected {}",
+                 coeffs.cols(),
+                 freq_count - 1);
+    }
+}
 
-    grid         = std::make_shared<ceres::Grid1D<double>>(&values[0], 0, values.rows());
-    interpolator = std::make_shared<ceres::CubicInterpolator<ceres::Grid1D<double>>>(*grid);
+/*
+ *  Outside the grid the end values are held constant, so only the T2 scale contributes to the
+ *  derivative there
+ */
+void InterpLineshape::evaluate(const Eigen::ArrayXd &f,
+                               const double          T2,
+                               Eigen::ArrayXd &      vals,
+                               Eigen::ArrayXd *      dvals_dT2) const {
+    auto const           n     = f.rows();
+    double const         scale = T2 / T2_nominal;
+    Eigen::ArrayXd const af    = f.abs();
+    Eigen::ArrayXd const sf    = (af * scale - freq_min) / freq_step;
+    Eigen::ArrayXd const csf   = sf.max(0.0).min(freq_count - 1.0);
+    Eigen::ArrayXd       s(n), c0(n), c1(n), c2(n), c3(n);
+    for (Eigen::Index i = 0; i < n; i++) {
+        int const seg = std::min(static_cast<int>(csf[i]), freq_count - 2);
+        s[i]          = csf[i] - seg;
+        c0[i]         = coeffs(0, seg);
+        c1[i]         = coeffs(1, seg);
+        c2[i]         = coeffs(2, seg);
+        c3[i]         = coeffs(3, seg);
+    }
+    vals = ((c3 * s + c2) * s + c1) * s + c0;
+    if (dvals_dT2) {
+        Eigen::ArrayXd const inside = (sf == csf).cast<double>();
+        Eigen::ArrayXd const dsf    = (3.0 * c3 * s + 2.0 * c2) * s + c1;
+        *dvals_dT2 = (vals + inside * dsf * scale * af / freq_step) / T2_nominal;
+    }
+    vals *= scale;
+}
+
+double InterpLineshape::evaluate(const double f,
+                                 const double T2,
+                                 double *     dval_dT2,
+                                 double *     dval_df) const {
+    double const scale = T2 / T2_nominal;
+    double const af    = std::abs(f);
+    double const sf    = (af * scale - freq_min) / freq_step;
+    double const csf   = std::clamp(sf, 0.0, freq_count - 1.0);
+    int const    seg   = std::min(static_cast<int>(csf), freq_count - 2);
+    double const s     = csf - seg;
+    auto const   c     = coeffs.col(seg);
+    double const val   = ((c[3] * s + c[2]) * s + c[1]) * s + c[0];
+    double const dsf   = (sf == csf) ? (3.0 * c[3] * s + 2.0 * c[2]) * s + c[1] : 0.0;
+    if (dval_dT2) {
+        *dval_dT2 = (val + dsf * scale * af / freq_step) / T2_nominal;
+    }
+    if (dval_df) {
+        double const sign = (f > 0.) - (f < 0.);
+        *dval_df          = dsf * scale * scale * sign / freq_step;
+    }
+    return val * scale;
+}
+
+SuperLorentzianTable const &SuperLorentzianTable::Get() {
+    static SuperLorentzianTable const table; // Thread-safe initialisation
+    return table;
+}
+
+/*
+ *  G(x) is the super-Lorentzian integral with T2b = 1. The integrand is sharply peaked at the
+ *  magic angle for small x, so integrate either side of it separately.
+ */
+SuperLorentzianTable::SuperLorentzianTable() :
+    m_t_min{std::log(x_min)}, m_t_step{(std::log(x_max) - std::log(x_min)) / (nodes - 1)},
+    m_G(nodes), m_dG(nodes) {
+    Eigen::Integrator<double> integrator(200);
+    auto const                quad_rule = Eigen::Integrator<double>::GaussKronrod61;
+    double const              abs_error = 0.0;
+    double const              rel_error = Eigen::NumTraits<double>::epsilon() * 50.0;
+    double const              u_magic   = 1. / std::sqrt(3.);
+    auto const                integrate = [&](auto const &f) {
+        return integrator.quadratureAdaptive(f, 0., u_magic, abs_error, rel_error, quad_rule) +
+               integrator.quadratureAdaptive(f, u_magic, 1., abs_error, rel_error, quad_rule);
+    };
+    double const T2b = 1.0;
+    for (int i = 0; i < nodes; i++) {
+        double const      x = std::exp(m_t_min + i * m_t_step);
+        SLFunctor<double> sl{T2b, x};
+        auto const        dsl = [&](double const u) {
+            double const w = 1. / std::abs(3. * u * u - 1.);
+            return -16. * M_PI * M_PI * x * x * w * w * sl(u);
+        };
+        m_G[i]  = integrate(sl);
+        m_dG[i] = integrate(dsl) * m_t_step;
+    }
 }
 
 } // End namespace QI
@@ -39,16 +170,28 @@ QI::InterpLineshape adl_serializer<QI::InterpLineshape>::from_json(const json &j
     auto fstep  = j.at("freq_step").get<double>();
     auto fcount = j.at("freq_count").get<int>();
     auto vals   = QI::ArrayFromJSON<double>(j, "values");
+    if (j.contains("coefficients")) { // Written by newer versions of qi lineshape
+        auto const nc = 4 * (fcount - 1);
+        auto const cs = QI::ArrayFromJSON<double>(j, "coefficients", 1.0, nc);
+        return QI::InterpLineshape(fmin,
+                                   fstep,
+                                   fcount,
+                                   vals,
+                                   Eigen::Map<const Eigen::Array4Xd>(cs.data(), 4, fcount - 1),
+                                   T2nom);
+    }
 
     return QI::InterpLineshape(fmin, fstep, fcount, vals, T2nom);
 }
 
 void adl_serializer<QI::InterpLineshape>::to_json(json &j, QI::InterpLineshape l) {
+    Eigen::ArrayXd const coeffs = Eigen::Map<Eigen::ArrayXd>(l.coeffs.data(), l.coeffs.size());
     j = json{{"T2_nominal", l.T2_nominal},
              {"freq_min", l.freq_min},
              {"freq_step", l.freq_step},
              {"freq_count", l.freq_count},
-             {"values", l.values}};
+             {"values", l.values},
+             {"coefficients", coeffs}};
 }
 
 } // namespace nlohmann
@@ -14,12 +14,13 @@
 
 #include "JSON.h"
 #include "Macro.h"
-#include "NumericalIntegration.h"
-#include "ceres/cubic_interpolation.h"
+#include "ceres/jet.h"
 #include <Eigen/Core>
+#include <algorithm>
 #include <functional>
 #include <memory>
 #include <string>
+#include <type_traits>
 
 namespace QI {
 
@@ -42,67 +43,125 @@ template <typename T> struct SLFunctor {
     }
 };
 
+inline double JetValue(double const x) {
+    return x;
+}
+
+template <typename T, int N> double JetValue(ceres::Jet<T, N> const &x) {
+    return x.a;
+}
+
+/*
+ *  The super-Lorentzian scales with T2b, i.e. SL(f, T2b) = T2b * G(|f| * T2b), so a single table
+ *  of G serves every voxel. It is built once on first use, on a uniform grid of log(|f| * T2b),
+ *  and interpolated with cubic Hermite splines through the integrated values and derivatives, so
+ *  the derivatives of the interpolant (e.g. through Jets) are continuous.
+ */
+class SuperLorentzianTable {
+  public:
+    static SuperLorentzianTable const &Get();
+
+    template <typename T> T operator()(T const &x) const {
+        if (JetValue(x) >= x_max) {
+            return T(0.0); // Below double precision
+        } else if (JetValue(x) <= x_min) {
+            return T(m_G[0]); // G diverges logarithmically at 0
+        }
+        T const   t  = (log(x) - m_t_min) / m_t_step;
+        int const i  = std::min(static_cast<int>(JetValue(t)), nodes - 2);
+        T const   s  = t - static_cast<double>(i);
+        T const   s2 = s * s;
+        T const   s3 = s2 * s;
+        return (2. * s3 - 3. * s2 + 1.) * m_G[i] + (s3 - 2. * s2 + s) * m_dG[i] +
+               (3. * s2 - 2. * s3) * m_G[i + 1] + (s3 - s2) * m_dG[i + 1];
+    }
+
+  private:
+    SuperLorentzianTable();
+
+    static constexpr double x_min = 1.e-8, x_max = 4.0;
+    static constexpr int    nodes = 2048;
+    double                  m_t_min, m_t_step;
+    Eigen::ArrayXd          m_G, m_dG; // m_dG is dG/dlog(x) times the step
+};
+
 template <typename T> QI_ARRAY(T) SuperLorentzian(const Eigen::ArrayXd &df0, const T T2b) {
-    Eigen::Integrator<T> integrator(200);
-    const auto           quad_rule = Eigen::Integrator<T>::GaussKronrod61;
-    T                    abs_error{0.0};
-    T                    rel_error{Eigen::NumTraits<double>::epsilon() * 50.0};
+    auto const &table = SuperLorentzianTable::Get();
     QI_ARRAY(T) vals(df0.rows());
     for (auto i = 0; i < df0.rows(); i++) {
-        SLFunctor<T> sl_functor{T2b, df0[i]};
-        vals[i] = integrator.quadratureAdaptive(
-            sl_functor, T{0.0}, T{1.0}, abs_error, rel_error, quad_rule);
+        vals[i] = T2b * table(std::abs(df0[i]) * T2b);
     }
     return vals;
 }
 
+/*
+ *  Lineshape values on a uniform frequency grid, interpolated with the same Catmull-Rom splines as
+ *  ceres::CubicInterpolator. The cubic coefficients of each grid interval are stored (and saved
+ *  to JSON by qi lineshape) so evaluating a whole frequency array is a gather followed by a
+ *  vectorised Horner step. Only T2 can be a Jet, so derivatives are chained through by hand.
+ */
 struct InterpLineshape {
-    double                                                           T2_nominal = 1e-6;
-    double                                                           freq_min, freq_step;
-    int                                                              freq_count;
-    Eigen::ArrayXd                                                   values;
-    std::shared_ptr<ceres::Grid1D<double>>                           grid;
-    std::shared_ptr<ceres::CubicInterpolator<ceres::Grid1D<double>>> interpolator;
+    double          T2_nominal = 1e-6;
+    double          freq_min, freq_step;
+    int             freq_count;
+    Eigen::ArrayXd  values;
+    Eigen::Array4Xd coeffs; // Constant term first, one column per grid interval
 
     InterpLineshape(const double          freq_min,
                     const double          freq_step,
                     const int             freq_count,
                     const Eigen::ArrayXd &vals,
                     const double          T2b);
+    InterpLineshape(const double           freq_min,
+                    const double           freq_step,
+                    const int              freq_count,
+                    const Eigen::ArrayXd & vals,
+                    const Eigen::Array4Xd &coeffs,
+                    const double           T2b);
     InterpLineshape(double const T2b, Eigen::ArrayXd &freqs, Eigen::ArrayXd &vals);
 
+    void   evaluate(const Eigen::ArrayXd &f,
+                    const double          T2,
+                    Eigen::ArrayXd &      vals,
+                    Eigen::ArrayXd *      dvals_dT2) const;
+    double evaluate(const double f,
+                    const double T2,
+                    double *     dval_dT2,
+                    double *     dval_df = nullptr) const;
+
     template <typename T> QI_ARRAY(T) operator()(const Eigen::ArrayXd &f, const T T2) const {
-        const auto scale = T2 / T2_nominal;
-        const auto sf    = (f.abs() * scale - freq_min) / freq_step;
-        QI_ARRAY(T) interp_vals(f.rows());
-        for (auto i = 0; i < f.rows(); i++) {
-            if (sf[i] < 0.0) {
-                interp_vals[i] = values[0] * scale;
-            } else if (sf[i] > (freq_count - 1.0)) {
-                interp_vals[i] = values[freq_count - 1] * scale;
-            } else {
-                interpolator->Evaluate(sf[i], &interp_vals[i]);
-                interp_vals[i] *= scale;
+        Eigen::ArrayXd vals;
+        if constexpr (std::is_floating_point<T>::value) {
+            evaluate(f, T2, vals, nullptr);
+            return vals;
+        } else {
+            Eigen::ArrayXd dvals;
+            evaluate(f, T2.a, vals, &dvals);
+            QI_ARRAY(T) interp_vals(f.rows());
+            for (auto i = 0; i < f.rows(); i++) {
+                interp_vals[i] = T(vals[i], dvals[i] * T2.v);
             }
+            return interp_vals;
         }
-        return interp_vals;
     }
 
     template <typename T> T operator()(double const &f, const T T2) const {
-        const auto scale = T2 / T2_nominal;
-        const auto sf    = (std::abs(f) * scale - freq_min) / freq_step;
-
-        if (sf < 0.0) {
-            return values[0] * scale;
-        } else if (sf > (freq_count - 1.0)) {
-            return values[freq_count - 1] * scale;
+        if constexpr (std::is_floating_point<T>::value) {
+            return evaluate(f, T2, nullptr);
         } else {
-            T val;
-            interpolator->Evaluate(sf, &val);
-            val *= scale;
-            return val;
+            double       dval;
+            double const val = evaluate(f, T2.a, &dval);
+            return T(val, dval * T2.v);
         }
     }
+
+    // For models where the frequency offset is also fitted
+    template <typename T, int N>
+    ceres::Jet<T, N> operator()(ceres::Jet<T, N> const &f, ceres::Jet<T, N> const &T2) const {
+        double       dval_dT2, dval_df;
+        double const val = evaluate(f.a, T2.a, &dval_dT2, &dval_df);
+        return ceres::Jet<T, N>(val, dval_dT2 * T2.v + dval_df * f.v);
+    }
 };
 
 } // End namespace QI
@@ -0,0 +1,74 @@
+/*
+ *  MatrixExp.h
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/LU>
+#include <cmath>
+
+namespace QI {
+
+/*
+ *  Matrix exponentials for the small systems in the signal models. Both only need arithmetic,
+ *  comparisons and scalar functions, so work with Ceres Jets as well as doubles.
+ */
+
+/*
+ *  exp(M) for a 2x2 matrix, from the Cayley-Hamilton theorem. Near repeated eigenvalues sqrt(q2)
+ *  loses precision and its derivative is singular, so use the series for cosh(q) and sinh(q)/q.
+ */
+template <typename T> Eigen::Matrix<T, 2, 2> Expm2(Eigen::Matrix<T, 2, 2> const &M) {
+    T const s  = M.trace() / 2.;
+    T const q2 = s * s - M.determinant();
+    T       ch, sh; // cosh(q) and sinh(q)/q, or cos and sin for complex eigenvalues
+    if (q2 < 1.e-12 && q2 > -1.e-12) {
+        ch = 1. + q2 / 2.;
+        sh = 1. + q2 / 6.;
+    } else if (q2 > 0.) {
+        T const q = sqrt(q2);
+        ch        = cosh(q);
+        sh        = sinh(q) / q;
+    } else {
+        T const q = sqrt(-q2);
+        ch        = cos(q);
+        sh        = sin(q) / q;
+    }
+    Eigen::Matrix<T, 2, 2> const I = Eigen::Matrix<T, 2, 2>::Identity();
+    return exp(s) * (ch * I + sh * (M - s * I));
+}
+
+/*
+ *  exp(M) for a general (small) matrix by scaling and squaring a Taylor series. Unlike the
+ *  MatrixFunctions version this does not need complex arithmetic.
+ */
+template <typename Matrix> Matrix Expm(Matrix const &M) {
+    using T          = typename Matrix::Scalar;
+    int const  order = 12; // Truncation error ~ (1/4)^13 / 13! < 1e-17
+    auto const norm  = M.cwiseAbs().rowwise().sum().maxCoeff();
+    int        squarings = 0;
+    double     scale     = 1.;
+    while (norm * scale > 0.25) {
+        scale /= 2.;
+        squarings++;
+    }
+    Matrix const A = M * T(scale);
+    Matrix       E = Matrix::Identity() + A / T(order);
+    for (int k = order - 1; k > 0; k--) {
+        E = Matrix::Identity() + (A * E) / T(k);
+    }
+    for (int i = 0; i < squarings; i++) {
+        E = E * E;
+    }
+    return E;
+}
+
+} // namespace QI
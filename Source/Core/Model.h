@@ -13,9 +13,14 @@
 
 #include "ImageTypes.h"
 #include "Macro.h"
+#include "Random.h"
 #include "ceres/ceres.h"
+#include <Eigen/Cholesky>
+#include <Eigen/LU>
 #include <array>
+#include <limits>
 #include <string>
+#include <type_traits>
 
 namespace QI {
 
@@ -37,6 +42,7 @@ template <typename DT_, typename PT_, int NV_, int NF_, int NI_ = 1, int ND_ = 0
     using FixedArray   = QI_ARRAYN(ParameterType, NF);
     using CovarArray   = QI_ARRAYN(ParameterType, NCov);
     using DerivedArray = QI_ARRAYN(ParameterType, ND);
+    using JacobianArray = Eigen::Array<ParameterType, Eigen::Dynamic, NV>; // Row per volume
 
     using VaryingNames = std::array<std::string const, NV>;
     using FixedNames   = std::array<std::string const, NF>;
@@ -45,26 +51,66 @@ template <typename DT_, typename PT_, int NV_, int NF_, int NI_ = 1, int ND_ = 0
     template <typename Derived>
     auto signal(const Eigen::ArrayBase<Derived> &varying, const FixedArray &fixed) const
         -> QI_ARRAY(typename Derived::Scalar);
+
+    /*
+     *  Optional. If a model provides d(signal)/d(varying) in closed form, then the fitting code will
+     *  use it instead of auto-differentiating signal().
+     */
+    // JacobianArray jacobian(VaryingArray const &varying, FixedArray const &fixed) const;
+
+    /*
+     *  Optional. Versions of signal() and jacobian() that write into storage sized by the caller
+     *  and do not allocate. The cost functions evaluate straight into the Ceres residual and
+     *  Jacobian buffers through these when they are available.
+     */
+    // template <typename Derived, typename Out>
+    // void signal(Eigen::ArrayBase<Derived> const &varying, FixedArray const &fixed,
+    //             Eigen::ArrayBase<Out> &out) const;
+    // template <typename Out>
+    // void jacobian(VaryingArray const &varying, FixedArray const &fixed,
+    //               Eigen::DenseBase<Out> &J) const;
 };
 
 /*
- *  Convert the Covariance Matrix from Ceres into something useful
+ *  True if Model supplies an analytic jacobian()
+ */
+template <typename Model, typename = void> struct HasJacobian : std::false_type {};
+template <typename Model>
+struct HasJacobian<Model,
+                   std::void_t<decltype(std::declval<Model const &>().jacobian(
+                       std::declval<typename Model::VaryingArray const &>(),
+                       std::declval<typename Model::FixedArray const &>()))>> : std::true_type {};
+
+/*
+ *  True if Model can write its signal and (if it has one) its jacobian into existing storage
+ */
+template <typename Model, typename = void> struct HasSignalInto : std::false_type {};
+template <typename Model>
+struct HasSignalInto<Model,
+                     std::void_t<decltype(std::declval<Model const &>().signal(
+                         std::declval<typename Model::VaryingArray const &>(),
+                         std::declval<typename Model::FixedArray const &>(),
+                         std::declval<QI_ARRAY(typename Model::DataType) &>()))>>
+    : std::true_type {};
+
+template <typename Model, typename = void> struct HasJacobianInto : std::false_type {};
+template <typename Model>
+struct HasJacobianInto<Model,
+                       std::void_t<decltype(std::declval<Model const &>().jacobian(
+                           std::declval<typename Model::VaryingArray const &>(),
+                           std::declval<typename Model::FixedArray const &>(),
+                           std::declval<typename Model::JacobianArray &>()))>> : std::true_type {};
+
+/*
+ *  Convert a full covariance matrix into something useful
  * The diagonal elements are the estimation variance of each parameter (after division by the
  * residual). Square-root to get the standard deviation. Off-diagonal elements need to be divided by
  * the standard deviation of each variable to get the correlation.
  */
 template <typename Model>
-void GetModelCovariance(ceres::Problem &                    p,
-                        typename Model::VaryingArray const &v,
-                        double const &                      scale,
-                        typename Model::CovarArray *        ptr) {
-    ceres::Covariance::Options cov_options;
-    ceres::Covariance          cov_c(cov_options);
-    cov_c.Compute({std::make_pair(v.data(), v.data())}, &p);
-
-    Eigen::MatrixXd full(Model::NV, Model::NV);
-    cov_c.GetCovarianceBlock(v.data(), v.data(), full.data());
-    full *= scale;
+void CovarianceToArray(Eigen::MatrixXd const &             full,
+                       typename Model::VaryingArray const &v,
+                       typename Model::CovarArray *        ptr) {
     typename Model::CovarArray &cov = (*ptr);
     cov.head(Model::NV)             = full.diagonal().array().sqrt();
     int index                       = Model::NV;
@@ -79,9 +125,63 @@ void GetModelCovariance(ceres::Problem &                    p,
 }
 
 /*
- *  A generic Ceres Cost Function compatible with auto-differentation
+ *  Covariance from J'J at the solution, e.g. from QI::LevenbergMarquardt. If J'J is not positive
+ *  definite, or the ratio of its smallest to largest pivot is below the reciprocal condition number
+ *  that ceres::Covariance accepts, it cannot be inverted. The covariance is then set to NaN and
+ *  false is returned.
+ */
+template <typename Model>
+bool GetModelCovariance(Eigen::Matrix<double, Model::NV, Model::NV> const &JtJ,
+                        typename Model::VaryingArray const &               v,
+                        double const &                                     scale,
+                        typename Model::CovarArray *                       ptr) {
+    using Matrix = Eigen::Matrix<double, Model::NV, Model::NV>;
+    Eigen::LDLT<Matrix> const ldlt(JtJ);
+    auto const                d = ldlt.vectorD();
+    if (!JtJ.allFinite() || (ldlt.info() != Eigen::Success) || !(d.minCoeff() > 0) ||
+        !(d.minCoeff() > 1e-14 * d.maxCoeff())) {
+        ptr->setConstant(std::numeric_limits<double>::quiet_NaN());
+        return false;
+    }
+    Eigen::MatrixXd const full = ldlt.solve(Matrix::Identity()) * scale;
+    CovarianceToArray<Model>(full, v, ptr);
+    return true;
+}
+
+/*
+ *  Covariance of the parameter block v at the Ceres solution. A ceres::Covariance object runs a
+ *  sparse factorization that is far too heavy for a single NVxNV block, so instead evaluate the
+ *  Jacobian once at the solution (including any loss function) and form J'J directly. Returns
+ *  false, with a NaN covariance, if that cannot be inverted.
+ */
+template <typename Model>
+bool GetModelCovariance(ceres::Problem &                    p,
+                        typename Model::VaryingArray const &v,
+                        double const &                      scale,
+                        typename Model::CovarArray *        ptr) {
+    ceres::Problem::EvaluateOptions options;
+    options.parameter_blocks = {const_cast<double *>(v.data())};
+    ceres::CRSMatrix J;
+    p.Evaluate(options, nullptr, nullptr, nullptr, &J);
+
+    using Matrix = Eigen::Matrix<double, Model::NV, Model::NV>;
+    Matrix JtJ   = Matrix::Zero();
+    for (int r = 0; r < J.num_rows; r++) {
+        for (int ii = J.rows[r]; ii < J.rows[r + 1]; ii++) {
+            for (int jj = J.rows[r]; jj < J.rows[r + 1]; jj++) {
+                JtJ(J.cols[ii], J.cols[jj]) += J.values[ii] * J.values[jj];
+            }
+        }
+    }
+    return GetModelCovariance<Model>(JtJ, v, scale, ptr);
+}
+
+/*
+ *  A generic Ceres Cost Function compatible with auto-differentation. N is the number of residuals
+ *  if it is known at compile time. If the model can write its signal into existing storage then
+ *  it goes straight into the residuals, so that evaluating the cost does not allocate.
  */
-template <typename Model> struct ModelCost {
+template <typename Model, int N = ceres::DYNAMIC> struct ModelCost {
     using VaryingArray = typename Model::VaryingArray;
     using FixedArray   = typename Model::FixedArray;
     using DataArray    = QI_ARRAY(typename Model::DataType);
@@ -91,19 +191,119 @@ template <typename Model> struct ModelCost {
 
     template <typename T> bool operator()(const T *const vin, T *rin) const {
         Eigen::Map<QI_ARRAYN(T, Model::NV) const> const v(vin);
-
-        auto const signal = model.signal(v, fixed);
-
-        Eigen::Map<QI_ARRAY(T)> residual(rin, data.rows());
-        residual = data - signal;
+        Eigen::Map<Eigen::Array<T, N == ceres::DYNAMIC ? Eigen::Dynamic : N, 1>> residual(
+            rin, data.rows());
+        if constexpr (HasSignalInto<Model>::value) {
+            model.signal(v, fixed, residual);
+            residual = data - residual;
+        } else {
+            residual = data - model.signal(v, fixed);
+        }
         QI_DBVEC(data);
-        QI_DBVEC(signal);
         QI_DBVEC(residual);
 
         return true;
     }
 };
 
+/*
+ *  Wrap cost in an AutoDiffCostFunction with n residuals. Ceres keeps the residuals and Jacobians on
+ *  the stack if it knows their number at compile time, so common sequence lengths are dispatched
+ *  to fixed-size instantiations, and only longer sequences fall back to DYNAMIC.
+ */
+constexpr int MaxFixedResiduals = 32;
+template <typename Cost, int NV, int N = 2>
+ceres::CostFunction *MakeAutoDiffCost(Cost *cost, int const n) {
+    if constexpr (N > MaxFixedResiduals) {
+        return new ceres::AutoDiffCostFunction<Cost, ceres::DYNAMIC, NV>(cost, n);
+    } else {
+        if (n == N) {
+            return new ceres::AutoDiffCostFunction<Cost, N, NV>(cost);
+        }
+        return MakeAutoDiffCost<Cost, NV, N + 1>(cost, n);
+    }
+}
+
+/*
+ *  The same dispatch for ModelCost, which also sizes its residual array at compile time
+ */
+template <typename Model, int N = 2>
+ceres::CostFunction *MakeModelAutoDiffCost(Model const &                             model,
+                                           typename Model::FixedArray const &        fixed,
+                                           QI_ARRAY(typename Model::DataType) const &data) {
+    if constexpr (N > MaxFixedResiduals) {
+        using Cost = ModelCost<Model>;
+        return new ceres::AutoDiffCostFunction<Cost, ceres::DYNAMIC, Model::NV>(
+            new Cost{model, fixed, data}, data.rows());
+    } else {
+        if (data.rows() == N) {
+            using Cost = ModelCost<Model, N>;
+            return new ceres::AutoDiffCostFunction<Cost, N, Model::NV>(
+                new Cost{model, fixed, data});
+        }
+        return MakeModelAutoDiffCost<Model, N + 1>(model, fixed, data);
+    }
+}
+
+/*
+ *  Cost Function for models with an analytic Jacobian. Ceres expects the Jacobian of the residual
+ *  (data - signal) in row-major order. Models that can write into existing storage fill the Ceres
+ *  buffers directly, so evaluating the cost does not allocate.
+ */
+template <typename Model>
+struct ModelJacobianCost : ceres::SizedCostFunction<ceres::DYNAMIC, Model::NV> {
+    using VaryingArray = typename Model::VaryingArray;
+    using FixedArray   = typename Model::FixedArray;
+    using DataArray    = QI_ARRAY(typename Model::DataType);
+    using JacobianMap  = Eigen::Map<Eigen::Matrix<double,
+                                                 Eigen::Dynamic,
+                                                 Model::NV,
+                                                 Model::NV == 1 ? Eigen::ColMajor : Eigen::RowMajor>>;
+    const Model &    model;
+    const FixedArray fixed;
+    const DataArray  data;
+
+    ModelJacobianCost(Model const &m, FixedArray const &f, DataArray const &d) :
+        model(m), fixed(f), data(d) {
+        this->set_num_residuals(data.rows());
+    }
+
+    bool Evaluate(double const *const *p, double *r, double **J) const override {
+        VaryingArray const    v = Eigen::Map<VaryingArray const>(p[0]);
+        Eigen::Map<DataArray> residual(r, data.rows());
+        if constexpr (HasSignalInto<Model>::value) {
+            model.signal(v, fixed, residual);
+            residual = data - residual;
+        } else {
+            residual = data - model.signal(v, fixed);
+        }
+        if (J && J[0]) {
+            JacobianMap jacobian(J[0], data.rows(), Model::NV);
+            if constexpr (HasJacobianInto<Model>::value) {
+                model.jacobian(v, fixed, jacobian);
+                jacobian = -jacobian;
+            } else {
+                jacobian = -model.jacobian(v, fixed).matrix();
+            }
+        }
+        return true;
+    }
+};
+
+/*
+ *  The analytic cost if the model has a jacobian(), otherwise auto-differentiate ModelCost
+ */
+template <typename Model>
+ceres::CostFunction *MakeModelCost(Model const &                             model,
+                                   typename Model::FixedArray const &        fixed,
+                                   QI_ARRAY(typename Model::DataType) const &data) {
+    if constexpr (HasJacobian<Model>::value) {
+        return new ModelJacobianCost<Model>(model, fixed, data);
+    } else {
+        return MakeModelAutoDiffCost<Model>(model, fixed, data);
+    }
+}
+
 /*
  *  Helper struct for converting between double/float for processing & IO
  */
@@ -127,20 +327,20 @@ template <int ImageDimension, typename T> struct BlockTypes<false, ImageDimensio
 };
 
 /*
- *  Which noise type to choose
+ *  Which noise type to choose. The noise is drawn from rng, usually the voxel's own stream.
  */
 template <typename DataType> struct NoiseFromDataType;
 
 template <> struct NoiseFromDataType<double> {
-    static Eigen::ArrayXd add_noise(Eigen::ArrayXd const &s, double const sigma);
+    static Eigen::ArrayXd add_noise(Eigen::ArrayXd const &s, double const sigma, Philox &rng);
 };
 
 template <> struct NoiseFromDataType<std::complex<double>> {
-    static Eigen::ArrayXcd add_noise(Eigen::ArrayXcd const &s, double const sigma);
+    static Eigen::ArrayXcd add_noise(Eigen::ArrayXcd const &s, double const sigma, Philox &rng);
 };
 
 struct RealNoise {
-    static Eigen::ArrayXd add_noise(Eigen::ArrayXd const &s, double const sigma);
+    static Eigen::ArrayXd add_noise(Eigen::ArrayXd const &s, double const sigma, Philox &rng);
 };
 
 template <typename ModelType>
@@ -12,13 +12,21 @@
  */
 
 #include <Eigen/Core>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstring>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include "itkCommand.h"
 #include "itkImageRegionConstIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionIteratorWithIndex.h"
 #include "itkImageToImageFilter.h"
@@ -26,11 +34,16 @@
 #include "itkVariableLengthVector.h"
 #include "itkVectorImage.h"
 
+#include "Checkpoint.h"
 #include "FitFunction.h"
+#include "FitWorkspace.h"
+#include "JSON.h"
 #include "Log.h"
 #include "Model.h"
 #include "Monitor.h"
+#include "Scheduler.h"
 #include "Util.h"
+#include "WriteQueue.h"
 
 namespace QI {
 
@@ -53,6 +66,7 @@ class ModelFitFilter
     using CovarArray    = typename ModelType::CovarArray;
     using DataArray     = QI_ARRAY(DataType);
     using ResidualArray = QI_ARRAY(DataType);
+    using Workspace     = FitWorkspace<FitType>;
 
     using InputPixelType    = typename IOPrecision<DataType>::Type;
     using OutputPixelType   = typename IOPrecision<ParameterType>::Type;
@@ -74,6 +88,7 @@ class ModelFitFilter
 
     using TRegion = typename TInputImage::RegionType;
     using TIndex  = typename TRegion::IndexType;
+    using TOffset = typename TRegion::OffsetType;
 
     using Self       = ModelFitFilter;
     using Superclass = itk::ImageToImageFilter<TInputImage, TOutputImage>;
@@ -81,6 +96,7 @@ class ModelFitFilter
 
     static constexpr bool Indexed    = FitType::Indexed;
     static constexpr bool HasDerived = ModelType::ND > 0;
+    static constexpr bool Batched    = HasFitBatch<FitType>::value && !Indexed;
 
     QI_ForwardNewMacro(Self);
     itkTypeMacro(ModelFitFilter,
@@ -118,6 +134,7 @@ class ModelFitFilter
             m_subregion    = RegionFromString<TRegion>(subregion);
             m_hasSubregion = true;
         }
+        m_tileOffset.Fill(0);
         this->DynamicMultiThreadingOn();
     }
 
@@ -178,6 +195,60 @@ class ModelFitFilter
         m_hasSubregion = true;
     }
 
+    /*
+     *  If a mask is set, fit the in-mask voxels in dynamically scheduled chunks of this size
+     *  instead of splitting the bounding region into slabs. Set to 0 to disable.
+     */
+    void SetChunkSize(const int cs) { m_chunkSize = std::max(cs, 0); }
+
+    /*
+     *  Pass the result of the last successful fit of an adjacent voxel to fit() as a starting
+     *  point. Iterative fits use it instead of the model start (see QI::WarmStart), which usually
+     *  saves iterations as neighbouring voxels have similar parameters.
+     */
+    void SetWarmStart(const bool w) { m_warmStart = w; }
+
+    /*
+     *  Read, fit and write the image in slabs of slices that fit into this many megabytes instead
+     *  of all at once. Must be set before ReadInputs(), which then only reads the first slice.
+     *  The parameter maps are still kept for the whole image, as they are small next to the
+     *  inputs and residuals. Update() only checks the inputs, and the fitting happens slab by slab
+     *  inside WriteOutputs(), which writes each slab of residuals as it goes. 0 disables.
+     */
+    void SetStreaming(const int megabytes) {
+        if (m_inputsRead) {
+            QI::Fail("Streaming must be set before the inputs are read");
+        }
+        m_streamMB = std::max(megabytes, 0);
+    }
+
+    /*
+     *  Write the outputs on this many background threads (see QI::WriteQueue), or one after
+     *  another on the calling thread if 0. If overlap is set when streaming, each slab of residuals
+     *  is written while the next slab is fitted, at the cost of memory for one more slab.
+     */
+    void SetWriters(const int threads, const bool overlap) {
+        m_writers       = std::max(threads, 0);
+        m_overlapWrites = overlap;
+    }
+
+    /*
+     *  Write all the outputs as volumes of one 4D file instead of a file each (see PackOutputs())
+     */
+    void SetPackOutputs(const bool p) { m_pack = p; }
+
+    /*
+     *  Save finished voxels to a checkpoint in dir while fitting (see QI::Checkpoint). If resume is
+     *  set, restore the voxels already in the checkpoint and only fit the rest.
+     */
+    void SetCheckpoint(std::string const &dir, const bool resume) {
+        if (resume && dir.empty()) {
+            QI::Fail("Resuming requires a checkpoint directory");
+        }
+        m_checkpointDir = dir;
+        m_resume        = resume;
+    }
+
     void SetBlocks(const int &nb) {
         if constexpr (Blocked) {
             m_blocks = nb;
@@ -248,7 +319,19 @@ class ModelFitFilter
         if (static_cast<size_t>(ModelType::NI) != inputs.size()) {
             QI::Fail("Number of input file paths did not match number of inputs for model");
         }
-
+        m_inputsRead = true;
+
+        if (m_streamMB > 0) {
+            std::copy(inputs.begin(), inputs.end(), m_inputPaths.begin());
+            std::copy(fixed.begin(), fixed.end(), m_fixedPaths.begin());
+            m_maskPath = mask;
+            ReadSlab(0, 1);
+            return;
+        }
+        if (m_hasSubregion) {
+            ReadSubregion(inputs, fixed, mask);
+            return;
+        }
         for (int i = 0; i < ModelType::NI; i++) {
             SetInput(i, QI::ReadImage<TInputImage>(inputs[i], m_verbose));
         }
@@ -261,42 +344,23 @@ class ModelFitFilter
     }
 
     void WriteOutputs(std::string const &prefix) {
-        for (int i = 0; i < ModelType::NV; i++) {
-            QI::WriteImage(
-                GetOutput(i), prefix + m_fit->model.varying_names.at(i) + QI::OutExt(), m_verbose);
-        }
-        if constexpr (ModelType::ND > 0) {
-            for (int i = 0; i < ModelType::ND; i++) {
-                QI::WriteImage(GetDerivedOutput(i),
-                               prefix + m_fit->model.derived_names.at(i) + QI::OutExt(),
-                               m_verbose);
-            }
-        }
-        QI::WriteImage(GetRMSErrorOutput(), prefix + "rmse" + QI::OutExt(), m_verbose);
-        QI::WriteImage(GetFlagOutput(), prefix + "iterations" + QI::OutExt(), m_verbose);
-        if (m_covar) {
-            for (int ii = 0; ii < ModelType::NV; ii++) {
-                auto const &name = m_fit->model.varying_names.at(ii);
-                QI::WriteImage(
-                    GetCovarOutput(ii), prefix + "CoV_" + name + QI::OutExt(), m_verbose);
+        QI::WriteQueue writes(m_writers);
+        // Writes on the queue's threads throw rather than exit, so that Wait() can report them here
+        try {
+            if (m_streamMB > 0) {
+                StreamSlabs(prefix, writes);
             }
-            int index = ModelType::NV;
-            for (int ii = 0; ii < ModelType::NV; ii++) {
-                auto const &name1 = m_fit->model.varying_names.at(ii);
-                for (int jj = ii + 1; jj < ModelType::NV; jj++) {
-                    auto const &name2 = m_fit->model.varying_names.at(jj);
-                    QI::WriteImage(GetCovarOutput(index++),
-                                   prefix + "Corr_" + name1 + "_" + name2 + QI::OutExt(),
-                                   m_verbose);
-                }
-            }
-        }
-        if (m_allResiduals) {
-            for (int i = 0; i < ModelType::NI; i++) {
-                QI::WriteImage(GetResidualsOutput(i),
-                               prefix + "residuals_" + std::to_string(i) + QI::OutExt(),
-                               m_verbose);
+            auto const ext = QI::OutExt();
+            if (m_pack) {
+                PackOutputs(prefix, ext, writes);
+            } else {
+                ForEachOutput([&](auto *img, std::string const &name) {
+                    QueueWrite(writes, img, prefix + name + ext);
+                });
             }
+            writes.Wait();
+        } catch (std::exception &e) {
+            QI::Fail("Error writing outputs: {}", e.what());
         }
     }
 
@@ -333,7 +397,30 @@ class ModelFitFilter
     const bool     m_verbose, m_allResiduals, m_covar;
     bool           m_hasSubregion = false;
     TRegion        m_subregion;
-    int            m_blocks = 1;
+    TOffset        m_tileOffset; // Start of the tile in the whole image, see ReadSubregion()
+    int            m_blocks    = 1;
+    size_t         m_chunkSize = 64;
+    bool           m_warmStart = false;
+    std::string    m_checkpointDir;
+    bool           m_resume        = false;
+    int            m_streamMB      = 0;
+    bool           m_inputsRead    = false;
+    int            m_writers       = 4;
+    bool           m_overlapWrites = false;
+    bool           m_pack          = false;
+
+    std::array<std::string, ModelType::NI> m_inputPaths; // Only kept when streaming
+    std::array<std::string, ModelType::NF> m_fixedPaths;
+    std::string                            m_maskPath;
+
+    std::unique_ptr<QI::Checkpoint> m_checkpoint;
+
+    std::vector<itk::OffsetValueType> m_workList;
+    std::atomic<size_t> m_workUnits{0}, m_workspaceAllocations{0}, m_workspaceMoves{0};
+
+    std::mutex m_flagMutex; // Guards the flag summary below
+    size_t     m_fits    = 0;
+    double     m_flagSum = 0;
 
     virtual void GenerateOutputInformation() override {
         Superclass::GenerateOutputInformation();
@@ -346,6 +433,17 @@ class ModelFitFilter
                 QI::Fail("Input parameter images are not all the same size");
             }
         }
+        // Voxels are addressed by offset, so the fixed maps and mask must match too
+        for (int i = 0; i < ModelType::NF; i++) {
+            const auto f = this->GetFixed(i);
+            if (f && (ip->GetLargestPossibleRegion() != f->GetLargestPossibleRegion())) {
+                QI::Fail("Fixed parameter image {} is not the same size as the input", i);
+            }
+        }
+        const auto m = this->GetMask();
+        if (m && (ip->GetLargestPossibleRegion() != m->GetLargestPossibleRegion())) {
+            QI::Fail("Mask image is not the same size as the input");
+        }
 
         for (int i = 0; i < ModelType::NI; i++) {
             if ((m_fit->input_size(i) * m_blocks) !=
@@ -432,231 +530,735 @@ class ModelFitFilter
                 res->SetOrigin(origin);
                 res->SetDirection(direction);
                 res->SetNumberOfComponentsPerPixel(m_fit->input_size(i) * m_blocks);
-                res->Allocate(true);
+                if (m_streamMB == 0) { // Otherwise one slab at a time is allocated
+                    res->Allocate(true);
+                }
             }
         }
     }
 
-    virtual void GenerateData() override {
-        auto region = this->GetInput(0)->GetLargestPossibleRegion();
-        if (m_hasSubregion) {
-            if (region.IsInside(m_subregion)) {
-                region = m_subregion;
-            } else {
-                itkExceptionMacro("Specified subregion is not entirely inside image.");
+    /*
+     *  Raw pointers into the input and output buffers, gathered once per Update() so that voxels
+     *  can be processed in any order from just their offset. All images share the same region,
+     *  which is checked in GenerateOutputInformation(). When streaming, only the current slab of
+     *  the inputs and residuals is buffered, so the pointers into the whole-image parameter maps
+     *  are moved along by base to line up with it. Fixed maps and masks may be read slab by slab
+     *  or set for the whole image with SetFixed(), so they are lined up by their own buffers.
+     */
+    struct Buffers {
+        std::array<InputPixelType const *, ModelType::NI>    inputs;
+        std::array<FixedPixelType const *, ModelType::NF>    fixed;
+        typename TMaskImage::PixelType const *               mask;
+        std::array<OutputPixelType *, ModelType::NV>         outputs;
+        std::array<OutputPixelType *, ModelType::ND>         derived;
+        std::array<OutputPixelType *, ModelType::NCov>       covar;
+        std::array<InputPixelType *, ModelType::NI>          residuals;
+        RMSErrorPixelType *                                  rmse;
+        typename FitType::FlagType *                         flag;
+    } m_buffers;
+
+    void GatherBuffers(itk::OffsetValueType const base = 0) {
+        for (int i = 0; i < ModelType::NI; i++) {
+            m_buffers.inputs[i] = this->GetInput(i)->GetBufferPointer();
+            m_buffers.residuals[i] =
+                m_allResiduals ? this->GetResidualsOutput(i)->GetBufferPointer() : nullptr;
+        }
+        auto const slab = this->GetInput(0)->GetBufferedRegion();
+        for (int i = 0; i < ModelType::NF; i++) {
+            m_buffers.fixed[i] = SlabPointer(this->GetFixed(i).GetPointer(), slab, "Fixed map");
+        }
+        m_buffers.mask = SlabPointer(this->GetMask().GetPointer(), slab, "Mask");
+        for (int i = 0; i < ModelType::NV; i++) {
+            m_buffers.outputs[i] = this->GetOutput(i)->GetBufferPointer() + base * m_blocks;
+        }
+        if constexpr (HasDerived) {
+            for (int i = 0; i < ModelType::ND; i++) {
+                m_buffers.derived[i] =
+                    this->GetDerivedOutput(i)->GetBufferPointer() + base * m_blocks;
             }
         }
+        for (int i = 0; i < ModelType::NCov; i++) {
+            m_buffers.covar[i] =
+                m_covar ? this->GetCovarOutput(i)->GetBufferPointer() + base * m_blocks : nullptr;
+        }
+        m_buffers.rmse = this->GetRMSErrorOutput()->GetBufferPointer() + base * m_blocks;
+        m_buffers.flag = this->GetFlagOutput()->GetBufferPointer() + base * m_blocks;
+    }
 
-        Info(m_verbose, "Processing...");
-        this->GetMultiThreader()->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
-        this->GetMultiThreader()->template ParallelizeImageRegion<ImageDim>(
-            region,
-            [this](const typename TOutputImage::RegionType &outputRegion) {
-                this->DynamicThreadedGenerateData(outputRegion);
-            },
-            this);
-        Info(m_verbose, "Finished processing.");
+    /*
+     *  Pointer to the first voxel of slab in img, which may hold just the slab or more
+     */
+    template <typename TImage>
+    static typename TImage::PixelType const *
+    SlabPointer(TImage const *img, TRegion const &slab, char const *name) {
+        if (!img) {
+            return nullptr;
+        }
+        if (!img->GetBufferedRegion().IsInside(slab)) {
+            QI::Fail("{} does not cover the slab being fitted", name);
+        }
+        return img->GetBufferPointer() + img->ComputeOffset(slab.GetIndex());
     }
 
-    virtual void DynamicThreadedGenerateData(const TRegion &region) override {
-        itk::ImageRegionConstIterator<TMaskImage> mask_iter;
-        const auto                                mask = this->GetMask();
-        if (mask) {
-            mask_iter = itk::ImageRegionConstIterator<TMaskImage>(mask, region);
+    /*
+     *  Compact the region into a list of voxel offsets, so that threads only ever see voxels that
+     *  actually need fitting. Voxels outside the mask or restored from a checkpoint are left out.
+     */
+    void BuildWorkList(TRegion const &region) {
+        auto const input = this->GetInput(0);
+        m_workList.clear();
+        for (itk::ImageRegionConstIteratorWithIndex<TInputImage> it(input, region); !it.IsAtEnd();
+             ++it) {
+            auto const offset = input->ComputeOffset(it.GetIndex());
+            if ((!m_buffers.mask || m_buffers.mask[offset]) &&
+                !(m_checkpoint && m_checkpoint->Done(offset))) {
+                m_workList.push_back(offset);
+            }
         }
+    }
 
-        std::vector<itk::ImageRegionConstIterator<TInputImage>> input_iters(ModelType::NI);
-        std::vector<itk::ImageRegionIterator<TResidualsImage>>  residuals_iters(ModelType::NI);
-        for (int i = 0; i < ModelType::NI; i++) {
-            input_iters[i] = itk::ImageRegionConstIterator<TInputImage>(this->GetInput(i), region);
-            if (m_allResiduals) {
-                residuals_iters[i] =
-                    itk::ImageRegionIterator<TResidualsImage>(this->GetResidualsOutput(i), region);
+    /*
+     *  The output buffers that make up a voxel's checkpoint record, with their bytes per voxel
+     */
+    std::vector<std::pair<char *, size_t>> CheckpointFields() const {
+        std::vector<std::pair<char *, size_t>> fields;
+        auto add = [&](auto *buffer, size_t const per_voxel) {
+            fields.emplace_back(reinterpret_cast<char *>(buffer), per_voxel * sizeof(*buffer));
+        };
+        for (auto *o : m_buffers.outputs) {
+            add(o, m_blocks);
+        }
+        for (auto *d : m_buffers.derived) {
+            add(d, m_blocks);
+        }
+        add(m_buffers.flag, m_blocks);
+        add(m_buffers.rmse, m_blocks);
+        if (m_covar) {
+            for (auto *c : m_buffers.covar) {
+                add(c, m_blocks);
+            }
+        }
+        if (m_allResiduals) {
+            for (int i = 0; i < ModelType::NI; i++) {
+                add(m_buffers.residuals[i], m_fit->input_size(i) * m_blocks);
             }
         }
-        std::array<itk::ImageRegionConstIterator<TFixedImage>, ModelType::NF> fixed_iters;
+        return fields;
+    }
+
+    /*
+     *  Identifies the inputs of a checkpoint, so that resuming with a different image of the same
+     *  size fails instead of restoring the wrong voxels
+     */
+    uint64_t CheckpointKey() const {
+        auto const input  = this->GetInput(0);
+        auto const region = input->GetLargestPossibleRegion();
+        uint64_t   key    = QI::HashBytes(&region.GetIndex(), sizeof(region.GetIndex()));
+        key = QI::HashBytes(&region.GetSize(), sizeof(region.GetSize()), key);
+        key = QI::HashBytes(&input->GetSpacing(), sizeof(input->GetSpacing()), key);
+        key = QI::HashBytes(&input->GetOrigin(), sizeof(input->GetOrigin()), key);
+        key = QI::HashBytes(&input->GetDirection(), sizeof(input->GetDirection()), key);
+        size_t const voxels = region.GetNumberOfPixels();
+        for (int i = 0; i < ModelType::NI; i++) {
+            key = QI::HashBytes(m_buffers.inputs[i],
+                                voxels * m_fit->input_size(i) * m_blocks * sizeof(InputPixelType),
+                                key);
+        }
         for (int i = 0; i < ModelType::NF; i++) {
-            typename TFixedImage::ConstPointer c = this->GetFixed(i);
-            if (c) {
-                fixed_iters[i] = itk::ImageRegionConstIterator<TFixedImage>(c, region);
+            if (m_buffers.fixed[i]) {
+                key = QI::HashBytes(m_buffers.fixed[i], voxels * sizeof(FixedPixelType), key);
             }
         }
+        if (m_buffers.mask) {
+            key = QI::HashBytes(
+                m_buffers.mask, voxels * sizeof(typename TMaskImage::PixelType), key);
+        }
+        return key;
+    }
 
-        std::array<itk::ImageRegionIterator<TOutputImage>, ModelType::NV> output_iters;
-        for (int i = 0; i < ModelType::NV; i++) {
-            output_iters[i] = itk::ImageRegionIterator<TOutputImage>(this->GetOutput(i), region);
+    void StartCheckpoint() {
+        auto const fields      = CheckpointFields();
+        size_t     record_size = 0;
+        for (auto const &f : fields) {
+            record_size += f.second;
+        }
+        m_checkpoint = std::make_unique<QI::Checkpoint>(
+            m_checkpointDir,
+            this->GetInput(0)->GetLargestPossibleRegion().GetNumberOfPixels(),
+            record_size,
+            CheckpointKey(),
+            m_resume,
+            [fields](itk::OffsetValueType const offset, char *record) {
+                for (auto const &f : fields) {
+                    std::memcpy(record, f.first + offset * f.second, f.second);
+                    record += f.second;
+                }
+            });
+        if (m_resume) {
+            auto const n = m_checkpoint->Replay(
+                [&fields](itk::OffsetValueType const offset, char const *record) {
+                    for (auto const &f : fields) {
+                        std::memcpy(f.first + offset * f.second, record, f.second);
+                        record += f.second;
+                    }
+                });
+            Info(m_verbose, "Restored {} finished voxels from {}", n, m_checkpointDir);
         }
+    }
 
-        std::array<itk::ImageRegionIterator<TOutputImage>, ModelType::ND> derived_iters;
-        if constexpr (HasDerived) {
+    /*
+     *  Call f(image, name) for every output that WriteOutputs() writes, in order. Streamed
+     *  residuals are left out, as they have already been written slab by slab.
+     */
+    template <typename F> void ForEachOutput(F &&f) {
+        for (int i = 0; i < ModelType::NV; i++) {
+            f(GetOutput(i), m_fit->model.varying_names.at(i));
+        }
+        if constexpr (ModelType::ND > 0) {
             for (int i = 0; i < ModelType::ND; i++) {
-                derived_iters[i] =
-                    itk::ImageRegionIterator<TOutputImage>(this->GetDerivedOutput(i), region);
+                f(GetDerivedOutput(i), m_fit->model.derived_names.at(i));
             }
         }
-
-        std::array<itk::ImageRegionIterator<TOutputImage>, ModelType::NCov> covar_iters;
+        f(GetRMSErrorOutput(), std::string("rmse"));
+        f(GetFlagOutput(), std::string("iterations"));
         if (m_covar) {
-            for (int ii = 0; ii < ModelType::NCov; ii++) {
-                covar_iters[ii] =
-                    itk::ImageRegionIterator<TOutputImage>(this->GetCovarOutput(ii), region);
+            for (int ii = 0; ii < ModelType::NV; ii++) {
+                f(GetCovarOutput(ii), "CoV_" + m_fit->model.varying_names.at(ii));
+            }
+            int index = ModelType::NV;
+            for (int ii = 0; ii < ModelType::NV; ii++) {
+                auto const &name1 = m_fit->model.varying_names.at(ii);
+                for (int jj = ii + 1; jj < ModelType::NV; jj++) {
+                    auto const &name2 = m_fit->model.varying_names.at(jj);
+                    f(GetCovarOutput(index++), "Corr_" + name1 + "_" + name2);
+                }
+            }
+        }
+        if (m_allResiduals && (m_streamMB == 0)) {
+            for (int i = 0; i < ModelType::NI; i++) {
+                f(GetResidualsOutput(i), "residuals_" + std::to_string(i));
             }
         }
+    }
 
-        // Keep the index on this one to report voxel locations where algorithm fails.
-        itk::ImageRegionIteratorWithIndex<TRMSErrorImage> rmse_iter(this->GetRMSErrorOutput(),
-                                                                    region);
-        itk::ImageRegionIterator<TFlagImage>              flag_iter(this->GetFlagOutput(), region);
+    /*
+     *  Write the real-valued outputs as volumes of one 4D float file, prefix + "outputs" + ext,
+     *  instead of a file each. A run then makes two files, this and prefix + "outputs.json", which
+     *  lists the first volume and number of volumes of each output so they can be pulled out with
+     *  qi select. Block gzip still compresses the one file on every thread. Each output is
+     *  released once copied, so the packed image adds little to the peak memory, but the outputs
+     *  cannot be used afterwards. Complex outputs, i.e. residuals of complex data, are still
+     *  written to their own files.
+     */
+    void PackOutputs(std::string const &prefix, std::string const &ext, QI::WriteQueue &writes) {
+        json   index = json::array();
+        size_t total = 0;
+        ForEachOutput([&](auto *img, std::string const &name) {
+            using TImg = std::remove_pointer_t<decltype(img)>;
+            if constexpr (std::is_arithmetic<typename TImg::InternalPixelType>::value) {
+                size_t const n = img->GetNumberOfComponentsPerPixel();
+                index.push_back(json{{"name", name}, {"volume", total}, {"volumes", n}});
+                total += n;
+            } else {
+                QueueWrite(writes, img, prefix + name + ext);
+            }
+        });
+
+        auto const region = this->GetOutput(0)->GetLargestPossibleRegion();
+        auto       packed = QI::VectorVolumeF::New();
+        packed->CopyInformation(this->GetOutput(0));
+        packed->SetRegions(region);
+        packed->SetNumberOfComponentsPerPixel(total);
+        packed->Allocate();
+        size_t const voxels = region.GetNumberOfPixels();
+        float *const out    = packed->GetBufferPointer();
+        size_t       first  = 0;
+        ForEachOutput([&](auto *img, std::string const &) {
+            using TImg = std::remove_pointer_t<decltype(img)>;
+            if constexpr (std::is_arithmetic<typename TImg::InternalPixelType>::value) {
+                size_t const n  = img->GetNumberOfComponentsPerPixel();
+                auto const * in = img->GetBufferPointer();
+                QI::Scheduler::Get().ParallelFor(
+                    voxels, 4096, [&](QI::Scheduler::Chunks &chunks) {
+                        size_t begin, end;
+                        while (chunks.next(begin, end)) {
+                            for (size_t v = begin; v < end; v++) {
+                                for (size_t c = 0; c < n; c++) {
+                                    out[v * total + first + c] = static_cast<float>(in[v * n + c]);
+                                }
+                            }
+                        }
+                    });
+                first += n;
+                img->ReleaseData();
+            }
+        });
 
-        VaryingArray outputs;
-        FixedArray   fixed;
-        CovarArray * covar = m_covar ? new CovarArray : nullptr;
+        std::string const path = prefix + "outputs" + ext;
+        QueueWrite(writes, packed.GetPointer(), path);
+        json const doc{{"file", path.substr(path.find_last_of('/') + 1)}, {"outputs", index}};
+        QI::WriteJSON(prefix + "outputs.json", doc);
+    }
 
-        while (!input_iters[0].IsAtEnd()) {
-            if (!mask || mask_iter.Get()) {
-                for (int b = 0; b < m_blocks; b++) {
-                    std::vector<DataArray> inputs(ModelType::NI);
-                    for (int i = 0; i < ModelType::NI; i++) {
-                        auto input_data       = input_iters[i].Get();
-                        inputs[i]             = DataArray(m_fit->input_size(i));
-                        const int block_start = b * m_fit->input_size(i);
-                        for (Eigen::Index j = 0; j < m_fit->input_size(i); j++) {
-                            inputs[i][j] = input_data[j + block_start];
-                        }
-                    }
+    /*
+     *  Queue a write of img. The writer gets its own image sharing img's buffer, so that it never
+     *  touches this filter's pipeline from another thread.
+     */
+    template <typename TImg>
+    void QueueWrite(QI::WriteQueue &writes, TImg *img, std::string const &path) const {
+        typename TImg::Pointer copy = TImg::New();
+        copy->Graft(img);
+        writes.Push([copy, path, verbose = m_verbose] {
+            QI::WriteImage(copy.GetPointer(), path, verbose);
+        });
+    }
 
-                    outputs = VaryingArray::Zero();
-                    if constexpr (ModelType::NF > 0) {
-                        fixed = m_fit->model.fixed_defaults;
-                        for (size_t i = 0; i < fixed_iters.size(); i++) {
-                            if (this->GetFixed(i)) {
-                                fixed[i] = fixed_iters[i].Get();
-                            }
-                        }
-                    }
-                    if (m_covar) {
-                        *covar = CovarArray::Zero();
-                    }
+    /*
+     *  Read only the subregion of every file. The images are cropped to it, so the outputs are
+     *  only allocated and written for the subregion, with the origin moved to match. Tiles of an
+     *  image fitted by separate jobs can then be put back together with qi merge_tiles. No halo is
+     *  needed, as each voxel is fitted on its own.
+     */
+    void ReadSubregion(std::vector<std::string> const &      inputs,
+                       typename ModelType::FixedNames const &fixed,
+                       std::string const &                   mask) {
+        for (int i = 0; i < ModelType::NI; i++) {
+            SetInput(i, QI::ReadImageRegion<TInputImage>(inputs[i], m_subregion, m_verbose));
+        }
+        for (int f = 0; f < ModelType::NF; f++) {
+            if (fixed[f] != "") {
+                SetFixed(f, QI::ReadImageRegion<TFixedImage>(fixed[f], m_subregion, m_verbose));
+            }
+        }
+        if (mask != "") {
+            SetMask(QI::ReadImageRegion<TMaskImage>(mask, m_subregion, m_verbose));
+        }
+        m_hasSubregion = false; // The inputs are now the subregion
+        // Indexed fits, e.g. ones that seed a random stream per voxel, must still see the index
+        // in the whole image, otherwise tiles would not match a fit of the whole image
+        for (int d = 0; d < ImageDim; d++) {
+            m_tileOffset[d] = m_subregion.GetIndex()[d];
+        }
+    }
 
-                    typename FitType::RMSErrorType rmse = 0;
-                    typename FitType::FlagType     flag = 0;
-                    std::vector<ResidualArray>     rs; // Leave size 0 if user doesn't want them
-                    if (m_allResiduals) {
-                        for (int i = 0; i < ModelType::NI; i++) {
-                            const int block_size = m_fit->input_size(i);
-                            rs.push_back(ResidualArray::Zero(block_size));
-                        }
-                    }
+    /*
+     *  Read slices [first, first + slices) of the inputs, fixed maps and mask when streaming
+     */
+    void ReadSlab(int const first, int const slices) {
+        // Release the last slab before reading the next
+        for (int i = 0; i < ModelType::NI; i++) {
+            SetInput(i, nullptr);
+            SetInput(
+                i, QI::ReadImageSlab<TInputImage>(m_inputPaths[i], first, slices, m_verbose));
+        }
+        for (int f = 0; f < ModelType::NF; f++) {
+            if (m_fixedPaths[f] != "") {
+                SetFixed(f, nullptr);
+                SetFixed(
+                    f, QI::ReadImageSlab<TFixedImage>(m_fixedPaths[f], first, slices, m_verbose));
+            }
+        }
+        if (m_maskPath != "") {
+            SetMask(nullptr);
+            SetMask(QI::ReadImageSlab<TMaskImage>(m_maskPath, first, slices, m_verbose));
+        }
+    }
 
-                    QI::FitReturnType status;
-                    if constexpr (Blocked && Indexed) {
-                        status = m_fit->fit(
-                            inputs, fixed, outputs, covar, rmse, rs, flag, b, rmse_iter.GetIndex());
-                    } else if constexpr (Blocked) {
-                        status = m_fit->fit(inputs, fixed, outputs, covar, rmse, rs, flag, b);
-                    } else if constexpr (Indexed) {
-                        status = m_fit->fit(
-                            inputs, fixed, outputs, covar, rmse, rs, flag, rmse_iter.GetIndex());
-                    } else {
-                        status = m_fit->fit(inputs, fixed, outputs, covar, rmse, rs, flag);
-                    }
+    /*
+     *  How many slices fit into the streaming budget after the whole-image parameter maps. Inputs
+     *  count twice, as they are briefly held in both the file and vector layouts while being read.
+     *  Overlapped writes hold on to the last slab of residuals while the next is fitted.
+     */
+    int SlabSlices() {
+        auto const   full   = this->GetInput(0)->GetLargestPossibleRegion();
+        size_t const slices = full.GetSize()[2];
+        size_t const slice  = full.GetNumberOfPixels() / slices;
+        size_t const maps =
+            ((ModelType::NV + ModelType::ND + (m_covar ? ModelType::NCov : 0)) *
+                 sizeof(OutputPixelType) +
+             sizeof(typename FitType::FlagType) + sizeof(RMSErrorPixelType)) *
+            m_blocks * full.GetNumberOfPixels();
+        size_t per_voxel =
+            ModelType::NF * sizeof(FixedPixelType) + sizeof(typename TMaskImage::PixelType);
+        for (int i = 0; i < ModelType::NI; i++) {
+            per_voxel += (m_allResiduals ? (m_overlapWrites ? 4 : 3) : 2) *
+                         m_fit->input_size(i) * m_blocks * sizeof(InputPixelType);
+        }
+        size_t const budget  = static_cast<size_t>(m_streamMB) << 20;
+        size_t const minimum = maps + per_voxel * slice;
+        if (budget < minimum) {
+            QI::Fail("Streaming this image needs at least {} MB", (minimum >> 20) + 1);
+        }
+        return std::min((budget - maps) / (per_voxel * slice), slices);
+    }
 
-                    if (!status.success && m_verbose) {
-                        QI::Warn(
-                            "Fit failed for voxel {}: {}", rmse_iter.GetIndex(), status.message);
+    /*
+     *  Read, fit and write one slab of slices at a time. Streamed residuals are written
+     *  uncompressed, because compressed files cannot be written in pieces. Each slab's files are
+     *  written in parallel, but a file's slabs must be written in order, so with overlapped writes
+     *  the last slab is only waited for once the next has been fitted.
+     */
+    void StreamSlabs(std::string const &prefix, QI::WriteQueue &writes) {
+        std::string ext = QI::OutExt();
+        if (m_allResiduals && (ext.size() > 3) && (ext.substr(ext.size() - 3) == ".gz")) {
+            ext.erase(ext.size() - 3);
+            QI::Warn("Streamed residuals will be written uncompressed, as {}", ext);
+        }
+        int const nz     = this->GetInput(0)->GetLargestPossibleRegion().GetSize()[2];
+        int const slices = SlabSlices();
+        Info(m_verbose, "Streaming {} slices at a time", slices);
+        for (int first = 0; first < nz; first += slices) {
+            ReadSlab(first, std::min(slices, nz - first));
+            auto const slab = this->GetInput(0)->GetBufferedRegion();
+            if (m_allResiduals) {
+                for (int i = 0; i < ModelType::NI; i++) {
+                    auto res = GetResidualsOutput(i);
+                    if (m_overlapWrites) { // The last slab may still be writing from the old one
+                        res->SetPixelContainer(TResidualsImage::PixelContainer::New());
                     }
+                    res->SetBufferedRegion(slab);
+                    res->Allocate(true);
+                }
+            }
+            GatherBuffers(this->GetOutput(0)->ComputeOffset(slab.GetIndex()));
+            FitRegion(slab);
+            if (m_allResiduals) {
+                writes.Wait();
+                for (int i = 0; i < ModelType::NI; i++) {
+                    typename TResidualsImage::Pointer res = TResidualsImage::New();
+                    res->Graft(GetResidualsOutput(i));
+                    writes.Push([res,
+                                 path    = prefix + "residuals_" + std::to_string(i) + ext,
+                                 verbose = m_verbose] {
+                        QI::WriteImageSlab(res.GetPointer(), path, verbose);
+                    });
+                }
+                if (!m_overlapWrites) {
+                    writes.Wait();
+                }
+            }
+        }
+    }
 
-                    if constexpr (Blocked) {
-                        flag_iter.Get()[b] = flag;
-                        rmse_iter.Get()[b] = rmse;
-                        for (int i = 0; i < ModelType::NV; i++) {
-                            output_iters[i].Get()[b] = outputs[i];
-                        }
-                    } else {
-                        flag_iter.Set(flag);
-                        rmse_iter.Set(rmse);
-                        for (int i = 0; i < ModelType::NV; i++) {
-                            output_iters[i].Set(outputs[i]);
-                        }
-                        if (m_covar) {
-                            for (int ii = 0; ii < ModelType::NCov; ii++) {
-                                covar_iters[ii].Set((*covar)[ii]);
-                            }
-                        }
-                    }
-                    if constexpr (HasDerived) {
-                        typename ModelType::DerivedArray derived;
-                        m_fit->model.derived(outputs, fixed, derived);
-                        for (int i = 0; i < ModelType::ND; i++) {
-                            derived_iters[i].Set(derived[i]);
-                        }
-                    }
-                    if (m_allResiduals) {
-                        for (int i = 0; i < ModelType::NI; i++) {
-                            const int block_start = m_fit->input_size(i) * b;
-                            for (int j = 0; j < m_fit->input_size(i); j++) {
-                                residuals_iters[i].Get()[j + block_start] = rs[i][j];
-                            }
-                        }
+    virtual void GenerateData() override {
+        auto const region = this->GetInput(0)->GetLargestPossibleRegion();
+        if (m_hasSubregion && !region.IsInside(m_subregion)) {
+            itkExceptionMacro("Specified subregion is not entirely inside image.");
+        }
+        if (m_streamMB > 0) {
+            if (!m_checkpointDir.empty()) {
+                QI::Fail("Checkpoints cannot be combined with streaming");
+            }
+            Info(m_verbose, "Streaming, voxels will be fitted slab by slab as outputs are written");
+            return;
+        }
+        GatherBuffers();
+        FitRegion(region);
+    }
+
+    /*
+     *  Fit every voxel in region that is inside the subregion, if there is one
+     */
+    void FitRegion(TRegion region) {
+        if (m_hasSubregion && !region.Crop(m_subregion)) {
+            return;
+        }
+        m_workUnits              = 0;
+        m_workspaceAllocations   = 0;
+        m_workspaceMoves = 0;
+        m_fits                   = 0;
+        m_flagSum                = 0;
+        if (!m_checkpointDir.empty()) {
+            StartCheckpoint();
+        }
+        // Checkpoints are written as chunks of the work list finish
+        if ((m_buffers.mask && m_chunkSize > 0) || m_checkpoint) {
+            size_t const chunk = m_chunkSize > 0 ? m_chunkSize : 64;
+            BuildWorkList(region);
+            Info(m_verbose,
+                 "Processing {} voxels ({} in region) in chunks of {}...",
+                 m_workList.size(),
+                 region.GetNumberOfPixels(),
+                 chunk);
+            this->UpdateProgress(0.0f);
+            QI::Scheduler::Get().ParallelFor(
+                m_workList.size(), chunk, [this](QI::Scheduler::Chunks &chunks) {
+                    this->ProcessWorkList(chunks);
+                });
+            this->UpdateProgress(1.0f);
+            if (m_checkpoint) {
+                m_checkpoint->Flush();
+                m_checkpoint.reset();
+            }
+        } else {
+            Info(m_verbose, "Processing...");
+            QI::ParallelizeImageRegion<ImageDim>(
+                region,
+                [this](const TRegion &outputRegion) {
+                    this->DynamicThreadedGenerateData(outputRegion);
+                },
+                this);
+        }
+        Info(m_verbose, "Finished processing.");
+        Log(m_verbose,
+            "Workspace buffers allocated: {} over {} work units, moved in voxel loop: {}",
+            m_workspaceAllocations.load(),
+            m_workUnits.load(),
+            m_workspaceMoves.load());
+        if (m_fits > 0) {
+            Log(m_verbose,
+                "Mean flag (iterations for most fits) over {} fits{}: {:.2f}",
+                m_fits,
+                m_warmStart ? " with warm starts" : "",
+                m_flagSum / m_fits);
+        }
+    }
+
+    /*
+     *  Called once by each thread taking part. Chunks come from this thread's share of the list
+     *  first and are then stolen from other threads, so threads that hit cheap voxels pick up the
+     *  slack from those that do not.
+     */
+    void ProcessWorkList(QI::Scheduler::Chunks &chunks) {
+        Workspace                  ws(*m_fit, m_allResiduals, UseBatches());
+        auto const                 input = this->GetInput(0);
+        itk::TotalProgressReporter progress(this, m_workList.size());
+        size_t                     begin, end;
+        if (m_warmStart) {
+            ws.warm_start(m_blocks);
+        }
+        while (chunks.next(begin, end)) {
+            for (size_t ii = begin; ii < end; ii++) {
+                auto const offset = m_workList[ii];
+                QueueVoxel(ws, offset, input->ComputeIndex(offset));
+            }
+            if (m_checkpoint) {
+                FlushBatch(ws); // The results must be final before they are saved
+                m_checkpoint->Finished(&m_workList[begin], end - begin);
+            }
+            progress.Completed(end - begin);
+        }
+        FlushBatch(ws);
+        m_workUnits++;
+        m_workspaceAllocations += ws.allocations;
+        m_workspaceMoves += ws.moves;
+        std::lock_guard<std::mutex> lock(m_flagMutex);
+        m_fits += ws.fits;
+        m_flagSum += ws.flag_sum;
+    }
+
+    virtual void DynamicThreadedGenerateData(const TRegion &region) override {
+        Workspace  ws(*m_fit, m_allResiduals, UseBatches());
+        auto const input = this->GetInput(0);
+        if (m_warmStart) {
+            ws.warm_start(m_blocks);
+        }
+        for (itk::ImageRegionConstIteratorWithIndex<TInputImage> it(input, region); !it.IsAtEnd();
+             ++it) {
+            auto const index  = it.GetIndex();
+            auto const offset = input->ComputeOffset(index);
+            if (!m_buffers.mask || m_buffers.mask[offset]) {
+                QueueVoxel(ws, offset, index);
+            }
+        }
+        FlushBatch(ws);
+        m_workUnits++;
+        m_workspaceAllocations += ws.allocations;
+        m_workspaceMoves += ws.moves;
+        std::lock_guard<std::mutex> lock(m_flagMutex);
+        m_fits += ws.fits;
+        m_flagSum += ws.flag_sum;
+    }
+
+    /*
+     *  fit_batch() does not return covariances, so if they were requested use fit() instead
+     */
+    bool UseBatches() const { return Batched && !m_covar; }
+
+    /*
+     *  Queue all blocks of a single voxel for fitting. If the fit type provides fit_batch() they
+     *  are added to the current tile, which is fitted once full, otherwise they are fitted
+     *  straight away. Outputs were zeroed when they were allocated, so voxels outside the mask are
+     *  simply never visited.
+     */
+    void QueueVoxel(Workspace &ws, itk::OffsetValueType const offset, TIndex const &index) const {
+        for (int b = 0; b < m_blocks; b++) {
+            if constexpr (Batched) {
+                if (ws.batch) {
+                    auto &batch               = *ws.batch;
+                    ws.batch_rows[batch.size] = offset * m_blocks + b;
+                    batch.blocks[batch.size]  = b;
+                    if (++batch.size == Workspace::Batch::MaxSize) {
+                        FlushBatch(ws);
                     }
+                    continue;
                 }
-            } else {
-                if constexpr (Blocked) {
-                    flag_iter.Get().Fill(0);
-                    rmse_iter.Get().Fill(0);
-                    for (auto &o : output_iters) {
-                        o.Get().Fill(0);
-                    }
-                } else {
-                    flag_iter.Set(0);
-                    flag_iter.Set(0);
-                    for (auto &o : output_iters) {
-                        o.Set(0);
+            }
+            FitBlock(ws, offset, b, index);
+        }
+    }
+
+    /*
+     *  Gather the queued rows into the tile, fit them, and scatter the results
+     */
+    void FlushBatch(Workspace &ws) const {
+        if constexpr (Batched) {
+            if (!ws.batch || ws.batch->size == 0) {
+                return;
+            }
+            auto &batch = *ws.batch;
+            for (Eigen::Index r = 0; r < batch.size; r++) {
+                auto const out    = ws.batch_rows[r];
+                auto const offset = out / m_blocks;
+                for (int i = 0; i < ModelType::NI; i++) {
+                    auto const  size  = m_fit->input_size(i);
+                    auto const *input = m_buffers.inputs[i] + out * size;
+                    for (Eigen::Index j = 0; j < size; j++) {
+                        batch.inputs[i](r, j) = input[j];
                     }
-                    if (m_covar) {
-                        for (auto &c : covar_iters) {
-                            c.Set(0);
-                        }
+                }
+                if constexpr (ModelType::NF > 0) {
+                    for (int i = 0; i < ModelType::NF; i++) {
+                        batch.fixed(r, i) = m_buffers.fixed[i] ? m_buffers.fixed[i][offset] :
+                                                                 m_fit->model.fixed_defaults[i];
                     }
                 }
+            }
+            batch.reset();
+
+            m_fit->fit_batch(batch);
+
+            for (Eigen::Index r = 0; r < batch.size; r++) {
+                auto const out      = ws.batch_rows[r];
+                ws.fits++;
+                ws.flag_sum += batch.flags[r];
+                m_buffers.flag[out] = batch.flags[r];
+                m_buffers.rmse[out] = batch.rmse[r];
+                for (int i = 0; i < ModelType::NV; i++) {
+                    m_buffers.outputs[i][out] = batch.outputs(r, i);
+                }
                 if constexpr (HasDerived) {
-                    for (auto &d : derived_iters) {
-                        d.Set(0);
+                    ws.outputs = batch.outputs.row(r).transpose();
+                    ws.fixed   = batch.fixed.row(r).transpose();
+                    m_fit->model.derived(ws.outputs, ws.fixed, ws.derived);
+                    for (int i = 0; i < ModelType::ND; i++) {
+                        m_buffers.derived[i][out] = ws.derived[i];
                     }
                 }
                 if (m_allResiduals) {
-                    for (auto &r : residuals_iters) {
-                        r.Get().Fill(0);
+                    for (int i = 0; i < ModelType::NI; i++) {
+                        auto const size     = m_fit->input_size(i);
+                        auto *     residual = m_buffers.residuals[i] + out * size;
+                        for (Eigen::Index j = 0; j < size; j++) {
+                            residual[j] = batch.residuals[i](r, j);
+                        }
                     }
                 }
             }
+            batch.size = 0;
+        }
+    }
 
-            if (this->GetMask())
-                ++mask_iter;
-            for (int i = 0; i < ModelType::NI; i++) {
-                ++input_iters[i];
-                if (m_allResiduals)
-                    ++residuals_iters[i];
+    /*
+     *  Fit a single block of a single voxel with fit()
+     */
+    void FitBlock(Workspace &                ws,
+                  itk::OffsetValueType const offset,
+                  int const                  b,
+                  TIndex const &             index) const {
+        // Both the inputs and residuals store blocks contiguously within each voxel
+        for (int i = 0; i < ModelType::NI; i++) {
+            auto const  size  = m_fit->input_size(i);
+            auto const *input = m_buffers.inputs[i] + (offset * m_blocks + b) * size;
+            for (Eigen::Index j = 0; j < size; j++) {
+                ws.inputs[i][j] = input[j];
             }
+        }
+
+        ws.reset();
+        if constexpr (ModelType::NF > 0) {
+            ws.fixed = m_fit->model.fixed_defaults;
             for (int i = 0; i < ModelType::NF; i++) {
-                if (this->GetFixed(i))
-                    ++fixed_iters[i];
+                if (m_buffers.fixed[i]) {
+                    ws.fixed[i] = m_buffers.fixed[i][offset];
+                }
             }
-            for (int i = 0; i < ModelType::NV; i++) {
-                ++output_iters[i];
+        }
+        if (m_warmStart) {
+            ws.seed(b, index);
+        }
+        VaryingArray const seed = ws.outputs;
+
+        CovarArray *      covar = m_covar ? &ws.covar : nullptr;
+        QI::FitReturnType status;
+        if constexpr (Blocked && Indexed) {
+            status = m_fit->fit(ws.inputs,
+                                ws.fixed,
+                                ws.outputs,
+                                covar,
+                                ws.rmse,
+                                ws.residuals,
+                                ws.flag,
+                                b,
+                                index + m_tileOffset);
+        } else if constexpr (Blocked) {
+            status = m_fit->fit(
+                ws.inputs, ws.fixed, ws.outputs, covar, ws.rmse, ws.residuals, ws.flag, b);
+        } else if constexpr (Indexed) {
+            status = m_fit->fit(ws.inputs,
+                                ws.fixed,
+                                ws.outputs,
+                                covar,
+                                ws.rmse,
+                                ws.residuals,
+                                ws.flag,
+                                index + m_tileOffset);
+        } else {
+            status = m_fit->fit(
+                ws.inputs, ws.fixed, ws.outputs, covar, ws.rmse, ws.residuals, ws.flag);
+        }
+        ws.check();
+        ws.fits++;
+        ws.flag_sum += ws.flag;
+
+        if (!status.success) {
+            if (m_verbose) {
+                QI::Warn("Fit failed for voxel {}: {}", index, status.message);
             }
-            if constexpr (HasDerived) {
-                for (auto &d : derived_iters) {
-                    ++d;
-                }
+            if ((ws.outputs == seed).all()) {
+                ws.outputs.setZero(); // Do not report an unused warm start as the result
+            }
+        }
+        if (m_warmStart) {
+            ws.remember(b, index, status.success);
+        }
+
+        // Scalar outputs have one component per block (m_blocks is 1 if not blocked)
+        auto const out = offset * m_blocks + b;
+        m_buffers.flag[out] = ws.flag;
+        m_buffers.rmse[out] = ws.rmse;
+        for (int i = 0; i < ModelType::NV; i++) {
+            m_buffers.outputs[i][out] = ws.outputs[i];
+        }
+        if (m_covar) {
+            for (int ii = 0; ii < ModelType::NCov; ii++) {
+                m_buffers.covar[ii][out] = ws.covar[ii];
+            }
+        }
+        if constexpr (HasDerived) {
+            m_fit->model.derived(ws.outputs, ws.fixed, ws.derived);
+            for (int i = 0; i < ModelType::ND; i++) {
+                m_buffers.derived[i][out] = ws.derived[i];
             }
-            if (m_covar) {
-                for (auto &c : covar_iters) {
-                    ++c;
+        }
+        if (m_allResiduals) {
+            for (int i = 0; i < ModelType::NI; i++) {
+                auto const size     = m_fit->input_size(i);
+                auto *     residual = m_buffers.residuals[i] + (offset * m_blocks + b) * size;
+                for (Eigen::Index j = 0; j < size; j++) {
+                    residual[j] = ws.residuals[i][j];
                 }
             }
-            ++flag_iter;
-            ++rmse_iter;
         }
     }
 }; // namespace QI
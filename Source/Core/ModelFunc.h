@@ -2,7 +2,8 @@
 #include "ImageTypes.h"
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
-#include "itkMultiThreaderBase.h"
+
+#include "Scheduler.h"
 
 namespace QI {
 template <typename ModelType>
@@ -10,11 +11,8 @@ void ModelFunc(ModelType const &                                  model,
                std::array<VolumeF::Pointer, ModelType::NI> const &inputs,
                std::array<VolumeF::Pointer, ModelType::NF> const &fixed,
                VolumeF::Pointer const &                           mask,
-               itk::ThreadIdType const                            nThreads,
                std::array<VolumeF::Pointer, ModelType::NV> &      outputs) {
-    auto mt = itk::MultiThreaderBase::New();
-    mt->SetNumberOfWorkUnits(nThreads);
-    mt->ParallelizeImageRegion<3>(
+    QI::ParallelizeImageRegion<3>(
         inputs.at(0)->GetBufferedRegion(),
         [&](const QI::VolumeF::RegionType &region) {
             std::array<itk::ImageRegionConstIterator<QI::VolumeF>, ModelType::NI> in_its;
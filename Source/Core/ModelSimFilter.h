@@ -19,6 +19,7 @@
 
 #include "ImageTypes.h"
 #include "Model.h"
+#include "Scheduler.h"
 #include "Util.h"
 
 namespace QI {
@@ -114,6 +115,12 @@ class ModelSimFilter
 
     void SetNoise(const double s) { m_sigma = s; }
 
+    /*
+     *  Each voxel draws its noise from its own stream for this seed, so the output only depends
+     *  on the seed and not on the number of threads. The default is a random seed.
+     */
+    void SetSeed(const uint64_t seed) { m_seed = seed; }
+
   private:
     ModelSimFilter(const Self &); // purposely not implemented
     void operator=(const Self &); // purposely not implemented
@@ -121,6 +128,7 @@ class ModelSimFilter
   protected:
     ModelType  m_model;
     double     m_sigma = 0.0;
+    uint64_t   m_seed  = RandomSeed();
     const bool m_verbose;
     bool       m_hasSubregion = false;
     RegionType m_subregion;
@@ -178,8 +186,7 @@ class ModelSimFilter
         }
 
         Info(m_verbose, "Simulating...");
-        this->GetMultiThreader()->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
-        this->GetMultiThreader()->template ParallelizeImageRegion<ImageDim>(
+        QI::ParallelizeImageRegion<ImageDim>(
             region,
             [this](const RegionType &outputRegion) {
                 this->DynamicThreadedGenerateData(outputRegion);
@@ -216,6 +223,7 @@ class ModelSimFilter
 
         while (!output_iters[0].IsAtEnd()) {
             if (!mask || mask_iter.Get()) {
+                QI::Philox rng(m_seed, QI::VoxelStream(output_iters[0].GetIndex()));
                 QI_ARRAYN(double, ModelType::NV) varying;
                 for (int i = 0; i < ModelType::NV; i++) {
                     varying[i] = varying_iters[i].Get();
@@ -235,7 +243,7 @@ class ModelSimFilter
                     const auto signals = m_model.signals(varying, fixed);
                     for (size_t i = 0; i < signals.size(); i++) {
                         const auto output =
-                            NoiseFromModelType<ModelType>::add_noise(signals[i], m_sigma);
+                            NoiseFromModelType<ModelType>::add_noise(signals[i], m_sigma, rng);
                         const auto output_io = output.template cast<OutputPixelType>().eval();
                         itk::VariableLengthVector<OutputPixelType> data_out(output_io.data(),
                                                                             output_io.rows());
@@ -243,7 +251,8 @@ class ModelSimFilter
                     }
                 } else {
                     const auto signal = m_model.signal(varying, fixed);
-                    const auto output = NoiseFromModelType<ModelType>::add_noise(signal, m_sigma);
+                    const auto output =
+                        NoiseFromModelType<ModelType>::add_noise(signal, m_sigma, rng);
                     const auto output_io = output.template cast<OutputPixelType>().eval();
                     itk::VariableLengthVector<OutputPixelType> data_out(output_io.data(),
                                                                         output_io.rows());
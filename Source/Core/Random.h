@@ -0,0 +1,102 @@
+/*
+ *  Random.h
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace QI {
+
+/*
+ *  Philox4x32-10 counter-based random number generator (Salmon et al, SC11). Each output is a
+ *  pure function of (seed, stream, position), so giving every voxel its own stream makes results
+ *  identical whatever thread handles the voxel, and a generator costs nothing to create. It is a
+ *  UniformRandomBitGenerator, so it also works with the <random> distributions.
+ */
+class Philox {
+  public:
+    using result_type = uint64_t;
+
+    Philox(uint64_t const seed, uint64_t const stream) :
+        m_key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+        m_counter{0, 0, static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)} {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() {
+        if (m_used == 2) {
+            Block();
+        }
+        auto const i = 2 * m_used++;
+        return (static_cast<uint64_t>(m_block[i + 1]) << 32) | m_block[i];
+    }
+
+    /*
+     *  Uniform on (0, 1], so it is safe to take the log
+     */
+    double uniform() { return ((*this)() >> 11) * 0x1.0p-53 + 0x1.0p-53; }
+
+    /*
+     *  Standard normal, from the Box-Muller transform. The second value is not kept, so that
+     *  the output does not depend on how calls are interleaved.
+     */
+    double normal() {
+        double const r = std::sqrt(-2. * std::log(uniform()));
+        return r * std::cos(2. * M_PI * uniform());
+    }
+
+  private:
+    std::array<uint32_t, 2> m_key;
+    std::array<uint32_t, 4> m_counter, m_block;
+    int                     m_used = 2; // Number of 64-bit halves of m_block already returned
+
+    static void MulHiLo(uint32_t const a, uint32_t const b, uint32_t &hi, uint32_t &lo) {
+        uint64_t const p = static_cast<uint64_t>(a) * b;
+        hi               = static_cast<uint32_t>(p >> 32);
+        lo               = static_cast<uint32_t>(p);
+    }
+
+    void Block() {
+        auto c = m_counter;
+        auto k = m_key;
+        for (int r = 0; r < 10; r++) {
+            uint32_t hi0, lo0, hi1, lo1;
+            MulHiLo(0xD2511F53, c[0], hi0, lo0);
+            MulHiLo(0xCD9E8D57, c[2], hi1, lo1);
+            c = {hi1 ^ c[1] ^ k[0], lo1, hi0 ^ c[3] ^ k[1], lo0};
+            k[0] += 0x9E3779B9;
+            k[1] += 0xBB67AE85;
+        }
+        m_block = c;
+        m_used  = 0;
+        // The first half of the counter is the position within the stream
+        if (++m_counter[0] == 0) {
+            ++m_counter[1];
+        }
+    }
+};
+
+/*
+ *  A distinct stream number for each voxel index, to pair with a run-wide seed in QI::Philox
+ */
+template <typename Index> uint64_t VoxelStream(Index const &index) {
+    uint64_t stream = 0;
+    for (unsigned int d = 0; d < Index::Dimension; d++) {
+        stream |= (static_cast<uint64_t>(index[d]) & 0x1FFFFF) << (21 * d);
+    }
+    return stream;
+}
+
+} // End namespace QI
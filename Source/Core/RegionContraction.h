@@ -13,7 +13,11 @@
 #ifndef DESPOT_RegionContraction_h
 #define DESPOT_RegionContraction_h
 
+#include <algorithm>
+#include <memory>
+#include <numeric>
 #include <random>
+#include <type_traits>
 #include <vector>
 
 #include <atomic>
@@ -21,29 +25,48 @@
 
 #include <Eigen/Core>
 
+#include "Random.h"
+#include "Scheduler.h"
 #include "Util.h"
 
 namespace QI {
 
 typedef Eigen::Array<bool, Eigen::Dynamic, 1> ArrayXb;
 
-std::vector<size_t> index_partial_sort(const Eigen::Ref<Eigen::ArrayXd> &x,
-                                       Eigen::ArrayXd::Index             N);
-std::vector<size_t> index_partial_sort(const Eigen::Ref<Eigen::ArrayXd> &x,
-                                       Eigen::ArrayXd::Index             N) {
+/*
+ *  Move the indices of the N smallest values of x to the front of indices, in ascending order.
+ *  indices must be the same size as x, and is used as the workspace, so nothing is allocated.
+ */
+inline void index_partial_sort(const Eigen::Ref<const Eigen::ArrayXd> &x,
+                               Eigen::ArrayXd::Index                   N,
+                               std::vector<size_t> &                   indices) {
     eigen_assert(x.size() >= N);
-    std::vector<size_t> allIndices(x.size()), indices(N);
-    for (size_t i = 0; i < allIndices.size(); i++) {
-        allIndices[i] = i;
-    }
-    partial_sort(allIndices.begin(), allIndices.begin() + N, allIndices.end(),
-                 [&x](size_t i1, size_t i2) { return x[i1] < x[i2]; });
-    for (Eigen::ArrayXd::Index i = 0; i < N; i++) {
-        indices[i] = allIndices[i];
-    }
-    return indices;
+    eigen_assert(indices.size() == static_cast<size_t>(x.size()));
+    std::iota(indices.begin(), indices.end(), 0);
+    auto const less = [&x](size_t i1, size_t i2) { return x[i1] < x[i2]; };
+    std::nth_element(indices.begin(), indices.begin() + (N - 1), indices.end(), less);
+    std::sort(indices.begin(), indices.begin() + N, less);
 }
 
+/*
+ *  Samples are evaluated in batches of at most this many columns. Batches are also the unit that
+ *  idle threads take when they help with a voxel.
+ */
+constexpr Eigen::Index RCBatchSize = 64;
+
+/*
+ *  True if the functor can evaluate a batch of samples at once with
+ *  batch(samples, residuals), where each column of samples is one sample. Threads helping with
+ *  the same voxel each call batch() on their own copy of the functor. Functors without batch()
+ *  are shared, so their operator() must be safe to call concurrently.
+ */
+template <typename Functor_t, typename = void> struct HasBatchResiduals : std::false_type {};
+template <typename Functor_t>
+struct HasBatchResiduals<Functor_t,
+                         std::void_t<decltype(std::declval<Functor_t &>().batch(
+                             std::declval<Eigen::Ref<const Eigen::ArrayXXd> const &>(),
+                             std::declval<Eigen::Ref<Eigen::ArrayXd>>()))>> : std::true_type {};
+
 enum class RCStatus {
     NotStarted = -1,
     Converged,
@@ -80,7 +103,7 @@ std::ostream &operator<<(std::ostream &os, const RCStatus &s) {
 template <typename Functor_t> class RegionContraction {
   private:
     Functor_t &     m_f;
-    std::mt19937_64 m_rng;
+    QI::Philox      m_rng;
     Eigen::ArrayXXd m_startBounds, m_currentBounds;
     Eigen::ArrayXd  m_threshes;
     size_t          m_nS, m_nR, m_maxContractions, m_contractions;
@@ -88,14 +111,67 @@ template <typename Functor_t> class RegionContraction {
     RCStatus        m_status;
     bool            m_gaussian, m_debug;
 
+    // Workspace for optimise(), so that it does not allocate. Samples are stored one per column.
+    Eigen::ArrayXXd     m_samples, m_retained;
+    Eigen::ArrayXd      m_residuals, m_retainedRes, m_width, m_previousBest, m_mu, m_sigma;
+    std::vector<size_t> m_indices;
+
+    std::vector<std::unique_ptr<Functor_t>> m_helpers; // Functor copies for helping threads
+
+    /*
+     *  Fill m_residuals from m_samples. The batches are submitted as a nested ParallelFor(), so
+     *  threads that have run out of voxels help with this one instead of sitting idle. Every
+     *  residual depends only on its own sample, so the results do not depend on who helps.
+     */
+    void evaluate() {
+        size_t const n_batches = (m_samples.cols() + RCBatchSize - 1) / RCBatchSize;
+        Scheduler::Get().ParallelFor(n_batches, 1, [&](Scheduler::Chunks &chunks) {
+            size_t begin, end;
+            while (chunks.next(begin, end)) {
+                for (size_t b = begin; b < end; b++) {
+                    auto const s = static_cast<Eigen::Index>(b) * RCBatchSize;
+                    auto const n = std::min(RCBatchSize, m_samples.cols() - s);
+                    if constexpr (HasBatchResiduals<Functor_t>::value) {
+                        helper(chunks.slot())
+                            .batch(m_samples.middleCols(s, n), m_residuals.segment(s, n));
+                    } else {
+                        for (Eigen::Index i = s; i < s + n; i++) {
+                            m_residuals[i] = m_f(m_samples.col(i));
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    /*
+     *  The functor for a participant in evaluate(). Copies are only made for threads that
+     *  actually help, and are kept for later contractions.
+     */
+    Functor_t &helper(int const slot) {
+        if (slot == 0) {
+            return m_f;
+        }
+        if (!m_helpers[slot]) {
+            m_helpers[slot] = std::make_unique<Functor_t>(m_f);
+        }
+        return *m_helpers[slot];
+    }
+
   public:
     RegionContraction(Functor_t &f, const Eigen::ArrayXd &loBounds, const Eigen::ArrayXd &hiBounds,
                       const Eigen::ArrayXd &thresh, const int nS = 5000, const int nR = 50,
                       const int maxContractions = 10, const double expand = 0.,
-                      const bool gauss = false, const bool debug = false, const int seed = -1)
-        : m_f(f), m_threshes(thresh), m_nS(nS), m_nR(nR), m_maxContractions(maxContractions),
-          m_contractions(0), m_expand(expand), m_status(RCStatus::NotStarted), m_gaussian(gauss),
-          m_debug(debug) {
+                      const bool gauss = false, const bool debug = false,
+                      const int64_t seed = -1, const uint64_t stream = 0)
+        : m_f(f), m_rng(seed < 0 ? RandomSeed() : seed, stream), m_threshes(thresh), m_nS(nS),
+          m_nR(nR), m_maxContractions(maxContractions), m_contractions(0), m_expand(expand),
+          m_status(RCStatus::NotStarted), m_gaussian(gauss), m_debug(debug),
+          m_samples(loBounds.rows(), nS), m_retained(loBounds.rows(), nR), m_residuals(nS),
+          m_retainedRes(nR), m_width(loBounds.rows()), m_previousBest(loBounds.rows()),
+          m_mu(loBounds.rows()), m_sigma(loBounds.rows()), m_indices(nS),
+          m_helpers(Scheduler::Get().GetThreads()) {
+        m_retained.setZero();
         m_startBounds        = Eigen::ArrayXXd(loBounds.rows(), 2);
         m_startBounds.col(0) = loBounds;
         m_startBounds.col(1) = hiBounds;
@@ -104,12 +180,6 @@ template <typename Functor_t> class RegionContraction {
         eigen_assert(m_startBounds.cols() == 2);
         eigen_assert(thresh.rows() == f.inputs());
         eigen_assert((thresh >= 0.).all() && (thresh <= 1.).all());
-
-        if (seed < 0) {
-            m_rng = std::mt19937_64(RandomSeed());
-        } else {
-            m_rng = std::mt19937_64(seed);
-        }
     }
 
     const Eigen::ArrayXXd &startBounds() const { return m_startBounds; }
@@ -139,13 +209,7 @@ template <typename Functor_t> class RegionContraction {
         std::mutex               warn_mtx;
 
         eigen_assert(m_f.inputs() == params.size());
-        int                 nP = static_cast<int>(params.size());
-        Eigen::ArrayXXd     samples(m_f.inputs(), m_nS);
-        Eigen::ArrayXXd     retained(m_f.inputs(), m_nR);
-        Eigen::ArrayXd      residuals(m_nS);
-        Eigen::ArrayXd      retainedRes(m_nR);
-        Eigen::ArrayXd      gauss_mu(m_f.inputs()), gauss_sigma(m_f.inputs());
-        std::vector<size_t> indices(m_nR);
+        int const nP = static_cast<int>(params.size());
         m_currentBounds = m_startBounds;
         if ((m_startBounds != m_startBounds).any() ||
             (m_startBounds >= std::numeric_limits<double>::infinity()).any() ||
@@ -173,35 +237,26 @@ template <typename Functor_t> class RegionContraction {
         std::uniform_real_distribution<double> uniform(0., 1.);
         m_status = RCStatus::IterationLimit;
         for (m_contractions = 0; m_contractions < m_maxContractions; m_contractions++) {
-            size_t startSample = 0;
-            /*if (m_contractions > 0) {
-                    // Keep the retained samples to prevent boundary contracting too fast
-                    for (size_t s = 0; s < m_nR; s++) {
-                            samples.col(s) = retained.col(s);
-                            residuals.col(s) = retainedRes.col(s);
-                    }
-                    startSample = m_nR;
-            }*/
-            for (size_t s = startSample; s < m_nS; s++) {
-                Eigen::ArrayXd tempSample(nP);
-                size_t         nTries = 0;
+            // Draw every sample first, then evaluate them together
+            m_width = m_currentBounds.col(1) - m_currentBounds.col(0);
+            for (size_t s = 0; s < m_nS; s++) {
+                auto   sample = m_samples.col(s);
+                size_t nTries = 0;
                 do {
                     if (!m_gaussian || (m_contractions == 0)) {
                         for (int p = 0; p < nP; p++) {
-                            tempSample(p) = uniform(m_rng);
+                            sample(p) = m_currentBounds(p, 0) + uniform(m_rng) * m_width(p);
                         }
-                        tempSample *= width();
-                        tempSample += m_currentBounds.col(0);
                     } else {
                         for (int p = 0; p < nP; p++) {
-                            if (std::isfinite(gauss_sigma(p))) {
-                                std::normal_distribution<double> gauss(gauss_mu(p), gauss_sigma(p));
+                            if (std::isfinite(m_sigma(p))) {
+                                std::normal_distribution<double> gauss(m_mu(p), m_sigma(p));
                                 do {
-                                    tempSample(p) = gauss(m_rng);
-                                } while ((tempSample(p) < m_currentBounds(p, 0)) ||
-                                         (tempSample(p) > m_currentBounds(p, 1)));
+                                    sample(p) = gauss(m_rng);
+                                } while ((sample(p) < m_currentBounds(p, 0)) ||
+                                         (sample(p) > m_currentBounds(p, 1)));
                             } else {
-                                tempSample(p) = gauss_mu(p);
+                                sample(p) = m_mu(p);
                             }
                         }
                     }
@@ -213,7 +268,7 @@ template <typename Functor_t> class RegionContraction {
                             std::cerr << "Warning: Cannot fulfill sample constraints after "
                                       << std::to_string(nTries) << " attempts, giving up."
                                       << std::endl
-                                      << "Last attempt was: " << tempSample.transpose() << std::endl
+                                      << "Last attempt was: " << sample.transpose() << std::endl
                                       << "This warning will only be printed once." << std::endl;
                         }
                         warn_mtx.unlock();
@@ -221,10 +276,12 @@ template <typename Functor_t> class RegionContraction {
                         m_status = RCStatus::ErrorInvalid;
                         return false;
                     }
-                } while (!m_f.constraint(tempSample));
+                } while (!m_f.constraint(sample));
+            }
 
-                residuals[s] = m_f(tempSample);
-                if (!std::isfinite(residuals[s])) {
+            evaluate();
+            for (size_t s = 0; s < m_nS; s++) {
+                if (!std::isfinite(m_residuals[s])) {
                     warn_mtx.lock();
                     if (!finiteWarning) {
                         finiteWarning = true;
@@ -232,36 +289,35 @@ template <typename Functor_t> class RegionContraction {
                             << "Warning: Non-finite residual found!" << std::endl
                             << "Result may be meaningless. This warning will only be printed once."
                             << std::endl
-                            << "Parameters were " << tempSample.transpose() << std::endl;
+                            << "Parameters were " << m_samples.col(s).transpose() << std::endl;
                     }
                     warn_mtx.unlock();
-                    params   = retained.col(0);
+                    params   = m_retained.col(0);
                     m_status = RCStatus::ErrorResidual;
                     return false;
                 }
-                samples.col(s) = tempSample;
             }
-            indices                     = index_partial_sort(residuals, m_nR);
-            Eigen::ArrayXd previousBest = retained.col(0);
+            index_partial_sort(m_residuals, m_nR, m_indices);
+            m_previousBest = m_retained.col(0);
             for (size_t i = 0; i < m_nR; i++) {
-                retained.col(i) = samples.col(indices[i]);
-                retainedRes(i)  = residuals(indices[i]);
+                m_retained.col(i) = m_samples.col(m_indices[i]);
+                m_retainedRes(i)  = m_residuals(m_indices[i]);
             }
             // Find the min and max for each parameter in the top nR samples
-            m_currentBounds.col(0) = retained.rowwise().minCoeff();
-            m_currentBounds.col(1) = retained.rowwise().maxCoeff();
+            m_currentBounds.col(0) = m_retained.rowwise().minCoeff();
+            m_currentBounds.col(1) = m_retained.rowwise().maxCoeff();
             if (m_gaussian) {
-                gauss_mu = retained.rowwise().mean();
-                gauss_sigma =
-                    ((retained.colwise() - gauss_mu).square().rowwise().sum() / (m_f.inputs() - 1))
+                m_mu = m_retained.rowwise().mean();
+                m_sigma =
+                    ((m_retained.colwise() - m_mu).square().rowwise().sum() / (m_f.inputs() - 1))
                         .sqrt();
             }
             if (m_debug) {
                 std::cout << "CONTRACTION:    " << m_contractions << std::endl
-                          << "Retained best: " << retainedRes.minCoeff()
-                          << " Worst: " << retainedRes.maxCoeff() << std::endl
-                          << "All best:      " << residuals.minCoeff()
-                          << " Worst: " << residuals.maxCoeff() << std::endl
+                          << "Retained best: " << m_retainedRes.minCoeff()
+                          << " Worst: " << m_retainedRes.maxCoeff() << std::endl
+                          << "All best:      " << m_residuals.minCoeff()
+                          << " Worst: " << m_residuals.maxCoeff() << std::endl
                           << "Current width%: " << (width() / startWidth()).transpose()
                           << std::endl;
                 // cout << "Thresh        : " << m_threshes.transpose() << std::endl;
@@ -269,17 +325,18 @@ template <typename Functor_t> class RegionContraction {
                 // startWidth())).transpose() << std::endl; cout << "Converged:      " << (width() <=
                 // (m_threshes * startWidth())).all() << std::endl;
                 if (m_gaussian) {
-                    std::cout << "Gaussian mu:    " << gauss_mu.transpose() << std::endl
-                              << "Gaussian sigma%:" << (gauss_sigma / startWidth()).transpose()
+                    std::cout << "Gaussian mu:    " << m_mu.transpose() << std::endl
+                              << "Gaussian sigma%:" << (m_sigma / startWidth()).transpose()
                               << std::endl;
                 }
             }
             // Terminate if all the desired parameters have converged
-            if ((width() <= (m_threshes * startWidth())).all()) {
+            m_width = m_currentBounds.col(1) - m_currentBounds.col(0);
+            if ((m_width <= (m_threshes * (m_startBounds.col(1) - m_startBounds.col(0)))).all()) {
                 m_status = RCStatus::Converged;
                 m_contractions++; // Just to give an accurate contraction count.
                 break;
-            } else if ((previousBest == retained.col(0)).all()) {
+            } else if ((m_previousBest == m_retained.col(0)).all()) {
                 m_status = RCStatus::NoImprovement;
                 m_contractions++; // Just to give an accurate contraction count.
                 break;
@@ -288,11 +345,11 @@ template <typename Functor_t> class RegionContraction {
             if (m_expand != 0) {
                 // Expand the boundaries back out in case we just missed a minima,
                 // but don't go past initial boundaries
-                Eigen::ArrayXd tempW = width(); // Because altering .col(0) will change width
+                // m_width still holds the width from before altering .col(0)
                 m_currentBounds.col(0) =
-                    (m_currentBounds.col(0) - tempW * m_expand).max(m_startBounds.col(0));
+                    (m_currentBounds.col(0) - m_width * m_expand).max(m_startBounds.col(0));
                 m_currentBounds.col(1) =
-                    (m_currentBounds.col(1) + tempW * m_expand).min(m_startBounds.col(1));
+                    (m_currentBounds.col(1) + m_width * m_expand).min(m_startBounds.col(1));
                 if (m_debug) {
                     std::cout << "Width expanded to: " << width().transpose() << std::endl;
                 }
@@ -300,12 +357,12 @@ template <typename Functor_t> class RegionContraction {
         }
 
         if (m_gaussian) {
-            params = gauss_mu;
+            params = m_mu;
         } else {
             // Return the best evaluated solution so far
-            params = retained.col(0);
+            params = m_retained.col(0);
         }
-        m_SoS = retainedRes(0);
+        m_SoS = m_retainedRes(0);
         if (m_debug) {
             std::cout << "Finished, contractions = " << m_contractions << std::endl;
         }
@@ -0,0 +1,205 @@
+/*
+ *  Scheduler.cpp
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <Eigen/Core>
+#include <algorithm>
+
+#include "itkMultiThreaderBase.h"
+
+#include "Log.h"
+#include "Scheduler.h"
+#include "Util.h"
+
+namespace QI {
+
+/*
+ *  One call to ParallelFor(). Lives on the stack of the calling thread.
+ */
+struct Scheduler::Job {
+    struct Slot {
+        std::mutex mutex;
+        size_t     begin = 0, end = 0;
+    };
+
+    Body const &            body;
+    size_t const            grain;
+    int const               n_slots;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<size_t>     remaining;
+    std::atomic<int>        next_slot{1}; // Slot 0 belongs to the calling thread
+    int                     active = 0;   // Helpers currently running body
+    std::mutex              done_mutex;
+    std::condition_variable done_cv;
+
+    Job(Body const &b, size_t const n, size_t const g, int const ns) :
+        body(b), grain(std::max<size_t>(g, 1)), n_slots(ns), slots(new Slot[ns]), remaining(n) {
+        for (int s = 0; s < n_slots; s++) {
+            slots[s].begin = (n * s) / n_slots;
+            slots[s].end   = (n * (s + 1)) / n_slots;
+        }
+    }
+
+    bool joinable() const { return (remaining > 0) && (next_slot < n_slots); }
+};
+
+bool Scheduler::Chunks::next(size_t &begin, size_t &end) {
+    auto &job = m_job;
+    auto &own = job.slots[m_slot];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.begin < own.end) {
+            begin     = own.begin;
+            end       = std::min(begin + job.grain, own.end);
+            own.begin = end;
+            job.remaining -= (end - begin);
+            return true;
+        }
+    }
+    for (int s = 1; s < job.n_slots; s++) {
+        auto & victim = job.slots[(m_slot + s) % job.n_slots];
+        size_t stolen_begin, stolen_end;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            size_t const left = victim.end - victim.begin;
+            if (left == 0) {
+                continue;
+            }
+            // Take the back half, or everything if there is only one chunk left
+            stolen_begin = (left > job.grain) ? victim.begin + left / 2 : victim.begin;
+            stolen_end   = victim.end;
+            victim.end   = stolen_begin;
+        }
+        begin = stolen_begin;
+        end   = std::min(begin + job.grain, stolen_end);
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.begin = end;
+            own.end   = stolen_end;
+        }
+        job.remaining -= (end - begin);
+        return true;
+    }
+    return false;
+}
+
+Scheduler &Scheduler::Get() {
+    // Never destroyed, so that a QI::Fail() from inside a worker does not try to join itself
+    static Scheduler *scheduler = new Scheduler;
+    return *scheduler;
+}
+
+Scheduler::Scheduler() : m_threads(std::max(GetDefaultThreads(), 1)) {}
+
+void Scheduler::SetThreads(int const n) {
+    if (std::max(n, 1) == m_threads) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto &w : m_workers) {
+        w.join();
+    }
+    m_workers.clear();
+    m_stop    = false;
+    m_threads = std::max(n, 1);
+}
+
+/*
+ *  Helpers are only started when there is work for them, so a program that sets the number of
+ *  threads more than once, or never runs anything in parallel, does not start them for nothing.
+ *  Must be called with m_mutex held.
+ */
+void Scheduler::StartWorkers() {
+    // The calling thread always takes part, so only start n - 1 helpers
+    for (int t = static_cast<int>(m_workers.size()) + 1; t < m_threads; t++) {
+        m_workers.emplace_back(&Scheduler::Work, this);
+    }
+}
+
+void Scheduler::Work() {
+    while (true) {
+        Job *job  = nullptr;
+        int  slot = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&] {
+                return m_stop || std::any_of(m_jobs.begin(), m_jobs.end(), [](Job *j) {
+                           return j->joinable();
+                       });
+            });
+            if (m_stop) {
+                return;
+            }
+            // Prefer the most recent job, which will be the innermost if they are nested
+            auto it = std::find_if(
+                m_jobs.rbegin(), m_jobs.rend(), [](Job *j) { return j->joinable(); });
+            job  = *it;
+            slot = job->next_slot++;
+            std::lock_guard<std::mutex> done_lock(job->done_mutex);
+            job->active++;
+        }
+        if (slot < job->n_slots) {
+            Chunks chunks(*job, slot);
+            job->body(chunks);
+        }
+        std::lock_guard<std::mutex> done_lock(job->done_mutex);
+        if (--job->active == 0) {
+            job->done_cv.notify_all();
+        }
+    }
+}
+
+void Scheduler::ParallelFor(size_t const n, size_t const grain, Body const &body) {
+    if (n == 0) {
+        return;
+    }
+    Job job(body, n, grain, m_threads);
+    if (m_threads > 1) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            StartWorkers();
+            m_jobs.push_back(&job);
+        }
+        m_cv.notify_all();
+    }
+    Chunks chunks(job, 0);
+    body(chunks);
+    if (m_threads > 1) {
+        {
+            // Once the job is unlisted nobody else can join, so only wait for those running
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), &job));
+        }
+        std::unique_lock<std::mutex> done_lock(job.done_mutex);
+        job.done_cv.wait(done_lock, [&] { return job.active == 0; });
+    }
+}
+
+void SetThreads(int const n) {
+    if ((n < 1) || (n > 1024)) {
+        QI::Fail("Number of threads {} was outside range 1-1024", n);
+    }
+    Scheduler::Get().SetThreads(n);
+    // Keep ITK's own filters (readers, writers, smoothing etc.) to the same limit, and stop Eigen
+    // from starting threads of its own inside a voxel
+    itk::MultiThreaderBase::SetGlobalMaximumNumberOfThreads(n);
+    itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads(n);
+    Eigen::setNbThreads(1);
+}
+
+int GetThreads() {
+    return Scheduler::Get().GetThreads();
+}
+
+} // End namespace QI
@@ -0,0 +1,132 @@
+/*
+ *  Scheduler.h
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "itkImageRegion.h"
+#include "itkProcessObject.h"
+#include "itkTotalProgressReporter.h"
+
+namespace QI {
+
+/*
+ *  Process-wide pool of worker threads that all QUIT filters submit their work to. The number of
+ *  threads is set once, from $QUIT_THREADS or --threads, via QI::SetThreads(), which also applies
+ *  the same limit to ITK's own filters so that nothing else oversubscribes the machine.
+ *
+ *  Work is submitted with ParallelFor() as a range [0, n). Every participating thread owns part of
+ *  the range and takes chunks of it from the front. When its own part runs out it steals the back
+ *  half of another participant's part. The calling thread always participates, so ParallelFor()
+ *  can be nested, e.g. inside a voxel fit, without deadlocking the pool.
+ */
+class Scheduler {
+  private:
+    struct Job;
+
+  public:
+    /*
+     *  Hands out chunks of the range to one participating thread
+     */
+    class Chunks {
+      public:
+        bool next(size_t &begin, size_t &end);
+        int  slot() const { return m_slot; } //!< Unique among participants, 0 is the caller
+
+      private:
+        friend class Scheduler;
+        Chunks(Job &j, int s) : m_job(j), m_slot(s) {}
+        Job &     m_job;
+        int const m_slot;
+    };
+    using Body = std::function<void(Chunks &)>;
+
+    static Scheduler &Get(); //!< The process-wide scheduler
+
+    Scheduler(const Scheduler &) = delete;
+    void operator=(const Scheduler &) = delete;
+
+    void SetThreads(int const n); //!< Not while work is running. No-op if unchanged
+    int  GetThreads() const { return m_threads; }
+
+    /*
+     *  Run body on up to GetThreads() threads until every chunk of [0, n) has been claimed. Each
+     *  participant calls body once and should keep calling Chunks::next() until it returns false.
+     *  Does not return until all participants have finished.
+     */
+    void ParallelFor(size_t const n, size_t const grain, Body const &body);
+
+  private:
+    Scheduler();
+    void StartWorkers();
+    void Work();
+
+    int                      m_threads = 1;
+    bool                     m_stop    = false;
+    std::vector<std::thread> m_workers;
+    std::vector<Job *>       m_jobs;
+    std::mutex               m_mutex;
+    std::condition_variable  m_cv;
+};
+
+void SetThreads(int const n); //!< Set the number of threads for QUIT and ITK
+int  GetThreads();            //!< Return the number of threads in use
+
+/*
+ *  Drop-in replacement for itk::MultiThreaderBase::ParallelizeImageRegion that runs on the QUIT
+ *  scheduler. The region is split into slabs along its slowest dimension that has enough slices
+ *  to keep every thread busy.
+ */
+template <unsigned int D>
+void ParallelizeImageRegion(itk::ImageRegion<D> const &                             region,
+                            std::function<void(itk::ImageRegion<D> const &)> const &f,
+                            itk::ProcessObject *                                    filter) {
+    unsigned int dim = D - 1;
+    while ((dim > 0) && (region.GetSize(dim) < 2 * static_cast<size_t>(GetThreads()))) {
+        dim--;
+    }
+    if (region.GetSize(dim) < 2 * static_cast<size_t>(GetThreads())) {
+        // Nothing is big enough, so pick the biggest
+        for (unsigned int d = 0; d < D; d++) {
+            if (region.GetSize(d) > region.GetSize(dim)) {
+                dim = d;
+            }
+        }
+    }
+
+    if (filter) {
+        filter->UpdateProgress(0.0f);
+    }
+    Scheduler::Get().ParallelFor(
+        region.GetSize(dim), 1, [&](Scheduler::Chunks &chunks) {
+            itk::TotalProgressReporter progress(filter, region.GetNumberOfPixels());
+            size_t                     begin, end;
+            while (chunks.next(begin, end)) {
+                auto slab = region;
+                slab.SetIndex(dim, region.GetIndex(dim) + begin);
+                slab.SetSize(dim, end - begin);
+                f(slab);
+                progress.Completed(slab.GetNumberOfPixels());
+            }
+        });
+    if (filter) {
+        filter->UpdateProgress(1.0f);
+    }
+}
+
+} // End namespace QI
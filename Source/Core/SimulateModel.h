@@ -26,9 +26,13 @@ void SimulateModel(json &                                    json,
                    std::string const &                       mask_path,
                    bool const                                verbose,
                    double const                              noise,
-                   std::string const &                       subRegion) {
+                   std::string const &                       subRegion,
+                   int64_t const                             seed = -1) {
     auto simulator = QI::ModelSimFilter<Model, MultiOutput>::New(model, verbose, subRegion);
     simulator->SetNoise(noise);
+    if (seed >= 0) { // Otherwise keep the random seed
+        simulator->SetSeed(seed);
+    }
     for (auto i = 0; i < Model::NV; i++) {
         const std::string vname = fmt::format("{}_map", model.varying_names[i]);
         const std::string vfile = json.at(vname).get<std::string>();
@@ -54,7 +58,6 @@ void SimulateModel(json &                                    json,
         simulator->SetMask(QI::ReadImage(mask_path, verbose));
     }
     QI::Log(verbose, "Noise level is {}\nSimulating model...", noise);
-    srand((unsigned int)time(0));
     simulator->Update();
     QI::Log(verbose, "Finished");
     if constexpr (MultiOutput) {
@@ -0,0 +1,293 @@
+/*
+ *  BlockGzip.cpp
+ *
+ *  Copyright (c) 2018 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "fmt/format.h"
+#include "itk_zlib.h"
+
+#include "BlockGzip.h"
+#include "RawNifti.h"
+#include "Scheduler.h"
+
+namespace QI {
+
+namespace {
+
+constexpr size_t BlockSize   = 1 << 20; // Uncompressed bytes per member
+constexpr size_t HeaderSize  = 20;      // Fixed gzip header plus one extra field
+constexpr size_t TrailerSize = 8;       // CRC32 and uncompressed size
+
+void Put32(unsigned char *p, uint32_t const x) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (x >> (8 * i)) & 0xFF;
+    }
+}
+
+uint32_t Get32(unsigned char const *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint16_t Get16(unsigned char const *p) {
+    return p[0] | (p[1] << 8);
+}
+
+/*
+ *  Compress one block into a complete gzip member. The extra field is 'Q' 'I' followed by the
+ *  length of the whole member. Returns an empty member if zlib fails.
+ */
+std::vector<unsigned char> CompressBlock(char const *data, size_t const size) {
+    z_stream zs{};
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return {};
+    }
+    std::vector<unsigned char> member(HeaderSize + deflateBound(&zs, size) + TrailerSize);
+    zs.next_in       = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zs.avail_in      = size;
+    zs.next_out      = member.data() + HeaderSize;
+    zs.avail_out     = member.size() - HeaderSize - TrailerSize;
+    int const result = deflate(&zs, Z_FINISH);
+    size_t const compressed = zs.total_out;
+    deflateEnd(&zs);
+    if (result != Z_STREAM_END) {
+        return {};
+    }
+    member.resize(HeaderSize + compressed + TrailerSize);
+    // ID1, ID2, deflate, FEXTRA, no time, no extra flags, unknown OS, XLEN = 8
+    unsigned char const header[12] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 8, 0};
+    std::memcpy(member.data(), header, sizeof(header));
+    member[12] = 'Q';
+    member[13] = 'I';
+    member[14] = 4;
+    member[15] = 0;
+    Put32(member.data() + 16, member.size());
+    unsigned char *const trailer = member.data() + HeaderSize + compressed;
+    Put32(trailer, crc32(0, reinterpret_cast<Bytef const *>(data), size));
+    Put32(trailer + 4, size);
+    return member;
+}
+
+/*
+ *  Find the length of the gzip member at p from its extra field, either ours or BGZF's, and the
+ *  length of its header. Returns false if it is not a member with a length field.
+ */
+bool ParseMember(unsigned char const *p, size_t const avail, size_t &member, size_t &header) {
+    if ((avail < 12) || (p[0] != 0x1f) || (p[1] != 0x8b) || (p[2] != 8) || !(p[3] & 4)) {
+        return false;
+    }
+    size_t const xend = 12 + Get16(p + 10);
+    if (xend > avail) {
+        return false;
+    }
+    member = 0;
+    for (size_t i = 12; i + 4 <= xend; i += 4 + Get16(p + i + 2)) {
+        size_t const slen = Get16(p + i + 2);
+        if ((p[i] == 'Q') && (p[i + 1] == 'I') && (slen == 4) && (i + 8 <= xend)) {
+            member = Get32(p + i + 4);
+        } else if ((p[i] == 'B') && (p[i + 1] == 'C') && (slen == 2) && (i + 6 <= xend)) {
+            member = Get16(p + i + 4) + 1;
+        }
+    }
+    header = xend;
+    for (unsigned char const flag : {8, 16}) { // FNAME and FCOMMENT are zero-terminated
+        if (p[3] & flag) {
+            while ((header < avail) && p[header]) {
+                header++;
+            }
+            header++;
+        }
+    }
+    if (p[3] & 2) { // FHCRC
+        header += 2;
+    }
+    return (member >= header + TrailerSize) && (member <= avail) &&
+           (member <= std::numeric_limits<uInt>::max());
+}
+
+bool InflateBlock(unsigned char const *in, size_t const in_size, char *out, size_t const out_size,
+                  uint32_t const crc) {
+    z_stream zs{};
+    if (inflateInit2(&zs, -15) != Z_OK) {
+        return false;
+    }
+    Bytef empty; // zlib needs somewhere to write even for an empty member, e.g. BGZF's last
+    zs.next_in       = const_cast<Bytef *>(in);
+    zs.avail_in      = in_size;
+    zs.next_out      = out_size ? reinterpret_cast<Bytef *>(out) : &empty;
+    zs.avail_out     = out_size ? out_size : 1;
+    int const result = inflate(&zs, Z_FINISH);
+    bool const ok    = (result == Z_STREAM_END) && (zs.total_out == out_size);
+    inflateEnd(&zs);
+    return ok && (crc32(0, reinterpret_cast<Bytef const *>(out), out_size) == crc);
+}
+
+/*
+ *  Decompress up to out_size bytes from the start of a member, without checking the CRC. Returns
+ *  the number of bytes written, which is less if the member is shorter.
+ */
+size_t
+InflateHead(unsigned char const *in, size_t const in_size, char *out, size_t const out_size) {
+    z_stream zs{};
+    if ((out_size == 0) || (inflateInit2(&zs, -15) != Z_OK)) {
+        return 0;
+    }
+    zs.next_in   = const_cast<Bytef *>(in);
+    zs.avail_in  = in_size;
+    zs.next_out  = reinterpret_cast<Bytef *>(out);
+    zs.avail_out = out_size;
+    inflate(&zs, Z_SYNC_FLUSH);
+    size_t const n = zs.total_out;
+    inflateEnd(&zs);
+    return n;
+}
+
+} // namespace
+
+bool UseBlockGzip(std::string const &path) {
+    static bool const enabled = [] {
+        char const *env = std::getenv("QUIT_BLOCK_GZIP");
+        return !env || (std::string(env) != "0");
+    }();
+    return enabled && (path.size() > 7) && (path.compare(path.size() - 7, 7, ".nii.gz") == 0);
+}
+
+bool IsBlockGzip(std::string const &path) {
+    if (!UseBlockGzip(path)) {
+        return false;
+    }
+    MappedFile const file(path);
+    size_t           member, header;
+    return file.data() && ParseMember(reinterpret_cast<unsigned char const *>(file.data()),
+                                      file.size(),
+                                      member,
+                                      header);
+}
+
+void WriteBlockGzip(char const *       header,
+                    size_t const       header_size,
+                    char const *       data,
+                    size_t const       size,
+                    std::string const &path) {
+    size_t const n_blocks = (size + BlockSize - 1) / BlockSize;
+    std::vector<std::vector<unsigned char>> members(n_blocks + 1);
+    members[0] = CompressBlock(header, header_size);
+    Scheduler::Get().ParallelFor(n_blocks, 1, [&](Scheduler::Chunks &chunks) {
+        size_t begin, end;
+        while (chunks.next(begin, end)) {
+            for (size_t b = begin; b < end; b++) {
+                size_t const offset = b * BlockSize;
+                members[b + 1] = CompressBlock(data + offset, std::min(BlockSize, size - offset));
+            }
+        }
+    });
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    for (auto const &m : members) {
+        if (m.empty()) {
+            throw std::runtime_error(fmt::format("Compression failed while writing: {}", path));
+        }
+        file.write(reinterpret_cast<char const *>(m.data()), m.size());
+    }
+    if (!file) {
+        throw std::runtime_error(fmt::format("Could not write file: {}", path));
+    }
+}
+
+bool ReadBlockGzip(std::string const &                                      path,
+                   std::function<bool(char const *, size_t, size_t)> const &start,
+                   std::function<void(char const *, size_t, size_t)> const &use,
+                   std::function<bool(size_t, size_t)> const &              want) {
+    if (!UseBlockGzip(path)) {
+        return false;
+    }
+    MappedFile const file(path);
+    auto const *     p = reinterpret_cast<unsigned char const *>(file.data());
+    if (!p) {
+        return false;
+    }
+    struct Block {
+        size_t   in, in_size, out, out_size;
+        uint32_t crc;
+    };
+    std::vector<Block> blocks;
+    size_t             total = 0;
+    for (size_t in = 0; in < file.size();) {
+        size_t member, header;
+        if (!ParseMember(p + in, file.size() - in, member, header)) {
+            return false;
+        }
+        unsigned char const *trailer = p + in + member - TrailerSize;
+        Block                b;
+        b.in       = in + header;
+        b.in_size  = member - header - TrailerSize;
+        b.out      = total;
+        b.out_size = Get32(trailer + 4);
+        b.crc      = Get32(trailer);
+        blocks.push_back(b);
+        total += b.out_size;
+        in += member;
+    }
+
+    // Gather up to n bytes from the blocks starting at first, for the head or an overlap
+    auto const gather = [&](size_t first, char *out, size_t const n) {
+        size_t got = 0;
+        for (; (first < blocks.size()) && (got < n); first++) {
+            Block const &b = blocks[first];
+            got += InflateHead(p + b.in, b.in_size, out + got, std::min(n - got, b.out_size));
+        }
+        return got;
+    };
+    std::vector<char> head(BlockGzipHead);
+    head.resize(gather(0, head.data(), head.size()));
+    if (!start(head.data(), head.size(), total)) {
+        return false;
+    }
+
+    std::vector<size_t> wanted;
+    wanted.reserve(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (!want || want(blocks[i].out, blocks[i].out_size)) {
+            wanted.push_back(i);
+        }
+    }
+
+    std::atomic<bool> ok{true};
+    Scheduler::Get().ParallelFor(wanted.size(), 1, [&](Scheduler::Chunks &chunks) {
+        std::vector<char> buffer; // Only one block per thread is ever held
+        size_t            begin, end;
+        while (chunks.next(begin, end)) {
+            for (size_t w = begin; w < end; w++) {
+                size_t const i = wanted[w];
+                Block const &b = blocks[i];
+                buffer.resize(b.out_size + BlockGzipOverlap);
+                if (!InflateBlock(p + b.in, b.in_size, buffer.data(), b.out_size, b.crc)) {
+                    ok = false;
+                    continue;
+                }
+                gather(i + 1, buffer.data() + b.out_size, BlockGzipOverlap);
+                use(buffer.data(), b.out, b.out_size);
+            }
+        }
+    });
+    if (!ok) {
+        throw std::runtime_error(fmt::format("Corrupt data in file: {}", path));
+    }
+    return true;
+}
+
+} // namespace QI
@@ -0,0 +1,83 @@
+#pragma once
+/*
+ *  BlockGzip.h
+ *
+ *  Copyright (c) 2018 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <functional>
+#include <string>
+
+#include "RawNifti.h"
+
+namespace QI {
+
+/*
+ *  Multi-threaded gzip for .nii.gz files, in the style of pigz and BGZF. The data is cut into
+ *  blocks that are compressed independently, and each block is written as a complete gzip member
+ *  with an extra field that records the length of the member. Any gzip reader sees one ordinary
+ *  file, but ReadBlockGzip() can find the block boundaries and decompress the blocks in parallel.
+ *
+ *  Set $QUIT_BLOCK_GZIP to 0 to turn this off and use ITK's own single-threaded compression.
+ */
+bool UseBlockGzip(std::string const &path); //!< True for .nii.gz unless $QUIT_BLOCK_GZIP is 0
+bool IsBlockGzip(std::string const &path);  //!< True if ReadBlockGzip() can read path in blocks
+
+/*
+ *  Write header and then data to path. The header gets a member of its own, so the blocks of data
+ *  are compressed straight from where they are and each starts on a value. Throws
+ *  std::runtime_error if compressing or writing fails, as this is often run on a WriteQueue thread.
+ */
+void WriteBlockGzip(char const *       header,
+                    size_t const       header_size,
+                    char const *       data,
+                    size_t const       size,
+                    std::string const &path);
+
+/*
+ *  Write img to path as a block gzip NIfTI, compressing straight from its buffer. Returns false,
+ *  having written nothing, if UseBlockGzip(path) is false or only part of img is buffered.
+ */
+template <typename TImg> bool WriteBlockGzipImage(TImg const *img, std::string const &path) {
+    auto const region = img->GetLargestPossibleRegion();
+    if (!UseBlockGzip(path) || (img->GetBufferedRegion() != region)) {
+        return false;
+    }
+    auto const header = MakeNiftiHeader(GetNiftiGeometry(img));
+    WriteBlockGzip(header.data(),
+                   header.size(),
+                   reinterpret_cast<char const *>(img->GetBufferPointer()),
+                   region.GetNumberOfPixels() * sizeof(typename TImg::PixelType),
+                   path);
+    return true;
+}
+
+/*
+ *  Decompress a block gzip file, as written by WriteBlockGzip() or as BGZF, on every thread without
+ *  ever holding all of it. start() is given the first BlockGzipHead bytes, or the whole file if it
+ *  is shorter, and the uncompressed size of the file. If it returns true, use() is called for every
+ *  block with its bytes, their offset in the uncompressed file and their number. The bytes are
+ *  followed by up to BlockGzipOverlap bytes of the next block, so that a value that straddles two
+ *  blocks can be read by the block it starts in.
+ *
+ *  If want() is given, only the blocks for which want(offset, size) is true are decompressed. The
+ *  member headers hold the block lengths, so the others are skipped without reading them, e.g. to
+ *  read one slab of slices at a time.
+ *
+ *  Returns false if the file has no block boundaries, if UseBlockGzip(path) is false, or if start()
+ *  returned false. Nothing else is called in the first two cases. Throws std::runtime_error if a
+ *  block is corrupt, after use() has been called for the others.
+ */
+constexpr size_t BlockGzipHead    = 352; // A NIfTI-1 header and its extension flag
+constexpr size_t BlockGzipOverlap = 16;  // The largest value, a complex double
+bool ReadBlockGzip(std::string const &                                      path,
+                   std::function<bool(char const *, size_t, size_t)> const &start,
+                   std::function<void(char const *, size_t, size_t)> const &use,
+                   std::function<bool(size_t, size_t)> const &              want = nullptr);
+
+} // namespace QI
@@ -22,6 +22,25 @@ template <typename TImg = QI::VolumeF>
 extern auto ReadMagnitudeImage(const std::string &path, const bool verbose) ->
     typename TImg::Pointer;
 
+/*
+ *  Read only slices [first, first + slices) along the last spatial axis. The image keeps the
+ *  size of the whole file as its largest possible region, but only the slab is buffered.
+ */
+template <typename TImg = QI::VolumeF>
+extern auto
+ReadImageSlab(const std::string &path, const int first, const int slices, const bool verbose) ->
+    typename TImg::Pointer;
+
+/*
+ *  Read only the voxels inside region of the file. The image is cropped to the region, as by
+ *  itk::RegionOfInterestImageFilter, so it starts at index 0 and its origin is the centre of the
+ *  first voxel of the region. Writing it out gives a tile that qi merge_tiles can put back.
+ */
+template <typename TImg = QI::VolumeF>
+extern auto ReadImageRegion(const std::string &              path,
+                            const typename TImg::RegionType &region,
+                            const bool                       verbose) -> typename TImg::Pointer;
+
 template <typename TImg>
 extern void WriteImage(const TImg *ptr, const std::string &path, const bool verbose);
 
@@ -49,4 +68,11 @@ extern void WriteScaledImage(const itk::SmartPointer<TImg> &       ptr,
                              const std::string &                   path,
                              const bool                            verbose);
 
+/*
+ *  Write the buffered slab of a vector image into its place in the file at path, creating the
+ *  file first if needed. Needs a format that supports streamed writes, e.g. uncompressed NIfTI.
+ */
+template <typename TImg>
+extern void WriteImageSlab(const TImg *ptr, const std::string &path, const bool verbose);
+
 } // namespace QI
@@ -12,11 +12,17 @@
 #ifndef QUIT_IMAGEIO_H
 
 #include <string>
+#include <type_traits>
+#include <vector>
 
+#include "BlockGzip.h"
 #include "ImageIO.h"
 #include "Log.h"
+#include "RawNifti.h"
 #include "itkComplexToModulusImageFilter.h"
 #include "itkImageFileReader.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
 
 namespace QI {
 
@@ -25,6 +31,44 @@ auto ReadImage(const std::string &path, const bool verbose) -> typename TImg::Po
     typedef itk::ImageFileReader<TImg> TReader;
     typename TReader::Pointer          file = TReader::New();
     file->SetFileName(path);
+    if constexpr (std::is_floating_point<typename TImg::PixelType>::value) {
+        // Decompress block gzip on every thread, straight into the image, instead of through ITK's
+        // single-threaded zlib
+        if (UseBlockGzip(path)) {
+            file->UpdateOutputInformation();
+            typename TImg::Pointer img    = file->GetOutput();
+            auto const             region = img->GetLargestPossibleRegion();
+            size_t const           voxels = region.GetNumberOfPixels();
+            NiftiLayout            nifti;
+            auto const start = [&](char const *head, size_t const head_size, size_t const total) {
+                if (!ParseNiftiLayout(head, head_size, nifti)) {
+                    return false;
+                }
+                for (unsigned int d = 0; d < 4; d++) {
+                    size_t const size = (d < TImg::ImageDimension) ? region.GetSize(d) : 1;
+                    if (nifti.dims[d] != size) {
+                        return false;
+                    }
+                }
+                if (total < NiftiDataEnd(nifti, voxels)) {
+                    QI::Fail("Image data is truncated: {}", path);
+                }
+                QI::Log(verbose, "Reading image: {} (block gzip)", path);
+                img->DisconnectPipeline();
+                img->SetBufferedRegion(region);
+                img->Allocate();
+                return true;
+            };
+            auto const use = [&](char const *data, size_t const offset, size_t const size) {
+                CopyNiftiRange(data, offset, size, nifti, voxels, 1, img->GetBufferPointer());
+            };
+            if (ReadBlockGzip(path, start, use)) {
+                return img;
+            }
+            file = TReader::New();
+            file->SetFileName(path);
+        }
+    }
     QI::Log(verbose, "Reading image: {}", path);
     file->Update();
     typename TImg::Pointer img = file->GetOutput();
@@ -35,6 +79,122 @@ auto ReadImage(const std::string &path, const bool verbose) -> typename TImg::Po
     return img;
 }
 
+namespace {
+
+/*
+ *  Read the part of the file that choose() picks out of its whole region, using the ImageIO's
+ *  streaming if it has any. The image keeps the geometry of the whole file, but only that part is
+ *  buffered. Block gzip volumes only decompress the blocks that hold the part.
+ */
+template <typename TImg, typename TChoose>
+auto ReadPart(const std::string &path, const TChoose &choose) -> typename TImg::Pointer {
+    auto file = itk::ImageFileReader<TImg>::New();
+    file->SetFileName(path);
+    file->UpdateOutputInformation();
+    auto const full   = file->GetOutput()->GetLargestPossibleRegion();
+    auto const region = choose(full);
+    if constexpr (std::is_floating_point<typename TImg::PixelType>::value &&
+                  (TImg::ImageDimension == 3)) {
+        typename TImg::Pointer img = file->GetOutput();
+        NiftiLayout            nifti;
+        NiftiPart              part;
+        for (int i = 0; i < 3; i++) {
+            part.index[i] = region.GetIndex(i) - full.GetIndex(i);
+            part.size[i]  = region.GetSize(i);
+        }
+        auto const start = [&](char const *head, size_t const head_size, size_t const total) {
+            if (!ParseNiftiLayout(head, head_size, nifti) ||
+                (nifti.dims != std::array<size_t, 4>{
+                                   full.GetSize(0), full.GetSize(1), full.GetSize(2), 1})) {
+                return false;
+            }
+            if (total < NiftiDataEnd(nifti, full.GetNumberOfPixels())) {
+                QI::Fail("Image data is truncated: {}", path);
+            }
+            img->DisconnectPipeline();
+            img->SetBufferedRegion(region);
+            img->Allocate();
+            return true;
+        };
+        if (ReadBlockGzip(
+                path,
+                start,
+                [&](char const *data, size_t const offset, size_t const size) {
+                    CopyNiftiPart(data, offset, size, nifti, part, img->GetBufferPointer());
+                },
+                [&](size_t const offset, size_t const size) {
+                    return NiftiPartInRange(nifti, part, offset, size);
+                })) {
+            return img;
+        }
+        file = itk::ImageFileReader<TImg>::New();
+        file->SetFileName(path);
+        file->UpdateOutputInformation();
+    }
+    file->GetOutput()->SetRequestedRegion(region);
+    file->Update();
+    typename TImg::Pointer img = file->GetOutput();
+    img->DisconnectPipeline();
+    if (img->GetBufferedRegion() == region) {
+        return img;
+    }
+    // The file format could not stream, so cut the part out of what was read
+    typename TImg::Pointer part = TImg::New();
+    part->CopyInformation(img);
+    part->SetRegions(region);
+    part->SetLargestPossibleRegion(img->GetLargestPossibleRegion());
+    part->Allocate();
+    itk::ImageRegionConstIterator<TImg> in(img, region);
+    itk::ImageRegionIterator<TImg>      out(part, region);
+    for (; !in.IsAtEnd(); ++in, ++out) {
+        out.Set(in.Get());
+    }
+    return part;
+}
+
+} // namespace
+
+template <typename TImg>
+auto ReadImageSlab(const std::string &path, const int first, const int slices, const bool verbose)
+    -> typename TImg::Pointer {
+    bool const gzip = (path.size() > 3) && (path.compare(path.size() - 3, 3, ".gz") == 0);
+    if ((first == 0) && gzip && !IsBlockGzip(path)) {
+        QI::Warn("{} is not block gzip, so it will be decompressed from the start for every slab",
+                 path);
+    }
+    constexpr int Axis = TImg::ImageDimension - 1;
+    return ReadPart<TImg>(path, [&](typename TImg::RegionType const &full) {
+        auto region = full;
+        region.GetModifiableIndex()[Axis] += first;
+        region.GetModifiableSize()[Axis] = slices;
+        if (!full.IsInside(region)) {
+            QI::Fail("Slices {} to {} are outside image: {}", first, first + slices - 1, path);
+        }
+        QI::Log(verbose, "Reading slices {} to {} of image: {}", first, first + slices - 1, path);
+        return region;
+    });
+}
+
+template <typename TImg>
+auto ReadImageRegion(const std::string &              path,
+                     const typename TImg::RegionType &region,
+                     const bool                       verbose) -> typename TImg::Pointer {
+    auto img = ReadPart<TImg>(path, [&](typename TImg::RegionType const &full) {
+        if (!full.IsInside(region)) {
+            QI::Fail("Subregion is outside image: {}", path);
+        }
+        QI::Log(verbose, "Reading subregion of image: {}", path);
+        return region;
+    });
+    // Only the region is buffered, so this moves the image rather than the data
+    typename TImg::PointType origin;
+    img->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+    typename TImg::RegionType cropped(region.GetSize());
+    img->SetRegions(cropped);
+    img->SetOrigin(origin);
+    return img;
+}
+
 template <typename TImg>
 auto ReadMagnitudeImage(const std::string &path, const bool verbose) -> typename TImg::Pointer {
     typedef itk::Image<std::complex<typename TImg::PixelType>, TImg::ImageDimension> TComplex;
@@ -69,6 +229,13 @@ template auto ReadImage<SeriesXF>(const std::string &path, const bool verbose) -
     typename SeriesXF::Pointer;
 template auto ReadImage<SeriesXD>(const std::string &path, const bool verbose) ->
     typename SeriesXD::Pointer;
+template auto ReadImageSlab<VolumeF>(const std::string &path,
+                                    const int          first,
+                                    const int          slices,
+                                    const bool         verbose) -> typename VolumeF::Pointer;
+template auto ReadImageRegion<VolumeF>(const std::string &          path,
+                                      const VolumeF::RegionType &region,
+                                      const bool                 verbose) -> VolumeF::Pointer;
 template auto ReadMagnitudeImage<VolumeF>(const std::string &path, const bool verbose) ->
     typename VolumeF::Pointer;
 template auto ReadMagnitudeImage<SeriesF>(const std::string &path, const bool verbose) ->
@@ -15,6 +15,7 @@
 #include "itkDivideImageFilter.h"
 #include "itkImageFileWriter.h"
 
+#include "BlockGzip.h"
 #include "ImageIO.h"
 #include "Log.h"
 
@@ -22,11 +23,14 @@ namespace QI {
 
 template <typename TImg>
 void WriteImage(const TImg *ptr, const std::string &path, const bool verbose) {
+    QI::Log(verbose, "Writing image: {}", path);
+    if (WriteBlockGzipImage(ptr, path)) {
+        return;
+    }
     typedef itk::ImageFileWriter<TImg> TWriter;
     typename TWriter::Pointer          file = TWriter::New();
-    file->SetFileName(path);
     file->SetInput(ptr);
-    QI::Log(verbose, "Writing image: {}", path);
+    file->SetFileName(path);
     file->Update();
 }
 
@@ -0,0 +1,219 @@
+/*
+ *  RawNifti.cpp
+ *
+ *  Copyright (c) 2018 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdint>
+
+#include "RawNifti.h"
+
+namespace QI {
+
+MappedFile::MappedFile(std::string const &path) {
+    int const fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+        void *const p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            m_data = static_cast<char const *>(p);
+            m_size = st.st_size;
+            madvise(p, m_size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd); // The mapping stays valid
+}
+
+MappedFile::~MappedFile() {
+    if (m_data) {
+        munmap(const_cast<char *>(m_data), m_size);
+    }
+}
+
+namespace {
+
+template <typename T> T HeaderField(char const *header, size_t const offset, bool const swap) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, header + offset, sizeof(T));
+    if (swap) {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+template <typename T> void PutField(char *header, size_t const offset, T const value) {
+    std::memcpy(header + offset, &value, sizeof(T));
+}
+
+} // namespace
+
+bool ParseNiftiLayout(char const *header, size_t const size, NiftiLayout &layout) {
+    if ((size < 348) || (std::memcmp(header + 344, "n+1", 4) != 0)) {
+        return false;
+    }
+    layout.swap = (HeaderField<int32_t>(header, 0, false) != 348);
+    if (HeaderField<int32_t>(header, 0, layout.swap) != 348) {
+        return false;
+    }
+    auto const ndim = HeaderField<int16_t>(header, 40, layout.swap);
+    if ((ndim < 1) || (ndim > 7)) {
+        return false;
+    }
+    for (int d = 0; d < 7; d++) {
+        int const n = (d < ndim) ? HeaderField<int16_t>(header, 42 + 2 * d, layout.swap) : 1;
+        if (d < 4) {
+            layout.dims[d] = std::max(n, 1);
+        } else if (n > 1) {
+            return false; // Vector or higher-dimensional data
+        }
+    }
+    switch (HeaderField<int16_t>(header, 70, layout.swap)) {
+    case 2:
+        layout.type = itk::ImageIOBase::UCHAR;
+        break;
+    case 4:
+        layout.type = itk::ImageIOBase::SHORT;
+        break;
+    case 8:
+        layout.type = itk::ImageIOBase::INT;
+        break;
+    case 16:
+        layout.type = itk::ImageIOBase::FLOAT;
+        break;
+    case 64:
+        layout.type = itk::ImageIOBase::DOUBLE;
+        break;
+    case 256:
+        layout.type = itk::ImageIOBase::CHAR;
+        break;
+    case 512:
+        layout.type = itk::ImageIOBase::USHORT;
+        break;
+    case 768:
+        layout.type = itk::ImageIOBase::UINT;
+        break;
+    case 1024:
+        layout.type = itk::ImageIOBase::LONGLONG;
+        break;
+    case 1280:
+        layout.type = itk::ImageIOBase::ULONGLONG;
+        break;
+    default:
+        return false; // Complex, RGB etc.
+    }
+    float const offset = HeaderField<float>(header, 108, layout.swap);
+    float const slope  = HeaderField<float>(header, 112, layout.swap);
+    float const inter  = HeaderField<float>(header, 116, layout.swap);
+    if (!(offset >= 348)) {
+        return false;
+    }
+    layout.offset = static_cast<size_t>(offset);
+    // As nifti1_io, a zero or invalid slope means the data is not scaled
+    layout.slope = (std::isfinite(slope) && slope != 0) ? slope : 1.;
+    layout.inter = (std::isfinite(slope) && slope != 0 && std::isfinite(inter)) ? inter : 0.;
+    return true;
+}
+
+std::vector<char> MakeNiftiHeader(NiftiGeometry const &g) {
+    std::vector<char> header(352, 0);
+    char *const       h = header.data();
+    PutField<int32_t>(h, 0, 348);
+    h[38] = 'r';
+    PutField<int16_t>(h, 40, g.ndim);
+    for (int d = 0; d < 7; d++) {
+        PutField<int16_t>(h, 42 + 2 * d, (d < 4) ? g.dims[d] : 1);
+        PutField<float>(h, 80 + 4 * d, (d < 4) ? g.spacing[d] : 1.f);
+    }
+    PutField<int16_t>(h, 70, g.datatype);
+    PutField<int16_t>(h, 72, g.bitpix);
+    PutField<float>(h, 108, 352.f); // vox_offset
+    PutField<float>(h, 112, 1.f);   // scl_slope
+    h[123] = 2 | 8;                 // Millimetres and seconds
+
+    // ITK is LPS, NIfTI is RAS
+    double R[3][3], o[3];
+    for (int i = 0; i < 3; i++) {
+        double const flip = (i < 2) ? -1. : 1.;
+        o[i]              = flip * g.origin[i];
+        for (int j = 0; j < 3; j++) {
+            R[i][j] = flip * g.direction[i][j];
+        }
+    }
+    for (int i = 0; i < 3; i++) { // The sform is the whole affine
+        for (int j = 0; j < 3; j++) {
+            PutField<float>(h, 280 + 16 * i + 4 * j, R[i][j] * g.spacing[j]);
+        }
+        PutField<float>(h, 280 + 16 * i + 12, o[i]);
+    }
+    // The qform stores the rotation as a quaternion, with any reflection of the third axis in qfac
+    double const det = R[0][0] * (R[1][1] * R[2][2] - R[1][2] * R[2][1]) -
+                       R[0][1] * (R[1][0] * R[2][2] - R[1][2] * R[2][0]) +
+                       R[0][2] * (R[1][0] * R[2][1] - R[1][1] * R[2][0]);
+    float const qfac = (det < 0.) ? -1.f : 1.f;
+    for (int i = 0; i < 3; i++) {
+        R[i][2] *= qfac;
+    }
+    // As nifti_mat44_to_quatern(), for a matrix that is already orthonormal
+    double       a, b, c, d;
+    double const trace = R[0][0] + R[1][1] + R[2][2] + 1.;
+    if (trace > 0.5) {
+        a = 0.5 * std::sqrt(trace);
+        b = 0.25 * (R[2][1] - R[1][2]) / a;
+        c = 0.25 * (R[0][2] - R[2][0]) / a;
+        d = 0.25 * (R[1][0] - R[0][1]) / a;
+    } else {
+        double const xd = 1. + R[0][0] - (R[1][1] + R[2][2]);
+        double const yd = 1. + R[1][1] - (R[0][0] + R[2][2]);
+        double const zd = 1. + R[2][2] - (R[0][0] + R[1][1]);
+        if (xd > 1.) {
+            b = 0.5 * std::sqrt(xd);
+            c = 0.25 * (R[0][1] + R[1][0]) / b;
+            d = 0.25 * (R[0][2] + R[2][0]) / b;
+            a = 0.25 * (R[2][1] - R[1][2]) / b;
+        } else if (yd > 1.) {
+            c = 0.5 * std::sqrt(yd);
+            b = 0.25 * (R[0][1] + R[1][0]) / c;
+            d = 0.25 * (R[1][2] + R[2][1]) / c;
+            a = 0.25 * (R[0][2] - R[2][0]) / c;
+        } else {
+            d = 0.5 * std::sqrt(zd);
+            b = 0.25 * (R[0][2] + R[2][0]) / d;
+            c = 0.25 * (R[1][2] + R[2][1]) / d;
+            a = 0.25 * (R[1][0] - R[0][1]) / d;
+        }
+        if (a < 0.) {
+            b = -b;
+            c = -c;
+            d = -d;
+        }
+    }
+    PutField<float>(h, 76, qfac);
+    PutField<int16_t>(h, 252, 1); // Both forms are NIFTI_XFORM_SCANNER_ANAT
+    PutField<int16_t>(h, 254, 1);
+    PutField<float>(h, 256, b);
+    PutField<float>(h, 260, c);
+    PutField<float>(h, 264, d);
+    for (int i = 0; i < 3; i++) {
+        PutField<float>(h, 268 + 4 * i, o[i]);
+    }
+    std::memcpy(h + 344, "n+1", 4);
+    return header;
+}
+
+} // namespace QI
@@ -0,0 +1,407 @@
+#pragma once
+/*
+ *  RawNifti.h
+ *
+ *  Copyright (c) 2018 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Scheduler.h"
+#include "itkImageIOBase.h"
+
+/*
+ *  Helpers for the readers and writers that bypass ImageFileReader/Writer and copy voxel data
+ *  straight between a file or (de)compressed buffer and an image.
+ */
+namespace QI {
+
+using ComponentType = itk::ImageIOBase::IOComponentType;
+
+/*
+ *  Call f with a null pointer of the C++ type matching an ITK component type. Returns false if
+ *  the type is not a real scalar.
+ */
+template <typename F> bool WithComponentType(ComponentType const type, F &&f) {
+    switch (type) {
+    case itk::ImageIOBase::UCHAR:
+        f(static_cast<unsigned char const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::CHAR:
+        f(static_cast<signed char const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::USHORT:
+        f(static_cast<unsigned short const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::SHORT:
+        f(static_cast<short const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::UINT:
+        f(static_cast<unsigned int const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::INT:
+        f(static_cast<int const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::ULONG:
+        f(static_cast<unsigned long const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::LONG:
+        f(static_cast<long const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::ULONGLONG:
+        f(static_cast<unsigned long long const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::LONGLONG:
+        f(static_cast<long long const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::FLOAT:
+        f(static_cast<float const *>(nullptr));
+        return true;
+    case itk::ImageIOBase::DOUBLE:
+        f(static_cast<double const *>(nullptr));
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ *  Copy nt volumes, stored one after another in the file layout, into components [t0, t0 + nt) of
+ *  an interleaved buffer with nvols components per voxel. The copy works on tiles of voxels and
+ *  volumes so that reads and writes both stay in cache, and the tiles are spread across threads.
+ */
+template <typename TIn, typename TOut, typename Convert>
+void Interleave(TIn const *     in,
+                size_t const    voxels,
+                size_t const    t0,
+                size_t const    nt,
+                size_t const    nvols,
+                Convert const &convert,
+                TOut *          out) {
+    constexpr size_t TileVoxels  = 256;
+    constexpr size_t TileVolumes = 16;
+    size_t const     tiles       = (voxels + TileVoxels - 1) / TileVoxels;
+    Scheduler::Get().ParallelFor(tiles, 4, [&](Scheduler::Chunks &chunks) {
+        size_t begin, end;
+        while (chunks.next(begin, end)) {
+            size_t const last = std::min(end * TileVoxels, voxels);
+            for (size_t v0 = begin * TileVoxels; v0 < last; v0 += TileVoxels) {
+                size_t const v1 = std::min(v0 + TileVoxels, last);
+                for (size_t ta = 0; ta < nt; ta += TileVolumes) {
+                    size_t const tb = std::min(ta + TileVolumes, nt);
+                    for (size_t v = v0; v < v1; v++) {
+                        TOut *const o = out + v * nvols + t0;
+                        for (size_t t = ta; t < tb; t++) {
+                            o[t] = convert(in[t * voxels + v]);
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+/*
+ *  Read-only memory map of a whole file. Unmapped on destruction. data() is null if the file could
+ *  not be mapped.
+ */
+class MappedFile {
+  public:
+    explicit MappedFile(std::string const &path);
+    ~MappedFile();
+    MappedFile(MappedFile const &) = delete;
+    void operator=(MappedFile const &) = delete;
+
+    char const *data() const { return m_data; }
+    size_t      size() const { return m_size; }
+
+  private:
+    char const *m_data = nullptr;
+    size_t      m_size = 0;
+};
+
+/*
+ *  What is needed to use the voxel data of a single-file NIfTI-1 in place. NiftiImageIO hides the
+ *  data offset, and reports the rescaled type rather than the stored one, so read the header.
+ */
+struct NiftiLayout {
+    ComponentType         type;
+    size_t                offset;
+    bool                  swap;
+    double                slope, inter;
+    std::array<size_t, 4> dims;
+};
+
+/*
+ *  Parse the start of a single-file NIfTI-1. Returns false if it is not one, or if the data is not
+ *  real and scalar.
+ */
+bool ParseNiftiLayout(char const *data, size_t const size, NiftiLayout &layout);
+
+template <typename T> T Swapped(T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    std::reverse(bytes, bytes + sizeof(T));
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+/*
+ *  Where the data of n values ends in the file
+ */
+inline size_t NiftiDataEnd(NiftiLayout const &layout, size_t const n) {
+    size_t bytes = 0;
+    WithComponentType(layout.type, [&](auto tag) { bytes = sizeof(*tag); });
+    return layout.offset + n * bytes;
+}
+
+/*
+ *  Convert one stored value to TPixel, applying byte-swapping and scaling
+ */
+template <typename TIn, typename TPixel> auto NiftiConverter(NiftiLayout const &layout) {
+    auto const slope  = static_cast<TPixel>(layout.slope);
+    auto const inter  = static_cast<TPixel>(layout.inter);
+    bool const scaled = (layout.slope != 1.) || (layout.inter != 0.);
+    bool const swap   = layout.swap;
+    return [=](TIn const x) {
+        TPixel const y = static_cast<TPixel>(swap ? Swapped(x) : x);
+        return scaled ? y * slope + inter : y;
+    };
+}
+
+/*
+ *  Copy the voxel data of an in-memory single-file NIfTI into an interleaved buffer with nvols
+ *  components per voxel, applying byte-swapping and scaling. Returns false if data is too short.
+ */
+template <typename TPixel>
+bool CopyNiftiData(char const *       data,
+                   size_t const       size,
+                   NiftiLayout const &layout,
+                   size_t const       voxels,
+                   size_t const       nvols,
+                   TPixel *           out) {
+    if (size < NiftiDataEnd(layout, voxels * nvols)) {
+        return false;
+    }
+    return WithComponentType(layout.type, [&](auto tag) {
+        using TIn      = std::remove_const_t<std::remove_pointer_t<decltype(tag)>>;
+        auto const *in = reinterpret_cast<TIn const *>(data + layout.offset);
+        Interleave(in, voxels, 0, nvols, nvols, NiftiConverter<TIn, TPixel>(layout), out);
+    });
+}
+
+/*
+ *  As CopyNiftiData(), but only for the values that start in bytes [begin, begin + size) of the
+ *  file. data holds those bytes, followed by enough of the next ones to finish the last value. This
+ *  lets each block of a compressed file be copied as soon as it is decompressed. It runs on the
+ *  calling thread only, as the blocks are already spread across threads.
+ */
+template <typename TPixel>
+void CopyNiftiRange(char const *       data,
+                    size_t const       begin,
+                    size_t const       size,
+                    NiftiLayout const &layout,
+                    size_t const       voxels,
+                    size_t const       nvols,
+                    TPixel *           out) {
+    WithComponentType(layout.type, [&](auto tag) {
+        using TIn          = std::remove_const_t<std::remove_pointer_t<decltype(tag)>>;
+        auto const convert = NiftiConverter<TIn, TPixel>(layout);
+        // The index of the first value that starts at or after byte
+        auto const index = [&](size_t const byte) -> size_t {
+            if (byte <= layout.offset) {
+                return 0;
+            }
+            return std::min(voxels * nvols, (byte - layout.offset + sizeof(TIn) - 1) / sizeof(TIn));
+        };
+        size_t const first = index(begin);
+        size_t const last  = index(begin + size);
+        size_t       v     = first % voxels;
+        size_t       t     = first / voxels;
+        for (size_t i = first; i < last; i++) {
+            TIn x;
+            std::memcpy(&x, data + (layout.offset + i * sizeof(TIn) - begin), sizeof(TIn));
+            out[v * nvols + t] = convert(x);
+            if (++v == voxels) {
+                v = 0;
+                t++;
+            }
+        }
+    });
+}
+
+/*
+ *  A box of voxels, the same in every volume, e.g. a slab of slices
+ */
+struct NiftiPart {
+    std::array<size_t, 3> index, size;
+};
+
+/*
+ *  Visit the values [first, last) of the file, counted across all volumes, that lie in part. Calls
+ *  f(value, voxel, volume, n) for each row of part that overlaps them, where value is the first
+ *  of the n overlapping values in the row and voxel its index within part. Returns the total n.
+ */
+template <typename F>
+size_t ForNiftiPartRows(NiftiLayout const &layout,
+                        NiftiPart const &  part,
+                        size_t const       first,
+                        size_t const       last,
+                        F &&               f) {
+    auto const & d      = layout.dims;
+    size_t const voxels = d[0] * d[1] * d[2];
+    if (first >= last) {
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t t = first / voxels; t <= (last - 1) / voxels; t++) {
+        for (size_t z = 0; z < part.size[2]; z++) {
+            for (size_t y = 0; y < part.size[1]; y++) {
+                size_t const row = t * voxels +
+                                   ((part.index[2] + z) * d[1] + part.index[1] + y) * d[0] +
+                                   part.index[0];
+                size_t const lo = std::max(row, first);
+                size_t const hi = std::min(row + part.size[0], last);
+                if (lo < hi) {
+                    f(lo, (z * part.size[1] + y) * part.size[0] + (lo - row), t, hi - lo);
+                    count += hi - lo;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+/*
+ *  The index of the first value that starts at or after byte
+ */
+inline size_t NiftiValueIndex(NiftiLayout const &layout, size_t const byte) {
+    size_t bytes = 1;
+    WithComponentType(layout.type, [&](auto tag) { bytes = sizeof(*tag); });
+    size_t const n = layout.dims[0] * layout.dims[1] * layout.dims[2] * layout.dims[3];
+    if (byte <= layout.offset) {
+        return 0;
+    }
+    return std::min(n, (byte - layout.offset + bytes - 1) / bytes);
+}
+
+/*
+ *  True if any value of part starts in bytes [begin, begin + size) of the file, so that a block
+ *  reader can skip the blocks that hold none
+ */
+inline bool NiftiPartInRange(NiftiLayout const &layout,
+                             NiftiPart const &  part,
+                             size_t const       begin,
+                             size_t const       size) {
+    size_t const first = NiftiValueIndex(layout, begin);
+    size_t const last  = NiftiValueIndex(layout, begin + size);
+    return ForNiftiPartRows(layout, part, first, last, [](size_t, size_t, size_t, size_t) {}) > 0;
+}
+
+/*
+ *  As CopyNiftiRange(), but only for the voxels in part, which are copied into an interleaved
+ *  buffer the size of part
+ */
+template <typename TPixel>
+void CopyNiftiPart(char const *       data,
+                   size_t const       begin,
+                   size_t const       size,
+                   NiftiLayout const &layout,
+                   NiftiPart const &  part,
+                   TPixel *           out) {
+    size_t const nvols = layout.dims[3];
+    WithComponentType(layout.type, [&](auto tag) {
+        using TIn          = std::remove_const_t<std::remove_pointer_t<decltype(tag)>>;
+        auto const convert = NiftiConverter<TIn, TPixel>(layout);
+        ForNiftiPartRows(layout,
+                         part,
+                         NiftiValueIndex(layout, begin),
+                         NiftiValueIndex(layout, begin + size),
+                         [&](size_t const i, size_t const v, size_t const t, size_t const n) {
+                             char const *in = data + (layout.offset + i * sizeof(TIn) - begin);
+                             for (size_t j = 0; j < n; j++, in += sizeof(TIn)) {
+                                 TIn x;
+                                 std::memcpy(&x, in, sizeof(TIn));
+                                 out[(v + j) * nvols + t] = convert(x);
+                             }
+                         });
+    });
+}
+
+/*
+ *  NIfTI-1 datatype code and bits per voxel of the pixel types that QUIT writes
+ */
+template <typename T> struct NiftiType;
+template <> struct NiftiType<unsigned char> {
+    static constexpr int16_t code = 2, bits = 8;
+};
+template <> struct NiftiType<int> {
+    static constexpr int16_t code = 8, bits = 32;
+};
+template <> struct NiftiType<float> {
+    static constexpr int16_t code = 16, bits = 32;
+};
+template <> struct NiftiType<double> {
+    static constexpr int16_t code = 64, bits = 64;
+};
+template <> struct NiftiType<std::complex<float>> {
+    static constexpr int16_t code = 32, bits = 64;
+};
+template <> struct NiftiType<std::complex<double>> {
+    static constexpr int16_t code = 1792, bits = 128;
+};
+
+/*
+ *  What goes in the header of a single-file NIfTI-1. The geometry is in ITK's LPS convention, with
+ *  the axes as the columns of direction.
+ */
+struct NiftiGeometry {
+    int16_t               datatype, bitpix, ndim;
+    std::array<size_t, 4> dims;
+    std::array<double, 4> spacing;
+    std::array<double, 3> origin;
+    double                direction[3][3];
+};
+
+template <typename TImg> NiftiGeometry GetNiftiGeometry(TImg const *img) {
+    constexpr int D = TImg::ImageDimension;
+    static_assert((D == 3) || (D == 4), "NIfTI images must be 3D or 4D");
+    using TNifti = NiftiType<typename TImg::PixelType>;
+    NiftiGeometry g;
+    g.datatype      = TNifti::code;
+    g.bitpix        = TNifti::bits;
+    g.ndim          = D;
+    auto const size = img->GetLargestPossibleRegion().GetSize();
+    for (int d = 0; d < 4; d++) {
+        g.dims[d]    = (d < D) ? size[d] : 1;
+        g.spacing[d] = (d < D) ? img->GetSpacing()[d] : 1.;
+    }
+    for (int i = 0; i < 3; i++) {
+        g.origin[i] = img->GetOrigin()[i];
+        for (int j = 0; j < 3; j++) {
+            g.direction[i][j] = img->GetDirection()[i][j];
+        }
+    }
+    return g;
+}
+
+/*
+ *  Everything before the voxel data of a single-file NIfTI-1, i.e. the 348 byte header and an
+ *  empty extension flag, set up as ITK's NIfTI writer would. The voxel data must follow in file
+ *  order, which for an itk::Image is the order of its buffer.
+ */
+std::vector<char> MakeNiftiHeader(NiftiGeometry const &g);
+
+} // namespace QI
@@ -11,18 +11,250 @@
 
 #ifndef QUIT_IMAGEIO_H
 
+#include <algorithm>
+#include <array>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "BlockGzip.h"
 #include "ImageIO.h"
 #include "ImageToVectorFilter.h"
 #include "Log.h"
+#include "RawNifti.h"
 #include "itkImageFileReader.h"
-#include <string>
+#include "itkImageIOFactory.h"
+#include "itkImageRegionConstIterator.h"
 
 namespace QI {
 
+namespace {
+
+/*
+ *  Read a scalar 3D or 4D file straight into a vector image, without an intermediate 4D image.
+ *  Single-file uncompressed NIfTI is memory-mapped and transposed in place, and block gzip NIfTI is
+ *  decompressed in parallel first. Other files are read through their ImageIO in groups of volumes
+ *  if they can stream, otherwise in one go. Returns nullptr if the file needs the general ITK
+ *  pipeline instead.
+ */
+template <typename TVectorImg>
+auto ReadInterleaved(std::string const &path, bool const verbose) -> typename TVectorImg::Pointer {
+    using TPixel = typename TVectorImg::InternalPixelType;
+
+    auto io = itk::ImageIOFactory::CreateImageIO(path.c_str(), itk::ImageIOFactory::ReadMode);
+    if (!io) {
+        return nullptr;
+    }
+    io->SetFileName(path);
+    io->ReadImageInformation();
+    unsigned int const ndims = io->GetNumberOfDimensions();
+    if ((io->GetNumberOfComponents() != 1) || (ndims < 3) || (ndims > 4)) {
+        return nullptr;
+    }
+
+    // Same geometry as ImageFileReader followed by ImageToVectorFilter
+    typename TVectorImg::RegionType    region;
+    typename TVectorImg::SpacingType   spacing;
+    typename TVectorImg::PointType     origin;
+    typename TVectorImg::DirectionType direction;
+    for (int i = 0; i < 3; i++) {
+        region.SetSize(i, io->GetDimensions(i));
+        spacing[i] = io->GetSpacing(i);
+        origin[i]  = io->GetOrigin(i);
+        for (int j = 0; j < 3; j++) {
+            direction[j][i] = io->GetDirection(i)[j];
+        }
+    }
+    size_t const nvols  = (ndims > 3) ? io->GetDimensions(3) : 1;
+    size_t const voxels = region.GetNumberOfPixels();
+    if (!WithComponentType(io->GetComponentType(), [](auto) {})) {
+        return nullptr;
+    }
+
+    typename TVectorImg::Pointer vols = TVectorImg::New();
+    vols->SetRegions(region);
+    vols->SetSpacing(spacing);
+    vols->SetOrigin(origin);
+    vols->SetDirection(direction);
+    vols->SetNumberOfComponentsPerPixel(nvols);
+
+    // Uncompressed NIfTI can be used in place, block gzip can be decompressed on every thread
+    NiftiLayout                 nifti;
+    std::array<size_t, 4> const dims{
+        region.GetSize(0), region.GetSize(1), region.GetSize(2), nvols};
+    auto const start =
+        [&](char const *head, size_t const size, size_t const total, char const *how) {
+            if (!ParseNiftiLayout(head, size, nifti) || (nifti.dims != dims)) {
+                return false;
+            }
+            if (total < NiftiDataEnd(nifti, voxels * nvols)) {
+                QI::Fail("Image data is truncated: {}", path);
+            }
+            QI::Log(verbose, "Reading image: {} ({})", path, how);
+            vols->Allocate();
+            return true;
+        };
+    if ((path.size() > 4) && (path.compare(path.size() - 4, 4, ".nii") == 0)) {
+        MappedFile const file(path);
+        if (file.data() && start(file.data(), file.size(), file.size(), "memory-mapped")) {
+            CopyNiftiData(file.data(), file.size(), nifti, voxels, nvols, vols->GetBufferPointer());
+            return vols;
+        }
+    }
+    // Each block is copied into place as soon as it is decompressed
+    if (ReadBlockGzip(
+            path,
+            [&](char const *head, size_t const size, size_t const total) {
+                return start(head, size, total, "block gzip");
+            },
+            [&](char const *data, size_t const offset, size_t const size) {
+                CopyNiftiRange(data, offset, size, nifti, voxels, nvols, vols->GetBufferPointer());
+            })) {
+        return vols;
+    }
+
+    // Read groups of about 64 MB if the file can stream. Seeking in a compressed file means
+    // decompressing from the start, so those are read in one go.
+    bool const   compressed   = (path.size() > 3) && (path.compare(path.size() - 3, 3, ".gz") == 0);
+    size_t const volume_bytes = voxels * io->GetComponentSize();
+    size_t       group        = nvols;
+    if (io->CanStreamRead() && !compressed) {
+        group = std::clamp<size_t>((64 << 20) / std::max<size_t>(volume_bytes, 1), 1, nvols);
+        io->SetUseStreamedReading(true);
+    }
+    QI::Log(verbose, "Reading image: {}", path);
+    vols->Allocate();
+    std::vector<char>  buffer(group * volume_bytes);
+    itk::ImageIORegion io_region(ndims);
+    for (unsigned int d = 0; d < ndims; d++) {
+        io_region.SetIndex(d, 0);
+        io_region.SetSize(d, io->GetDimensions(d));
+    }
+    for (size_t t0 = 0; t0 < nvols; t0 += group) {
+        size_t const nt = std::min(group, nvols - t0);
+        if (ndims > 3) {
+            io_region.SetIndex(3, t0);
+            io_region.SetSize(3, nt);
+        }
+        io->SetIORegion(io_region);
+        io->Read(buffer.data());
+        WithComponentType(io->GetComponentType(), [&](auto tag) {
+            using TIn          = std::remove_const_t<std::remove_pointer_t<decltype(tag)>>;
+            auto const *in     = reinterpret_cast<TIn const *>(buffer.data());
+            auto const convert = [](TIn const x) { return static_cast<TPixel>(x); };
+            Interleave(in, voxels, t0, nt, nvols, convert, vols->GetBufferPointer());
+        });
+    }
+    return vols;
+}
+
+/*
+ *  Read the part of the file that choose() picks out of its whole 4D region. The vector image
+ *  keeps the geometry of the whole file, but only that part is buffered. Block gzip files only
+ *  decompress the blocks that hold the part, other compressed files are decompressed from the
+ *  start every time.
+ */
+template <typename TVectorImg, typename TChoose>
+auto ReadVectorPart(const std::string &path, const TChoose &choose) ->
+    typename TVectorImg::Pointer {
+    using TPixel  = typename TVectorImg::InternalPixelType;
+    using TSeries = itk::Image<TPixel, 4>;
+    using TReader = itk::ImageFileReader<TSeries>;
+
+    auto file = TReader::New();
+    file->SetFileName(path);
+    file->UpdateOutputInformation();
+    auto const series        = file->GetOutput();
+    auto const series_region = series->GetLargestPossibleRegion();
+    auto const region        = choose(series_region);
+
+    // Same geometry as ImageToVectorFilter, but only the part is buffered
+    typename TVectorImg::RegionType    full, part;
+    typename TVectorImg::SpacingType   spacing;
+    typename TVectorImg::PointType     origin;
+    typename TVectorImg::DirectionType direction;
+    for (int i = 0; i < 3; i++) {
+        full.SetIndex(i, series_region.GetIndex()[i]);
+        full.SetSize(i, series_region.GetSize()[i]);
+        part.SetIndex(i, region.GetIndex()[i]);
+        part.SetSize(i, region.GetSize()[i]);
+        spacing[i] = series->GetSpacing()[i];
+        origin[i]  = series->GetOrigin()[i];
+        for (int j = 0; j < 3; j++) {
+            direction[i][j] = series->GetDirection()[i][j];
+        }
+    }
+    size_t const                 nvols = region.GetSize()[3];
+    typename TVectorImg::Pointer vols  = TVectorImg::New();
+    vols->SetRegions(part);
+    vols->SetLargestPossibleRegion(full);
+    vols->SetSpacing(spacing);
+    vols->SetOrigin(origin);
+    vols->SetDirection(direction);
+    vols->SetNumberOfComponentsPerPixel(nvols);
+
+    if constexpr (std::is_floating_point<TPixel>::value) {
+        NiftiLayout                 nifti;
+        NiftiPart                   nifti_part;
+        std::array<size_t, 4> const dims{series_region.GetSize(0),
+                                         series_region.GetSize(1),
+                                         series_region.GetSize(2),
+                                         series_region.GetSize(3)};
+        for (int i = 0; i < 3; i++) {
+            nifti_part.index[i] = part.GetIndex()[i] - full.GetIndex()[i];
+            nifti_part.size[i]  = part.GetSize()[i];
+        }
+        auto const start = [&](char const *head, size_t const size, size_t const total) {
+            if (!ParseNiftiLayout(head, size, nifti) || (nifti.dims != dims) ||
+                (region.GetSize(3) != dims[3])) {
+                return false;
+            }
+            if (total < NiftiDataEnd(nifti, full.GetNumberOfPixels() * dims[3])) {
+                QI::Fail("Image data is truncated: {}", path);
+            }
+            vols->Allocate();
+            return true;
+        };
+        if (ReadBlockGzip(
+                path,
+                start,
+                [&](char const *data, size_t const offset, size_t const size) {
+                    CopyNiftiPart(data, offset, size, nifti, nifti_part, vols->GetBufferPointer());
+                },
+                [&](size_t const offset, size_t const size) {
+                    return NiftiPartInRange(nifti, nifti_part, offset, size);
+                })) {
+            return vols;
+        }
+    }
+
+    series->SetRequestedRegion(region);
+    file->Update();
+    vols->Allocate();
+    // The series is stored volume by volume, the vector image voxel by voxel
+    size_t const                           voxels = part.GetNumberOfPixels();
+    TPixel *                               out    = vols->GetBufferPointer();
+    itk::ImageRegionConstIterator<TSeries> in(series, region);
+    for (size_t t = 0; t < nvols; t++) {
+        for (size_t v = 0; v < voxels; v++, ++in) {
+            out[v * nvols + t] = in.Get();
+        }
+    }
+    return vols;
+}
+
+} // namespace
+
 template <typename TVectorImg>
 auto ReadImage(const std::string &path, const bool verbose) -> typename TVectorImg::Pointer {
+    using TPixel = typename TVectorImg::InternalPixelType;
+    if constexpr (std::is_floating_point<TPixel>::value) {
+        if (auto vols = ReadInterleaved<TVectorImg>(path, verbose)) {
+            return vols;
+        }
+    }
 
-    using TPixel    = typename TVectorImg::InternalPixelType;
+    // Complex data, or a file that ReadInterleaved() cannot handle
     using TSeries   = itk::Image<TPixel, 4>;
     using TReader   = itk::ImageFileReader<TSeries>;
     using TToVector = itk::ImageToVectorFilter<TSeries>;
@@ -44,10 +276,74 @@ auto ReadImage(const std::string &path, const bool verbose) -> typename TVectorI
     return vols;
 }
 
+template <typename TVectorImg>
+auto ReadImageSlab(const std::string &path, const int first, const int slices, const bool verbose)
+    -> typename TVectorImg::Pointer {
+    bool const gzip = (path.size() > 3) && (path.compare(path.size() - 3, 3, ".gz") == 0);
+    if ((first == 0) && gzip && !IsBlockGzip(path)) {
+        QI::Warn("{} is not block gzip, so it will be decompressed from the start for every slab",
+                 path);
+    }
+    return ReadVectorPart<TVectorImg>(path, [&](auto const &full) {
+        auto region = full;
+        region.GetModifiableIndex()[2] += first;
+        region.GetModifiableSize()[2] = slices;
+        if (!full.IsInside(region)) {
+            QI::Fail("Slices {} to {} are outside image: {}", first, first + slices - 1, path);
+        }
+        QI::Log(verbose, "Reading slices {} to {} of image: {}", first, first + slices - 1, path);
+        return region;
+    });
+}
+
+template <typename TVectorImg>
+auto ReadImageRegion(const std::string &                    path,
+                     const typename TVectorImg::RegionType &region,
+                     const bool                             verbose) ->
+    typename TVectorImg::Pointer {
+    auto vols = ReadVectorPart<TVectorImg>(path, [&](auto const &full) {
+        auto part = full;
+        for (int i = 0; i < 3; i++) {
+            part.SetIndex(i, region.GetIndex()[i]);
+            part.SetSize(i, region.GetSize()[i]);
+        }
+        if (!full.IsInside(part)) {
+            QI::Fail("Subregion is outside image: {}", path);
+        }
+        QI::Log(verbose, "Reading subregion of image: {}", path);
+        return part;
+    });
+    // Only the region is buffered, so this moves the image rather than the data
+    typename TVectorImg::PointType origin;
+    vols->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+    typename TVectorImg::RegionType cropped(region.GetSize());
+    vols->SetRegions(cropped);
+    vols->SetOrigin(origin);
+    return vols;
+}
+
 template auto ReadImage<QI::VectorVolumeF>(const std::string &path, const bool verbose)
     -> QI::VectorVolumeF::Pointer;
 template auto ReadImage<QI::VectorVolumeXF>(const std::string &path, const bool verbose)
     -> QI::VectorVolumeXF::Pointer;
+template auto ReadImageSlab<QI::VectorVolumeF>(const std::string &path,
+                                              const int          first,
+                                              const int          slices,
+                                              const bool         verbose)
+    -> QI::VectorVolumeF::Pointer;
+template auto ReadImageSlab<QI::VectorVolumeXF>(const std::string &path,
+                                               const int          first,
+                                               const int          slices,
+                                               const bool         verbose)
+    -> QI::VectorVolumeXF::Pointer;
+template auto ReadImageRegion<QI::VectorVolumeF>(const std::string &                    path,
+                                                const QI::VectorVolumeF::RegionType &region,
+                                                const bool                           verbose)
+    -> QI::VectorVolumeF::Pointer;
+template auto ReadImageRegion<QI::VectorVolumeXF>(const std::string &                     path,
+                                                 const QI::VectorVolumeXF::RegionType &region,
+                                                 const bool                            verbose)
+    -> QI::VectorVolumeXF::Pointer;
 
 } // namespace QI
 
@@ -14,9 +14,12 @@
 #include "itkComplexToModulusImageFilter.h"
 #include "itkDivideImageFilter.h"
 #include "itkImageFileWriter.h"
+#include "itkImageIORegion.h"
+#include "itkImageRegionIterator.h"
 
 #include "VectorToImageFilter.h"
 
+#include "BlockGzip.h"
 #include "ImageIO.h"
 #include "Log.h"
 
@@ -31,10 +34,13 @@ void WriteImage(const TVImg *img, const std::string &path, const bool verbose) {
     convert->SetInput(img);
     convert->Update();
 
+    QI::Log(verbose, "Writing image: {}", path);
+    if (WriteBlockGzipImage(convert->GetOutput(), path)) {
+        return;
+    }
     typename TWriter::Pointer file = TWriter::New();
-    file->SetFileName(path);
     file->SetInput(convert->GetOutput());
-    QI::Log(verbose, "Writing image: {}", path);
+    file->SetFileName(path);
     file->Update();
 }
 
@@ -43,6 +49,68 @@ void WriteImage(const itk::SmartPointer<TVImg> &ptr, const std::string &path, co
     WriteImage(ptr.GetPointer(), path, verbose);
 }
 
+template <typename TVImg>
+void WriteImageSlab(const TVImg *img, const std::string &path, const bool verbose) {
+    using TPixel  = typename TVImg::InternalPixelType;
+    using TSeries = itk::Image<TPixel, 4>;
+    using TWriter = itk::ImageFileWriter<TSeries>;
+
+    // Same geometry as VectorToImageFilter, but only the slab is buffered
+    auto const                      full  = img->GetLargestPossibleRegion();
+    auto const                      slab  = img->GetBufferedRegion();
+    size_t const                    nvols = img->GetNumberOfComponentsPerPixel();
+    typename TSeries::RegionType    series_full, series_slab;
+    typename TSeries::SpacingType   spacing;
+    typename TSeries::PointType     origin;
+    typename TSeries::DirectionType direction;
+    spacing.Fill(1);
+    origin.Fill(1);
+    direction.SetIdentity();
+    for (int i = 0; i < 3; i++) {
+        series_full.SetIndex(i, full.GetIndex()[i]);
+        series_full.SetSize(i, full.GetSize()[i]);
+        series_slab.SetIndex(i, slab.GetIndex()[i]);
+        series_slab.SetSize(i, slab.GetSize()[i]);
+        spacing[i] = img->GetSpacing()[i];
+        origin[i]  = img->GetOrigin()[i];
+        for (int j = 0; j < 3; j++) {
+            direction[i][j] = img->GetDirection()[i][j];
+        }
+    }
+    series_full.SetIndex(3, 0);
+    series_full.SetSize(3, nvols);
+    series_slab.SetIndex(3, 0);
+    series_slab.SetSize(3, nvols);
+
+    auto series = TSeries::New();
+    series->SetRegions(series_slab);
+    series->SetLargestPossibleRegion(series_full);
+    series->SetSpacing(spacing);
+    series->SetOrigin(origin);
+    series->SetDirection(direction);
+    series->Allocate();
+    size_t const                      voxels = slab.GetNumberOfPixels();
+    TPixel const *                    in     = img->GetBufferPointer();
+    itk::ImageRegionIterator<TSeries> out(series, series_slab);
+    for (size_t t = 0; t < nvols; t++) {
+        for (size_t v = 0; v < voxels; v++, ++out) {
+            out.Set(in[v * nvols + t]);
+        }
+    }
+
+    itk::ImageIORegion io_region(4);
+    for (int i = 0; i < 4; i++) {
+        io_region.SetIndex(i, series_slab.GetIndex()[i] - series_full.GetIndex()[i]);
+        io_region.SetSize(i, series_slab.GetSize()[i]);
+    }
+    auto file = TWriter::New();
+    file->SetFileName(path);
+    file->SetInput(series);
+    file->SetIORegion(io_region);
+    QI::Log(verbose, "Writing slab of image: {}", path);
+    file->Update();
+}
+
 template <typename TVImg>
 void WriteMagnitudeImage(const TVImg *img, const std::string &path, const bool verbose) {
     using TToSeries   = itk::VectorToImageFilter<TVImg>;
@@ -99,6 +167,12 @@ template void WriteImage<VectorVolumeXF>(const itk::SmartPointer<VectorVolumeXF>
                                          const std::string &path, const bool verbose);
 template void WriteImage<VectorVolumeI>(const itk::SmartPointer<VectorVolumeI> &ptr,
                                         const std::string &path, const bool verbose);
+template void WriteImageSlab<VectorVolumeF>(const VectorVolumeF *img,
+                                            const std::string &  path,
+                                            const bool           verbose);
+template void WriteImageSlab<VectorVolumeXF>(const VectorVolumeXF *img,
+                                             const std::string &   path,
+                                             const bool            verbose);
 template void WriteMagnitudeImage<VectorVolumeXF>(const VectorVolumeXF *ptr,
                                                   const std::string &path, const bool verbose);
 template void WriteMagnitudeImage<VectorVolumeXF>(const itk::SmartPointer<VectorVolumeXF> &ptr,
@@ -0,0 +1,82 @@
+/*
+ *  WriteQueue.cpp
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "WriteQueue.h"
+
+namespace QI {
+
+WriteQueue::WriteQueue(int const threads) {
+    for (int i = 0; i < threads; i++) {
+        m_threads.emplace_back(&WriteQueue::Work, this);
+    }
+}
+
+WriteQueue::~WriteQueue() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_queued.notify_all();
+    for (auto &t : m_threads) {
+        t.join();
+    }
+}
+
+void WriteQueue::Push(Write write) {
+    if (m_threads.empty()) {
+        write();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(write));
+        m_pending++;
+    }
+    m_queued.notify_one();
+}
+
+void WriteQueue::Wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finished.wait(lock, [this] { return m_pending == 0; });
+    if (m_error) {
+        auto const error = m_error;
+        m_error          = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void WriteQueue::Work() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_queued.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+        if (m_queue.empty()) { // Only stop once the queue has drained
+            return;
+        }
+        Write const write = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            write();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && !m_error) {
+            m_error = error;
+        }
+        if (--m_pending == 0) {
+            m_finished.notify_all();
+        }
+    }
+}
+
+} // namespace QI
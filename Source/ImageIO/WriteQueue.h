@@ -0,0 +1,62 @@
+#pragma once
+/*
+ *  WriteQueue.h
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace QI {
+
+/*
+ *  A few background threads that run queued writes, so that several output files can be
+ *  compressed and written at once, or while the caller carries on fitting. Writing is mostly
+ *  waiting on zlib and the disk, so these are separate from the Scheduler's workers, but any
+ *  ParallelFor() inside a write (e.g. block gzip) still shares the Scheduler.
+ *
+ *  Each write must keep its own references to whatever it writes. Images that belong to a
+ *  pipeline should be grafted onto a fresh image first, as ITK pipelines are not thread-safe.
+ */
+class WriteQueue {
+  public:
+    using Write = std::function<void()>;
+
+    explicit WriteQueue(int const threads); //!< With 0 threads Push() writes straight away
+    ~WriteQueue();                          //!< Finishes the queue, but errors are lost
+
+    WriteQueue(const WriteQueue &) = delete;
+    void operator=(const WriteQueue &) = delete;
+
+    void Push(Write write);
+
+    /*
+     *  Block until every queued write has finished, then rethrow the first exception that any of
+     *  them threw
+     */
+    void Wait();
+
+  private:
+    void Work();
+
+    std::vector<std::thread> m_threads;
+    std::deque<Write>        m_queue;
+    size_t                   m_pending = 0; // Queued or running
+    bool                     m_stop    = false;
+    std::exception_ptr       m_error;
+    std::mutex               m_mutex;
+    std::condition_variable  m_queued, m_finished;
+};
+
+} // namespace QI
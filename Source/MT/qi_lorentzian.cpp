@@ -175,12 +175,19 @@ int lorentzian_main(args::Subparser &parser) {
                                          mask.Get(),
                                          verbose,
                                          simulate.Get(),
-                                         subregion.Get());
+                                         subregion.Get(),
+                                         seed.Get());
         } else {
             LFit fit{model};
             auto fit_filter =
                 QI::ModelFitFilter<LFit>::New(&fit, verbose, covar, resids, subregion.Get());
+            fit_filter->SetStreaming(stream.Get());
+            fit_filter->SetWriters(writers.Get(), overlap);
+            fit_filter->SetPackOutputs(pack);
             fit_filter->ReadInputs({input_path.Get()}, {}, mask.Get());
+            fit_filter->SetChunkSize(chunk.Get());
+            fit_filter->SetWarmStart(warm);
+            fit_filter->SetCheckpoint(checkpoint.Get(), resume);
             fit_filter->Update();
             fit_filter->WriteOutputs(prefix.Get() + "LTZ_");
             QI::Log(verbose, "Finished.");
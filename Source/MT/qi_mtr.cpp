@@ -17,7 +17,6 @@
 #include "Util.h"
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
-#include "itkMultiThreaderBase.h"
 
 struct MTContrast {
     std::string               name;
@@ -60,7 +59,7 @@ void to_json(json &j, const MTContrast &s) {
 int mtr_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(
         parser, "INPUT", "Input file with different MT contrasts");
-    args::ValueFlag<int>         threads(parser,
+    QI::ThreadsFlag              threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -99,9 +98,7 @@ int mtr_main(args::Subparser &parser) {
     }
 
     QI::Info(verbose, "Processing");
-    auto mt = itk::MultiThreaderBase::New();
-    mt->SetNumberOfWorkUnits(threads.Get());
-    mt->ParallelizeImageRegion<3>(
+    QI::ParallelizeImageRegion<3>(
         input_img->GetBufferedRegion(),
         [&](const QI::VolumeF::RegionType &region) {
             itk::ImageRegionConstIterator<QI::VectorVolumeF> in_it(input_img, region);
@@ -45,7 +45,8 @@ int mtsat_main(args::Subparser &parser) {
             mask.Get(),
             verbose,
             simulate.Get(),
-            subregion.Get());
+            subregion.Get(),
+            seed.Get());
     } else {
         auto pdw_img = QI::ReadImage(QI::CheckPos(pdw_path), verbose);
         auto t1w_img = QI::ReadImage(QI::CheckPos(t1w_path), verbose);
@@ -66,7 +67,7 @@ int mtsat_main(args::Subparser &parser) {
 
         std::array<QI::VolumeF::Pointer, 3> outs{A_img, R1_img, d_img};
 
-        QI::ModelFunc(model, {pdw_img, t1w_img, mtw_img}, {B1_img}, mask_img, threads.Get(), outs);
+        QI::ModelFunc(model, {pdw_img, t1w_img, mtw_img}, {B1_img}, mask_img, outs);
         QI::Info(verbose, "Finished");
         QI::WriteImage(A_img, prefix.Get() + "MTSat_PD" + QI::OutExt(), verbose);
         QI::WriteImage(R1_img, prefix.Get() + "MTSat_R1" + QI::OutExt(), verbose);
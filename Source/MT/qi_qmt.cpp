@@ -167,14 +167,21 @@ int qmt_main(args::Subparser &parser) {
                                               mask.Get(),
                                               verbose,
                                               simulate.Get(),
-                                              subregion.Get());
+                                              subregion.Get(),
+                                              seed.Get());
     } else {
         RamaniFitFunction fit{model};
 
         auto fit_filter = QI::ModelFitFilter<RamaniFitFunction>::New(
             &fit, verbose, covar, resids, subregion.Get());
+        fit_filter->SetStreaming(stream.Get());
+        fit_filter->SetWriters(writers.Get(), overlap);
+        fit_filter->SetPackOutputs(pack);
         fit_filter->ReadInputs(
             {mtsat_path.Get()}, {f0.Get(), B1.Get(), QI::CheckValue(T1)}, mask.Get());
+        fit_filter->SetChunkSize(chunk.Get());
+        fit_filter->SetWarmStart(warm);
+        fit_filter->SetCheckpoint(checkpoint.Get(), resume);
         fit_filter->Update();
         fit_filter->WriteOutputs(prefix.Get() + "QMT_");
         QI::Log(verbose, "Finished.");
@@ -135,8 +135,8 @@ struct EMTFit {
         const Eigen::ArrayXd &a     = inputs[1];
         const Eigen::ArrayXd &b     = inputs[2];
 
-        auto *cost = new ceres::AutoDiffCostFunction<EMTCost, ceres::DYNAMIC, 5>(
-            new EMTCost{model, fixed, G, b}, G.size() + b.size());
+        auto *cost =
+            QI::MakeAutoDiffCost<EMTCost, 5>(new EMTCost{model, fixed, G, b}, G.size() + b.size());
         ceres::LossFunction *loss = new ceres::HuberLoss(1.0);
         p                         = model.start;
         ceres::Problem problem;
@@ -212,19 +212,23 @@ int ssfp_emt_main(args::Subparser &parser) {
                                           mask.Get(),
                                           verbose,
                                           simulate.Get(),
-                                          subregion.Get());
+                                          subregion.Get(),
+                                          seed.Get());
     } else {
         // First calculate T2_f
-        auto a_input = QI::ReadImage<QI::VectorVolumeF>(a_path.Get(), verbose);
+        // Cropped to the subregion like the fit inputs, so T2_f lines up with them
+        auto a_input =
+            subregion ? QI::ReadImageRegion<QI::VectorVolumeF>(
+                            a_path.Get(),
+                            QI::RegionFromString<QI::VolumeF::RegionType>(subregion.Get()),
+                            verbose) :
+                        QI::ReadImage<QI::VectorVolumeF>(a_path.Get(), verbose);
 
         auto T2_f_calc = QI::NewImageLike(a_input);
 
         QI::Info(verbose, "Calculating T2_f");
-        auto mt = itk::MultiThreaderBase::New();
-        mt->SetNumberOfWorkUnits(threads.Get());
-        mt->ParallelizeImageRegion<3>(
-            subregion ? QI::RegionFromString<QI::VolumeF::RegionType>(subregion.Get()) :
-                        a_input->GetBufferedRegion(),
+        QI::ParallelizeImageRegion<3>(
+            a_input->GetBufferedRegion(),
             [&](const QI::VectorVolumeF::RegionType &region) {
                 itk::ImageRegionConstIterator<QI::VectorVolumeF> a_it(a_input, region);
                 itk::ImageRegionIterator<QI::VolumeF>            T2_f_it(T2_f_calc, region);
@@ -242,9 +246,15 @@ int ssfp_emt_main(args::Subparser &parser) {
         EMTFit fit{model};
         auto   fit_filter =
             QI::ModelFitFilter<EMTFit>::New(&fit, verbose, covar, resids, subregion.Get());
+        fit_filter->SetStreaming(stream.Get());
+        fit_filter->SetWriters(writers.Get(), overlap);
+        fit_filter->SetPackOutputs(pack);
         fit_filter->ReadInputs(
             {G_path.Get(), a_path.Get(), b_path.Get()}, {B1.Get(), ""}, mask.Get());
         fit_filter->SetFixed(1, T2_f_calc);
+        fit_filter->SetChunkSize(chunk.Get());
+        fit_filter->SetWarmStart(warm);
+        fit_filter->SetCheckpoint(checkpoint.Get(), resume);
         fit_filter->Update();
         fit_filter->WriteOutputs(prefix.Get() + "EMT_");
         QI::WriteImage(T2_f_calc, prefix.Get() + "EMT_T2_f" + QI::OutExt(), verbose);
@@ -15,7 +15,6 @@
 
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
-#include "itkMultiThreaderBase.h"
 
 // #define QI_DEBUG_BUILD 1
 
@@ -30,7 +29,7 @@ int zspec_b1_main(args::Subparser &parser) {
     args::Positional<std::string>     b1_path(parser, "B1", "Path to B1-map");
     args::PositionalList<std::string> input_paths(
         parser, "INPUTS", "Input Z-spectra files (1 file per B1 level)");
-    args::ValueFlag<int>         threads(parser,
+    QI::ThreadsFlag              threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -74,10 +73,8 @@ int zspec_b1_main(args::Subparser &parser) {
 
     QI::VolumeF::Pointer const mask_image = mask ? QI::ReadImage(mask.Get(), verbose) : nullptr;
 
-    auto mt = itk::MultiThreaderBase::New();
     QI::Log(verbose, "Processing");
-    mt->SetNumberOfWorkUnits(threads.Get());
-    mt->ParallelizeImageRegion<3>(
+    QI::ParallelizeImageRegion<3>(
         inputs.front()->GetBufferedRegion(),
         [&](const QI::VectorVolumeF::RegionType &region) {
             auto b1_it = itk::ImageRegionConstIterator<QI::VolumeF>(b1_image, region);
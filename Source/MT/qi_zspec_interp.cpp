@@ -13,7 +13,6 @@
 
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
-#include "itkMultiThreaderBase.h"
 
 // #define QI_DEBUG_BUILD 1
 
@@ -26,7 +25,7 @@
 
 int zspec_interp_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "INPUT", "Input Z-spectrum file");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -81,10 +80,8 @@ int zspec_interp_main(args::Subparser &parser) {
     auto const          process_region = subregion ?
                                     QI::RegionFromString<QI::VolumeF::RegionType>(subregion.Get()) :
                                     input->GetBufferedRegion();
-    auto mt = itk::MultiThreaderBase::New();
     QI::Log(verbose, "Processing");
-    mt->SetNumberOfWorkUnits(threads.Get());
-    mt->ParallelizeImageRegion<3>(
+    QI::ParallelizeImageRegion<3>(
         process_region,
         [&](const QI::VectorVolumeF::RegionType &region) {
             itk::ImageRegionConstIterator<QI::VectorVolumeF> in_it(input, region);
@@ -1,10 +1,14 @@
 #pragma once
 
 #include "Macro.h"
+#include "MatrixExp.h"
 #include <Eigen/Dense>
 #include <functional>
-#include <unsupported/Eigen/MatrixFunctions>
 
+/*
+ *  Everything below is templated on the scalar type, so that the models can be evaluated with
+ *  Ceres Jets. Jets have no implicit conversion from double, hence the explicit T(...) casts.
+ */
 template <typename AugmentedMatrix>
 auto SolveSteadyState(AugmentedMatrix const &X)
     -> Eigen::Vector<typename AugmentedMatrix::Scalar, AugmentedMatrix::RowsAtCompileTime> {
@@ -19,7 +23,7 @@ auto SolveSteadyState(AugmentedMatrix const &X)
     ReducedVector   b    = -X.template topRightCorner<N - 1, 1>();
     ReducedVector   m_ss = Xr.partialPivLu().solve(b);
     AugmentedVector m_aug;
-    m_aug << m_ss, 1.;
+    m_aug << m_ss, T(1.);
     return m_aug;
 }
 
@@ -37,8 +41,87 @@ auto GeometricAvg(AugmentedMatrix const &X,
 
     AugmentedMatrix const LHS = (AugmentedMatrix::Identity() - X);
     ReducedVector const   RHS = ((AugmentedMatrix::Identity() - Xn) * a).template head<N - 1>() -
-                              (n * LHS.template topRightCorner<N - 1, 1>());
+                              (T(n) * LHS.template topRightCorner<N - 1, 1>());
     ReducedVector const m_gm =
-        LHS.template topLeftCorner<N - 1, N - 1>().partialPivLu().solve(RHS) / n;
+        LHS.template topLeftCorner<N - 1, N - 1>().partialPivLu().solve(RHS) / T(n);
     return m_gm;
 }
+
+/*
+ *  Propagators for the PARMESAN models. These are evaluated for every segment on every model
+ *  evaluation, so avoid the general matrix exponential where the structure allows.
+ */
+
+// Augmented propagator for dm/dt = A m + b over time t, i.e. [exp(At), A^-1 (exp(At) - I) b]
+template <typename T>
+Eigen::Matrix<T, 3, 3>
+AffineExp2(Eigen::Matrix<T, 2, 2> const &A, Eigen::Vector<T, 2> const &b, double const t) {
+    Eigen::Matrix<T, 2, 2> const E = QI::Expm2<T>(A * T(t));
+    Eigen::Matrix<T, 3, 3>       X = Eigen::Matrix<T, 3, 3>::Identity();
+    X.template topLeftCorner<2, 2>()  = E;
+    X.template topRightCorner<2, 1>() =
+        A.inverse() * ((E - Eigen::Matrix<T, 2, 2>::Identity()) * b);
+    return X;
+}
+
+// X^n for integer n >= 0 by repeated squaring
+template <typename AugmentedMatrix> AugmentedMatrix MatrixPow(AugmentedMatrix X, int n) {
+    AugmentedMatrix P = AugmentedMatrix::Identity();
+    while (n > 0) {
+        if (n & 1) {
+            P = P * X;
+        }
+        n >>= 1;
+        if (n) {
+            X = X * X;
+        }
+    }
+    return P;
+}
+
+/*
+ *  Single-pool propagators in (Mx, My, Mz, 1). Relaxation alone is diagonal. During a pulse
+ *  about x, Mx only relaxes and (My, Mz) is a 2x2 affine system.
+ */
+template <typename T>
+Eigen::Matrix<T, 4, 4> RelaxProp(T const &R1, T const &R2, double const t) {
+    T const                E1 = exp(-R1 * t);
+    T const                E2 = exp(-R2 * t);
+    Eigen::Matrix<T, 4, 4> X  = Eigen::Matrix<T, 4, 4>::Zero();
+    X(0, 0)                   = E2;
+    X(1, 1)                   = E2;
+    X(2, 2)                   = E1;
+    X(2, 3)                   = 1. - E1;
+    X(3, 3)                   = T(1.);
+    return X;
+}
+
+template <typename T>
+Eigen::Matrix<T, 4, 4> PulseProp(T const &R1, T const &R2, T const &B1x, double const t) {
+    Eigen::Matrix<T, 2, 2> A;
+    A << -R2, B1x, //
+        -B1x, -R1;
+    Eigen::Vector<T, 2> const    b{T(0.), R1};
+    Eigen::Matrix<T, 3, 3> const Y = AffineExp2<T>(A, b, t);
+    Eigen::Matrix<T, 4, 4>       X = Eigen::Matrix<T, 4, 4>::Zero();
+    X(0, 0)                        = exp(-R2 * t);
+    X.template bottomRightCorner<3, 3>() = Y;
+    return X;
+}
+
+/*
+ *  Two-pool (free water and bound) relaxation in (Mx_f, My_f, Mz_f, Mz_b, 1). L is the
+ *  longitudinal relaxation and exchange block and b the recovery terms.
+ */
+template <typename T>
+Eigen::Matrix<T, 5, 5> RelaxPropMT(T const &                     R2_f,
+                                   Eigen::Matrix<T, 2, 2> const &L,
+                                   Eigen::Vector<T, 2> const &   b,
+                                   double const                  t) {
+    T const                E2 = exp(-R2_f * t);
+    Eigen::Matrix<T, 5, 5> X  = Eigen::Matrix<T, 5, 5>::Zero();
+    X(0, 0)                   = E2;
+    X(1, 1)                   = E2;
+    X.template bottomRightCorner<3, 3>() = AffineExp2<T>(L, b, t);
+    return X;
+}
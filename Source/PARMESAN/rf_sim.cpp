@@ -35,7 +35,7 @@ double round_sig(double value, int digits) {
  */
 int rf_sim_main(args::Subparser &parser) {
     args::Flag uT(parser, "uT", "Units are microTesla, not radians per second", {'u', "uT"});
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -3,8 +3,9 @@
 #include "parmesan.hpp"
 #include "ss_T2.h"
 
-auto SS_T1T2_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double) {
-    using T      = double;
+template <typename T>
+auto SS_T1T2_Model::typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(T) {
     using AugMat = Eigen::Matrix<T, 4, 4>; // Short for Augmented Matrix
     using AugVec = Eigen::Vector<T, 4>;
 
@@ -16,49 +17,45 @@ auto SS_T1T2_Model::signal(VaryingArray const &v, FixedArray const &) const -> Q
     T const &B1plus = v[4];
 
     // Relaxation
-    AugMat R;
-    R << -R2, 0, 0, 0, //
-        0, -R2, 0, 0,  //
-        0, 0, -R1, R1, //
-        0, 0, 0, 0;
+    AugMat R = AugMat::Zero();
+    R(0, 0)  = -R2;
+    R(1, 1)  = -R2;
+    R(2, 2)  = -R1;
+    R(2, 3)  = R1;
 
     // Spoiling
-    AugMat S;
-    S << 0, 0, 0, 0, //
-        0, 0, 0, 0,  //
-        0, 0, 1, 0,  //
-        0, 0, 0, 1;
+    AugMat const S = Eigen::Vector<T, 4>(T(0.), T(0.), T(1.), T(1.)).asDiagonal();
 
     QI_DBMAT(R);
     // Useful for later
     auto RF =
         [&R, &f0, &B1plus](double const alpha, double const tau, double const df, double const p1) {
-            AugMat  rf;
-            T const B1nom = alpha / (p1 * tau);
+            T const B1nom = T(alpha / (p1 * tau));
             T const B1    = B1plus * B1nom;
             T const dw    = 2. * M_PI * (f0 + df);
-            rf << 0, dw, 0, 0, //
-                -dw, 0, B1, 0, //
-                0, -B1, 0, 0,  //
-                0, 0, 0, 0;
+            AugMat  rf    = AugMat::Zero();
+            rf(0, 1)      = dw;
+            rf(1, 0)      = -dw;
+            rf(1, 2)      = B1;
+            rf(2, 1)      = -B1;
             QI_DBMAT(rf);
-            AugMat const Arf = ((rf + R) * tau).exp();
+            AugMat const Arf = QI::Expm(AugMat((rf + R) * T(tau)));
             QI_DBMAT(Arf);
             return Arf;
         };
 
     // Setup constant matrices
-    AugMat const Rrd  = (R * (sequence.TR - sequence.Trf)).exp();
-    AugMat const ramp = (R * sequence.Tramp).exp();
-    // AugMat const prep_spoiler = (R * sequence.Tspoil).exp();
+    AugMat const Rrd  = RelaxProp(R1, R2, sequence.TR - sequence.Trf);
+    AugMat const ramp = RelaxProp(R1, R2, sequence.Tramp);
+    // AugMat const prep_spoiler = RelaxProp(R1, R2, sequence.Tspoil);
 
-    Eigen::ArrayXd sig(sequence.size());
+    QI_ARRAY(T) sig(sequence.size());
     for (long is = 0, ie = sequence.size(); is < ie; is++) {
         AugMat const rfp =
             RF(sequence.prep_FA[is], sequence.prep_Trf, sequence.prep_df[is], sequence.prep_p1);
         AugMat const rf1     = RF(sequence.FA[is], sequence.Trf, 0., 1.);
         AugMat const TR_mat  = S * Rrd * rf1;
-        AugMat const seg_mat = TR_mat.pow(sequence.spokes_per_seg);
+        AugMat const seg_mat = MatrixPow(TR_mat, sequence.spokes_per_seg);
 
         // Calculate the steady-state just before the segment readout
         AugMat const X    = ramp * S * rfp * ramp * seg_mat;
@@ -71,4 +68,9 @@ auto SS_T1T2_Model::signal(VaryingArray const &v, FixedArray const &) const -> Q
     QI_DBVEC(v)
     QI_DBVEC(sig)
     return sig;
-}
\ No newline at end of file
+}
+
+template auto SS_T1T2_Model::typed_signal(QI_ARRAYN(double, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(double);
+template auto SS_T1T2_Model::typed_signal(QI_ARRAYN(Jet, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(Jet);
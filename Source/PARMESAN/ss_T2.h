@@ -7,13 +7,24 @@ struct SS_T1T2_Model : QI::Model<double, double, 5, 0> {
     static int const   NS = 1;
     SSSequence &       sequence;
     VaryingArray const start{30.0, 1.0, 0.07, 0, 1};
-    VaryingArray const lo{0.1, 0.5, 0.01, -250, 0.5};
-    VaryingArray const hi{60.0, 5.0, 2.5, 250, 1.5};
+    VaryingArray const bounds_lo{0.1, 0.5, 0.01, -250, 0.5};
+    VaryingArray const bounds_hi{60.0, 5.0, 2.5, 250, 1.5};
 
     std::array<std::string, NV> const varying_names{"M0", "T1", "T2", "f0", "B1"};
 
-    int  input_size(const int /* Unused */) const { return sequence.size(); }
-    auto signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double);
+    int input_size(const int /* Unused */) const { return sequence.size(); }
+
+    template <typename Derived>
+    auto signal(Eigen::ArrayBase<Derived> const &v, FixedArray const &f) const
+        -> QI_ARRAY(typename Derived::Scalar) {
+        using T = typename Derived::Scalar;
+        return typed_signal<T>(v, f);
+    }
+
+    // Instantiated for double and Jet in the .cpp
+    using Jet = ceres::Jet<double, NV>;
+    template <typename T>
+    auto typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const -> QI_ARRAY(T);
     void derived(const VaryingArray &varying, const FixedArray &, DerivedArray &derived) const;
 };
 
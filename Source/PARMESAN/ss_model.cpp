@@ -3,8 +3,9 @@
 #include "parmesan.hpp"
 #include "ss_model.h"
 
-auto SS_T1_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double) {
-    using T      = double;
+template <typename T>
+auto SS_T1_Model::typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(T) {
     using AugMat = Eigen::Matrix<T, 2, 2>; // Short for Augmented Matrix
     using AugVec = Eigen::Vector<T, 2>;
 
@@ -12,27 +13,32 @@ auto SS_T1_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_
     T const &R1 = 1. / v[1];
     T const &B1 = v[2];
 
-    AugMat R;
-    R << -R1, M0 * R1, //
-        0, 0;
+    // Relaxation, i.e. exp(R t) with R = [-R1, M0 * R1; 0, 0]
+    auto relax = [&](double const t) {
+        T const E1 = exp(-R1 * t);
+        AugMat  X;
+        X << E1, M0 * (1. - E1), //
+            T(0.), T(1.);
+        return X;
+    };
 
     // Setup constant matrices
-    AugMat const Rrd  = (R * sequence.TR).exp();
-    AugMat const ramp = (R * sequence.Tramp).exp();
-    // AugMat const prep_spoiler = (R * sequence.Tspoil).exp();
+    AugMat const Rrd  = relax(sequence.TR);
+    AugMat const ramp = relax(sequence.Tramp);
+    // AugMat const prep_spoiler = relax(sequence.Tspoil);
 
-    Eigen::ArrayXd sig(sequence.size());
+    QI_ARRAY(T) sig(sequence.size());
     for (long is = 0; is < sequence.size(); is++) {
         AugMat rf1;
-        rf1 << cos(B1 * sequence.FA[is]), 0, //
-            0, 1;
+        rf1 << cos(B1 * sequence.FA[is]), T(0.), //
+            T(0.), T(1.);
 
         AugMat TR_mat  = Rrd * rf1;
-        AugMat seg_mat = TR_mat.pow(sequence.spokes_per_seg);
+        AugMat seg_mat = MatrixPow(TR_mat, sequence.spokes_per_seg);
 
         AugMat rfp;
-        rfp << cos(B1 * sequence.prep_FA[is]), 0, //
-            0, 1;
+        rfp << cos(B1 * sequence.prep_FA[is]), T(0.), //
+            T(0.), T(1.);
 
         // Calculate the steady-state just before the segment readout
         AugMat X    = AugMat::Identity();
@@ -51,3 +57,8 @@ auto SS_T1_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_
     QI_DBVEC(sig)
     return sig;
 }
+
+template auto SS_T1_Model::typed_signal(QI_ARRAYN(double, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(double);
+template auto SS_T1_Model::typed_signal(QI_ARRAYN(Jet, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(Jet);
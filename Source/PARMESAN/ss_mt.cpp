@@ -3,11 +3,11 @@
 #include "parmesan.hpp"
 #include "ss_mt.h"
 
-using AugMat = Eigen::Matrix<double, 5, 5>; // Short for Augmented Matrix
-using AugVec = Eigen::Vector<double, 5>;
-
-auto SS_MT_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double) {
-    using T = double;
+template <typename T>
+auto SS_MT_Model::typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(T) {
+    using AugMat = Eigen::Matrix<T, 5, 5>; // Short for Augmented Matrix
+    using AugVec = Eigen::Vector<T, 5>;
 
     T const &M0_f = v[0];
     T const &M0_b = v[1];
@@ -21,27 +21,23 @@ auto SS_MT_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_
     T const &f0   = v[6];
     T const &B1p  = v[7];
 
-    AugMat R;
-    R << -R2_f, 0, 0, 0, 0,          //
-        0, -R2_f, 0, 0, 0,           //
-        0, 0, -R1_f, 0, M0_f * R1_f, //
-        0, 0, 0, -R1_b, M0_b * R1_b, //
-        0, 0, 0, 0, 0;
-
-    AugMat K;
-    K << 0, 0, 0, 0, 0,       //
-        0, 0, 0, 0, 0,        //
-        0, 0, -k_fb, k_bf, 0, //
-        0, 0, k_fb, -k_bf, 0, //
-        0, 0, 0, 0, 0;
+    // Longitudinal relaxation and exchange
+    Eigen::Matrix<T, 2, 2> L;
+    L << -R1_f - k_fb, k_bf, //
+        k_fb, -R1_b - k_bf;
+    Eigen::Vector<T, 2> const b{M0_f * R1_f, M0_b * R1_b};
 
-    AugMat const S = Eigen::DiagonalMatrix<double, 5, 5>({0, 0, 1., 1., 1.}).toDenseMatrix();
+    AugMat RpK                     = AugMat::Zero();
+    RpK(0, 0)                      = -R2_f;
+    RpK(1, 1)                      = -R2_f;
+    RpK.template block<2, 2>(2, 2) = L;
+    RpK.template block<2, 1>(2, 4) = b;
 
-    AugMat const RpK = R + K;
+    AugMat const S = Eigen::Vector<T, 5>(T(0.), T(0.), T(1.), T(1.), T(1.)).asDiagonal();
 
     // Setup constant matrices
-    AugMat const Rrd  = (RpK * (sequence.TR - sequence.Trf)).exp();
-    AugMat const ramp = (RpK * sequence.Tramp).exp();
+    AugMat const Rrd  = RelaxPropMT(R2_f, L, b, sequence.TR - sequence.Trf);
+    AugMat const ramp = RelaxPropMT(R2_f, L, b, sequence.Tramp);
 
     auto RF = [&RpK, &T2_b, &f0, &B1p, this](double const alpha,
                                              double const tau,
@@ -51,22 +47,22 @@ auto SS_MT_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_
         T const B1 = B1p * alpha / (p1 * tau);
         T const dw = 2. * M_PI * (f0 + df);
 
-        T const G = this->lineshape(f0 + df, T2_b);
+        T const G = this->lineshape(T(f0 + df), T2_b);
         T const W = M_PI * B1p * B1p * G * (p2 / (p1 * p1)) * (alpha * alpha) / (tau * tau);
 
-        AugMat rf;
-        rf << 0, dw, 0, 0, 0, //
-            -dw, 0, B1, 0, 0, //
-            0, -B1, 0, 0, 0,  //
-            0, 0, 0, -W, 0,   //
-            0, 0, 0, 0, 0;
+        AugMat rf = AugMat::Zero();
+        rf(0, 1)  = dw;
+        rf(1, 0)  = -dw;
+        rf(1, 2)  = B1;
+        rf(2, 1)  = -B1;
+        rf(3, 3)  = -W;
         QI_DBMAT(rf);
-        AugMat const Arf = ((rf + RpK) * tau).exp();
+        AugMat const Arf = QI::Expm(AugMat((rf + RpK) * T(tau)));
         QI_DBMAT(Arf);
         return Arf;
     };
 
-    Eigen::ArrayXd sig(sequence.size());
+    QI_ARRAY(T) sig(sequence.size());
     for (long is = 0; is < sequence.size(); is++) {
         AugMat const rfp     = RF(sequence.prep_FA[is],
                               sequence.prep_Trf,
@@ -75,7 +71,7 @@ auto SS_MT_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_
                               sequence.prep_p2);
         AugMat const rf1     = RF(sequence.FA[is], sequence.Trf, 0., 1., 1.);
         AugMat       TR_mat  = S * Rrd * rf1;
-        AugMat       seg_mat = TR_mat.pow(sequence.spokes_per_seg);
+        AugMat       seg_mat = MatrixPow(TR_mat, sequence.spokes_per_seg);
 
         // Calculate the steady-state just before the segment readout
         AugMat X    = AugMat::Identity();
@@ -89,10 +85,15 @@ auto SS_MT_Model::signal(VaryingArray const &v, FixedArray const &) const -> QI_
     return sig;
 }
 
+template auto SS_MT_Model::typed_signal(QI_ARRAYN(double, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(double);
+template auto SS_MT_Model::typed_signal(QI_ARRAYN(Jet, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(Jet);
+
 void SS_MT_Model::derived(const VaryingArray &varying,
                           const FixedArray & /* Unused */,
                           DerivedArray &derived) const {
     const auto &M0_f = varying[0];
     const auto &M0_b = varying[1];
     derived[0]       = 100.0 * M0_b / (M0_f + M0_b);
-}
\ No newline at end of file
+}
@@ -9,8 +9,8 @@ struct SS_MT_Model : QI::Model<double, double, 8, 0, 1, 1> {
     SSSequence &        sequence;
     QI::InterpLineshape lineshape;
     VaryingArray const  start{30.0, 3.0, 1.0, 0.1, 12e-6, 30., 0., 1.0};
-    VaryingArray const  lo{0.1, 5e-6, 0.5, 0.005, 5e-6, 1., -250., 0.5};
-    VaryingArray const  hi{60.0, 30.0, 5.0, 5.0, 25e-6, 100., 250., 1.5};
+    VaryingArray const  bounds_lo{0.1, 5e-6, 0.5, 0.005, 5e-6, 1., -250., 0.5};
+    VaryingArray const  bounds_hi{60.0, 30.0, 5.0, 5.0, 25e-6, 100., 250., 1.5};
 
     std::array<std::string, NV> const varying_names{
         "M0_f", "M0_b", "T1_f", "T2_f", "T2_b", "k", "f0", "B1"};
@@ -18,7 +18,17 @@ struct SS_MT_Model : QI::Model<double, double, 8, 0, 1, 1> {
 
     int input_size(const int /* Unused */) const { return sequence.size(); }
 
-    auto signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double);
+    template <typename Derived>
+    auto signal(Eigen::ArrayBase<Derived> const &v, FixedArray const &f) const
+        -> QI_ARRAY(typename Derived::Scalar) {
+        using T = typename Derived::Scalar;
+        return typed_signal<T>(v, f);
+    }
+
+    // Instantiated for double and Jet in the .cpp
+    using Jet = ceres::Jet<double, NV>;
+    template <typename T>
+    auto typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const -> QI_ARRAY(T);
     void derived(const VaryingArray &varying, const FixedArray &, DerivedArray &derived) const;
 };
 
@@ -7,14 +7,24 @@ struct MUPAB1Model : QI::Model<double, double, 4, 0> {
     static int const   NS = 1;
     RUFISSequence &    sequence;
     VaryingArray const start{30., 1., 0.1, 1.0};
-    VaryingArray const lo{1, 0.01, 0.01, 0.5};
-    VaryingArray const hi{150, 5.0, 5.0, 1.5};
+    VaryingArray const bounds_lo{1, 0.01, 0.01, 0.5};
+    VaryingArray const bounds_hi{150, 5.0, 5.0, 1.5};
 
     std::array<std::string, NV> const varying_names{"M0", "T1", "T2", "B1"};
 
     int input_size(const int /* Unused */) const { return sequence.size(); }
 
-    auto signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double);
+    template <typename Derived>
+    auto signal(Eigen::ArrayBase<Derived> const &v, FixedArray const &f) const
+        -> QI_ARRAY(typename Derived::Scalar) {
+        using T = typename Derived::Scalar;
+        return typed_signal<T>(v, f);
+    }
+
+    // Instantiated for double and Jet in the .cpp
+    using Jet = ceres::Jet<double, NV>;
+    template <typename T>
+    auto typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const -> QI_ARRAY(T);
 };
 
 template <> struct QI::NoiseFromModelType<MUPAB1Model> : QI::RealNoise {};
@@ -14,6 +14,7 @@
 // #define QI_DEBUG_BUILD 1
 
 #include "Args.h"
+#include "FitScaledAuto.h"
 #include "FitScaledNumeric.h"
 #include "ImageIO.h"
 #include "Macro.h"
@@ -35,6 +36,11 @@ int transient_main(args::Subparser &parser) {
     args::ValueFlag<double>      T2_b(parser, "T2_b", "T2 of bound pool", {"T2b"}, 12e-6);
     args::ValueFlag<std::string> ls_arg(
         parser, "LINESHAPE", "Path to lineshape file", {"lineshape"});
+    args::Flag                   numeric(
+        parser,
+        "NUMERIC",
+        "Use central numeric differences instead of automatic differentiation (slower)",
+        {"numeric"});
 
     parser.Parse();
 
@@ -56,15 +62,31 @@ int transient_main(args::Subparser &parser) {
                                                       mask.Get(),
                                                       verbose,
                                                       simulate.Get(),
-                                                      subregion.Get());
+                                                      subregion.Get(),
+                                                      seed.Get());
         } else {
-            using FitType = QI::ScaledNumericDiffFit<decltype(model), decltype(model)::NS>;
-            FitType fit{model};
-            auto    fit_filter =
-                QI::ModelFitFilter<FitType>::New(&fit, verbose, covar, resids, subregion.Get());
-            fit_filter->ReadInputs({input_path.Get()}, fixed, mask.Get());
-            fit_filter->Update();
-            fit_filter->WriteOutputs(prefix.Get() + model_name);
+            auto run = [&](auto &fit) {
+                using FitType = std::remove_reference_t<decltype(fit)>;
+                auto fit_filter =
+                    QI::ModelFitFilter<FitType>::New(&fit, verbose, covar, resids, subregion.Get());
+                fit_filter->SetStreaming(stream.Get());
+                fit_filter->SetWriters(writers.Get(), overlap);
+                fit_filter->SetPackOutputs(pack);
+                fit_filter->ReadInputs({input_path.Get()}, fixed, mask.Get());
+                fit_filter->SetChunkSize(chunk.Get());
+                fit_filter->SetWarmStart(warm);
+                fit_filter->SetCheckpoint(checkpoint.Get(), resume);
+                fit_filter->Update();
+                fit_filter->WriteOutputs(prefix.Get() + model_name);
+            };
+            using Model = decltype(model);
+            if (numeric) {
+                QI::ScaledNumericDiffFit<Model, Model::NS> fit(model);
+                run(fit);
+            } else {
+                QI::ScaledAutoDiffFit<Model, int, QI::NLLSSolver::Ceres, Model::NS> fit(model);
+                run(fit);
+            }
         }
     };
 
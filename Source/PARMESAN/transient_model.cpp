@@ -3,11 +3,11 @@
 #include "parmesan.hpp"
 #include "transient_model.h"
 
-using AugMat = Eigen::Matrix<double, 4, 4>;
-using AugVec = Eigen::Vector<double, 4>;
-
-auto MUPAModel::signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double) {
-    using T = double;
+template <typename T>
+auto MUPAModel::typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(T) {
+    using AugMat = Eigen::Matrix<T, 4, 4>;
+    using AugVec = Eigen::Vector<T, 4>;
 
     T const &M0 = v[0];
     T const &R1 = 1. / v[1];
@@ -22,69 +22,52 @@ auto MUPAModel::signal(VaryingArray const &v, FixedArray const &) const -> QI_AR
     QI_DB(sequence.spokes_per_seg)
     QI_DBVEC(sequence.groups_per_seg)
 
-    AugMat R;
-    R << -R2, 0, 0, 0, //
-        0, -R2, 0, 0,  //
-        0, 0, -R1, R1, //
-        0, 0, 0, 0;
-
-    AugMat const Rrd  = (R * sequence.TR).exp();
-    AugMat const S    = Eigen::DiagonalMatrix<double, 4, 4>({0, 0, 1., 1.}).toDenseMatrix();
-    AugMat const ramp = (R * sequence.Tramp).exp();
+    // Relaxation and spoiling
+    AugMat const Rrd  = RelaxProp(R1, R2, sequence.TR);
+    AugMat const S    = Eigen::Vector<T, 4>(T(0.), T(0.), T(1.), T(1.)).asDiagonal();
+    AugMat const ramp = RelaxProp(R1, R2, sequence.Tramp);
 
     // Setup readout segment matrices
     std::vector<AugMat> TR_mats(sequence.size());
     std::vector<AugMat> seg_mats(sequence.size());
     for (int is = 0; is < sequence.size(); is++) {
-        AugMat rf;
-        float  B1x = sequence.FA[is] / sequence.Trf[is];
-        rf << 0, 0, 0, 0,  //
-            0, 0, B1x, 0,  //
-            0, -B1x, 0, 0, //
-            0, 0, 0, 0;
-        AugMat const Ard = ((R + rf) * sequence.Trf[is]).exp();
+        T const      B1x = T(sequence.FA[is] / sequence.Trf[is]);
+        AugMat const Ard = PulseProp(R1, R2, B1x, sequence.Trf[is]);
         TR_mats[is]      = S * Rrd * Ard;
-        seg_mats[is]     = TR_mats[is].pow(sequence.spokes_per_seg / sequence.groups_per_seg[is]);
+        seg_mats[is]     = MatrixPow(TR_mats[is], sequence.spokes_per_group[is]);
     }
 
     // Setup pulse matrices
     std::vector<AugMat> prep_mats(sequence.size());
     for (int is = 0; is < sequence.size(); is++) {
-        auto const & name = sequence.prep[is];
-        auto const & p    = sequence.prep_pulses[name];
-        double const E2   = exp(-R2 * p.T_trans);
-        double const E1   = exp(-R1 * p.T_long);
-        AugMat       C;
-        C << 0, 0, 0, 0,                            //
-            0, 0, 0, 0,                             //
-            0, 0, E1 * E2 * cos(p.FAeff), (1 - E1), //
-            0, 0, 0, 1;
-        prep_mats[is] = C;
+        auto const &p  = sequence.seg_prep[is];
+        T const     E2 = exp(-R2 * p.T_trans);
+        T const     E1 = exp(-R1 * p.T_long);
+        AugMat      C  = AugMat::Zero();
+        C(2, 2)        = E1 * E2 * cos(p.FAeff);
+        C(2, 3)        = 1. - E1;
+        C(3, 3)        = T(1.);
+        prep_mats[is]  = C;
     }
 
     // First calculate the system matrix and get SS
-    QI_DBMAT(R);
     AugMat X = AugMat::Identity();
     for (int is = 0; is < sequence.size(); is++) {
-        for (int ig = 0; ig < sequence.groups_per_seg[is]; ig++) {
-            X = ramp * seg_mats[is] * ramp * prep_mats[is] * X;
-        }
+        AugMat const group = ramp * seg_mats[is] * ramp * prep_mats[is];
+        X                  = MatrixPow(group, sequence.groups_per_seg[is]) * X;
     }
     AugVec m_ss = SolveSteadyState(X);
     QI_DBMAT(X);
     QI_DBVEC(m_ss);
     // Now loop through the segments and record the signal for each
-    Eigen::ArrayXd sig(sequence.size());
-    AugVec         m_current = m_ss;
+    QI_ARRAY(T) sig(sequence.size());
+    AugVec m_current = m_ss;
     for (int is = 0; is < sequence.size(); is++) {
-        double segment_accumulate = 0.;
+        T segment_accumulate(0.);
         for (int ig = 0; ig < sequence.groups_per_seg[is]; ig++) {
             AugVec const m_prepped = ramp * prep_mats[is] * m_current;
             auto const   m_group_avg =
-                GeometricAvg(TR_mats[is],
-                             seg_mats[is],
-                             m_prepped,
-                             sequence.spokes_per_seg / sequence.groups_per_seg[is]);
+                GeometricAvg(TR_mats[is], seg_mats[is], m_prepped, sequence.spokes_per_group[is]);
             segment_accumulate += m_group_avg[2] * sin(sequence.FA[is]);
             QI_DBVEC(m_group_avg);
             QI_DB(sin(sequence.FA[is]));
@@ -92,8 +75,13 @@ auto MUPAModel::signal(VaryingArray const &v, FixedArray const &) const -> QI_AR
             m_current = ramp * seg_mats[is] * m_prepped;
         }
         QI_DB(segment_accumulate);
-        sig[is] = M0 * segment_accumulate / sequence.groups_per_seg[is];
+        sig[is] = M0 * segment_accumulate / double(sequence.groups_per_seg[is]);
     }
     QI_DBVEC(sig);
     return sig;
-}
\ No newline at end of file
+}
+
+template auto MUPAModel::typed_signal(QI_ARRAYN(double, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(double);
+template auto MUPAModel::typed_signal(QI_ARRAYN(Jet, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(Jet);
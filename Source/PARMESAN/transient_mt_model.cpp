@@ -3,22 +3,22 @@
 #include "parmesan.hpp"
 #include "transient_mt_model.h"
 
-using AugMat = Eigen::Matrix<double, 5, 5>; // Short for Augmented Matrix
-using AugVec = Eigen::Vector<double, 5>;
+template <typename T>
+auto MUPAMTModel::typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(T) {
+    using AugMat = Eigen::Matrix<T, 5, 5>; // Short for Augmented Matrix
+    using AugVec = Eigen::Vector<T, 5>;
 
-auto MUPAMTModel::signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double) {
-    using T = double;
-
-    T const &M0_f = v[0];
-    T const &M0_b = v[1];
-    T const &R1_f = 1. / v[2];
-    T const &R1_b = R1_f;
-    T const &R2_f = 1. / v[3];
-    T const &k    = 4.3;
-    T const &k_bf = k * M0_f / (M0_f + M0_b);
-    T const &k_fb = k * M0_b / (M0_f + M0_b);
-    T const &B1   = v[4];
-    T const &G0   = 1.4e-5;
+    T const &    M0_f = v[0];
+    T const &    M0_b = v[1];
+    T const &    R1_f = 1. / v[2];
+    T const &    R1_b = R1_f;
+    T const &    R2_f = 1. / v[3];
+    double const k    = 4.3;
+    T const &    k_bf = k * M0_f / (M0_f + M0_b);
+    T const &    k_fb = k * M0_b / (M0_f + M0_b);
+    T const &    B1   = v[4];
+    double const G0   = 1.4e-5;
     QI_DBVEC(v)
     QI_DB(M0_f)
     QI_DB(M0_b)
@@ -27,94 +27,86 @@ auto MUPAMTModel::signal(VaryingArray const &v, FixedArray const &) const -> QI_
     QI_DB(k_bf)
     QI_DB(k_fb)
     QI_DB(B1)
-    AugMat R;
-    R << -R2_f, 0, 0, 0, 0,          //
-        0, -R2_f, 0, 0, 0,           //
-        0, 0, -R1_f, 0, M0_f * R1_f, //
-        0, 0, 0, -R1_b, M0_b * R1_b, //
-        0, 0, 0, 0, 0;
-
-    AugMat K;
-    K << 0, 0, 0, 0, 0,       //
-        0, 0, 0, 0, 0,        //
-        0, 0, -k_fb, k_bf, 0, //
-        0, 0, k_fb, -k_bf, 0, //
-        0, 0, 0, 0, 0;
+    // Longitudinal relaxation and exchange
+    Eigen::Matrix<T, 2, 2> L;
+    L << -R1_f - k_fb, k_bf, //
+        k_fb, -R1_b - k_bf;
+    Eigen::Vector<T, 2> const b{M0_f * R1_f, M0_b * R1_b};
 
-    AugMat const S = Eigen::DiagonalMatrix<double, 5, 5>({0, 0, 1., 1., 1.}).toDenseMatrix();
+    AugMat R                     = AugMat::Zero();
+    R(0, 0)                      = -R2_f;
+    R(1, 1)                      = -R2_f;
+    R.template block<2, 2>(2, 2) = L;
+    R.template block<2, 1>(2, 4) = b;
 
-    AugMat const RpK = R + K;
+    AugMat const S = Eigen::Vector<T, 5>(T(0.), T(0.), T(1.), T(1.), T(1.)).asDiagonal();
 
     // Setup readout segment matrices
-    AugMat const        ramp = (RpK * sequence.Tramp).exp();
+    AugMat const        ramp = RelaxPropMT(R2_f, L, b, sequence.Tramp);
     std::vector<AugMat> TR_mats(sequence.FA.rows());
     std::vector<AugMat> seg_mats(sequence.FA.rows());
     for (int is = 0; is < sequence.FA.rows(); is++) {
-        double const B1x = B1 * sequence.FA[is] / sequence.Trf[is];
-        double const W   = M_PI * G0 * B1x * B1x;
-        AugMat       rf;
-        rf << 0, 0, 0, 0, 0,  //
-            0, 0, B1x, 0, 0,  //
-            0, -B1x, 0, 0, 0, //
-            0, 0, 0, -W, 0,   //
-            0, 0, 0, 0, 0;
-        AugMat const Rrd = (RpK * (sequence.TR - sequence.Trf[is])).exp();
-        AugMat const Ard = ((RpK + rf) * sequence.Trf[is]).exp();
+        T const B1x = B1 * sequence.FA[is] / sequence.Trf[is];
+        T const W   = M_PI * G0 * B1x * B1x;
+        AugMat  rf  = AugMat::Zero();
+        rf(1, 2)    = B1x;
+        rf(2, 1)    = -B1x;
+        rf(3, 3)    = -W;
+
+        AugMat const Rrd = RelaxPropMT(R2_f, L, b, sequence.TR - sequence.Trf[is]);
+        AugMat const Ard = QI::Expm(AugMat((R + rf) * T(sequence.Trf[is])));
         TR_mats[is]      = S * Rrd * Ard;
-        seg_mats[is]     = TR_mats[is].pow(sequence.spokes_per_seg / sequence.groups_per_seg[is]);
+        seg_mats[is]     = MatrixPow(TR_mats[is], sequence.spokes_per_group[is]);
     }
 
     // Setup pulse matrices
     std::vector<AugMat> prep_mats(sequence.size());
     for (int is = 0; is < sequence.size(); is++) {
-        auto const & name = sequence.prep[is];
-        auto const & p    = sequence.prep_pulses[name];
-        double const Ew   = exp(-M_PI * 1.4e-5 * B1 * B1 * p.int_b1_sq);
-        AugMat       C;
-        double const E2 = exp(-R2_f * p.T_trans);
-        // double const E1 = exp(-R1_f * p.T_long);
+        auto const &p  = sequence.seg_prep[is];
+        T const     Ew = exp(-M_PI * 1.4e-5 * B1 * B1 * p.int_b1_sq);
+        T const     E2 = exp(-R2_f * p.T_trans);
         QI_DB(Ew)
         QI_DB(E2)
-        C << 0, 0, 0, 0, 0,                //
-            0, 0, 0, 0, 0,                 //
-            0, 0, E2 * cos(p.FAeff), 0, 0, //
-            0, 0, 0, Ew, 0,                //
-            0, 0, 0, 0, 1;
+        AugMat C      = AugMat::Zero();
+        C(2, 2)       = E2 * cos(p.FAeff);
+        C(3, 3)       = Ew;
+        C(4, 4)       = T(1.);
         prep_mats[is] = C;
     }
 
     // First calculate the system matrix
     AugMat X = AugMat::Identity();
     for (int is = 0; is < sequence.size(); is++) {
-        for (int ig = 0; ig < sequence.groups_per_seg[is]; ig++) {
-            X = ramp * seg_mats[is] * ramp * S * prep_mats[is] * X;
-        }
+        AugMat const group = ramp * seg_mats[is] * ramp * S * prep_mats[is];
+        X                  = MatrixPow(group, sequence.groups_per_seg[is]) * X;
     }
     AugVec m_ss = SolveSteadyState(X);
 
     // Now loop through the segments and record the signal for each
-    Eigen::ArrayXd sig(sequence.size());
+    QI_ARRAY(T) sig(sequence.size());
     QI_DBVEC(m_ss);
     AugVec m_current = m_ss;
     for (int is = 0; is < sequence.size(); is++) {
-        double segment_accumulate = 0.;
+        T segment_accumulate(0.);
         for (int ig = 0; ig < sequence.groups_per_seg[is]; ig++) {
             AugVec const m_prepped = ramp * S * prep_mats[is] * m_current;
             auto const   m_group_avg =
-                GeometricAvg(TR_mats[is],
-                             seg_mats[is],
-                             m_prepped,
-                             sequence.spokes_per_seg / sequence.groups_per_seg[is]);
+                GeometricAvg(TR_mats[is], seg_mats[is], m_prepped, sequence.spokes_per_group[is]);
             segment_accumulate += m_group_avg[2] * sin(B1 * sequence.FA[is]);
             m_current = ramp * seg_mats[is] * m_prepped;
         }
-        sig[is] = segment_accumulate / sequence.groups_per_seg[is];
+        sig[is] = segment_accumulate / double(sequence.groups_per_seg[is]);
     }
     QI_DBVEC(v);
     QI_DBVEC(sig);
     return sig;
 }
 
+template auto MUPAMTModel::typed_signal(QI_ARRAYN(double, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(double);
+template auto MUPAMTModel::typed_signal(QI_ARRAYN(Jet, NV) const &v, FixedArray const &) const
+    -> QI_ARRAY(Jet);
+
 void MUPAMTModel::derived(const VaryingArray &varying,
                           const FixedArray & /* Unused */,
                           DerivedArray &derived) const {
@@ -125,4 +117,4 @@ void MUPAMTModel::derived(const VaryingArray &varying,
     QI_DB(M0_f)
     QI_DB(M0_b)
     QI_DBVEC(derived)
-}
\ No newline at end of file
+}
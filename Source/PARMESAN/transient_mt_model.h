@@ -7,15 +7,25 @@ struct MUPAMTModel : QI::Model<double, double, 5, 0, 1, 1> {
     static int const   NS = 2;
     RUFISSequence &    sequence;
     VaryingArray const start{30.0, 3.0, 1.0, 0.1, 1.0};
-    VaryingArray const lo{0.1, 0.1, 0.5, 0.005, 0.5};
-    VaryingArray const hi{100.0, 60.0, 5.0, 5.0, 1.5};
+    VaryingArray const bounds_lo{0.1, 0.1, 0.5, 0.005, 0.5};
+    VaryingArray const bounds_hi{100.0, 60.0, 5.0, 5.0, 1.5};
 
     std::array<std::string, NV> const varying_names{"M0_f", "M0_b", "T1_f", "T2_f", "B1"};
     std::array<std::string, ND> const derived_names{"f_b"};
 
     int input_size(const int /* Unused */) const { return sequence.size(); }
 
-    auto signal(VaryingArray const &v, FixedArray const &) const -> QI_ARRAY(double);
+    template <typename Derived>
+    auto signal(Eigen::ArrayBase<Derived> const &v, FixedArray const &f) const
+        -> QI_ARRAY(typename Derived::Scalar) {
+        using T = typename Derived::Scalar;
+        return typed_signal<T>(v, f);
+    }
+
+    // Instantiated for double and Jet in the .cpp
+    using Jet = ceres::Jet<double, NV>;
+    template <typename T>
+    auto typed_signal(QI_ARRAYN(T, NV) const &v, FixedArray const &) const -> QI_ARRAY(T);
     void derived(const VaryingArray &varying, const FixedArray &, DerivedArray &derived) const;
 };
 
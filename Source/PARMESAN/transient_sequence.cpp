@@ -15,4 +15,13 @@ void from_json(const json &j, RUFISSequence &s) {
         QI::Fail(
             "Number preps {} does not match number of flip-angles {}", s.prep.size(), s.FA.rows());
     }
+    s.seg_prep.clear();
+    for (auto const &name : s.prep) {
+        auto const p = s.prep_pulses.find(name);
+        if (p == s.prep_pulses.end()) {
+            QI::Fail("Prep pulse {} was not defined", name);
+        }
+        s.seg_prep.push_back(p->second);
+    }
+    s.spokes_per_group = s.spokes_per_seg / s.groups_per_seg;
 }
\ No newline at end of file
@@ -11,6 +11,8 @@ struct RUFISSequence : QI::SequenceBase {
     int                                        spokes_per_seg;
     std::unordered_map<std::string, PrepPulse> prep_pulses;
     std::vector<std::string>                   prep;
+    std::vector<PrepPulse>                     seg_prep;         // prep_pulses[prep[is]]
+    Eigen::ArrayXi                             spokes_per_group; // Per segment
     QI_SEQUENCE_DECLARE(RUFIS);
     Eigen::Index size() const override { return prep.size(); };
 };
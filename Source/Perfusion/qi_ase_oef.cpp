@@ -86,7 +86,7 @@ struct ASEModel : QI::Model<double, double, 4, 0, 1, 3> {
         derived[2] = dHb;
     }
 };
-using ASEFit = QI::ScaledAutoDiffFit<ASEModel>;
+template <QI::NLLSSolver Solver> using ASEFit = QI::ScaledAutoDiffFit<ASEModel, int, Solver>;
 
 struct ASEFixDBVModel : QI::Model<double, double, 3, 0, 1, 3> {
     using SequenceType = QI::MultiEchoSequence;
@@ -139,7 +139,8 @@ struct ASEFixDBVModel : QI::Model<double, double, 3, 0, 1, 3> {
         derived[2] = dHb;
     }
 };
-using ASEFixDBVFit = QI::ScaledAutoDiffFit<ASEFixDBVModel>;
+template <QI::NLLSSolver Solver>
+using ASEFixDBVFit = QI::ScaledAutoDiffFit<ASEFixDBVModel, int, Solver>;
 
 /*
  * Main
@@ -150,6 +151,7 @@ int ase_oef_main(args::Subparser &parser) {
     QI_COMMON_ARGS;
     args::ValueFlag<double> B0(parser, "B0", "Field-strength (Tesla), default 3", {'B', "B0"}, 3.0);
     args::ValueFlag<double> DBV(parser, "DBV", "Fix DBV and only fit R2'", {'d', "DBV"}, 0.0);
+    args::Flag lm(parser, "LM", "Use the built-in Levenberg-Marquardt, not Ceres", {"lm"});
 
     parser.Parse();
     json input    = json_file ? QI::ReadJSON(json_file.Get()) : QI::ReadJSON(std::cin);
@@ -165,7 +167,8 @@ int ase_oef_main(args::Subparser &parser) {
                                                      mask.Get(),
                                                      verbose,
                                                      simulate.Get(),
-                                                     subregion.Get());
+                                                     subregion.Get(),
+                                                     seed.Get());
         } else {
             ASEModel model{{}, sequence, B0.Get()};
             QI::SimulateModel<ASEModel, false>(input,
@@ -175,24 +178,37 @@ int ase_oef_main(args::Subparser &parser) {
                                                mask.Get(),
                                                verbose,
                                                simulate.Get(),
-                                               subregion.Get());
+                                               subregion.Get(),
+                                               seed.Get());
         }
     } else {
         auto process = [&](auto fit_func) {
             auto fit_filter = QI::ModelFitFilter<decltype(fit_func)>::New(
                 &fit_func, verbose, covar, resids, subregion.Get());
+            fit_filter->SetStreaming(stream.Get());
+            fit_filter->SetWriters(writers.Get(), overlap);
+            fit_filter->SetPackOutputs(pack);
             fit_filter->ReadInputs({QI::CheckPos(input_path)}, {}, mask.Get());
+            fit_filter->SetChunkSize(chunk.Get());
+            fit_filter->SetWarmStart(warm);
+            fit_filter->SetCheckpoint(checkpoint.Get(), resume);
             fit_filter->Update();
             fit_filter->WriteOutputs(prefix.Get() + "ASE_");
         };
         if (DBV) {
             ASEFixDBVModel model{{}, sequence, B0.Get(), DBV.Get()};
-            ASEFixDBVFit   fit{model};
-            process(fit);
+            if (lm) {
+                process(ASEFixDBVFit<QI::NLLSSolver::LM>{model});
+            } else {
+                process(ASEFixDBVFit<QI::NLLSSolver::Ceres>{model});
+            }
         } else {
             ASEModel model{{}, sequence, B0.Get()};
-            ASEFit   fit{model};
-            process(fit);
+            if (lm) {
+                process(ASEFit<QI::NLLSSolver::LM>{model});
+            } else {
+                process(ASEFit<QI::NLLSSolver::Ceres>{model});
+            }
         }
     }
     return EXIT_SUCCESS;
@@ -17,7 +17,6 @@
 #include "Util.h"
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIteratorWithIndex.h"
-#include "itkMultiThreaderBase.h"
 
 /*
  * Main
@@ -25,7 +24,7 @@
 int asl_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "ASL_FILE", "Input ASL file");
 
-    args::ValueFlag<int>         threads(parser,
+    QI::ThreadsFlag              threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -99,9 +98,7 @@ int asl_main(args::Subparser &parser) {
         6000 * lambda.Get() * exp(sequence.post_label_delay / T1_blood.Get()) /
         (2. * alpha.Get() * T1_blood.Get() * (1. - exp(-sequence.label_time / T1_blood.Get())));
     QI::Info(verbose, "Processing");
-    auto mt = itk::MultiThreaderBase::New();
-    mt->SetNumberOfWorkUnits(threads.Get());
-    mt->ParallelizeImageRegion<3>(
+    QI::ParallelizeImageRegion<3>(
         input->GetBufferedRegion(),
         [&](const QI::VectorVolumeF::RegionType &region) {
             itk::ImageRegionConstIterator<QI::VectorVolumeF>     in_it(input, region);
@@ -23,7 +23,7 @@
  */
 int zshim_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "ZSHIM_FILE", "Input Z-Shimmed file");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -83,9 +83,7 @@ int zshim_main(args::Subparser &parser) {
     }
 
     QI::Log(verbose, "Processing");
-    auto mt = itk::MultiThreaderBase::New();
-    mt->SetNumberOfWorkUnits(threads.Get());
-    mt->ParallelizeImageRegion<3>(
+    QI::ParallelizeImageRegion<3>(
         input->GetBufferedRegion(),
         [&](const QI::VectorVolumeF::RegionType &region) {
             itk::ImageRegionConstIterator<QI::VectorVolumeF> in_it(input, region);
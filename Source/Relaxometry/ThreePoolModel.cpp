@@ -94,25 +94,77 @@ bool ThreePoolModel::valid(const QI_ARRAYN(double, NV) & params) const {
 
 std::vector<Eigen::ArrayXd> ThreePoolModel::signals(const Eigen::ArrayXd &v,
                                                     const QI_ARRAYN(double, NF) & f) const {
-    return {spgr_signal(v, f), ssfp_signal(v, f)};
+    return signals(v, precompute(f));
+}
+
+std::vector<Eigen::ArrayXd> ThreePoolModel::signals(const Eigen::ArrayXd &v,
+                                                    Precomputed const &   pre) const {
+    return {spgr_signal(v, pre), ssfp_signal(v, pre)};
 }
 
 Eigen::ArrayXd ThreePoolModel::signal(const Eigen::ArrayXd &v,
                                       const QI_ARRAYN(double, NF) & f) const {
-    auto           sigs = signals(v, f);
+    return signal(v, precompute(f));
+}
+
+Eigen::ArrayXd ThreePoolModel::signal(const Eigen::ArrayXd &v, Precomputed const &pre) const {
     Eigen::ArrayXd sig(spgr.size() + ssfp.size());
-    sig.head(spgr.size()) = sigs[0];
-    sig.tail(ssfp.size()) = sigs[1];
+    signal(v, pre, sig);
     return sig;
 }
 
+/*
+ *  The two-pool signal plus the CSF pool, which is SPGRSignal() and SSFP1() a value at a time
+ */
+void ThreePoolModel::signal(VaryingArray const &       v,
+                            Precomputed const &        pre,
+                            Eigen::Ref<Eigen::ArrayXd> out) const {
+    double const               f_ab = 1. - v[9];
+    TwoPoolModel::VaryingArray two_pool_varying;
+    two_pool_varying << v[0] * f_ab, v[1], v[2], v[3], v[4], v[7], v[8] / f_ab;
+    two_pool.signal(two_pool_varying, pre, out);
+
+    double const PD_c    = v[0] * v[9];
+    double const E1_spgr = exp(-spgr.TR / v[5]);
+    for (Eigen::Index i = 0; i < spgr.size(); i++) {
+        out[i] += PD_c * ((1. - E1_spgr) * pre.spgr_sa[i]) / (1. - E1_spgr * pre.spgr_ca[i]);
+    }
+    double const E1      = exp(-ssfp.TR / v[5]);
+    double const E2      = exp(-ssfp.TR / v[6]);
+    double const theta0  = 2.0 * M_PI * pre.fixed[0];
+    double const cos_psi = cos(theta0 / 2.0);
+    double const sin_psi = sin(theta0 / 2.0);
+    for (Eigen::Index i = 0; i < ssfp.size(); i++) {
+        double const ca     = pre.ssfp_ca[i];
+        double const sa     = pre.ssfp_sa[i];
+        double const d      = 1. - E1 * ca - E2 * E2 * (E1 - ca);
+        double const G      = sa * (1. - E1) / d;
+        double const b      = E2 * (1. - E1) * (1. + ca) / d;
+        double const cos_th = cos(theta0 - ssfp.PhaseInc[i]);
+        double const sin_th = sin(theta0 - ssfp.PhaseInc[i]);
+        double const re_m =
+            (cos_psi - E2 * (cos_th * cos_psi - sin_th * sin_psi)) * G / (1.0 - b * cos_th);
+        double const im_m =
+            (sin_psi - E2 * (cos_th * sin_psi + sin_th * cos_psi)) * G / (1.0 - b * cos_th);
+        out[spgr.size() + i] += PD_c * sqrt(re_m * re_m + im_m * im_m);
+    }
+    if (scale_to_mean) {
+        out.head(spgr.size()) /= out.head(spgr.size()).mean();
+        out.tail(ssfp.size()) /= out.tail(ssfp.size()).mean();
+    }
+}
+
 Eigen::ArrayXd ThreePoolModel::spgr_signal(const Eigen::ArrayXd &v,
                                            const QI_ARRAYN(double, NF) & fixed) const {
+    return spgr_signal(v, precompute(fixed));
+}
+
+Eigen::ArrayXd ThreePoolModel::spgr_signal(const Eigen::ArrayXd &v, Precomputed const &pre) const {
     double f_ab = 1. - v[9];
     QI_ARRAYN(double, TwoPoolModel::NV) two_pool_varying;
     two_pool_varying << v[0] * f_ab, v[1], v[2], v[3], v[4], v[7], v[8] / f_ab;
-    Eigen::VectorXd m_ab   = two_pool.spgr_signal(two_pool_varying, fixed);
-    Eigen::VectorXd m_c    = SPGRSignal(v[0] * v[9], v[5], fixed[1], spgr);
+    Eigen::VectorXd m_ab   = two_pool.spgr_signal(two_pool_varying, pre);
+    Eigen::VectorXd m_c    = SPGRSignal(v[0] * v[9], v[5], pre.fixed[1], spgr);
     Eigen::VectorXd signal = m_ab + m_c;
     // std::cout << "SPGR\n" << m_ab.transpose() << "\n" << m_c.transpose() << "\n" <<
     // signal.transpose() << std::endl;
@@ -124,11 +176,15 @@ Eigen::ArrayXd ThreePoolModel::spgr_signal(const Eigen::ArrayXd &v,
 
 Eigen::ArrayXd ThreePoolModel::ssfp_signal(const Eigen::ArrayXd &v,
                                            const QI_ARRAYN(double, NF) & fixed) const {
+    return ssfp_signal(v, precompute(fixed));
+}
+
+Eigen::ArrayXd ThreePoolModel::ssfp_signal(const Eigen::ArrayXd &v, Precomputed const &pre) const {
     double f_ab = 1. - v[9];
     QI_ARRAYN(double, TwoPoolModel::NV) two_pool_varying;
     two_pool_varying << v[0] * f_ab, v[1], v[2], v[3], v[4], v[7], v[8] / f_ab;
-    Eigen::VectorXd m_ab   = two_pool.ssfp_signal(two_pool_varying, fixed);
-    Eigen::VectorXd m_c    = SSFP1(v[0] * v[9], v[5], v[6], fixed[0], fixed[1], ssfp);
+    Eigen::VectorXd m_ab   = two_pool.ssfp_signal(two_pool_varying, pre);
+    Eigen::VectorXd m_c    = SSFP1(v[0] * v[9], v[5], v[6], pre.fixed[0], pre.fixed[1], ssfp);
     Eigen::VectorXd signal = m_ab + m_c;
     if (scale_to_mean) {
         signal /= signal.mean();
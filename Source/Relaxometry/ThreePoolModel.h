@@ -37,20 +37,31 @@ struct ThreePoolModel : Model<double, double, 10, 2, 2> {
     QI_ARRAYN(double, NV) bounds_lo;
     QI_ARRAYN(double, NV) bounds_hi;
 
+    using Precomputed = TwoPoolModel::Precomputed; // Same sequences and fixed parameters
+
     ThreePoolModel(SPGRSequence const &s1, SSFPSequence const &s2, const bool scale);
-    bool   valid(const QI_ARRAYN(double, NV) & params) const; // For SRC
-    size_t num_outputs() const;
-    int    output_size(int i) const;
+    bool        valid(const QI_ARRAYN(double, NV) & params) const; // For SRC
+    size_t      num_outputs() const;
+    int         output_size(int i) const;
+    Precomputed precompute(FixedArray const &fixed) const { return two_pool.precompute(fixed); }
 
     Eigen::ArrayXd spgr_signal(const Eigen::ArrayXd &varying,
                                const QI_ARRAYN(double, NF) & fixed) const;
+    Eigen::ArrayXd spgr_signal(const Eigen::ArrayXd &varying, Precomputed const &pre) const;
 
     Eigen::ArrayXd ssfp_signal(const Eigen::ArrayXd &varying,
                                const QI_ARRAYN(double, NF) & fixed) const;
+    Eigen::ArrayXd ssfp_signal(const Eigen::ArrayXd &varying, Precomputed const &pre) const;
 
     std::vector<Eigen::ArrayXd> signals(const Eigen::ArrayXd &varying,
                                         const QI_ARRAYN(double, NF) & fixed) const;
+    std::vector<Eigen::ArrayXd> signals(const Eigen::ArrayXd &varying,
+                                        Precomputed const &   pre) const;
     Eigen::ArrayXd signal(const Eigen::ArrayXd &varying, const QI_ARRAYN(double, NF) & fixed) const;
+    Eigen::ArrayXd signal(const Eigen::ArrayXd &varying, Precomputed const &pre) const;
+    void           signal(VaryingArray const &       varying,
+                          Precomputed const &        pre,
+                          Eigen::Ref<Eigen::ArrayXd> out) const; // As TwoPoolModel
 };
 
 } // End namespace QI
@@ -13,18 +13,55 @@
 
 #include "Helpers.h"
 #include "Log.h"
+#include "MatrixExp.h"
 #include "TwoPoolModel.h"
 
-// There's a bug in matrix log that leads to duplicate symbol definitions if
-// this is included in the header file
-#include <unsupported/Eigen/MatrixFunctions>
+#include <Eigen/Dense>
 
 using namespace std::literals;
 
 namespace {
-Eigen::MatrixXd SSFP2(const Eigen::ArrayXd &varying,
-                      const QI_ARRAYN(double, 2) & fixed,
-                      QI::SSFPSequence const &ssfp) {
+/*
+ *  The exchange matrix and the steady-state solution are both 2x2, so use closed forms
+ */
+void SPGR2(QI::TwoPoolModel::VaryingArray const &varying,
+           QI::TwoPoolModel::Precomputed const & pre,
+           QI::SPGRSequence const &              spgr,
+           Eigen::Ref<Eigen::ArrayXd>            signal) {
+    const double &        PD    = varying[0];
+    const double &        T1_a  = varying[1];
+    const double &        T1_b  = varying[3];
+    const double &        tau_a = varying[5];
+    const double &        f_a   = varying[6];
+    const double &        TR    = spgr.TR;
+    const Eigen::Matrix2d I     = Eigen::Matrix2d::Identity();
+    Eigen::Matrix2d       A;
+    Eigen::Vector2d       M0;
+    double                k_ab, k_ba, f_b;
+    QI::CalcExchange(tau_a, f_a, f_b, k_ab, k_ba);
+    M0 << f_a, f_b;
+    A << ((1. / T1_a) + k_ab), -k_ba, -k_ab, ((1. / T1_b) + k_ba);
+    const Eigen::Matrix2d eATR = QI::Expm2<double>(-TR * A);
+    const Eigen::Vector2d RHS  = (I - eATR) * M0;
+    for (Eigen::Index i = 0; i < signal.rows(); i++) {
+        const Eigen::Vector2d Mobs = (I - eATR * pre.spgr_ca[i]).inverse() * (RHS * pre.spgr_sa[i]);
+        signal[i]                  = PD * Mobs.sum();
+    }
+}
+
+/*
+ *  The two-pool SSFP steady state is a 6x6 system in (Mx, My, Mz) of both pools, but the pools
+ *  are only coupled through 2x2 blocks. With T and L the transverse and longitudinal
+ *  relaxation/exchange blocks, c & s the trig terms of the phase and ca & sa of the flip-angle:
+ *      (ca - cT) Mx + sT My + sa Mz = 0
+ *               -sT Mx + (1 - cT) My = 0
+ *               -sa Mx + (ca - L) Mz = R
+ *  Eliminating My and Mz leaves a 2x2 system for Mx (T commutes with (1 - cT)^-1).
+ */
+void SSFP2(QI::TwoPoolModel::VaryingArray const &varying,
+           QI::TwoPoolModel::Precomputed const & pre,
+           QI::SSFPSequence const &              ssfp,
+           Eigen::Ref<Eigen::ArrayXd>            signal) {
     const double &PD    = varying[0];
     const double &T1_a  = varying[1];
     const double &T2_a  = varying[2];
@@ -32,8 +69,6 @@ Eigen::MatrixXd SSFP2(const Eigen::ArrayXd &varying,
     const double &T2_b  = varying[4];
     const double &tau_a = varying[5];
     const double &f_a   = varying[6];
-    const double &f0    = fixed[0];
-    const double &B1    = fixed[1];
     const double &TR    = ssfp.TR;
     const double  E1_a  = exp(-TR / T1_a);
     const double  E1_b  = exp(-TR / T1_b);
@@ -41,36 +76,32 @@ Eigen::MatrixXd SSFP2(const Eigen::ArrayXd &varying,
     const double  E2_b  = exp(-TR / T2_b);
     double        f_b, k_ab, k_ba;
     QI::CalcExchange(tau_a, f_a, f_b, k_ab, k_ba);
-    const double         E_ab  = exp(-TR * k_ab / f_b);
-    const double         K1    = E_ab * f_b + f_a;
-    const double         K2    = E_ab * f_a + f_b;
-    const double         K3    = f_a * (1 - E_ab);
-    const double         K4    = f_b * (1 - E_ab);
-    const Eigen::ArrayXd alpha = B1 * ssfp.FA;
-    const Eigen::ArrayXd theta = ssfp.PhaseInc + 2. * M_PI * f0 * TR;
-
-    Eigen::MatrixXd M(4, ssfp.size());
-    Eigen::Matrix6d LHS;
-    Eigen::Vector6d RHS;
-    RHS << 0, 0, 0, 0, -E1_b * K3 * f_b + f_a * (-E1_a * K1 + 1),
-        -E1_a * K4 * f_a + f_b * (-E1_b * K2 + 1);
-
-    for (int i = 0; i < ssfp.size(); i++) {
-        const double ca  = cos(alpha[i]);
-        const double sa  = sin(alpha[i]);
-        const double cta = cos(theta[i]);
-        const double ctb = cos(theta[i]);
-        const double sta = sin(theta[i]);
-        const double stb = sin(theta[i]);
-
-        LHS << -E2_a * K1 * cta + ca, -E2_b * K3 * cta, E2_a * K1 * sta, E2_b * K3 * sta, sa, 0,
-            -E2_a * K4 * ctb, -E2_b * K2 * ctb + ca, E2_a * K4 * stb, E2_b * K2 * stb, 0, sa,
-            -E2_a * K1 * sta, -E2_b * K3 * sta, -E2_a * K1 * cta + 1, -E2_b * K3 * cta, 0, 0,
-            -E2_a * K4 * stb, -E2_b * K2 * stb, -E2_a * K4 * ctb, -E2_b * K2 * ctb + 1, 0, 0, -sa,
-            0, 0, 0, -E1_a * K1 + ca, -E1_b * K3, 0, -sa, 0, 0, -E1_a * K4, -E1_b * K2 + ca;
-        M.col(i).noalias() = PD * (LHS.partialPivLu().solve(RHS)).head(4);
+    const double E_ab = exp(-TR * k_ab / f_b);
+    const double K1   = E_ab * f_b + f_a;
+    const double K2   = E_ab * f_a + f_b;
+    const double K3   = f_a * (1 - E_ab);
+    const double K4   = f_b * (1 - E_ab);
+
+    Eigen::Matrix2d T, L;
+    T << E2_a * K1, E2_b * K3, E2_a * K4, E2_b * K2;
+    L << E1_a * K1, E1_b * K3, E1_a * K4, E1_b * K2;
+    const Eigen::Matrix2d T2 = T * T;
+    const Eigen::Vector2d R{-E1_b * K3 * f_b + f_a * (-E1_a * K1 + 1),
+                            -E1_a * K4 * f_a + f_b * (-E1_b * K2 + 1)};
+    const Eigen::Matrix2d I = Eigen::Matrix2d::Identity();
+
+    for (Eigen::Index i = 0; i < signal.rows(); i++) {
+        const double          ca = pre.ssfp_ca[i];
+        const double          sa = pre.ssfp_sa[i];
+        const double          c  = pre.ssfp_ct[i];
+        const double          s  = pre.ssfp_st[i];
+        const Eigen::Matrix2d P  = (I - c * T).inverse();
+        const Eigen::Matrix2d B  = (ca * I - L).inverse();
+        const Eigen::Matrix2d A  = ca * I - c * T + s * s * T2 * P + sa * sa * B;
+        const Eigen::Vector2d Mx = A.inverse() * (-sa * B * R);
+        const Eigen::Vector2d My = s * P * T * Mx;
+        signal[i]                = PD * sqrt(Mx.squaredNorm() + My.squaredNorm());
     }
-    return M;
 }
 } // namespace
 
@@ -108,43 +139,60 @@ bool TwoPoolModel::valid(VaryingArray const &params) const {
     }
 }
 
+TwoPoolModel::Precomputed TwoPoolModel::precompute(FixedArray const &fixed) const {
+    const double &       f0    = fixed[0];
+    const double &       B1    = fixed[1];
+    const Eigen::ArrayXd theta = ssfp.PhaseInc + 2. * M_PI * f0 * ssfp.TR;
+    return {fixed,
+            cos(B1 * spgr.FA),
+            sin(B1 * spgr.FA),
+            cos(B1 * ssfp.FA),
+            sin(B1 * ssfp.FA),
+            cos(theta),
+            sin(theta)};
+}
+
 std::vector<Eigen::ArrayXd> TwoPoolModel::signals(VaryingArray const &v,
                                                   FixedArray const &  f) const {
-    return {spgr_signal(v, f), ssfp_signal(v, f)};
+    return signals(v, precompute(f));
+}
+
+std::vector<Eigen::ArrayXd> TwoPoolModel::signals(VaryingArray const &v,
+                                                  Precomputed const & pre) const {
+    return {spgr_signal(v, pre), ssfp_signal(v, pre)};
 }
 
 Eigen::ArrayXd TwoPoolModel::signal(const Eigen::ArrayXd &v,
                                     const QI_ARRAYN(double, NF) & f) const {
-    auto           sigs = signals(v, f);
+    return signal(v, precompute(f));
+}
+
+Eigen::ArrayXd TwoPoolModel::signal(const Eigen::ArrayXd &v, Precomputed const &pre) const {
     Eigen::ArrayXd sig(spgr.size() + ssfp.size());
-    sig.head(spgr.size()) = sigs[0];
-    sig.tail(ssfp.size()) = sigs[1];
+    signal(v, pre, sig);
     return sig;
 }
 
+void TwoPoolModel::signal(VaryingArray const &       v,
+                          Precomputed const &        pre,
+                          Eigen::Ref<Eigen::ArrayXd> out) const {
+    SPGR2(v, pre, spgr, out.head(spgr.size()));
+    SSFP2(v, pre, ssfp, out.tail(ssfp.size()));
+    if (scale_to_mean) {
+        out.head(spgr.size()) /= out.head(spgr.size()).mean();
+        out.tail(ssfp.size()) /= out.tail(ssfp.size()).mean();
+    }
+}
+
 Eigen::ArrayXd TwoPoolModel::spgr_signal(const Eigen::ArrayXd &varying,
                                          const QI_ARRAYN(double, NF) & fixed) const {
-    const double &  PD    = varying[0];
-    const double &  T1_a  = varying[1];
-    const double &  T1_b  = varying[3];
-    const double &  tau_a = varying[5];
-    const double &  f_a   = varying[6];
-    const double &  B1    = fixed[1];
-    const double &  TR    = spgr.TR;
-    Eigen::Matrix2d A, eATR;
-    Eigen::Vector2d M0, Mobs;
-    Eigen::ArrayXd  signal(spgr.size());
-    double          k_ab, k_ba, f_b;
-    CalcExchange(tau_a, f_a, f_b, k_ab, k_ba);
-    M0 << f_a, f_b;
-    A << ((1. / T1_a) + k_ab), -k_ba, -k_ab, ((1. / T1_b) + k_ba);
-    eATR                      = (-TR * A).exp();
-    const Eigen::Vector2d RHS = (Eigen::Matrix2d::Identity() - eATR) * M0;
-    for (int i = 0; i < spgr.size(); i++) {
-        const double a = spgr.FA[i] * B1;
-        Mobs = (Eigen::Matrix2d::Identity() - eATR * cos(a)).partialPivLu().solve(RHS * sin(a));
-        signal(i) = PD * Mobs.sum();
-    }
+    return spgr_signal(varying, precompute(fixed));
+}
+
+Eigen::ArrayXd TwoPoolModel::spgr_signal(const Eigen::ArrayXd &varying,
+                                         Precomputed const &   pre) const {
+    Eigen::ArrayXd signal(spgr.size());
+    SPGR2(varying, pre, spgr, signal);
     if (scale_to_mean) {
         signal /= signal.mean();
     }
@@ -153,8 +201,13 @@ Eigen::ArrayXd TwoPoolModel::spgr_signal(const Eigen::ArrayXd &varying,
 
 Eigen::ArrayXd TwoPoolModel::ssfp_signal(const Eigen::ArrayXd &varying,
                                          const QI_ARRAYN(double, NF) & fixed) const {
-    Eigen::MatrixXd M       = SSFP2(varying, fixed, ssfp);
-    QI_ARRAY(double) signal = M.array().square().colwise().sum().sqrt();
+    return ssfp_signal(varying, precompute(fixed));
+}
+
+Eigen::ArrayXd TwoPoolModel::ssfp_signal(const Eigen::ArrayXd &varying,
+                                         Precomputed const &   pre) const {
+    Eigen::ArrayXd signal(ssfp.size());
+    SSFP2(varying, pre, ssfp, signal);
     if (scale_to_mean) {
         signal /= signal.mean();
     }
@@ -34,19 +34,42 @@ struct TwoPoolModel : Model<double, double, 7, 2, 2> {
     QI_ARRAYN(double, 7) bounds_lo;
     QI_ARRAYN(double, 7) bounds_hi;
 
+    /*
+     *  The trig terms of the flip-angles and SSFP phases only depend on the fixed parameters.
+     *  When the signal is needed for many sets of varying parameters in one voxel, e.g. for SRC,
+     *  calculate them once with precompute() and use the overloads that take them.
+     */
+    struct Precomputed {
+        FixedArray     fixed;
+        Eigen::ArrayXd spgr_ca, spgr_sa, ssfp_ca, ssfp_sa, ssfp_ct, ssfp_st;
+    };
+
     TwoPoolModel(SPGRSequence const &s1, SSFPSequence const &s2, const bool scale);
-    bool   valid(VaryingArray const &params) const; // For SRC
-    size_t num_outputs() const;
-    int    output_size(int i) const;
+    bool        valid(VaryingArray const &params) const; // For SRC
+    size_t      num_outputs() const;
+    int         output_size(int i) const;
+    Precomputed precompute(FixedArray const &fixed) const;
 
     Eigen::ArrayXd spgr_signal(const Eigen::ArrayXd &varying,
                                const QI_ARRAYN(double, NF) & fixed) const;
+    Eigen::ArrayXd spgr_signal(const Eigen::ArrayXd &varying, Precomputed const &pre) const;
 
     Eigen::ArrayXd ssfp_signal(const Eigen::ArrayXd &varying,
                                const QI_ARRAYN(double, NF) & fixed) const;
+    Eigen::ArrayXd ssfp_signal(const Eigen::ArrayXd &varying, Precomputed const &pre) const;
 
     std::vector<Eigen::ArrayXd> signals(VaryingArray const &varying, FixedArray const &fixed) const;
+    std::vector<Eigen::ArrayXd> signals(VaryingArray const &varying, Precomputed const &pre) const;
     Eigen::ArrayXd signal(const Eigen::ArrayXd &varying, const QI_ARRAYN(double, NF) & fixed) const;
+    Eigen::ArrayXd signal(const Eigen::ArrayXd &varying, Precomputed const &pre) const;
+
+    /*
+     *  As above, but written into out, which must already hold spgr.size() + ssfp.size() values.
+     *  Nothing is allocated, so SRC can evaluate a whole batch of samples into one matrix.
+     */
+    void signal(VaryingArray const &       varying,
+                Precomputed const &        pre,
+                Eigen::Ref<Eigen::ArrayXd> out) const;
 };
 
 } // End namespace QI
\ No newline at end of file
@@ -15,6 +15,7 @@
 // #define QI_DEBUG_BUILD 1
 
 #include "Args.h"
+#include "FitFunction.h"
 #include "ImageIO.h"
 #include "Macro.h"
 #include "Model.h"
@@ -126,40 +127,104 @@ struct JSRModel : QI::Model<double, double, 4, 1, 2> {
         return s;
     }
 
+    // Analytic derivatives of the signals, used instead of auto-differentiation during fitting
+    JacobianArray spgr_jacobian(VaryingArray const &v, FixedArray const &f) const {
+        double const         PD = v[0];
+        double const         T1 = v[1];
+        double const         T2 = v[2];
+        Eigen::ArrayXd const sa = sin(spgr.FA * f[0]);
+        Eigen::ArrayXd const ca = cos(spgr.FA * f[0]);
+        double const         E1 = exp(-spgr.TR / T1);
+        double const         Ee = exp(-spgr.TE / T2);
+        Eigen::ArrayXd const d  = 1. - E1 * ca;
+        Eigen::ArrayXd const S1 = Ee * sa * (1. - E1) / d;
+
+        JacobianArray J(spgr.size(), NV);
+        J.col(0) = S1;
+        J.col(1) = PD * Ee * sa * (ca - 1.) / d.square() * (E1 * spgr.TR / (T1 * T1));
+        J.col(2) = PD * S1 * spgr.TE / (T2 * T2);
+        J.col(3).setZero();
+        return J;
+    }
+
+    /*
+     *  The SSFP magnitude simplifies to |G| * |1 - E2 * exp(i theta)| / |1 - b cos(theta)|, so each
+     *  derivative is the signal multiplied by the sum of the log-derivatives of the factors. The
+     *  finite-pulse correction makes E2 depend on T1 as well as T2.
+     */
+    JacobianArray ssfp_jacobian(VaryingArray const &v, FixedArray const &f) const {
+        double const PD  = v[0];
+        double const T1  = v[1];
+        double const T2  = v[2];
+        double const psi = v[3];
+        double const k   = 0.125 * (1.0 + ssfp.Trf / ssfp.TR) * ssfp.Trf;
+        double const TRc = ssfp.TR - (0.68 * ssfp.Trf - k * T2 / T1);
+        double const E1  = exp(-ssfp.TR / T1);
+        double const E2  = exp(-TRc / T2);
+
+        Eigen::ArrayXd const alpha = ssfp.FA * f[0];
+        Eigen::ArrayXd const ca    = cos(alpha);
+        Eigen::ArrayXd const d     = 1. - E1 * E2 * E2 - (E1 - E2 * E2) * ca;
+        Eigen::ArrayXd const b     = E2 * (1. - E1) * (1. + ca) / d;
+        Eigen::ArrayXd const theta = ssfp.PhaseInc + psi;
+        Eigen::ArrayXd const ct    = cos(theta);
+        Eigen::ArrayXd const st    = sin(theta);
+        Eigen::ArrayXd const q2    = 1. - 2. * E2 * ct + E2 * E2;
+        Eigen::ArrayXd const u     = 1. - b * ct;
+        Eigen::ArrayXd const S1 = (sqrt(E2) * (1. - E1) * sin(alpha) * sqrt(q2) / (d * u)).abs();
+
+        // Partial log-derivatives with respect to E1 and E2
+        Eigen::ArrayXd const dd1 = -E2 * E2 - ca;
+        Eigen::ArrayXd const db1 = -E2 * (1. + ca) / d - b * dd1 / d;
+        Eigen::ArrayXd const dl1 = -1. / (1. - E1) - dd1 / d + ct * db1 / u;
+        Eigen::ArrayXd const dd2 = 2. * E2 * (ca - E1);
+        Eigen::ArrayXd const db2 = b / E2 - b * dd2 / d;
+        Eigen::ArrayXd const dl2 = 0.5 / E2 - dd2 / d + (E2 - ct) / q2 + ct * db2 / u;
+
+        JacobianArray J(ssfp.size(), NV);
+        J.col(0) = S1;
+        J.col(1) = PD * S1 * (dl1 * E1 * ssfp.TR + dl2 * E2 * k) / (T1 * T1);
+        J.col(2) = PD * S1 * dl2 * E2 * (ssfp.TR - 0.68 * ssfp.Trf) / (T2 * T2);
+        J.col(3) = PD * S1 * st * (E2 / q2 - b / u);
+        return J;
+    }
+
     auto signals(VaryingArray const &v, FixedArray const &f) const
         -> std::vector<QI_ARRAY(double)> {
         return {spgr_signal(v, f), ssfp_signal(v, f)};
     }
 };
 
-// Cost functors. These need to calculate the residuals
-struct SPGRCost {
+// Cost functions. These calculate the residuals for input I (0 = SPGR, 1 = SSFP) and their
+// Jacobian, which is the negative of the signal Jacobian
+template <int I> struct JSRCost : ceres::SizedCostFunction<ceres::DYNAMIC, JSRModel::NV> {
     JSRModel const &     model;
     JSRModel::FixedArray fixed;
     QI_ARRAY(double) const data;
 
-    template <typename T> bool operator()(T const *const vin, T *rin) const {
-        Eigen::Map<QI_ARRAYN(T, JSRModel::NV) const> const varying(vin);
-
-        Eigen::Map<QI_ARRAY(T)> residuals(rin, data.rows());
-        residuals = data - model.spgr_signal(varying, fixed);
-        return true;
+    JSRCost(JSRModel const &m, JSRModel::FixedArray const &f, QI_ARRAY(double) const &d) :
+        model(m), fixed(f), data(d) {
+        set_num_residuals(data.rows());
     }
-};
 
-struct SSFPCost {
-    JSRModel const &     model;
-    JSRModel::FixedArray fixed;
-    QI_ARRAY(double) const data;
-
-    template <typename T> bool operator()(T const *const vin, T *rin) const {
-        Eigen::Map<QI_ARRAYN(T, JSRModel::NV) const> const varying(vin);
-
-        Eigen::Map<QI_ARRAY(T)> residuals(rin, data.rows());
-        residuals = data - model.ssfp_signal(varying, fixed);
+    bool Evaluate(double const *const *vin, double *rin, double **jin) const override {
+        JSRModel::VaryingArray const varying = Eigen::Map<JSRModel::VaryingArray const>(vin[0]);
+
+        Eigen::Map<QI_ARRAY(double)> residuals(rin, data.rows());
+        residuals = data - ((I == 0) ? model.spgr_signal(varying, fixed) :
+                                       model.ssfp_signal(varying, fixed));
+        if (jin && jin[0]) {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, JSRModel::NV, Eigen::RowMajor>> J(
+                jin[0], data.rows(), JSRModel::NV);
+            J = -((I == 0) ? model.spgr_jacobian(varying, fixed) :
+                             model.ssfp_jacobian(varying, fixed))
+                     .matrix();
+        }
         return true;
     }
 };
+using SPGRCost = JSRCost<0>;
+using SSFPCost = JSRCost<1>;
 
 // Fit function structure. This is what actually runs the fitting/optimisation
 struct JSRFit {
@@ -210,12 +275,8 @@ struct JSRFit {
 
         // Setup Ceres
         ceres::Problem problem;
-        using AutoSPGRType = ceres::AutoDiffCostFunction<SPGRCost, ceres::DYNAMIC, ModelType::NV>;
-        using AutoSSFPType = ceres::AutoDiffCostFunction<SSFPCost, ceres::DYNAMIC, ModelType::NV>;
-        auto *spgr_cost =
-            new AutoSPGRType(new SPGRCost{model, fixed, spgr_data}, model.spgr.size());
-        auto *ssfp_cost =
-            new AutoSSFPType(new SSFPCost{model, fixed, ssfp_data}, model.ssfp.size());
+        auto *spgr_cost = new SPGRCost(model, fixed, spgr_data);
+        auto *ssfp_cost = new SSFPCost(model, fixed, ssfp_data);
         ceres::LossFunction *loss = new ceres::HuberLoss(1.0); // Don't know if this helps
         // This is where the parameters and cost functions actually get added to Ceres
         ModelType::VaryingArray varying;
@@ -229,7 +290,6 @@ struct JSRFit {
         }
 
         ceres::Solver::Options options;
-        ceres::Solver::Summary summary;
         options.max_num_iterations  = 50;
         options.function_tolerance  = 1e-6;
         options.gradient_tolerance  = 1e-7;
@@ -237,22 +297,19 @@ struct JSRFit {
         options.logging_type        = ceres::SILENT;
 
         // We need to do 2 starts for JSR in case off-resonance is very high
-        double       best_cost = std::numeric_limits<double>::max();
-        double const psi_step  = (n_psi % 2) ? 2 * M_PI / (n_psi - 1) : 2 * M_PI / (n_psi);
-        double       psi       = (n_psi == 1) ? 0 : -M_PI;
+        double const psi_step = (n_psi % 2) ? 2 * M_PI / (n_psi - 1) : 2 * M_PI / (n_psi);
+        double       psi      = (n_psi == 1) ? 0 : -M_PI;
+        std::vector<ModelType::VaryingArray> starts;
         for (int p = 0; p < n_psi; p++, psi += psi_step) {
-            varying    = model.start;
-            varying[3] = psi;
-            ceres::Solve(options, &problem, &summary);
-            if (!summary.IsSolutionUsable()) {
-                return {false, summary.FullReport()};
-            }
-            if (summary.final_cost < best_cost) {
-                iterations   = summary.iterations.size();
-                best_varying = varying;
-                best_cost    = summary.final_cost;
-            }
+            starts.push_back(model.start);
+            starts.back()[3] = psi;
+        }
+        auto const ms = QI::MultiStart(options, problem, varying, starts);
+        if (!ms.usable) {
+            return {false, ms.message};
         }
+        iterations   = ms.iterations;
+        best_varying = varying;
         Eigen::ArrayXd const spgr_residual = (spgr_data - model.spgr_signal(best_varying, fixed));
         Eigen::ArrayXd const ssfp_residual = (ssfp_data - model.ssfp_signal(best_varying, fixed));
         if (residuals.size() > 0) {
@@ -306,12 +363,19 @@ int jsr_main(args::Subparser &parser) {
                                           mask.Get(),
                                           verbose,
                                           simulate.Get(),
-                                          subregion.Get());
+                                          subregion.Get(),
+                                          seed.Get());
     } else {
         JSRFit jsr_fit{model, npsi.Get()};
         auto   fit_filter =
             QI::ModelFitFilter<JSRFit>::New(&jsr_fit, verbose, covar, resids, subregion.Get());
+        fit_filter->SetStreaming(stream.Get());
+        fit_filter->SetWriters(writers.Get(), overlap);
+        fit_filter->SetPackOutputs(pack);
         fit_filter->ReadInputs({spgr_path.Get(), ssfp_path.Get()}, {b1_path.Get()}, mask.Get());
+        fit_filter->SetChunkSize(chunk.Get());
+        fit_filter->SetWarmStart(warm);
+        fit_filter->SetCheckpoint(checkpoint.Get(), resume);
         fit_filter->Update();
         fit_filter->WriteOutputs(prefix.Get() + "JSR_");
     }
@@ -174,12 +174,12 @@ struct MPMFit {
         Eigen::ArrayXd const mtw_data = inputs[2] / scale;
         v << 20., 1., 1., 1.; // R2s, S_PDw, S_T1w, S_MTw
         ceres::Problem problem;
-        using AutoPDwType = ceres::AutoDiffCostFunction<PDwCost, ceres::DYNAMIC, ModelType::NV>;
-        using AutoT1wType = ceres::AutoDiffCostFunction<T1wCost, ceres::DYNAMIC, ModelType::NV>;
-        using AutoMTwType = ceres::AutoDiffCostFunction<MTwCost, ceres::DYNAMIC, ModelType::NV>;
-        auto *pdw_cost    = new AutoPDwType(new PDwCost{model, pdw_data}, model.pdw_s.size());
-        auto *t1w_cost    = new AutoT1wType(new T1wCost{model, t1w_data}, model.t1w_s.size());
-        auto *mtw_cost    = new AutoMTwType(new MTwCost{model, mtw_data}, model.mtw_s.size());
+        auto *pdw_cost = QI::MakeAutoDiffCost<PDwCost, ModelType::NV>(new PDwCost{model, pdw_data},
+                                                                      model.pdw_s.size());
+        auto *t1w_cost = QI::MakeAutoDiffCost<T1wCost, ModelType::NV>(new T1wCost{model, t1w_data},
+                                                                      model.t1w_s.size());
+        auto *mtw_cost = QI::MakeAutoDiffCost<MTwCost, ModelType::NV>(new MTwCost{model, mtw_data},
+                                                                      model.mtw_s.size());
         ceres::LossFunction *loss = new ceres::HuberLoss(1.0);
         problem.AddResidualBlock(pdw_cost, loss, v.data());
         problem.AddResidualBlock(t1w_cost, loss, v.data());
@@ -250,11 +250,18 @@ int mpm_r2s_main(args::Subparser &parser) {
                                           mask.Get(),
                                           verbose,
                                           simulate.Get(),
-                                          subregion.Get());
+                                          subregion.Get(),
+                                          seed.Get());
     } else {
         auto fit_filter =
             QI::ModelFitFilter<MPMFit>::New(&mpm_fit, verbose, covar, resids, subregion.Get());
+        fit_filter->SetStreaming(stream.Get());
+        fit_filter->SetWriters(writers.Get(), overlap);
+        fit_filter->SetPackOutputs(pack);
         fit_filter->ReadInputs({pdw_path.Get(), t1w_path.Get(), mtw_path.Get()}, {}, mask.Get());
+        fit_filter->SetChunkSize(chunk.Get());
+        fit_filter->SetWarmStart(warm);
+        fit_filter->SetCheckpoint(checkpoint.Get(), resume);
         fit_filter->Update();
         fit_filter->WriteOutputs(prefix.Get() + "MPM_");
     }
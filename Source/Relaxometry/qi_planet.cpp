@@ -60,6 +60,7 @@ struct PLANETFit {
     using RMSErrorType        = double;
     using FlagType            = int;
     using ModelType           = PLANETModel;
+    using Batch               = QI::FitBatch<PLANETModel, FlagType>;
     ModelType model;
 
     int input_size(const int /* Unused */) const { return 1; }
@@ -91,6 +92,34 @@ struct PLANETFit {
         out[2] = T2;
         return {true, ""};
     }
+
+    /*
+     *  The same closed-form solution for a whole tile. Each row may come from a different block,
+     *  and hence flip-angle.
+     */
+    void fit_batch(Batch &batch) const {
+        using Column   = Batch::Column;
+        Column const G = batch.inputs[0].col(0);
+        Column const a = batch.inputs[1].col(0);
+        Column const b = batch.inputs[2].col(0);
+        Column       FA;
+        for (Eigen::Index r = 0; r < Batch::MaxSize; r++) {
+            FA[r] = model.sequence.FA(batch.blocks[r]);
+        }
+        Column const alpha = batch.fixed.col(0) * FA;
+        Column const cosa  = alpha.cos();
+        Column const sina  = alpha.sin();
+        Column const T1    = -model.sequence.TR / ((a * (1. + cosa - a * b * cosa) - b) /
+                                                 (a * (1. + cosa - a * b) - b * cosa))
+                                                    .log();
+        Column const T2 = -model.sequence.TR / a.log();
+        Column const E1 = (-model.sequence.TR / T1).exp();
+        Column const E2 = a; // For simplicity copying formulas
+        batch.outputs.col(0) =
+            G * (1. - E1 * cosa - E2 * E2 * (E1 - cosa)) / (E2.sqrt() * (1. - E1) * sina);
+        batch.outputs.col(1) = T1;
+        batch.outputs.col(2) = T2;
+    }
 };
 
 int planet_main(args::Subparser &parser) {
@@ -116,13 +145,20 @@ int planet_main(args::Subparser &parser) {
                                              mask.Get(),
                                              verbose,
                                              simulate.Get(),
-                                             subregion.Get());
+                                             subregion.Get(),
+                                             seed.Get());
     } else {
         PLANETFit fit{model};
         auto      fit_filter =
             QI::ModelFitFilter<PLANETFit>::New(&fit, verbose, false, false, subregion.Get());
+        fit_filter->SetStreaming(stream.Get());
+        fit_filter->SetWriters(writers.Get(), overlap);
+        fit_filter->SetPackOutputs(pack);
         fit_filter->ReadInputs({G_path.Get(), a_path.Get(), b_path.Get()}, {B1.Get()}, mask.Get());
         fit_filter->SetBlocks(ssfp.size());
+        fit_filter->SetChunkSize(chunk.Get());
+        fit_filter->SetWarmStart(warm);
+        fit_filter->SetCheckpoint(checkpoint.Get(), resume);
         fit_filter->Update();
         fit_filter->WriteOutputs(prefix.Get() + "PLANET_");
         QI::Log(verbose, "Finished.");
@@ -122,8 +122,8 @@ struct EllipseFit {
         const Eigen::ArrayXcd      data   = inputs[0] / scale;
         const std::complex<double> c_mean = data.mean();
 
-        using AutoCost = ceres::AutoDiffCostFunction<EllipseCost, ceres::DYNAMIC, EllipseModel::NV>;
-        auto *auto_cost           = new AutoCost(new EllipseCost{model, data}, data.rows() * 2);
+        auto *auto_cost = QI::MakeAutoDiffCost<EllipseCost, EllipseModel::NV>(
+            new EllipseCost{model, data}, data.rows() * 2);
         ceres::LossFunction *loss = new ceres::HuberLoss(1.0);
         ceres::Problem       problem;
         problem.AddResidualBlock(auto_cost, loss, p.data());
@@ -203,14 +203,21 @@ int ssfp_ellipse_main(args::Subparser &parser) {
                                                mask.Get(),
                                                verbose,
                                                simulate.Get(),
-                                               subregion.Get());
+                                               subregion.Get(),
+                                               seed.Get());
     } else {
         EllipseFit fit{model};
         auto       fit_filter =
             QI::ModelFitFilter<EllipseFit>::New(&fit, verbose, covar, resids, subregion.Get());
+        fit_filter->SetStreaming(stream.Get());
+        fit_filter->SetWriters(writers.Get(), overlap);
+        fit_filter->SetPackOutputs(pack);
         fit_filter->ReadInputs({sequence_path.Get()}, {}, mask.Get());
         fit_filter->SetBlocks(fit_filter->GetInput(0)->GetNumberOfComponentsPerPixel() /
                               sequence.size());
+        fit_filter->SetChunkSize(chunk.Get());
+        fit_filter->SetWarmStart(warm);
+        fit_filter->SetCheckpoint(checkpoint.Get(), resume);
         fit_filter->Update();
         fit_filter->WriteOutputs(prefix.Get() + "ES_");
         QI::Log(verbose, "Finished.");
@@ -41,7 +41,45 @@ struct DESPOT1 : QI::Model<double, double, 2, 1> {
     template <typename Derived>
     auto signal(const Eigen::ArrayBase<Derived> &v, const QI_ARRAYN(double, NF) & f) const
         -> QI_ARRAY(typename Derived::Scalar) {
-        return QI::SPGRSignal(v[0], v[1], f[0], sequence);
+        QI_ARRAY(typename Derived::Scalar) s(sequence.size());
+        signal(v, f, s);
+        return s;
+    }
+
+    /*
+     *  The SPGR signal one flip-angle at a time, into out. Does not allocate.
+     */
+    template <typename Derived, typename Out>
+    void signal(Eigen::ArrayBase<Derived> const &v,
+                FixedArray const &               f,
+                Eigen::ArrayBase<Out> &          out) const {
+        using T    = typename Derived::Scalar;
+        T const E1 = exp(-sequence.TR / v[1]);
+        for (Eigen::Index i = 0; i < sequence.size(); i++) {
+            double const a = f[0] * sequence.FA[i];
+            out[i]         = v[0] * ((1. - E1) * sin(a)) / (1. - E1 * cos(a));
+        }
+    }
+
+    JacobianArray jacobian(VaryingArray const &v, FixedArray const &f) const {
+        JacobianArray J(sequence.size(), NV);
+        jacobian(v, f, J);
+        return J;
+    }
+
+    template <typename Out>
+    void jacobian(VaryingArray const &v, FixedArray const &f, Eigen::DenseBase<Out> &J) const {
+        double const PD  = v[0];
+        double const T1  = v[1];
+        double const E1  = exp(-sequence.TR / T1);
+        double const dE1 = E1 * sequence.TR / (T1 * T1); // d(E1)/d(T1)
+        for (Eigen::Index i = 0; i < sequence.size(); i++) {
+            double const sa = sin(f[0] * sequence.FA[i]);
+            double const ca = cos(f[0] * sequence.FA[i]);
+            double const d  = 1. - E1 * ca;
+            J(i, 0)         = (1. - E1) * sa / d;
+            J(i, 1)         = PD * sa * (ca - 1.) / (d * d) * dE1;
+        }
     }
 };
 
@@ -74,6 +112,49 @@ struct DESPOT1LLS : DESPOT1Fit {
         iterations = 1;
         return {true, ""};
     }
+
+    /*
+     *  The same straight-line fit, accumulated one flip-angle at a time across the whole tile
+     */
+    void fit_batch(Batch &batch) const {
+        using Column      = Batch::Column;
+        auto const & data = batch.inputs[0];
+        Column const B1   = batch.fixed.col(0);
+        double const n    = model.sequence.size();
+        Column       sx   = Column::Zero();
+        Column       sy   = Column::Zero();
+        Column       sxx  = Column::Zero();
+        Column       sxy  = Column::Zero();
+        for (Eigen::Index j = 0; j < model.sequence.size(); j++) {
+            Column const flip = model.sequence.FA[j] * B1;
+            Column const x    = data.col(j) / flip.tan();
+            Column const y    = data.col(j) / flip.sin();
+            sx += x;
+            sy += y;
+            sxx += x.square();
+            sxy += x * y;
+        }
+        Column const slope     = (n * sxy - sx * sy) / (n * sxx - sx.square());
+        Column const intercept = (sy - slope * sx) / n;
+        batch.outputs.col(0) =
+            Batch::Clamp(intercept / (1. - slope), 0., std::numeric_limits<double>::max());
+        batch.outputs.col(1) =
+            Batch::Clamp(-model.sequence.TR / slope.log(), model.bounds_lo[1], model.bounds_hi[1]);
+
+        Column const PD = batch.outputs.col(0);
+        Column const E1 = (-model.sequence.TR / batch.outputs.col(1)).exp();
+        Column       ss = Column::Zero();
+        for (Eigen::Index j = 0; j < model.sequence.size(); j++) {
+            Column const flip = model.sequence.FA[j] * B1;
+            Column const r = data.col(j) - PD * ((1. - E1) * flip.sin()) / (1. - E1 * flip.cos());
+            ss += r.square();
+            if (batch.residuals.size() > 0) {
+                batch.residuals[0].col(j) = r;
+            }
+        }
+        batch.rmse = (ss / n).sqrt();
+        batch.flags.setConstant(1);
+    }
 };
 
 struct DESPOT1WLLS : DESPOT1Fit {
@@ -118,7 +199,7 @@ struct DESPOT1WLLS : DESPOT1Fit {
     }
 };
 
-struct DESPOT1NLLS : DESPOT1Fit {
+template <QI::NLLSSolver Solver> struct DESPOT1NLLS : DESPOT1Fit {
     DESPOT1NLLS(DESPOT1 &m) : DESPOT1Fit(m) {}
 
     QI::FitReturnType fit(const std::vector<Eigen::ArrayXd> &inputs,
@@ -135,30 +216,57 @@ struct DESPOT1NLLS : DESPOT1Fit {
             return {false, "Maximum data value was not positive"};
         }
         const Eigen::ArrayXd data = inputs[0] / scale;
-        p << 10., 1.;
-        ceres::Problem problem;
-        using Cost      = QI::ModelCost<DESPOT1>;
-        using AutoCost  = ceres::AutoDiffCostFunction<Cost, ceres::DYNAMIC, DESPOT1::NV>;
-        auto *cost      = new Cost{model, fixed, data};
-        auto *auto_cost = new AutoCost(cost, model.sequence.size());
-        problem.AddResidualBlock(auto_cost, NULL, p.data());
-        problem.SetParameterLowerBound(p.data(), 0, model.bounds_lo[0]);
-        problem.SetParameterUpperBound(p.data(), 0, model.bounds_hi[0]);
-        problem.SetParameterLowerBound(p.data(), 1, model.bounds_lo[1]);
-        problem.SetParameterUpperBound(p.data(), 1, model.bounds_hi[1]);
-        ceres::Solver::Options options;
-        ceres::Solver::Summary summary;
-        options.max_num_iterations  = model.max_iterations;
-        options.function_tolerance  = 1e-5;
-        options.gradient_tolerance  = 1e-6;
-        options.parameter_tolerance = 1e-4;
-        options.logging_type        = ceres::SILENT;
-        ceres::Solve(options, &problem, &summary);
-
-        if (!summary.IsSolutionUsable()) {
-            return {false, summary.FullReport()};
+        p[0] /= scale;
+        DESPOT1::VaryingArray const start{10., 1.};
+        bool const                  warm =
+            QI::WarmStart(p, start, model.bounds_lo, model.bounds_hi);
+        Eigen::Matrix2d             JtJ;
+        if constexpr (Solver == QI::NLLSSolver::LM) {
+            QI::LevenbergMarquardt<DESPOT1> lm(
+                model, fixed, data, model.bounds_lo, model.bounds_hi);
+            QI::LMOptions                   options;
+            options.max_iterations      = model.max_iterations;
+            options.function_tolerance  = 1e-5;
+            options.gradient_tolerance  = 1e-6;
+            options.parameter_tolerance = 1e-4;
+            auto summary                = lm.solve(p, options);
+            if (warm && (!summary.usable || !p.allFinite())) {
+                p       = start;
+                summary = lm.solve(p, options);
+            }
+            if (!summary.usable) {
+                return {false, summary.message};
+            }
+            iterations = summary.iterations;
+            JtJ        = lm.JtJ();
+        } else {
+            ceres::Problem problem;
+            problem.AddResidualBlock(QI::MakeModelCost(model, fixed, data), NULL, p.data());
+            problem.SetParameterLowerBound(p.data(), 0, model.bounds_lo[0]);
+            problem.SetParameterUpperBound(p.data(), 0, model.bounds_hi[0]);
+            problem.SetParameterLowerBound(p.data(), 1, model.bounds_lo[1]);
+            problem.SetParameterUpperBound(p.data(), 1, model.bounds_hi[1]);
+            ceres::Solver::Options options;
+            ceres::Solver::Summary summary;
+            options.max_num_iterations  = model.max_iterations;
+            options.function_tolerance  = 1e-5;
+            options.gradient_tolerance  = 1e-6;
+            options.parameter_tolerance = 1e-4;
+            options.logging_type        = ceres::SILENT;
+            ceres::Solve(options, &problem, &summary);
+            if (warm && (!summary.IsSolutionUsable() || !p.allFinite())) {
+                p = start;
+                ceres::Solve(options, &problem, &summary);
+            }
+            if (!summary.IsSolutionUsable()) {
+                return {false, summary.FullReport()};
+            }
+            iterations = summary.iterations.size();
+            if (cov) { // What GetModelCovariance(problem, ...) would get from the analytic cost
+                Eigen::MatrixXd const J = model.jacobian(p, fixed).matrix();
+                JtJ                     = J.transpose() * J;
+            }
         }
-        iterations = summary.iterations.size();
 
         Eigen::ArrayXd const rs  = (data - model.signal(p, fixed));
         double const         var = rs.square().sum();
@@ -167,7 +275,7 @@ struct DESPOT1NLLS : DESPOT1Fit {
             residuals[0] = rs * scale;
         }
         if (cov) {
-            QI::GetModelCovariance<DESPOT1>(problem, p, var / (data.rows() - DESPOT1::NV), cov);
+            QI::GetModelCovariance<DESPOT1>(JtJ, p, var / (data.rows() - DESPOT1::NV), cov);
         }
         p[0] = p[0] * scale;
         return {true, ""};
@@ -184,6 +292,7 @@ int despot1_main(args::Subparser &parser) {
     args::ValueFlag<char> algorithm(parser, "ALGO", "Choose algorithm (l/w/n)", {'a', "algo"}, 'l');
     args::ValueFlag<int>  its(
         parser, "ITERS", "Max iterations for WLLS/NLLS (default 15)", {'i', "its"}, 15);
+    args::Flag lm(parser, "LM", "Use the built-in Levenberg-Marquardt for NLLS, not Ceres", {"lm"});
     parser.Parse();
     QI::CheckPos(spgr_path);
     QI::Log(verbose, "Reading sequence information");
@@ -199,29 +308,43 @@ int despot1_main(args::Subparser &parser) {
                                           mask.Get(),
                                           verbose,
                                           simulate.Get(),
-                                          subregion.Get());
+                                          subregion.Get(),
+                                          seed.Get());
     } else {
-        DESPOT1Fit *d1 = nullptr;
+        // Each algorithm gets its own filter, so that LLS can be batched
+        auto process = [&](auto fit_func) {
+            auto fit = QI::ModelFitFilter<decltype(fit_func)>::New(
+                &fit_func, verbose, covar, resids, subregion.Get());
+            fit->SetStreaming(stream.Get());
+            fit->SetWriters(writers.Get(), overlap);
+            fit->SetPackOutputs(pack);
+            fit->ReadInputs({QI::CheckPos(spgr_path)}, {B1.Get()}, mask.Get());
+            fit->SetChunkSize(chunk.Get());
+            fit->SetWarmStart(warm);
+            fit->SetCheckpoint(checkpoint.Get(), resume);
+            fit->Update();
+            fit->WriteOutputs(prefix.Get() + "D1_");
+        };
         switch (algorithm.Get()) {
         case 'l':
-            d1 = new DESPOT1LLS(model);
             QI::Log(verbose, "LLS algorithm selected.");
+            process(DESPOT1LLS(model));
             break;
         case 'w':
-            d1 = new DESPOT1WLLS(model);
             QI::Log(verbose, "WLLS algorithm selected.");
+            process(DESPOT1WLLS(model));
             break;
         case 'n':
-            d1 = new DESPOT1NLLS(model);
             QI::Log(verbose, "NLLS algorithm selected.");
+            if (lm) {
+                process(DESPOT1NLLS<QI::NLLSSolver::LM>(model));
+            } else {
+                process(DESPOT1NLLS<QI::NLLSSolver::Ceres>(model));
+            }
             break;
         default:
             QI::Fail("Unknown algorithm type: {}", algorithm.Get());
         }
-        auto fit = QI::ModelFitFilter<DESPOT1Fit>::New(d1, verbose, covar, resids, subregion.Get());
-        fit->ReadInputs({QI::CheckPos(spgr_path)}, {B1.Get()}, mask.Get());
-        fit->Update();
-        fit->WriteOutputs(prefix.Get() + "D1_");
         QI::Log(verbose, "Finished.");
     }
     return EXIT_SUCCESS;
@@ -134,13 +134,10 @@ struct HIFIFit {
         const Eigen::ArrayXd mprage_data = inputs[1] / scale;
         v << 10., 1., 1.; // PD, T1, B1
         ceres::Problem problem;
-        using AutoSPGRType =
-            ceres::AutoDiffCostFunction<HIFISPGRCost, ceres::DYNAMIC, HIFIModel::NV>;
-        using AutoMPRAGEType =
-            ceres::AutoDiffCostFunction<HIFIMPRAGECost, ceres::DYNAMIC, HIFIModel::NV>;
-        auto *spgr_cost = new AutoSPGRType(new HIFISPGRCost{model, spgr_data}, model.spgr.size());
-        auto *mprage_cost =
-            new AutoMPRAGEType(new HIFIMPRAGECost{model, mprage_data}, model.mprage.size());
+        auto *spgr_cost   = QI::MakeAutoDiffCost<HIFISPGRCost, HIFIModel::NV>(
+            new HIFISPGRCost{model, spgr_data}, model.spgr.size());
+        auto *mprage_cost = QI::MakeAutoDiffCost<HIFIMPRAGECost, HIFIModel::NV>(
+            new HIFIMPRAGECost{model, mprage_data}, model.mprage.size());
         problem.AddResidualBlock(spgr_cost, NULL, v.data());
         problem.AddResidualBlock(mprage_cost, NULL, v.data());
         for (int i = 0; i < 3; i++) {
@@ -206,13 +203,20 @@ int despot1hifi_main(args::Subparser &parser) {
                                            mask.Get(),
                                            verbose,
                                            simulate.Get(),
-                                           subregion.Get());
+                                           subregion.Get(),
+                                           seed.Get());
     } else {
         HIFIFit hifi_fit{model};
         auto    fit_filter =
             QI::ModelFitFilter<HIFIFit>::New(&hifi_fit, verbose, covar, resids, subregion.Get());
+        fit_filter->SetStreaming(stream.Get());
+        fit_filter->SetWriters(writers.Get(), overlap);
+        fit_filter->SetPackOutputs(pack);
         fit_filter->ReadInputs(
             {QI::CheckPos(spgr_path), QI::CheckPos(mprage_path)}, {}, mask.Get());
+        fit_filter->SetChunkSize(chunk.Get());
+        fit_filter->SetWarmStart(warm);
+        fit_filter->SetCheckpoint(checkpoint.Get(), resume);
         fit_filter->Update();
         fit_filter->WriteOutputs(prefix.Get() + "HIFI_");
         QI::Log(verbose, "Finished.");
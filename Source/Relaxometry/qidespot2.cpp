@@ -41,19 +41,57 @@ struct DESPOT2 : QI::Model<double, double, 2, 2> {
     template <typename Derived>
     auto signal(const Eigen::ArrayBase<Derived> &v, const QI_ARRAYN(double, NF) & f) const
         -> QI_ARRAY(typename Derived::Scalar) {
-        using T          = typename Derived::Scalar;
-        const T &     PD = v[0];
-        const T &     T2 = v[1];
-        const double &T1 = f[0];
-        const double &B1 = f[1];
-        const double  E1 = exp(-sequence.TR / T1);
-        const T       E2 = exp(-sequence.TR / T2);
+        QI_ARRAY(typename Derived::Scalar) s(sequence.size());
+        signal(v, f, s);
+        return s;
+    }
+
+    /*
+     *  The SSFP signal one flip-angle at a time, into out. Does not allocate.
+     */
+    template <typename Derived, typename Out>
+    void signal(Eigen::ArrayBase<Derived> const &v,
+                FixedArray const &               f,
+                Eigen::ArrayBase<Out> &          out) const {
+        using T             = typename Derived::Scalar;
+        const T &     PD    = v[0];
+        const T &     T2    = v[1];
+        const double &T1    = f[0];
+        const double &B1    = f[1];
+        const double  E1    = exp(-sequence.TR / T1);
+        const T       E2    = exp(-sequence.TR / T2);
+        const T       E2d   = elliptical ? T(E2 * E2) : E2; // E2^2 in the elliptical denominator
+        const T       numer = PD * sqrt(E2) * (1.0 - E1);
+        for (Eigen::Index i = 0; i < sequence.size(); i++) {
+            const double alpha = sequence.FA[i] * B1;
+            out[i] = numer * sin(alpha) / (1.0 - E1 * E2d - (E1 - E2d) * cos(alpha));
+        }
+    }
 
-        const QI_ARRAY(double) alpha = sequence.FA * B1;
-        const QI_ARRAY(T) denom = elliptical ? (1.0 - E1 * E2 * E2 - (E1 - E2 * E2) * cos(alpha)) :
-                                               (1.0 - E1 * E2 - (E1 - E2) * cos(alpha));
-        const QI_ARRAY(T) numer = PD * sqrt(E2) * (1.0 - E1) * sin(alpha);
-        return numer / denom;
+    JacobianArray jacobian(VaryingArray const &v, FixedArray const &f) const {
+        JacobianArray J(sequence.size(), NV);
+        jacobian(v, f, J);
+        return J;
+    }
+
+    template <typename Out>
+    void jacobian(VaryingArray const &v, FixedArray const &f, Eigen::DenseBase<Out> &J) const {
+        double const PD = v[0];
+        double const T2 = v[1];
+        double const E1 = exp(-sequence.TR / f[0]);
+        double const E2 = exp(-sequence.TR / T2);
+        // The elliptical signal is the same with E2^2 in place of E2 in the denominator
+        double const E2d  = elliptical ? E2 * E2 : E2;
+        double const dE2d = elliptical ? 2. * E2 : 1.; // d(E2d)/d(E2)
+        double const dE2  = E2 * sequence.TR / (T2 * T2); // d(E2)/d(T2)
+        for (Eigen::Index i = 0; i < sequence.size(); i++) {
+            double const alpha = sequence.FA[i] * f[1];
+            double const d     = 1. - E1 * E2d - (E1 - E2d) * cos(alpha);
+            double const dd    = dE2d * (cos(alpha) - E1); // d(d)/d(E2)
+            double const S1    = sqrt(E2) * (1. - E1) * sin(alpha) / d;
+            J(i, 0)            = S1;
+            J(i, 1)            = PD * S1 * (0.5 / E2 - dd / d) * dE2;
+        }
     }
 };
 
@@ -100,6 +138,57 @@ struct DESPOT2LLS : DESPOT2Fit {
         iterations = 1;
         return {true, ""};
     }
+
+    /*
+     *  The same straight-line fit, accumulated one flip-angle at a time across the whole tile
+     */
+    void fit_batch(Batch &batch) const {
+        using Column      = Batch::Column;
+        auto const & data = batch.inputs[0];
+        Column const B1   = batch.fixed.col(1);
+        double const TR   = model.sequence.TR;
+        double const n    = model.sequence.size();
+        Column const E1   = (-TR / batch.fixed.col(0)).exp();
+        Column       sx   = Column::Zero();
+        Column       sy   = Column::Zero();
+        Column       sxx  = Column::Zero();
+        Column       sxy  = Column::Zero();
+        for (Eigen::Index j = 0; j < model.sequence.size(); j++) {
+            Column const alpha = model.sequence.FA[j] * B1;
+            Column const x     = data.col(j) / alpha.tan();
+            Column const y     = data.col(j) / alpha.sin();
+            sx += x;
+            sy += y;
+            sxx += x.square();
+            sxy += x * y;
+        }
+        Column const slope     = (n * sxy - sx * sy) / (n * sxx - sx.square());
+        Column const intercept = (sy - slope * sx) / n;
+        double const scale     = model.elliptical ? 2. : 1.;
+        Column const T2        = scale * TR / ((slope * E1 - 1.) / (slope - E1)).log();
+        Column const E2        = (-TR / T2).exp();
+        Column const E2e       = model.elliptical ? Column(E2.square()) : E2;
+        Column const PD        = intercept * (1. - E1 * E2e) / (E2.sqrt() * (1. - E1));
+        batch.outputs.col(0)   = Batch::Clamp(PD, model.bounds_lo[0], model.bounds_hi[0]);
+        batch.outputs.col(1)   = Batch::Clamp(T2, model.bounds_lo[1], model.bounds_hi[1]);
+
+        // Signal equation as in DESPOT2::signal, using the clamped parameters
+        Column const cE2  = (-TR / batch.outputs.col(1)).exp();
+        Column const cE2e = model.elliptical ? Column(cE2.square()) : cE2;
+        Column const G    = batch.outputs.col(0) * cE2.sqrt() * (1. - E1);
+        Column       ss   = Column::Zero();
+        for (Eigen::Index j = 0; j < model.sequence.size(); j++) {
+            Column const alpha = model.sequence.FA[j] * B1;
+            Column const r =
+                data.col(j) - G * alpha.sin() / (1. - E1 * cE2e - (E1 - cE2e) * alpha.cos());
+            ss += r.square();
+            if (batch.residuals.size() > 0) {
+                batch.residuals[0].col(j) = r;
+            }
+        }
+        batch.rmse = (ss / n).sqrt();
+        batch.flags.setConstant(1);
+    }
 };
 
 struct DESPOT2WLLS : DESPOT2Fit {
@@ -185,18 +274,19 @@ struct DESPOT2NLLS : DESPOT2Fit {
             return {false, "Maximum data value was not positive"};
         }
         const Eigen::ArrayXd data = inputs[0] / scale;
-        p << 10., 0.1;
-        ceres::Problem problem;
-        using Cost      = QI::ModelCost<DESPOT2>;
-        using AutoCost  = ceres::AutoDiffCostFunction<Cost, ceres::DYNAMIC, DESPOT2::NV>;
-        auto *cost      = new Cost{model, fixed, data};
-        auto *auto_cost = new AutoCost(cost, model.sequence.size());
-        problem.AddResidualBlock(auto_cost, NULL, p.data());
-        problem.SetParameterLowerBound(p.data(), 0, model.bounds_lo[0] / scale);
-        problem.SetParameterUpperBound(p.data(), 0, model.bounds_hi[0] / scale);
-        problem.SetParameterLowerBound(p.data(), 1, model.bounds_lo[1]);
-        problem.SetParameterUpperBound(
-            p.data(), 1, std::min(model.bounds_hi[1], fixed[0])); // T2 cannot be > T1
+        // T2 cannot be > T1
+        DESPOT2::VaryingArray const lo{model.bounds_lo[0] / scale, model.bounds_lo[1]};
+        DESPOT2::VaryingArray const hi{model.bounds_hi[0] / scale,
+                                       std::min(model.bounds_hi[1], fixed[0])};
+        p[0] /= scale;
+        DESPOT2::VaryingArray const start{10., 0.1};
+        bool const                  warm = QI::WarmStart(p, start, lo, hi);
+        ceres::Problem              problem;
+        problem.AddResidualBlock(QI::MakeModelCost(model, fixed, data), NULL, p.data());
+        for (int i = 0; i < DESPOT2::NV; i++) {
+            problem.SetParameterLowerBound(p.data(), i, lo[i]);
+            problem.SetParameterUpperBound(p.data(), i, hi[i]);
+        }
         ceres::Solver::Options options;
         ceres::Solver::Summary summary;
         options.max_num_iterations  = model.max_iterations;
@@ -205,7 +295,10 @@ struct DESPOT2NLLS : DESPOT2Fit {
         options.parameter_tolerance = 1e-4;
         options.logging_type        = ceres::SILENT;
         ceres::Solve(options, &problem, &summary);
-        p[0] = p[0] * scale;
+        if (warm && (!summary.IsSolutionUsable() || !p.allFinite())) {
+            p = start;
+            ceres::Solve(options, &problem, &summary);
+        }
         if (!summary.IsSolutionUsable()) {
             return {false, summary.FullReport()};
         }
@@ -254,31 +347,42 @@ int despot2_main(args::Subparser &parser) {
                                           mask.Get(),
                                           verbose,
                                           simulate.Get(),
-                                          subregion.Get());
+                                          subregion.Get(),
+                                          seed.Get());
     } else {
-        DESPOT2Fit *d2 = nullptr;
+        if (gs_arg) {
+            QI::Log(verbose, "GS Mode selected");
+            model.elliptical = true;
+        }
+        // Each algorithm gets its own filter, so that LLS can be batched
+        auto process = [&](auto fit_func) {
+            auto fit = QI::ModelFitFilter<decltype(fit_func)>::New(
+                &fit_func, verbose, covar, resids, subregion.Get());
+            fit->SetStreaming(stream.Get());
+            fit->SetWriters(writers.Get(), overlap);
+            fit->SetPackOutputs(pack);
+            fit->ReadInputs(
+                {QI::CheckPos(ssfp_path)}, {QI::CheckValue(t1_path), B1.Get()}, mask.Get());
+            fit->SetChunkSize(chunk.Get());
+            fit->SetWarmStart(warm);
+            fit->SetCheckpoint(checkpoint.Get(), resume);
+            fit->Update();
+            fit->WriteOutputs(prefix.Get() + "D2_");
+        };
         switch (algorithm.Get()) {
         case 'l':
-            d2 = new DESPOT2LLS(model);
             QI::Log(verbose, "LLS algorithm selected.");
+            process(DESPOT2LLS(model));
             break;
         case 'w':
-            d2 = new DESPOT2WLLS(model);
             QI::Log(verbose, "WLLS algorithm selected.");
+            process(DESPOT2WLLS(model));
             break;
         case 'n':
-            d2 = new DESPOT2NLLS(model);
             QI::Log(verbose, "NLLS algorithm selected.");
+            process(DESPOT2NLLS(model));
             break;
         }
-        if (gs_arg) {
-            QI::Log(verbose, "GS Mode selected");
-            d2->model.elliptical = true;
-        }
-        auto fit = QI::ModelFitFilter<DESPOT2Fit>::New(d2, verbose, covar, resids, subregion.Get());
-        fit->ReadInputs({QI::CheckPos(ssfp_path)}, {QI::CheckValue(t1_path), B1.Get()}, mask.Get());
-        fit->Update();
-        fit->WriteOutputs(prefix.Get() + "D2_");
         QI::Log(verbose, "Finished.");
     }
     return EXIT_SUCCESS;
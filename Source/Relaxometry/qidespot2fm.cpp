@@ -62,6 +62,38 @@ struct FMModel : QI::Model<double, double, 3, 2> {
             (sin_psi - E2 * (cos_th * sin_psi + sin_th * cos_psi)) * G / (1.0 - b * cos_th);
         return sqrt(re_m.square() + im_m.square());
     }
+
+    /*
+     *  The magnitude above simplifies to |G| * |1 - E2 * exp(i theta)| / |1 - b cos(theta)|, so
+     *  each derivative is the signal multiplied by the sum of the log-derivatives of the factors
+     */
+    JacobianArray jacobian(VaryingArray const &v, FixedArray const &f) const {
+        double const         PD    = v[0];
+        double const         T2    = v[1];
+        double const         E1    = exp(-sequence.TR / f[0]);
+        double const         E2    = exp(-sequence.TR / T2);
+        double const         psi   = 2. * M_PI * v[2] * sequence.TR;
+        Eigen::ArrayXd const alpha = sequence.FA * f[1];
+        Eigen::ArrayXd const ca    = cos(alpha);
+        Eigen::ArrayXd const d     = 1. - E1 * E2 * E2 - (E1 - E2 * E2) * ca;
+        Eigen::ArrayXd const b     = E2 * (1. - E1) * (1. + ca) / d;
+        Eigen::ArrayXd const theta = sequence.PhaseInc + psi;
+        Eigen::ArrayXd const ct    = cos(theta);
+        Eigen::ArrayXd const st    = sin(theta);
+        Eigen::ArrayXd const q2    = 1. - 2. * E2 * ct + E2 * E2;
+        Eigen::ArrayXd const u     = 1. - b * ct;
+        Eigen::ArrayXd const S1    = ((1. - E1) * sin(alpha) * sqrt(q2) / (d * u)).abs();
+        // Derivatives of d and b with respect to E2
+        Eigen::ArrayXd const dd = 2. * E2 * (ca - E1);
+        Eigen::ArrayXd const db = b / E2 - b * dd / d;
+
+        JacobianArray J(sequence.size(), NV);
+        J.col(0) = S1;
+        J.col(1) =
+            PD * S1 * (-dd / d + (E2 - ct) / q2 + ct * db / u) * (E2 * sequence.TR / (T2 * T2));
+        J.col(2) = PD * S1 * st * (E2 / q2 - b / u) * (2. * M_PI * sequence.TR);
+        return J;
+    }
 };
 
 using FMFit = QI::FitFunction<FMModel>;
@@ -84,30 +116,21 @@ struct FMNLLS : FMFit {
             const double         scale = inputs[0].maxCoeff();
             const Eigen::ArrayXd data  = inputs[0] / scale;
 
-            std::vector<double> f0_starts = {0, 0.4 / model.sequence.TR};
-            if (this->asymmetric) {
-                f0_starts.push_back(0.2 / model.sequence.TR);
-                f0_starts.push_back(-0.2 / model.sequence.TR);
-                f0_starts.push_back(-0.4 / model.sequence.TR);
-            }
-
-            double         best = std::numeric_limits<double>::infinity();
-            Eigen::Array3d p;
+            double const TR = model.sequence.TR;
+            // Yarnykh gives T2 = 0.045 * T1 in brain, but best to overestimate for CSF
+            Eigen::Array3d const start{5., std::max(0.1 * T1, 1.5 * TR), 0.};
+            Eigen::Array3d const lo{1., TR, this->asymmetric ? -0.5 / TR : 0.};
+            Eigen::Array3d const hi{std::numeric_limits<double>::infinity(), T1, 0.5 / TR};
+            double               best = std::numeric_limits<double>::infinity();
+            Eigen::Array3d       p;
             ceres::Problem problem;
-            using Cost      = QI::ModelCost<FMModel>;
-            using AutoCost  = ceres::AutoDiffCostFunction<Cost, ceres::DYNAMIC, FMModel::NV>;
-            auto *cost      = new Cost{model, fixed, data};
-            auto *auto_cost = new AutoCost(cost, model.sequence.size());
-            problem.AddResidualBlock(auto_cost, NULL, p.data());
-            problem.SetParameterLowerBound(p.data(), 0, 1.);
-            problem.SetParameterLowerBound(p.data(), 1, model.sequence.TR);
-            problem.SetParameterUpperBound(p.data(), 1, T1);
-            if (this->asymmetric) {
-                problem.SetParameterLowerBound(p.data(), 2, -0.5 / model.sequence.TR);
-            } else {
-                problem.SetParameterLowerBound(p.data(), 2, 0.0);
+            problem.AddResidualBlock(QI::MakeModelCost(model, fixed, data), NULL, p.data());
+            for (int i = 0; i < FMModel::NV; i++) {
+                problem.SetParameterLowerBound(p.data(), i, lo[i]);
+                if (std::isfinite(hi[i])) {
+                    problem.SetParameterUpperBound(p.data(), i, hi[i]);
+                }
             }
-            problem.SetParameterUpperBound(p.data(), 2, 0.5 / model.sequence.TR);
             ceres::Solver::Options options;
             ceres::Solver::Summary summary;
             options.max_num_iterations  = max_iterations;
@@ -115,24 +138,39 @@ struct FMNLLS : FMFit {
             options.gradient_tolerance  = 1e-7;
             options.parameter_tolerance = 1e-5;
             options.logging_type        = ceres::SILENT;
-            for (const double &f0 : f0_starts) {
-                p = {5., std::max(0.1 * T1, 1.5 * model.sequence.TR), f0};
-                // Yarnykh gives T2 = 0.045 * T1 in brain, but best to overestimate for CSF
+            iterations                  = 0;
+
+            // A warm start from a neighbouring voxel that converges makes the search unnecessary
+            p    = bestP;
+            p[0] = p[0] / scale;
+            if (QI::WarmStart(p, start, lo, hi)) {
                 ceres::Solve(options, &problem, &summary);
-                if (!summary.IsSolutionUsable()) {
-                    return {false, summary.FullReport()};
-                }
-                double r = summary.final_cost;
-                if (r < best) {
-                    best       = r;
-                    bestP      = p;
-                    iterations = summary.iterations.size();
+                iterations += summary.iterations.size();
+                if (summary.IsSolutionUsable() &&
+                    summary.termination_type == ceres::CONVERGENCE) {
+                    best  = summary.final_cost;
+                    bestP = p;
                 }
             }
-            if (!summary.IsSolutionUsable()) {
-                return {false, summary.FullReport()};
+            if (!std::isfinite(best)) {
+                std::vector<double> f0_starts = {0, 0.4 / TR};
+                if (this->asymmetric) {
+                    f0_starts.push_back(0.2 / TR);
+                    f0_starts.push_back(-0.2 / TR);
+                    f0_starts.push_back(-0.4 / TR);
+                }
+                std::vector<Eigen::Array3d> starts;
+                for (double const f0 : f0_starts) {
+                    starts.push_back({start[0], start[1], f0});
+                }
+                auto const ms = QI::MultiStart(options, problem, p, starts);
+                iterations += ms.iterations;
+                if (!ms.usable) {
+                    return {false, ms.message};
+                }
+                bestP = p;
             }
-            iterations = summary.iterations.size();
+            p = bestP;
 
             Eigen::ArrayXd const rs  = (data - model.signal(p, fixed));
             double const         var = rs.square().sum();
@@ -141,7 +179,6 @@ struct FMNLLS : FMFit {
                 residuals[0] = rs * scale;
             }
             if (cov) {
-                p = bestP;
                 QI::GetModelCovariance<ModelType>(
                     problem, p, var / (data.rows() - ModelType::NV), cov);
             }
@@ -181,15 +218,22 @@ int despot2fm_main(args::Subparser &parser) {
                                           mask.Get(),
                                           verbose,
                                           simulate.Get(),
-                                          subregion.Get());
+                                          subregion.Get(),
+                                          seed.Get());
     } else {
         FMNLLS fm{model};
         fm.max_iterations = its.Get();
         fm.asymmetric     = asym.Get();
         auto fit_filter =
             QI::ModelFitFilter<FMNLLS>::New(&fm, verbose, covar, resids, subregion.Get());
+        fit_filter->SetStreaming(stream.Get());
+        fit_filter->SetWriters(writers.Get(), overlap);
+        fit_filter->SetPackOutputs(pack);
         fit_filter->ReadInputs(
             {QI::CheckPos(ssfp_path)}, {QI::CheckValue(t1_path), B1.Get()}, mask.Get());
+        fit_filter->SetChunkSize(chunk.Get());
+        fit_filter->SetWarmStart(warm);
+        fit_filter->SetCheckpoint(checkpoint.Get(), resume);
         fit_filter->Update();
         fit_filter->WriteOutputs(prefix.Get() + "FM_");
         QI::Log(verbose, "Finished.");
@@ -28,16 +28,17 @@
 #include "Util.h"
 
 template <typename Model> struct MCDSRCFunctor {
-    const Eigen::ArrayXd data, weights;
-    const QI_ARRAYN(double, Model::NF) fixed;
-    const Model &model;
+    const Eigen::ArrayXd              data, weights;
+    const Model &                     model;
+    const typename Model::Precomputed pre;    // Trig terms for this voxel's f0 and B1
+    Eigen::ArrayXd                    signal; // Workspace for batch()
 
     MCDSRCFunctor(const Model &m,
                   const QI_ARRAYN(double, Model::NF) & f,
                   const Eigen::ArrayXd &d,
                   const Eigen::ArrayXd &w) :
         data(d),
-        weights(w), fixed(f), model(m) {}
+        weights(w), model(m), pre(m.precompute(f)), signal(d.rows()) {}
 
     int inputs() const { return Model::NV; }
     int values() const { return model.spgr.size() + model.ssfp.size(); }
@@ -47,17 +48,29 @@ template <typename Model> struct MCDSRCFunctor {
     }
 
     Eigen::ArrayXd residuals(const QI_ARRAYN(double, Model::NV) & varying) const {
-        return data - model.signal(varying, fixed);
+        return data - model.signal(varying, pre);
     }
 
     double operator()(const QI_ARRAYN(double, Model::NV) & varying) const {
         return (residuals(varying) * weights).square().sum();
     }
+
+    /*
+     *  Weighted sum of squares for each column of samples. The signal for each sample is written
+     *  into a buffer sized in the constructor, so a batch allocates nothing.
+     */
+    void batch(Eigen::Ref<const Eigen::ArrayXXd> const &samples, Eigen::Ref<Eigen::ArrayXd> sos) {
+        auto const n = samples.cols();
+        for (Eigen::Index s = 0; s < n; s++) {
+            model.signal(QI_ARRAYN(double, Model::NV)(samples.col(s)), pre, signal);
+            sos[s] = ((signal - data) * weights).square().sum();
+        }
+    }
 };
 
 template <typename Model> struct SRCFit {
     static const bool Blocked = false;
-    static const bool Indexed = false;
+    static const bool Indexed = true;
     using InputType           = double;
     using OutputType          = double;
     using RMSErrorType        = double;
@@ -76,9 +89,10 @@ template <typename Model> struct SRCFit {
     }
     int n_outputs() const { return Model::NV; }
 
-    int    max_iterations = 5;
-    size_t src_samples = 5000, src_retain = 50;
-    bool   src_gauss = true;
+    int     max_iterations = 5;
+    size_t  src_samples = 5000, src_retain = 50;
+    bool    src_gauss = true;
+    int64_t seed      = -1; // Each voxel uses its own stream of this seed, so results repeat
 
     QI::FitReturnType fit(const std::vector<Eigen::ArrayXd> &inputs,
                           typename Model::FixedArray const & fixed,
@@ -86,7 +100,8 @@ template <typename Model> struct SRCFit {
                           typename Model::CovarArray * /*Unused */,
                           RMSErrorType &               residual,
                           std::vector<Eigen::ArrayXd> &residuals,
-                          FlagType &                   iterations) const {
+                          FlagType &                   iterations,
+                          const itk::Index<3> &        index) const {
         Eigen::ArrayXd data(model.ssfp.size() + model.spgr.size());
         int            dataIndex = 0;
         for (size_t i = 0; i < inputs.size(); i++) {
@@ -113,7 +128,9 @@ template <typename Model> struct SRCFit {
                                           max_iterations,
                                           0.02,
                                           src_gauss,
-                                          false);
+                                          false,
+                                          seed,
+                                          QI::VoxelStream(index));
         if (!rc.optimise(v)) {
             return {false, "Region contraction failed"};
         }
@@ -162,11 +179,13 @@ int mcdespot_main(args::Subparser &parser) {
                                                      mask.Get(),
                                                      verbose,
                                                      simulate.Get(),
-                                                     subregion.Get());
+                                                     subregion.Get(),
+                                                     seed.Get());
         } else {
             using FitType = SRCFit<decltype(model)>;
             FitType src{model};
             src.src_gauss = !use_src;
+            src.seed      = (seed.Get() < 0) ? (QI::RandomSeed() >> 1) : seed.Get();
             if (bounds) {
                 src.model.bounds_lo = QI::ArrayFromJSON<double>(input, "lower_bounds");
                 src.model.bounds_hi = QI::ArrayFromJSON<double>(input, "upper_bounds");
@@ -176,8 +195,14 @@ int mcdespot_main(args::Subparser &parser) {
 
             auto fit_filter =
                 QI::ModelFitFilter<FitType>::New(&src, verbose, covar, resids, subregion.Get());
+            fit_filter->SetStreaming(stream.Get());
+            fit_filter->SetWriters(writers.Get(), overlap);
+            fit_filter->SetPackOutputs(pack);
             fit_filter->ReadInputs(
                 {spgr_path.Get(), ssfp_path.Get()}, {f0.Get(), B1.Get()}, mask.Get());
+            fit_filter->SetChunkSize(chunk.Get());
+            fit_filter->SetWarmStart(warm);
+            fit_filter->SetCheckpoint(checkpoint.Get(), resume);
             fit_filter->Update();
             fit_filter->WriteOutputs(prefix.Get() + model_name);
             QI::Log(verbose, "Finished.");
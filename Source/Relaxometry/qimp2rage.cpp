@@ -62,7 +62,7 @@ One_MP2RAGE(const double &M0, const double &T1, const double &B1, const QI::MP2R
 
 int mp2rage_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "INPUT FILE", "Path to complex MP-RAGE data");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
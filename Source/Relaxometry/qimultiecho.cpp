@@ -37,12 +37,43 @@ struct MultiEcho : QI::Model<double, double, 2, 0> {
     int input_size(const int /* Unused */) const { return sequence.size(); }
 
     template <typename Derived>
-    auto signal(Eigen::ArrayBase<Derived> const &p, FixedArray const &
-                /*Unused*/) const -> QI_ARRAY(typename Derived::Scalar) {
+    auto signal(Eigen::ArrayBase<Derived> const &p, FixedArray const &f) const
+        -> QI_ARRAY(typename Derived::Scalar) {
+        QI_ARRAY(typename Derived::Scalar) s(sequence.size());
+        signal(p, f, s);
+        return s;
+    }
+
+    /*
+     *  The echo train one echo at a time, into out. Does not allocate.
+     */
+    template <typename Derived, typename Out>
+    void signal(Eigen::ArrayBase<Derived> const &p,
+                FixedArray const & /* Unused */,
+                Eigen::ArrayBase<Out> &           out) const {
         using T     = typename Derived::Scalar;
         const T &PD = p[0];
         const T &T2 = p[1];
-        return PD * exp(-sequence.TE / T2);
+        for (Eigen::Index i = 0; i < sequence.size(); i++) {
+            out[i] = PD * exp(-sequence.TE[i] / T2);
+        }
+    }
+
+    JacobianArray jacobian(VaryingArray const &v, FixedArray const &f) const {
+        JacobianArray J(sequence.size(), NV);
+        jacobian(v, f, J);
+        return J;
+    }
+
+    template <typename Out>
+    void jacobian(VaryingArray const &v,
+                  FixedArray const & /* Unused */,
+                  Eigen::DenseBase<Out> & J) const {
+        for (Eigen::Index i = 0; i < sequence.size(); i++) {
+            double const e = exp(-sequence.TE[i] / v[1]);
+            J(i, 0)        = e;
+            J(i, 1)        = v[0] * e * sequence.TE[i] / (v[1] * v[1]);
+        }
     }
 };
 
@@ -73,6 +104,42 @@ struct MultiEchoLogLin : MultiEchoFit {
         iterations = 1;
         return {true, ""};
     }
+
+    /*
+     *  The echo times are the same for every voxel, so only the data sums vary across the tile
+     */
+    void fit_batch(Batch &batch) const {
+        using Column      = Batch::Column;
+        auto const & data = batch.inputs[0];
+        auto const & TE   = model.sequence.TE;
+        double const n    = model.sequence.size();
+        double const sx   = TE.sum();
+        double const sxx  = TE.square().sum();
+        Column       sy   = Column::Zero();
+        Column       sxy  = Column::Zero();
+        for (Eigen::Index j = 0; j < model.sequence.size(); j++) {
+            Column const y = data.col(j).log();
+            sy += y;
+            sxy += TE[j] * y;
+        }
+        Column const slope     = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+        Column const intercept = (sy - slope * sx) / n;
+        batch.outputs.col(0)   = intercept.exp();
+        batch.outputs.col(1)   = -1. / slope;
+
+        Column const PD = batch.outputs.col(0);
+        Column const T2 = batch.outputs.col(1);
+        Column       ss = Column::Zero();
+        for (Eigen::Index j = 0; j < model.sequence.size(); j++) {
+            Column const r = data.col(j) - PD * (-TE[j] / T2).exp();
+            ss += r.square();
+            if (batch.residuals.size() > 0) {
+                batch.residuals[0].col(j) = r;
+            }
+        }
+        batch.rmse = (ss / n).sqrt();
+        batch.flags.setConstant(1);
+    }
 };
 
 struct MultiEchoARLO : MultiEchoFit {
@@ -109,7 +176,7 @@ struct MultiEchoARLO : MultiEchoFit {
     }
 };
 
-struct MultiEchoNLLS : MultiEchoFit {
+template <QI::NLLSSolver Solver> struct MultiEchoNLLS : MultiEchoFit {
     using MultiEchoFit::MultiEchoFit;
     QI::FitReturnType fit(const std::vector<Eigen::ArrayXd> &inputs,
                           MultiEcho::FixedArray const &      fixed,
@@ -125,30 +192,57 @@ struct MultiEchoNLLS : MultiEchoFit {
             rmse = 0;
             return {false, "Maximum data value was not positive"};
         }
-        const Eigen::ArrayXd data = inputs[0] / scale;
-        p                         = model.start;
-        ceres::Problem problem;
-        using Cost      = QI::ModelCost<MultiEcho>;
-        using AutoCost  = ceres::AutoDiffCostFunction<Cost, ceres::DYNAMIC, MultiEcho::NV>;
-        auto *cost      = new Cost{model, fixed, data};
-        auto *auto_cost = new AutoCost(cost, model.sequence.size());
-        problem.AddResidualBlock(auto_cost, NULL, p.data());
-        problem.SetParameterLowerBound(p.data(), 0, 1.0e-6);
-        problem.SetParameterUpperBound(p.data(), 0, model.bounds_hi[0] / scale);
-        problem.SetParameterLowerBound(p.data(), 1, 1.0e-3);
-        problem.SetParameterUpperBound(p.data(), 1, model.bounds_hi[1]);
-        ceres::Solver::Options options;
-        ceres::Solver::Summary summary;
-        options.max_num_iterations  = 50;
-        options.function_tolerance  = 1e-5;
-        options.gradient_tolerance  = 1e-6;
-        options.parameter_tolerance = 1e-4;
-        options.logging_type        = ceres::SILENT;
-        ceres::Solve(options, &problem, &summary);
-        if (!summary.IsSolutionUsable()) {
-            return {false, summary.FullReport()};
+        const Eigen::ArrayXd          data = inputs[0] / scale;
+        MultiEcho::VaryingArray const lo{1.0e-6, 1.0e-3};
+        MultiEcho::VaryingArray const hi{model.bounds_hi[0] / scale, model.bounds_hi[1]};
+        p[0] /= scale;
+        bool const      warm = QI::WarmStart(p, model.start, lo, hi);
+        Eigen::Matrix2d JtJ;
+        if constexpr (Solver == QI::NLLSSolver::LM) {
+            QI::LevenbergMarquardt<MultiEcho> lm(model, fixed, data, lo, hi);
+            QI::LMOptions                     options;
+            options.max_iterations      = 50;
+            options.function_tolerance  = 1e-5;
+            options.gradient_tolerance  = 1e-6;
+            options.parameter_tolerance = 1e-4;
+            auto summary                = lm.solve(p, options);
+            if (warm && (!summary.usable || !p.allFinite())) {
+                p       = model.start;
+                summary = lm.solve(p, options);
+            }
+            if (!summary.usable) {
+                return {false, summary.message};
+            }
+            iterations = summary.iterations;
+            JtJ        = lm.JtJ();
+        } else {
+            ceres::Problem problem;
+            problem.AddResidualBlock(QI::MakeModelCost(model, fixed, data), NULL, p.data());
+            for (int i = 0; i < MultiEcho::NV; i++) {
+                problem.SetParameterLowerBound(p.data(), i, lo[i]);
+                problem.SetParameterUpperBound(p.data(), i, hi[i]);
+            }
+            ceres::Solver::Options options;
+            ceres::Solver::Summary summary;
+            options.max_num_iterations  = 50;
+            options.function_tolerance  = 1e-5;
+            options.gradient_tolerance  = 1e-6;
+            options.parameter_tolerance = 1e-4;
+            options.logging_type        = ceres::SILENT;
+            ceres::Solve(options, &problem, &summary);
+            if (warm && (!summary.IsSolutionUsable() || !p.allFinite())) {
+                p = model.start;
+                ceres::Solve(options, &problem, &summary);
+            }
+            if (!summary.IsSolutionUsable()) {
+                return {false, summary.FullReport()};
+            }
+            iterations = summary.iterations.size();
+            if (cov) { // What GetModelCovariance(problem, ...) would get from the analytic cost
+                Eigen::MatrixXd const J = model.jacobian(p, fixed).matrix();
+                JtJ                     = J.transpose() * J;
+            }
         }
-        iterations = summary.iterations.size();
 
         Eigen::ArrayXd const rs  = (data - model.signal(p, fixed));
         double const         var = rs.square().sum();
@@ -157,7 +251,7 @@ struct MultiEchoNLLS : MultiEchoFit {
             residuals[0] = rs * scale;
         }
         if (cov) {
-            QI::GetModelCovariance<ModelType>(problem, p, var / (data.rows() - ModelType::NV), cov);
+            QI::GetModelCovariance<ModelType>(JtJ, p, var / (data.rows() - ModelType::NV), cov);
         }
         p[0] = p[0] * scale;
         return {true, ""};
@@ -171,6 +265,7 @@ int multiecho_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "INPUT FILE", "Input multi-echo data");
     QI_COMMON_ARGS;
     args::ValueFlag<char> algorithm(parser, "ALGO", "Choose algorithm (l/a/n)", {'a', "algo"}, 'l');
+    args::Flag lm(parser, "LM", "Use the built-in Levenberg-Marquardt for NLLS, not Ceres", {"lm"});
     parser.Parse();
     QI::CheckPos(input_path);
     QI::Log(verbose, "Reading sequence parameters");
@@ -186,37 +281,50 @@ int multiecho_main(args::Subparser &parser) {
                                             mask.Get(),
                                             verbose,
                                             simulate.Get(),
-                                            subregion.Get());
+                                            subregion.Get(),
+                                            seed.Get());
     } else {
-        MultiEchoFit *me = nullptr;
+        // Each algorithm gets its own filter, so that LogLin can be batched
+        auto process = [&](auto fit_func) {
+            auto fit = QI::ModelFitFilter<decltype(fit_func)>::New(
+                &fit_func, verbose, covar, resids, subregion.Get());
+            fit->SetStreaming(stream.Get());
+            fit->SetWriters(writers.Get(), overlap);
+            fit->SetPackOutputs(pack);
+            fit->ReadInputs({QI::CheckPos(input_path)}, {}, mask.Get());
+            const int nvols = fit->GetInput(0)->GetNumberOfComponentsPerPixel();
+            if (nvols % sequence.size() == 0) {
+                const int nblocks = nvols / sequence.size();
+                fit->SetBlocks(nblocks);
+            } else {
+                QI::Fail("Input size is not a multiple of the sequence size");
+            }
+            fit->SetChunkSize(chunk.Get());
+            fit->SetWarmStart(warm);
+            fit->SetCheckpoint(checkpoint.Get(), resume);
+            fit->Update();
+            fit->WriteOutputs(prefix.Get() + "ME_");
+        };
         switch (algorithm.Get()) {
         case 'l':
-            me = new MultiEchoLogLin(model);
             QI::Log(verbose, "LogLin algorithm selected.");
+            process(MultiEchoLogLin(model));
             break;
         case 'a':
-            me = new MultiEchoARLO(model);
             QI::Log(verbose, "ARLO algorithm selected.");
+            process(MultiEchoARLO(model));
             break;
         case 'n':
-            me = new MultiEchoNLLS(model);
             QI::Log(verbose, "Non-linear algorithm (Levenberg Marquardt) selected.");
+            if (lm) {
+                process(MultiEchoNLLS<QI::NLLSSolver::LM>(model));
+            } else {
+                process(MultiEchoNLLS<QI::NLLSSolver::Ceres>(model));
+            }
             break;
         default:
             QI::Fail("Unknown algorithm type {}", algorithm.Get());
         }
-        auto fit =
-            QI::ModelFitFilter<MultiEchoFit>::New(me, verbose, covar, resids, subregion.Get());
-        fit->ReadInputs({QI::CheckPos(input_path)}, {}, mask.Get());
-        const int nvols = fit->GetInput(0)->GetNumberOfComponentsPerPixel();
-        if (nvols % sequence.size() == 0) {
-            const int nblocks = nvols / sequence.size();
-            fit->SetBlocks(nblocks);
-        } else {
-            QI::Fail("Input size is not a multiple of the sequence size");
-        }
-        fit->Update();
-        fit->WriteOutputs(prefix.Get() + "ME_");
         QI::Log(verbose, "Finished.");
     }
     return EXIT_SUCCESS;
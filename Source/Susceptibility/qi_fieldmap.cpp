@@ -13,7 +13,6 @@
 
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
-#include "itkMultiThreaderBase.h"
 
 #include "Args.h"
 #include "ImageIO.h"
@@ -22,7 +21,7 @@
 
 int fieldmap_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "INPUT", "Input multi-echo GRE file");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -43,7 +42,6 @@ int fieldmap_main(args::Subparser &parser) {
     fieldmap->SetRegions(input->GetBufferedRegion());
     fieldmap->Allocate(true);
 
-    auto mt = itk::MultiThreaderBase::New();
     QI::Log(verbose, "Processing");
     const int N     = input->GetNumberOfComponentsPerPixel();
     auto      scale = 1e3 / (2. * M_PI * delta_te.Get()); // Convert to Hz
@@ -51,8 +49,7 @@ int fieldmap_main(args::Subparser &parser) {
         const auto gamma = 42.57747892; // MHz per T to get PPM
         scale /= (gamma * B0.Get());
     }
-    mt->SetNumberOfWorkUnits(threads.Get());
-    mt->ParallelizeImageRegion<3>(
+    QI::ParallelizeImageRegion<3>(
         input->GetBufferedRegion(),
         [&](const QI::VectorVolumeF::RegionType &region) {
             itk::ImageRegionConstIterator<QI::VectorVolumeXF> in_it(input, region);
@@ -268,7 +268,7 @@ class DiscreteInverseLaplace2 : public ImageSource<QI::VolumeF> {
 //******************************************************************************
 int unwrap_laplace_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "PHASE", "Wrapped phase image");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -21,7 +21,7 @@
  */
 int gradient_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "FILE", "Input file");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -0,0 +1,122 @@
+/*
+ *  qi_merge_tiles.cpp
+ *
+ *  Copyright (c) 2019 Tobias Wood.
+ *
+ *  This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "itkImageIOFactory.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+
+#include "Args.h"
+#include "ImageIO.h"
+#include "ImageTypes.h"
+#include "Util.h"
+
+namespace {
+
+itk::ImageIOBase::Pointer ReadHeader(std::string const &path) {
+    auto io = itk::ImageIOFactory::CreateImageIO(path.c_str(), itk::ImageIOFactory::ReadMode);
+    if (!io) {
+        QI::Fail("Could not open: {}", path);
+    }
+    io->SetFileName(path);
+    io->ReadImageInformation();
+    if (io->GetNumberOfDimensions() < 3) {
+        QI::Fail("Image must have at least 3 dimensions: {}", path);
+    }
+    return io;
+}
+
+/*
+ *  Paste each tile into an image with the geometry of the reference, at the voxel that the tile's
+ *  origin falls on. Tiles written with --subregion have their origin moved to their first voxel.
+ */
+template <typename TImg>
+void MergeTiles(itk::ImageIOBase const *        ref,
+                std::vector<std::string> const &tile_paths,
+                std::string const &             out_path,
+                bool const                      verbose) {
+    typename TImg::RegionType    region;
+    typename TImg::SpacingType   spacing;
+    typename TImg::PointType     origin;
+    typename TImg::DirectionType direction;
+    for (int i = 0; i < 3; i++) {
+        region.SetSize(i, ref->GetDimensions(i));
+        spacing[i] = ref->GetSpacing(i);
+        origin[i]  = ref->GetOrigin(i);
+        for (int j = 0; j < 3; j++) {
+            direction[j][i] = ref->GetDirection(i)[j];
+        }
+    }
+    typename TImg::Pointer merged = TImg::New();
+    merged->SetRegions(region);
+    merged->SetSpacing(spacing);
+    merged->SetOrigin(origin);
+    merged->SetDirection(direction);
+
+    for (size_t t = 0; t < tile_paths.size(); t++) {
+        auto const &path = tile_paths[t];
+        auto const  tile = QI::ReadImage<TImg>(path, verbose);
+        if (t == 0) {
+            merged->SetNumberOfComponentsPerPixel(tile->GetNumberOfComponentsPerPixel());
+            merged->Allocate(true);
+        } else if (tile->GetNumberOfComponentsPerPixel() !=
+                   merged->GetNumberOfComponentsPerPixel()) {
+            QI::Fail("Tile {} has a different number of volumes to the first tile", path);
+        }
+        for (int i = 0; i < 3; i++) {
+            if (std::abs(tile->GetSpacing()[i] - spacing[i]) > 1e-3 * spacing[i]) {
+                QI::Fail("Tile {} has different voxel spacing to the reference image", path);
+            }
+        }
+
+        typename TImg::IndexType index;
+        if (!merged->TransformPhysicalPointToIndex(tile->GetOrigin(), index)) {
+            QI::Fail("Tile {} does not start inside the reference image", path);
+        }
+        typename TImg::RegionType const place(index, tile->GetLargestPossibleRegion().GetSize());
+        if (!region.IsInside(place)) {
+            QI::Fail("Tile {} does not fit inside the reference image", path);
+        }
+        QI::Log(verbose, "Tile {} starts at voxel {},{},{}", path, index[0], index[1], index[2]);
+        itk::ImageRegionConstIterator<TImg> in(tile, tile->GetLargestPossibleRegion());
+        itk::ImageRegionIterator<TImg>      out(merged, place);
+        for (; !in.IsAtEnd(); ++in, ++out) {
+            out.Set(in.Get());
+        }
+    }
+    QI::WriteImage(merged, out_path, verbose);
+}
+
+} // namespace
+
+int merge_tiles_main(args::Subparser &parser) {
+    args::Positional<std::string> ref_path(
+        parser, "REFERENCE", "Image with the geometry of the whole output, e.g. an input");
+    args::Positional<std::string>     out_path(parser, "OUTPUT", "Output file");
+    args::PositionalList<std::string> tile_paths(
+        parser, "TILES", "Tiles of one output, written with --subregion");
+    parser.Parse();
+
+    auto const ref   = ReadHeader(QI::CheckPos(ref_path));
+    auto const tiles = QI::CheckList(tile_paths);
+    auto const first = ReadHeader(tiles.front());
+    // Tiles of residuals are 4D, everything else is 3D
+    if (first->GetNumberOfDimensions() > 3) {
+        MergeTiles<QI::VectorVolumeF>(ref, tiles, QI::CheckPos(out_path), verbose);
+    } else {
+        MergeTiles<QI::VolumeF>(ref, tiles, QI::CheckPos(out_path), verbose);
+    }
+    QI::Log(verbose, "Finished.");
+    return EXIT_SUCCESS;
+}
@@ -15,7 +15,6 @@
 
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
-#include "itkMultiThreaderBase.h"
 
 // #define QI_DEBUG_BUILD 1
 
@@ -30,7 +29,7 @@ using namespace std::literals;
 
 int pca_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "INPUT", "Input 4D file");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -124,9 +123,7 @@ int pca_main(args::Subparser &parser) {
     auto out_img  = QI::NewImageLike<QI::VectorVolumeF>(input, Nq);
 
     QI::Info(verbose, "Calculating projection...");
-    auto mt = itk::MultiThreaderBase::New();
-    mt->SetNumberOfWorkUnits(threads.Get());
-    mt->ParallelizeImageRegion<3>(
+    QI::ParallelizeImageRegion<3>(
         input->GetBufferedRegion(),
         [&](const QI::VectorVolumeF::RegionType &thread_region) {
             itk::ImageRegionConstIterator<QI::VectorVolumeF> in_it(input, thread_region);
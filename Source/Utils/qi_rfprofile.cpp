@@ -173,7 +173,7 @@ int rfprofile_main(args::Subparser &parser) {
     args::Positional<std::string> b1plus_path(parser, "B1+_FILE", "Input B1+ file");
     args::Positional<std::string> output_path(parser, "B1_FILE", "Output relative B1 file");
 
-    args::ValueFlag<int>         threads(parser,
+    QI::ThreadsFlag              threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -23,7 +23,7 @@ int select_main(args::Subparser &parser) {
     args::Positional<std::string> input_path(parser, "INPUT", "Input file");
     args::Positional<std::string> output_path(parser, "OUTPUT", "Output file");
     args::Positional<std::string> volume_list(parser, "VOLUMES", "Comma separated list of volumes");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
@@ -361,7 +361,7 @@ int ssfp_bands_main(args::Subparser &parser) {
 
     args::ValueFlag<std::string> out_arg(
         parser, "OUTPREFIX", "Change output prefix (default input filename)", {'o', "out"});
-    args::ValueFlag<int>         threads(parser,
+    QI::ThreadsFlag              threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
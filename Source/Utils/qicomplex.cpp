@@ -92,7 +92,7 @@ template <typename TImage> class NegateFilter : public InPlaceImageFilter<TImage
 } // End namespace itk
 
 int complex_main(args::Subparser &parser) {
-    args::ValueFlag<int> threads(parser,
+    QI::ThreadsFlag      threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
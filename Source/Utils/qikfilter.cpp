@@ -130,7 +130,7 @@ template <typename TImage> class KernelSource : public ImageSource<TImage> {
 
 int kfilter_main(args::Subparser &parser) {
     args::Positional<std::string> in_path(parser, "INPUT", "Input file.");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
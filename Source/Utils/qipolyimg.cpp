@@ -101,7 +101,7 @@ int polyimg_main(args::Subparser &parser) {
     args::Positional<std::string> ref_path(
         parser, "REFERENCE", "Reference image space to create the polynomial");
     args::Positional<std::string> out_path(parser, "OUTPUT", "Output image path");
-    args::ValueFlag<int>          threads(parser,
+    QI::ThreadsFlag               threads(parser,
                                  "THREADS",
                                  "Use N threads (default=hardware limit or $QUIT_THREADS)",
                                  {'T', "threads"},
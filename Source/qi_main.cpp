@@ -4,6 +4,8 @@
 #include <iostream>
 
 int main(int argc, char **argv) {
+    // Size the shared scheduler (and ITK) from $QUIT_THREADS, --threads can override it later
+    QI::SetThreads(QI::GetDefaultThreads());
     args::ArgumentParser parser("http://github.com/spinicist/QUIT");
     args::GlobalOptions  globals(parser, global_group);
 
@@ -78,6 +80,7 @@ int main(int argc, char **argv) {
     ADD(gradient, utils, "Calculate the gradients of an image");
     ADD(kfilter, utils, "Filter an image via k-space");
     ADD(mask, utils, "Calculate a mask using various threshold based methods");
+    ADD(merge_tiles, utils, "Merge tiles written with --subregion into one image");
     ADD(noise_est, utils, "Calculate noise values in a region/mask");
     ADD(pca, utils, "Perform PCA noise reduction on multi-volume data");
     ADD(polyfit, utils, "Fit a polynomial to an image");